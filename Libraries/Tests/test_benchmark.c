@@ -0,0 +1,293 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_benchmark.h
+ * Compile with the OS define (VUL_LINUX etc.) and link with libm. Hardware counters
+ * are often unavailable (virtual machines, perf_event_paranoid); the tests then
+ * only check that the runners degrade to timing alone.
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_BENCHMARK_H
+#define VUL_TEST_BENCHMARK_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+#define VUL_DEFINE
+#include "../vul_resizable_array.h"
+#include "../vul_benchmark.h"
+
+static volatile uint32_t vul_test_benchmark_sink;
+
+void vul_test_benchmark_loop( void *data )
+{
+   uint32_t i, n;
+
+   n = *( uint32_t* )data;
+   for( i = 0; i < n; ++i ) {
+      vul_test_benchmark_sink += i;
+   }
+}
+
+void vul_test_benchmark_counters( )
+{
+   vul_benchmark_result a, b;
+   uint32_t n, i;
+
+   // No counters unless asked for
+   n = 10000;
+   a = vul_benchmark_micros( 20, vul_test_benchmark_loop, &n );
+   TEST( a.iterations == 20 );
+   TEST( a.counters.available == 0 );
+   for( i = 0; i < VUL_BENCHMARK_COUNTER_COUNT; ++i ) {
+      TEST( a.counters.per_iteration[ i ] == 0.0 );
+   }
+
+   // Whatever is available counts more for more work, the rest reads zero
+   vul_benchmark_set_counters( VUL_BENCHMARK_ALL_COUNTERS );
+   a = vul_benchmark_micros( 20, vul_test_benchmark_loop, &n );
+   n = 1000000;
+   b = vul_benchmark_millis( 20, vul_test_benchmark_loop, &n );
+   TEST( a.iterations == 20 && b.iterations == 20 );
+   TEST( a.counters.available == b.counters.available );
+   if( a.counters.available & VUL_BENCHMARK_COUNTER_BIT( VUL_BENCHMARK_INSTRUCTIONS ) ) {
+      TEST( a.counters.per_iteration[ VUL_BENCHMARK_INSTRUCTIONS ] >= 10000.0 );
+      TEST( b.counters.per_iteration[ VUL_BENCHMARK_INSTRUCTIONS ]
+            > 50.0 * a.counters.per_iteration[ VUL_BENCHMARK_INSTRUCTIONS ] );
+   }
+   if( a.counters.available & VUL_BENCHMARK_COUNTER_BIT( VUL_BENCHMARK_CYCLES ) ) {
+      TEST( b.counters.per_iteration[ VUL_BENCHMARK_CYCLES ]
+            > a.counters.per_iteration[ VUL_BENCHMARK_CYCLES ] );
+   }
+   for( i = 0; i < VUL_BENCHMARK_COUNTER_COUNT; ++i ) {
+      if( !( a.counters.available & VUL_BENCHMARK_COUNTER_BIT( i ) ) ) {
+         TEST( a.counters.per_iteration[ i ] == 0.0 );
+      }
+   }
+   printf( "Available counters:" );
+   for( i = 0; i < VUL_BENCHMARK_COUNTER_COUNT; ++i ) {
+      if( a.counters.available & VUL_BENCHMARK_COUNTER_BIT( i ) ) {
+         printf( " %s", vul_benchmark_counter_name( ( vul_benchmark_counter )i ) );
+      }
+   }
+   printf( "\n" );
+
+   // Only the selected ones
+   vul_benchmark_set_counters( VUL_BENCHMARK_COUNTER_BIT( VUL_BENCHMARK_BRANCH_MISSES ) );
+   a = vul_benchmark_micros( 5, vul_test_benchmark_loop, &n );
+   TEST( ( a.counters.available & ~VUL_BENCHMARK_COUNTER_BIT( VUL_BENCHMARK_BRANCH_MISSES ) ) == 0 );
+   vul_benchmark_set_counters( 0 );
+
+   TEST( strcmp( vul_benchmark_counter_name( VUL_BENCHMARK_CYCLES ), "cycles" ) == 0 );
+   TEST( strcmp( vul_benchmark_counter_name( VUL_BENCHMARK_BRANCH_MISSES ), "branch_misses" ) == 0 );
+}
+
+void vul_test_benchmark_mann_whitney( )
+{
+   uint64_t a[ 20 ], b[ 20 ], c[ 20 ];
+   uint32_t i;
+   double p;
+
+   for( i = 0; i < 20; ++i ) {
+      a[ i ] = 100 + i;
+      b[ i ] = 100 + ( i * 7 ) % 20; // Same values, other order
+      c[ i ] = 110 + i;
+   }
+   p = vul_benchmark_mann_whitney( a, 20, b, 20 );
+   TEST( p > 0.4 && p < 0.6 );
+   p = vul_benchmark_mann_whitney( a, 20, c, 20 );
+   TEST( p < 0.01 );
+   p = vul_benchmark_mann_whitney( c, 20, a, 20 );
+   TEST( p > 0.99 );
+   // Fully separated, 10 each: U = 100, z = 49.5 / sqrt( 175 ), p = 9.2e-5
+   p = vul_benchmark_mann_whitney( a, 10, c + 10, 10 );
+   TEST( p > 8e-5 && p < 1e-4 );
+   // All ties is no evidence either way
+   TEST( vul_benchmark_mann_whitney( a, 1, a, 1 ) == 1.0 );
+   TEST( vul_benchmark_mann_whitney( a, 0, c, 20 ) == 1.0 );
+}
+
+/**
+ * Makes a result of count samples around base.
+ */
+vul_benchmark_result vul_test_benchmark_make( vul_benchmark_unit unit, uint64_t base, uint32_t count )
+{
+   vul_benchmark_result r;
+   uint32_t i;
+
+   memset( &r, 0, sizeof( r ) );
+   r.unit = unit;
+   r.iterations = count;
+   r.samples = ( uint64_t* )malloc( sizeof( uint64_t ) * count );
+   r.mean = 0.0;
+   for( i = 0; i < count; ++i ) {
+      r.samples[ i ] = base + ( i * 7 ) % 5;
+      r.mean += ( double )r.samples[ i ] / ( double )count;
+   }
+   r.median = base + 2;
+   return r;
+}
+
+void vul_test_benchmark_report( )
+{
+   vul_benchmark_report *report, *read;
+   vul_benchmark_result r;
+   uint32_t n, i, lines;
+   FILE *f;
+   char line[ 4096 ];
+
+   // Runners keep the samples on request, in run order
+   vul_benchmark_keep_samples( 1 );
+   n = 1000;
+   r = vul_benchmark_micros( 15, vul_test_benchmark_loop, &n );
+   vul_benchmark_keep_samples( 0 );
+   TEST( r.samples != NULL );
+   TEST( r.unit == VUL_BENCHMARK_MICROS );
+
+   report = vul_benchmark_report_create( );
+   vul_benchmark_report_add( report, "loop \"1000\"\n", &r );
+   vul_benchmark_result_free( &r );
+   TEST( r.samples == NULL );
+   TEST( report->entries[ 0 ].result.samples != NULL ); // The report has its own copy
+   r = vul_benchmark_millis( 3, vul_test_benchmark_loop, &n );
+   TEST( r.samples == NULL );
+   TEST( r.unit == VUL_BENCHMARK_MILLIS );
+   r.counters.available = VUL_BENCHMARK_COUNTER_BIT( VUL_BENCHMARK_INSTRUCTIONS );
+   r.counters.per_iteration[ VUL_BENCHMARK_INSTRUCTIONS ] = 1234.5;
+   vul_benchmark_report_add( report, "no samples", &r );
+
+   // JSON round trip
+   f = tmpfile( );
+   TEST( vul_benchmark_report_write_json( report, f ) );
+   rewind( f );
+   read = vul_benchmark_report_read_json( f );
+   fclose( f );
+   TEST( read != NULL );
+   TEST( read->count == 2 );
+   for( i = 0; i < 2; ++i ) {
+      TEST( strcmp( read->entries[ i ].name, report->entries[ i ].name ) == 0 );
+      TEST( read->entries[ i ].result.unit == report->entries[ i ].result.unit );
+      TEST( read->entries[ i ].result.iterations == report->entries[ i ].result.iterations );
+      TEST( read->entries[ i ].result.median == report->entries[ i ].result.median );
+      TEST( read->entries[ i ].result.mean == report->entries[ i ].result.mean );
+      TEST( read->entries[ i ].result.counters.available == report->entries[ i ].result.counters.available );
+   }
+   TEST( memcmp( read->entries[ 0 ].result.samples, report->entries[ 0 ].result.samples,
+                 sizeof( uint64_t ) * 15 ) == 0 );
+   TEST( read->entries[ 1 ].result.samples == NULL );
+   TEST( read->entries[ 1 ].result.counters.per_iteration[ VUL_BENCHMARK_INSTRUCTIONS ] == 1234.5 );
+   vul_benchmark_report_destroy( read );
+
+   // CSV: environment comments, a header and a row per benchmark
+   f = tmpfile( );
+   TEST( vul_benchmark_report_write_csv( report, f ) );
+   rewind( f );
+   lines = 0;
+   while( fgets( line, sizeof( line ), f ) ) {
+      if( line[ 0 ] == '#' ) {
+         continue;
+      }
+      if( lines++ == 0 ) {
+         TEST( strncmp( line, "name,unit,iterations,mean,median,std_deviation,p0,", 50 ) == 0 );
+      }
+   }
+   fclose( f );
+   TEST( lines == 4 ); // The first name has a newline in it
+   vul_benchmark_report_destroy( report );
+
+   // Not a report
+   f = tmpfile( );
+   fputs( "{\"benchmarks\":[{\"name\":\"x\",\"iterations\":2,\"samples\":[1,2,3]}]}", f );
+   rewind( f );
+   TEST( vul_benchmark_report_read_json( f ) == NULL );
+   fclose( f );
+   f = tmpfile( );
+   fputs( "{\"benchmarks\":[{\"name\":\"x\"", f );
+   rewind( f );
+   TEST( vul_benchmark_report_read_json( f ) == NULL );
+   fclose( f );
+   f = tmpfile( );
+   fputs( " { \"other\" : [ true, null, { \"a\" : \"\\u0041\" } ], \"benchmarks\" : [ ] } ", f );
+   rewind( f );
+   read = vul_benchmark_report_read_json( f );
+   fclose( f );
+   TEST( read != NULL && read->count == 0 );
+   vul_benchmark_report_destroy( read );
+}
+
+void vul_test_benchmark_compare( )
+{
+   vul_benchmark_report *baseline, *current;
+   vul_benchmark_result r;
+
+   baseline = vul_benchmark_report_create( );
+   r = vul_test_benchmark_make( VUL_BENCHMARK_MICROS, 1000, 30 );
+   vul_benchmark_report_add( baseline, "same", &r );
+   vul_benchmark_report_add( baseline, "slower", &r );
+   vul_benchmark_report_add( baseline, "slightly slower", &r );
+   vul_benchmark_report_add( baseline, "faster", &r );
+   vul_benchmark_result_free( &r );
+   r = vul_test_benchmark_make( VUL_BENCHMARK_MILLIS, 1, 30 );
+   vul_benchmark_report_add( baseline, "other unit", &r );
+   vul_benchmark_result_free( &r );
+
+   current = vul_benchmark_report_create( );
+   r = vul_test_benchmark_make( VUL_BENCHMARK_MICROS, 1000, 30 );
+   vul_benchmark_report_add( current, "same", &r );
+   vul_benchmark_result_free( &r );
+   r = vul_test_benchmark_make( VUL_BENCHMARK_MICROS, 1200, 30 );
+   vul_benchmark_report_add( current, "slower", &r );
+   vul_benchmark_report_add( current, "new", &r );
+   vul_benchmark_result_free( &r );
+   r = vul_test_benchmark_make( VUL_BENCHMARK_MICROS, 1010, 30 );
+   vul_benchmark_report_add( current, "slightly slower", &r ); // Significant, but only 1%
+   vul_benchmark_result_free( &r );
+   r = vul_test_benchmark_make( VUL_BENCHMARK_MICROS, 800, 30 );
+   vul_benchmark_report_add( current, "faster", &r );
+   vul_benchmark_result_free( &r );
+   r = vul_test_benchmark_make( VUL_BENCHMARK_MICROS, 3000, 30 ); // 3ms against 1-5ms
+   vul_benchmark_report_add( current, "other unit", &r );
+   vul_benchmark_result_free( &r );
+
+   TEST( vul_benchmark_compare( baseline, current, 0.01, 0.05, stdout ) == 1 );
+   TEST( vul_benchmark_compare( baseline, current, 0.01, 0.0, NULL ) == 2 );
+   TEST( vul_benchmark_compare( baseline, baseline, 0.01, 0.0, NULL ) == 0 );
+   TEST( vul_benchmark_compare( current, baseline, 0.01, 0.05, NULL ) == 1 ); // "faster" the other way
+
+   vul_benchmark_report_destroy( baseline );
+   vul_benchmark_report_destroy( current );
+}
+
+int main( )
+{
+   vul_test_benchmark_counters( );
+   vul_test_benchmark_mann_whitney( );
+   vul_test_benchmark_report( );
+   vul_test_benchmark_compare( );
+
+   return 0;
+}
+#endif
@@ -0,0 +1,148 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_hash_map_linked_list.h
+ * 
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_HASH_MAP_LINKED_LIST_H
+#define VUL_TEST_HASH_MAP_LINKED_LIST_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+#define VUL_DEFINE
+#include "../vul_hash_map_linked_list.h"
+
+int vul_test_map_ll_compare( void *a, void *b )
+{
+   uint32_t ka, kb;
+
+   ka = *( uint32_t* )( ( vul_hash_map_element* )a )->key;
+   kb = *( uint32_t* )( ( vul_hash_map_element* )b )->key;
+
+   return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+uint32_t vul_test_map_ll_hash( const uint8_t *data, uint32_t len )
+{
+   uint32_t h;
+
+   ( void )len;
+   // Bad on purpose, so we get collisions
+   h = *( uint32_t* )data;
+   return h & 0xfff0;
+}
+
+static uint32_t vul_test_map_ll_count;
+
+void vul_test_map_ll_iterate( vul_list_element *e )
+{
+   vul_hash_map_element *me;
+
+   me = ( vul_hash_map_element* )e->data;
+   TEST( *( uint32_t* )me->key == *( uint32_t* )me->data );
+   ++vul_test_map_ll_count;
+}
+
+#define VUL_TEST_MAP_LL_COUNT 4096
+
+int main( )
+{
+   vul_hash_map *map;
+   vul_hash_map_element e, *first;
+   uint32_t *keys, i;
+
+   keys = ( uint32_t* )malloc( sizeof( uint32_t ) * VUL_TEST_MAP_LL_COUNT );
+   for( i = 0; i < VUL_TEST_MAP_LL_COUNT; ++i ) {
+      keys[ i ] = i * 7;
+   }
+
+   map = vul_map_create( 4, vul_test_map_ll_hash, vul_test_map_ll_compare, malloc, free );
+
+   // Insert enough elements to grow the map many times
+   first = NULL;
+   for( i = 0; i < VUL_TEST_MAP_LL_COUNT; ++i ) {
+      e.key = &keys[ i ];
+      e.key_size = sizeof( uint32_t );
+      e.data = &keys[ i ];
+      e.data_size = sizeof( uint32_t );
+      if( i == 0 ) {
+         first = vul_map_insert( map, &e );
+      } else {
+         vul_map_insert( map, &e );
+      }
+   }
+   TEST( vul_map_size( map ) == VUL_TEST_MAP_LL_COUNT );
+   TEST( map->bucket_count >= VUL_TEST_MAP_LL_COUNT );
+
+   // Element pointers must survive growing
+   TEST( vul_map_get( map, &keys[ 0 ], sizeof( uint32_t ) ) == first );
+
+   // All elements must still be found after rehashing
+   for( i = 0; i < VUL_TEST_MAP_LL_COUNT; ++i ) {
+      TEST( vul_map_get( map, &keys[ i ], sizeof( uint32_t ) ) != NULL );
+   }
+   i = 1;
+   TEST( vul_map_get( map, &i, sizeof( uint32_t ) ) == NULL );
+
+   vul_test_map_ll_count = 0;
+   vul_map_iterate( map, vul_test_map_ll_iterate );
+   TEST( vul_test_map_ll_count == VUL_TEST_MAP_LL_COUNT );
+
+   // Remove every other element
+   for( i = 0; i < VUL_TEST_MAP_LL_COUNT; i += 2 ) {
+      e.key = &keys[ i ];
+      e.key_size = sizeof( uint32_t );
+      vul_map_remove( map, &e );
+   }
+   TEST( vul_map_size( map ) == VUL_TEST_MAP_LL_COUNT / 2 );
+   for( i = 0; i < VUL_TEST_MAP_LL_COUNT; ++i ) {
+      if( i & 1 ) {
+         TEST( vul_map_get( map, &keys[ i ], sizeof( uint32_t ) ) != NULL );
+      } else {
+         TEST( vul_map_get( map, &keys[ i ], sizeof( uint32_t ) ) == NULL );
+      }
+   }
+
+   // Reinsert them; these must come from the free list, not new slabs
+   for( i = 0; i < VUL_TEST_MAP_LL_COUNT; i += 2 ) {
+      e.key = &keys[ i ];
+      e.key_size = sizeof( uint32_t );
+      e.data = &keys[ i ];
+      e.data_size = sizeof( uint32_t );
+      vul_map_insert( map, &e );
+   }
+   TEST( map->free_nodes == NULL );
+   TEST( vul_map_size( map ) == VUL_TEST_MAP_LL_COUNT );
+   for( i = 0; i < VUL_TEST_MAP_LL_COUNT; ++i ) {
+      TEST( vul_map_get( map, &keys[ i ], sizeof( uint32_t ) ) != NULL );
+   }
+
+   vul_map_destroy( map );
+   free( keys );
+
+   return 0;
+}
+#endif
@@ -0,0 +1,210 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_linked_list.h
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_LINKED_LIST_H
+#define VUL_TEST_LINKED_LIST_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+#define VUL_DEFINE
+#include "../vul_linked_list.h"
+
+#define VUL_TEST_LIST_CACHE 16
+
+typedef struct vul_test_list_entry {
+   uint32_t key;
+   uint32_t value;
+   vul_list_node lru;
+} vul_test_list_entry;
+
+// Counts allocations, to check that the pooled and intrusive paths don't make any
+static uint32_t vul_test_list_allocations = 0;
+
+void *vul_test_list_alloc( size_t size )
+{
+   ++vul_test_list_allocations;
+   return malloc( size );
+}
+
+int vul_test_list_compare( void *a, void *b )
+{
+   uint32_t ka, kb;
+
+   ka = *( uint32_t* )a;
+   kb = *( uint32_t* )b;
+   return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+int vul_test_list_compare_nodes( vul_list_node *a, vul_list_node *b )
+{
+   uint32_t ka, kb;
+
+   ka = VUL_LIST_CONTAINER_OF( a, vul_test_list_entry, lru )->key;
+   kb = VUL_LIST_CONTAINER_OF( b, vul_test_list_entry, lru )->key;
+   return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+void vul_test_list_pooled( )
+{
+   vul_list_pool pool;
+   vul_list_element *list, *copy, *e, *next;
+   uint32_t i, k, r, prev, allocations;
+
+   vul_list_pool_initialize( &pool, sizeof( uint32_t ), 8, vul_test_list_alloc, free );
+   vul_list_pool_reserve( &pool, 20 );
+   TEST( vul_test_list_allocations == 3 );
+
+   // Sorted inserts, in the same order as the unpooled list
+   list = NULL;
+   r = 12345;
+   for( i = 0; i < 100; ++i ) {
+      r = r * 1664525u + 1013904223u;
+      k = r >> 24;
+      e = vul_list_insert_pooled( list, &k, vul_test_list_compare, &pool );
+      if( list == NULL || e->next == list ) {
+         list = e;
+      }
+      TEST( ( ( uintptr_t )e->data & 15 ) == 0 );
+   }
+   TEST( vul_list_size( list ) == 100 );
+   prev = 0;
+   for( e = list; e != NULL; e = e->next ) {
+      TEST( *( uint32_t* )e->data >= prev );
+      prev = *( uint32_t* )e->data;
+   }
+
+   copy = vul_list_copy_pooled( list, &pool );
+   TEST( vul_list_size( copy ) == 100 );
+   vul_list_destroy_pooled( copy, &pool );
+
+   // Remove every other element; the freed slots must be reused without allocating
+   for( e = list->next; e != NULL; e = next ) {
+      next = e->next ? e->next->next : NULL;
+      vul_list_remove_pooled( e, &pool );
+   }
+   TEST( vul_list_size( list ) == 50 );
+   allocations = vul_test_list_allocations;
+   for( i = 0; i < 150; ++i ) {
+      k = i;
+      e = vul_list_insert_pooled( list, &k, vul_test_list_compare, &pool );
+      if( e->next == list ) {
+         list = e;
+      }
+   }
+   TEST( vul_list_size( list ) == 200 );
+   TEST( vul_test_list_allocations == allocations );
+
+   vul_list_pool_destroy( &pool );
+}
+
+void vul_test_list_intrusive( )
+{
+   vul_list_intrusive lru, free_entries, sorted;
+   vul_list_node *n;
+   vul_test_list_entry entries[ VUL_TEST_LIST_CACHE ], *entry;
+   uint32_t i, j, key, hits, misses, allocations;
+
+   vul_list_intrusive_initialize( &lru );
+   vul_list_intrusive_initialize( &free_entries );
+   TEST( vul_list_intrusive_first( &lru ) == NULL );
+   TEST( vul_list_intrusive_pop_back( &lru ) == NULL );
+   for( i = 0; i < VUL_TEST_LIST_CACHE; ++i ) {
+      vul_list_intrusive_push_back( &free_entries, &entries[ i ].lru );
+   }
+   TEST( vul_list_intrusive_size( &free_entries ) == VUL_TEST_LIST_CACHE );
+
+   // An LRU cache over keys 0..31 with room for 16, looked up linearly
+   allocations = vul_test_list_allocations;
+   hits = misses = 0;
+   for( i = 0; i < 10000; ++i ) {
+      key = ( i * 7 + ( i >> 3 ) ) % 32;
+      entry = NULL;
+      for( n = vul_list_intrusive_first( &lru ); n != NULL; n = vul_list_intrusive_next( &lru, n ) ) {
+         if( VUL_LIST_CONTAINER_OF( n, vul_test_list_entry, lru )->key == key ) {
+            entry = VUL_LIST_CONTAINER_OF( n, vul_test_list_entry, lru );
+            break;
+         }
+      }
+      if( entry != NULL ) {
+         TEST( entry->value == key * 3 );
+         vul_list_intrusive_move_to_front( &lru, &entry->lru );
+         ++hits;
+      } else {
+         n = vul_list_intrusive_pop_front( &free_entries );
+         if( n == NULL ) {
+            n = vul_list_intrusive_pop_back( &lru ); // Evict the least recently used
+         }
+         entry = VUL_LIST_CONTAINER_OF( n, vul_test_list_entry, lru );
+         entry->key = key;
+         entry->value = key * 3;
+         vul_list_intrusive_push_front( &lru, &entry->lru );
+         ++misses;
+      }
+      TEST( VUL_LIST_CONTAINER_OF( vul_list_intrusive_first( &lru ), vul_test_list_entry, lru )->key == key );
+   }
+   TEST( hits + misses == 10000 && hits > 0 && misses > 0 );
+   TEST( vul_list_intrusive_size( &lru ) == VUL_TEST_LIST_CACHE );
+   TEST( vul_list_intrusive_size( &free_entries ) == 0 );
+   TEST( vul_test_list_allocations == allocations );
+
+   // Links must be consistent in both directions
+   j = 0;
+   for( n = vul_list_intrusive_last( &lru ); n != NULL; n = vul_list_intrusive_prev( &lru, n ) ) {
+      ++j;
+   }
+   TEST( j == VUL_TEST_LIST_CACHE );
+
+   // Sorted, stable inserts
+   vul_list_intrusive_initialize( &sorted );
+   while( ( n = vul_list_intrusive_pop_front( &lru ) ) != NULL ) {
+      VUL_LIST_CONTAINER_OF( n, vul_test_list_entry, lru )->key %= 4;
+      vul_list_intrusive_insert_sorted( &sorted, n, vul_test_list_compare_nodes );
+   }
+   TEST( vul_list_intrusive_size( &lru ) == 0 );
+   TEST( vul_list_intrusive_size( &sorted ) == VUL_TEST_LIST_CACHE );
+   n = vul_list_intrusive_first( &sorted );
+   for( ; vul_list_intrusive_next( &sorted, n ) != NULL; n = vul_list_intrusive_next( &sorted, n ) ) {
+      TEST( vul_test_list_compare_nodes( n, vul_list_intrusive_next( &sorted, n ) ) <= 0 );
+   }
+   n = vul_list_intrusive_last( &sorted );
+   vul_list_intrusive_remove( &sorted, n );
+   TEST( vul_list_intrusive_size( &sorted ) == VUL_TEST_LIST_CACHE - 1 );
+   vul_list_intrusive_insert_before( &sorted, vul_list_intrusive_first( &sorted ), n );
+   TEST( vul_list_intrusive_first( &sorted ) == n );
+   TEST( vul_list_intrusive_size( &sorted ) == VUL_TEST_LIST_CACHE );
+}
+
+int main( )
+{
+   vul_test_list_pooled( );
+   vul_test_list_intrusive( );
+
+   return 0;
+}
+#endif
@@ -177,6 +177,9 @@ u32 vul_priority_heap_reference_size( vul_priority_heap_reference_t *q )
 //
 
 #include "../vul_priority_heap.h"
+#include "../vul_dary_heap.h"
+#include "../vul_pairing_heap.h"
+#include "../vul_radix_heap.h"
 
 int vul_test_priority_heap_compare_floats( void *a, void *b )
 {
@@ -189,6 +192,276 @@ int vul_test_priority_heap_compare_floats( void *a, void *b )
    return ( r < 0.f ) ? -1 : ( r > 0.f ) ? 1 : 0;
 }
 
+void vul_test_dary_heap( )
+{
+   vul_dary_heap *heap, *heap2;
+   vul_priority_heap_reference_t *reference;
+   vul_dary_heap_handle handles[ 1000 ], h2;
+   float a, b, f;
+   u32 i;
+
+   heap = vul_dary_heap_create( sizeof( float ), 4, vul_test_priority_heap_compare_floats, malloc, free );
+   reference = vul_priority_heap_reference_create( sizeof( float ), vul_test_priority_heap_compare_floats, malloc, free );
+
+   /* Insert a bunch of things; the heap has to grow along the way */
+   for( i = 0; i < 1000; ++i ) {
+      f = ( float )rand( ) / ( float )RAND_MAX;
+      handles[ i ] = vul_dary_heap_push( heap, &f );
+      TEST( *( float* )vul_dary_heap_get( heap, handles[ i ] ) == f );
+   }
+   TEST( vul_dary_heap_size( heap ) == 1000 );
+
+   /* Decrease every third key, remove every seventh element, and mirror it in the reference */
+   for( i = 0; i < 1000; ++i ) {
+      f = *( float* )vul_dary_heap_get( heap, handles[ i ] );
+      if( i % 7 == 0 ) {
+         vul_dary_heap_remove( heap, handles[ i ], &a );
+         TEST( a == f );
+         TEST( !vul_dary_heap_contains( heap, handles[ i ] ) );
+         continue;
+      }
+      if( i % 3 == 0 ) {
+         f *= 0.5f;
+         vul_dary_heap_decrease_key( heap, handles[ i ], &f );
+      } else if( i % 5 == 0 ) {
+         f += 1.f;
+         vul_dary_heap_update( heap, handles[ i ], &f );
+      }
+      vul_priority_heap_reference_push( reference, &f );
+   }
+   TEST( vul_dary_heap_size( heap ) == vul_priority_heap_reference_size( reference ) );
+   TEST( *( float* )vul_dary_heap_peek( heap ) == *( float* )vul_priority_heap_reference_peek( reference ) );
+
+   /* Merge in a second heap */
+   heap2 = vul_dary_heap_create( sizeof( float ), 0, vul_test_priority_heap_compare_floats, malloc, free );
+   f = 3.f;
+   vul_dary_heap_push( heap2, &f );
+   f = -1.f;
+   h2 = vul_dary_heap_push( heap2, &f );
+   vul_priority_heap_reference_push( reference, &f );
+   f = 3.f;
+   vul_priority_heap_reference_push( reference, &f );
+   h2 += heap->handle_count;
+   heap = vul_dary_heap_merge( heap, heap2 );
+   TEST( *( float* )vul_dary_heap_get( heap, h2 ) == -1.f );
+   TEST( vul_dary_heap_peek_handle( heap ) == h2 );
+
+   /* Check that we agree on the order */
+   while( !vul_priority_heap_reference_is_empty( reference ) ) {
+      vul_dary_heap_pop( heap, &a );
+      vul_priority_heap_reference_pop( reference, &b );
+      TEST( a == b );
+   }
+   TEST( vul_dary_heap_is_empty( heap ) );
+   TEST( vul_dary_heap_peek( heap ) == NULL );
+
+   vul_dary_heap_destroy( heap );
+   vul_priority_heap_reference_destroy( reference );
+}
+
+u64 vul_test_priority_heap_key_floats( void *a )
+{
+   return vul_radix_heap_key_f32( *( float* )a );
+}
+
+void vul_test_pairing_heap( )
+{
+   vul_pairing_heap *heap, *heap2;
+   vul_priority_heap_reference_t *reference;
+   float a, b, f;
+   u32 i;
+
+   heap = vul_pairing_heap_create( sizeof( float ), vul_test_priority_heap_compare_floats, malloc, free );
+   heap2 = vul_pairing_heap_create( sizeof( float ), vul_test_priority_heap_compare_floats, malloc, free );
+   reference = vul_priority_heap_reference_create( sizeof( float ), vul_test_priority_heap_compare_floats, malloc, free );
+
+   /* Fill both heaps, interleaving some pops to exercise node reuse */
+   for( i = 0; i < 1000; ++i ) {
+      f = ( float )rand( ) / ( float )RAND_MAX;
+      vul_pairing_heap_push( ( i & 1 ) ? heap : heap2, &f );
+      vul_priority_heap_reference_push( reference, &f );
+      if( i % 10 == 9 ) {
+         vul_pairing_heap_pop( heap, &a );
+         vul_pairing_heap_push( heap, &a );
+      }
+   }
+   TEST( vul_pairing_heap_size( heap ) + vul_pairing_heap_size( heap2 ) == 1000 );
+
+   heap = vul_pairing_heap_merge( heap, heap2 );
+   TEST( vul_pairing_heap_size( heap ) == 1000 );
+   TEST( *( float* )vul_pairing_heap_peek( heap ) == *( float* )vul_priority_heap_reference_peek( reference ) );
+
+   for( i = 0; i < 1000; ++i ) {
+      vul_pairing_heap_pop( heap, &a );
+      vul_priority_heap_reference_pop( reference, &b );
+      TEST( a == b );
+   }
+   TEST( vul_pairing_heap_is_empty( heap ) );
+   TEST( vul_pairing_heap_peek( heap ) == NULL );
+
+   vul_pairing_heap_destroy( heap );
+   vul_priority_heap_reference_destroy( reference );
+}
+
+void vul_test_radix_heap( )
+{
+   vul_radix_heap *heap, *heap2;
+   vul_priority_heap_reference_t *reference;
+   float a, b, f;
+   u32 i;
+
+   heap = vul_radix_heap_create( sizeof( float ), vul_test_priority_heap_key_floats, malloc, free );
+   reference = vul_priority_heap_reference_create( sizeof( float ), vul_test_priority_heap_compare_floats, malloc, free );
+
+   /* Float keys must keep their order, including negatives */
+   TEST( vul_radix_heap_key_f32( -2.f ) < vul_radix_heap_key_f32( -1.f ) );
+   TEST( vul_radix_heap_key_f32( -1.f ) < vul_radix_heap_key_f32( 0.f ) );
+   TEST( vul_radix_heap_key_f32( 0.5f ) < vul_radix_heap_key_f32( 1.f ) );
+   TEST( vul_radix_heap_key_f64( -1.0 ) < vul_radix_heap_key_f64( 2.0 ) );
+
+   for( i = 0; i < 1000; ++i ) {
+      f = ( float )rand( ) / ( float )RAND_MAX - 0.5f;
+      vul_radix_heap_push( heap, &f );
+      vul_priority_heap_reference_push( reference, &f );
+   }
+   TEST( vul_radix_heap_size( heap ) == 1000 );
+   TEST( *( float* )vul_radix_heap_peek( heap ) == *( float* )vul_priority_heap_reference_peek( reference ) );
+
+   /* Monotone workload: pop the minimum and push something larger, like Dijkstra does */
+   for( i = 0; i < 1000; ++i ) {
+      vul_radix_heap_pop( heap, &a );
+      vul_priority_heap_reference_pop( reference, &b );
+      TEST( a == b );
+      f = a + ( float )rand( ) / ( float )RAND_MAX;
+      vul_radix_heap_push( heap, &f );
+      vul_priority_heap_reference_push( reference, &f );
+   }
+
+   /* Merge with a heap that is behind this one */
+   heap2 = vul_radix_heap_create( sizeof( float ), vul_test_priority_heap_key_floats, malloc, free );
+   f = -10.f;
+   vul_radix_heap_push( heap2, &f );
+   vul_priority_heap_reference_push( reference, &f );
+   heap = vul_radix_heap_merge( heap, heap2 );
+   TEST( vul_radix_heap_size( heap ) == 1001 );
+
+   while( !vul_priority_heap_reference_is_empty( reference ) ) {
+      vul_radix_heap_pop( heap, &a );
+      vul_priority_heap_reference_pop( reference, &b );
+      TEST( a == b );
+   }
+   TEST( vul_radix_heap_is_empty( heap ) );
+
+   vul_radix_heap_destroy( heap );
+   vul_priority_heap_reference_destroy( reference );
+}
+
+#ifdef VUL_TEST_BENCHMARK
+//----------------------
+// Benchmarks
+//
+// Compile with VUL_TEST_BENCHMARK and an OS define (VUL_LINUX etc.) for vul_timer.
+// Runs the same push-all/pop-all workload as the tests, and a monotone
+// pop-min/push-larger workload as seen in Dijkstra and event simulation.
+
+#include "../vul_resizable_array.h"
+#include "../vul_benchmark.h"
+
+#define VUL_BENCH_PQ_COUNT 100000
+
+typedef enum vul__bench_pq_kind {
+   VUL_BENCH_PQ_FIBONACCI,
+   VUL_BENCH_PQ_DARY,
+   VUL_BENCH_PQ_PAIRING,
+   VUL_BENCH_PQ_RADIX,
+   VUL_BENCH_PQ_Count
+} vul__bench_pq_kind;
+
+typedef struct vul__bench_pq_data {
+   vul__bench_pq_kind kind;
+   b32 monotone;
+   float *values;
+} vul__bench_pq_data;
+
+void vul__bench_pq_run( void *data )
+{
+   vul__bench_pq_data *d;
+   void *heap;
+   float f;
+   u32 i;
+
+   d = ( vul__bench_pq_data* )data;
+   switch( d->kind ) {
+   case VUL_BENCH_PQ_FIBONACCI: heap = vul_priority_heap_create( sizeof( float ), vul_test_priority_heap_compare_floats, malloc, free ); break;
+   case VUL_BENCH_PQ_DARY: heap = vul_dary_heap_create( sizeof( float ), 16, vul_test_priority_heap_compare_floats, malloc, free ); break;
+   case VUL_BENCH_PQ_PAIRING: heap = vul_pairing_heap_create( sizeof( float ), vul_test_priority_heap_compare_floats, malloc, free ); break;
+   default: heap = vul_radix_heap_create( sizeof( float ), vul_test_priority_heap_key_floats, malloc, free ); break;
+   }
+
+#define VUL__BENCH_PQ_PUSH( v ) switch( d->kind ) {\
+   case VUL_BENCH_PQ_FIBONACCI: vul_priority_heap_push( ( vul_priority_heap* )heap, &v ); break;\
+   case VUL_BENCH_PQ_DARY: vul_dary_heap_push( ( vul_dary_heap* )heap, &v ); break;\
+   case VUL_BENCH_PQ_PAIRING: vul_pairing_heap_push( ( vul_pairing_heap* )heap, &v ); break;\
+   default: vul_radix_heap_push( ( vul_radix_heap* )heap, &v ); break;\
+   }
+#define VUL__BENCH_PQ_POP( v ) switch( d->kind ) {\
+   case VUL_BENCH_PQ_FIBONACCI: vul_priority_heap_pop( ( vul_priority_heap* )heap, &v ); break;\
+   case VUL_BENCH_PQ_DARY: vul_dary_heap_pop( ( vul_dary_heap* )heap, &v ); break;\
+   case VUL_BENCH_PQ_PAIRING: vul_pairing_heap_pop( ( vul_pairing_heap* )heap, &v ); break;\
+   default: vul_radix_heap_pop( ( vul_radix_heap* )heap, &v ); break;\
+   }
+
+   for( i = 0; i < VUL_BENCH_PQ_COUNT; ++i ) {
+      VUL__BENCH_PQ_PUSH( d->values[ i ] );
+   }
+   if( d->monotone ) {
+      for( i = 0; i < VUL_BENCH_PQ_COUNT; ++i ) {
+         VUL__BENCH_PQ_POP( f );
+         f += d->values[ i ];
+         VUL__BENCH_PQ_PUSH( f );
+      }
+   }
+   for( i = 0; i < VUL_BENCH_PQ_COUNT; ++i ) {
+      VUL__BENCH_PQ_POP( f );
+   }
+#undef VUL__BENCH_PQ_PUSH
+#undef VUL__BENCH_PQ_POP
+
+   switch( d->kind ) {
+   case VUL_BENCH_PQ_FIBONACCI: vul_priority_heap_destroy( ( vul_priority_heap* )heap ); break;
+   case VUL_BENCH_PQ_DARY: vul_dary_heap_destroy( ( vul_dary_heap* )heap ); break;
+   case VUL_BENCH_PQ_PAIRING: vul_pairing_heap_destroy( ( vul_pairing_heap* )heap ); break;
+   default: vul_radix_heap_destroy( ( vul_radix_heap* )heap ); break;
+   }
+}
+
+void vul_bench_priority_queues( )
+{
+   const char *names[ VUL_BENCH_PQ_Count ] = { "Fibonacci", "D-ary", "Pairing", "Radix" };
+   vul_benchmark_result res;
+   vul__bench_pq_data d;
+   u32 i, k;
+
+   d.values = ( float* )malloc( sizeof( float ) * VUL_BENCH_PQ_COUNT );
+   for( i = 0; i < VUL_BENCH_PQ_COUNT; ++i ) {
+      d.values[ i ] = ( float )rand( ) / ( float )RAND_MAX;
+   }
+
+   printf( "Heap\t\t|\tWorkload\t|\tMean (us)\t|\tMedian (us)\t|\tStd.dev.\n" );
+   for( d.monotone = 0; d.monotone < 2; ++d.monotone ) {
+      for( k = 0; k < VUL_BENCH_PQ_Count; ++k ) {
+         d.kind = ( vul__bench_pq_kind )k;
+         res = vul_benchmark_micros( 10, vul__bench_pq_run, &d );
+         printf( "%s\t|\t%s\t|\t%.1f\t|\t%llu\t|\t%.1f\n", names[ k ],
+                 d.monotone ? "monotone" : "push/pop",
+                 res.mean, ( unsigned long long )res.median, res.std_deviation );
+      }
+   }
+
+   free( d.values );
+}
+#endif
+
 int main( )
 {
    vul_priority_heap *heap;
@@ -233,5 +506,13 @@ int main( )
    vul_priority_heap_destroy( heap );
    vul_priority_heap_reference_destroy( reference );
 
+   vul_test_dary_heap( );
+   vul_test_pairing_heap( );
+   vul_test_radix_heap( );
+
+#ifdef VUL_TEST_BENCHMARK
+   vul_bench_priority_queues( );
+#endif
+
    return 0;
 }
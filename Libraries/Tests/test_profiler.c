@@ -0,0 +1,270 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_profiler.h
+ * Compile with the OS define (VUL_LINUX etc.) and link with pthreads.
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_PROFILER_H
+#define VUL_TEST_PROFILER_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+#define VUL_DEFINE
+#define VUL_PROFILER_ENABLED
+#include "../vul_profiler.h"
+
+#define VUL_TEST_PROFILER_THREADS 3
+#define VUL_TEST_PROFILER_FRAMES 100
+#define VUL_TEST_PROFILER_INNER 4
+
+static volatile uint32_t vul_test_profiler_sink;
+
+void vul_test_profiler_work( uint32_t n )
+{
+   uint32_t i;
+
+   VUL_PROFILE_SCOPE( "work" );
+   for( i = 0; i < n; ++i ) {
+      vul_atomic_add_u32( &vul_test_profiler_sink, i );
+   }
+}
+
+void vul_test_profiler_frame( )
+{
+   uint32_t i;
+
+   VUL_PROFILE_BEGIN( "frame" );
+   for( i = 0; i < VUL_TEST_PROFILER_INNER; ++i ) {
+      VUL_PROFILE_BEGIN( "update" );
+      vul_test_profiler_work( 100 );
+      VUL_PROFILE_END( );
+   }
+   VUL_PROFILE_BEGIN( "render \"quoted\"" );
+   vul_test_profiler_work( 50 );
+   VUL_PROFILE_END( );
+   VUL_PROFILE_END( );
+}
+
+#ifdef VUL_WINDOWS
+#define VUL_TEST_THREAD_FUNC( name ) DWORD WINAPI name( LPVOID arg )
+#define VUL_TEST_THREAD_RETURN return 0
+#else
+#define VUL_TEST_THREAD_FUNC( name ) void *name( void *arg )
+#define VUL_TEST_THREAD_RETURN return NULL
+#endif
+
+VUL_TEST_THREAD_FUNC( vul_test_profiler_worker )
+{
+   uint32_t i;
+
+   VUL_PROFILE_THREAD_NAME( "worker" );
+   for( i = 0; i < VUL_TEST_PROFILER_FRAMES; ++i ) {
+      vul_test_profiler_frame( );
+   }
+   ( void )arg;
+   VUL_TEST_THREAD_RETURN;
+}
+
+/**
+ * Finds the child of node with the given name, or VUL__PROFILER_NONE.
+ */
+uint32_t vul_test_profiler_child( vul__profiler_tree *tree, uint32_t node, const char *name )
+{
+   uint32_t c;
+
+   for( c = tree->nodes[ node ].first_child; c != 0xffffffffu; c = tree->nodes[ c ].next_sibling ) {
+      if( strcmp( tree->nodes[ c ].name, name ) == 0 ) {
+         return c;
+      }
+   }
+   return 0xffffffffu;
+}
+
+void vul_test_profiler( )
+{
+   vul_thread threads[ VUL_TEST_PROFILER_THREADS ];
+   vul_thread_attributes attr;
+   vul__profiler_tree tree;
+   uint32_t i, roots, frame, update, work;
+   FILE *f;
+   char *buf;
+   long size;
+   char *p;
+   uint32_t begins, ends;
+
+   // Nothing is recorded before initialize
+   vul_profiler_begin( "ignored" );
+   vul_profiler_end( );
+
+   vul_profiler_initialize( malloc, free );
+   VUL_PROFILE_THREAD_NAME( "main" );
+   memset( &attr, 0, sizeof( attr ) );
+   for( i = 0; i < VUL_TEST_PROFILER_THREADS; ++i ) {
+      threads[ i ] = vul_thread_create( attr, vul_test_profiler_worker, NULL );
+   }
+   for( i = 0; i < VUL_TEST_PROFILER_FRAMES; ++i ) {
+      vul_test_profiler_frame( );
+      vul_profiler_collect( ); // Collect while the workers record
+   }
+   for( i = 0; i < VUL_TEST_PROFILER_THREADS; ++i ) {
+      vul_thread_join( threads[ i ], NULL );
+   }
+   vul_profiler_collect( );
+   TEST( vul_profiler_dropped( ) == 0 );
+
+   // Every thread has the same call tree
+   vul__profiler_build_tree( &tree );
+   roots = 0;
+   for( i = 0; i < tree.count; ++i ) {
+      if( tree.nodes[ i ].parent != 0xffffffffu ) {
+         continue;
+      }
+      ++roots;
+      frame = vul_test_profiler_child( &tree, i, "frame" );
+      TEST( frame != 0xffffffffu );
+      TEST( tree.nodes[ frame ].calls == VUL_TEST_PROFILER_FRAMES );
+      update = vul_test_profiler_child( &tree, frame, "update" );
+      TEST( update != 0xffffffffu );
+      TEST( tree.nodes[ update ].calls == VUL_TEST_PROFILER_FRAMES * VUL_TEST_PROFILER_INNER );
+      work = vul_test_profiler_child( &tree, update, "work" );
+      TEST( work != 0xffffffffu );
+      TEST( tree.nodes[ work ].calls == VUL_TEST_PROFILER_FRAMES * VUL_TEST_PROFILER_INNER );
+      TEST( tree.nodes[ frame ].inclusive >= tree.nodes[ frame ].children );
+      TEST( tree.nodes[ update ].inclusive >= tree.nodes[ work ].inclusive );
+      TEST( vul_test_profiler_child( &tree, i, "ignored" ) == 0xffffffffu );
+   }
+   TEST( roots == VUL_TEST_PROFILER_THREADS + 1 );
+   free( tree.nodes );
+
+   // The trace has balanced begins and ends, and escapes names
+   f = tmpfile( );
+   TEST( f );
+   TEST( vul_profiler_write_chrome_trace( f ) );
+   size = ftell( f );
+   rewind( f );
+   buf = ( char* )malloc( size + 1 );
+   TEST( fread( buf, 1, size, f ) == ( size_t )size );
+   buf[ size ] = 0;
+   fclose( f );
+   TEST( strncmp( buf, "{\"traceEvents\":[", 16 ) == 0 );
+   TEST( strstr( buf, "render \\\"quoted\\\"" ) != NULL );
+   TEST( strstr( buf, "\"args\":{\"name\":\"worker\"}" ) != NULL );
+   begins = ends = 0;
+   for( p = buf; ( p = strstr( p, "\"ph\":\"" ) ) != NULL; p += 6 ) {
+      begins += p[ 6 ] == 'B';
+      ends += p[ 6 ] == 'E';
+   }
+   TEST( begins == ends );
+   TEST( begins == ( VUL_TEST_PROFILER_THREADS + 1 ) * VUL_TEST_PROFILER_FRAMES
+                   * ( 1 + 2 * VUL_TEST_PROFILER_INNER + 2 ) );
+   free( buf );
+
+   // Both summaries mention every zone
+   f = tmpfile( );
+   TEST( f );
+   vul_profiler_write_summary( f, 0 );
+   vul_profiler_write_summary( f, 1 );
+   size = ftell( f );
+   rewind( f );
+   buf = ( char* )malloc( size + 1 );
+   TEST( fread( buf, 1, size, f ) == ( size_t )size );
+   buf[ size ] = 0;
+   fclose( f );
+   TEST( strstr( buf, "frame" ) && strstr( buf, "update" ) && strstr( buf, "work" ) );
+   TEST( strstr( buf, "Thread" ) && strstr( buf, "main" ) );
+   free( buf );
+
+   // Reset drops what was collected
+   vul_profiler_reset( );
+   vul__profiler_build_tree( &tree );
+   TEST( tree.count == VUL_TEST_PROFILER_THREADS + 1 );
+   free( tree.nodes );
+
+   vul_profiler_shutdown( );
+
+   // Again after shutdown; the thread's old record must not be reused
+   vul_profiler_initialize( malloc, free );
+   vul_test_profiler_frame( );
+   vul__profiler_build_tree( &tree );
+   TEST( tree.count == 1 );
+   free( tree.nodes );
+   vul_profiler_collect( );
+   vul__profiler_build_tree( &tree );
+   TEST( tree.count == 6 ); // Thread, frame, update, work, render and its work
+   free( tree.nodes );
+   vul_profiler_shutdown( );
+}
+
+void vul_test_profiler_full_ring( )
+{
+   vul__profiler_tree tree;
+   uint32_t i, thread, a, b;
+
+   // Fill the ring inside a and b, so that "dropped" can't be recorded
+   vul_profiler_initialize( malloc, free );
+   vul_profiler_begin( "a" );
+   vul_profiler_begin( "b" );
+   for( i = 0; i < VUL_PROFILER_RING_SIZE; ++i ) {
+      vul_profiler_begin( "filler" );
+      vul_profiler_end( );
+   }
+   vul_profiler_begin( "dropped" );
+   vul_profiler_begin( "dropped child" );
+   vul_profiler_end( );
+   // Room again, but dropped's end must go too, or it would end b and make c b's sibling
+   vul_profiler_collect( );
+   vul_profiler_end( );
+   vul_profiler_begin( "c" );
+   vul_profiler_end( );
+   vul_profiler_end( );
+   vul_profiler_end( );
+   vul_profiler_collect( );
+   TEST( vul_profiler_dropped( ) >= 4 );
+
+   vul__profiler_build_tree( &tree );
+   thread = 0;
+   a = vul_test_profiler_child( &tree, thread, "a" );
+   TEST( a != 0xffffffffu && tree.nodes[ a ].calls == 1 );
+   b = vul_test_profiler_child( &tree, a, "b" );
+   TEST( b != 0xffffffffu && tree.nodes[ b ].calls == 1 );
+   TEST( vul_test_profiler_child( &tree, b, "c" ) != 0xffffffffu );
+   TEST( vul_test_profiler_child( &tree, a, "c" ) == 0xffffffffu );
+   TEST( vul_test_profiler_child( &tree, b, "dropped" ) == 0xffffffffu );
+   TEST( tree.nodes[ vul_test_profiler_child( &tree, b, "filler" ) ].calls < VUL_PROFILER_RING_SIZE );
+   free( tree.nodes );
+   vul_profiler_shutdown( );
+}
+
+int main( )
+{
+   vul_test_profiler( );
+   vul_test_profiler_full_ring( );
+
+   return 0;
+}
+#endif
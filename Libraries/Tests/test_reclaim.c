@@ -0,0 +1,283 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_reclaim.h
+ * Compile with the OS define (VUL_LINUX etc.) and link with pthreads.
+ * Best run with a sanitizer, which catches a pointer freed too early.
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_RECLAIM_H
+#define VUL_TEST_RECLAIM_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+#define VUL_DEFINE
+#include "../vul_reclaim.h"
+
+#define VUL_TEST_RECLAIM_THREADS 4
+#define VUL_TEST_RECLAIM_SLOTS 16
+#define VUL_TEST_RECLAIM_OPS 50000
+#define VUL_TEST_RECLAIM_MAGIC 0x5ca1ab1eu
+
+typedef struct vul_test_reclaim_object {
+   uint32_t magic;
+   uint32_t value;
+} vul_test_reclaim_object;
+
+typedef struct vul_test_reclaim_job {
+   vul_epoch_domain *epoch;
+   vul_hazard_domain *hazard;
+   uint32_t index;
+   uint32_t retired;
+} vul_test_reclaim_job;
+
+static void *volatile vul_test_reclaim_slots[ VUL_TEST_RECLAIM_SLOTS ];
+static volatile uint32_t vul_test_reclaim_freed;
+
+void vul_test_reclaim_free( void *ptr )
+{
+   ( ( vul_test_reclaim_object* )ptr )->magic = 0;
+   free( ptr );
+   vul_atomic_add_u32( &vul_test_reclaim_freed, 1 );
+}
+
+vul_test_reclaim_object *vul_test_reclaim_new( uint32_t value )
+{
+   vul_test_reclaim_object *o;
+
+   o = ( vul_test_reclaim_object* )malloc( sizeof( vul_test_reclaim_object ) );
+   o->magic = VUL_TEST_RECLAIM_MAGIC;
+   o->value = value;
+   return o;
+}
+
+void vul_test_reclaim_fill( )
+{
+   uint32_t i;
+
+   for( i = 0; i < VUL_TEST_RECLAIM_SLOTS; ++i ) {
+      vul_test_reclaim_slots[ i ] = vul_test_reclaim_new( i );
+   }
+}
+
+void vul_test_reclaim_empty( )
+{
+   uint32_t i;
+
+   for( i = 0; i < VUL_TEST_RECLAIM_SLOTS; ++i ) {
+      vul_test_reclaim_free( vul_test_reclaim_slots[ i ] );
+      vul_test_reclaim_slots[ i ] = NULL;
+   }
+}
+
+#ifdef VUL_WINDOWS
+#define VUL_TEST_THREAD_FUNC( name ) DWORD WINAPI name( LPVOID arg )
+#define VUL_TEST_THREAD_RETURN return 0
+#else
+#define VUL_TEST_THREAD_FUNC( name ) void *name( void *arg )
+#define VUL_TEST_THREAD_RETURN return NULL
+#endif
+
+// Every thread reads random slots and every fourth operation replaces one,
+// retiring the old object while others may still be reading it
+VUL_TEST_THREAD_FUNC( vul_test_reclaim_epoch_worker )
+{
+   vul_test_reclaim_job *job;
+   vul_epoch_thread *t;
+   vul_test_reclaim_object *o;
+   uint32_t i, r, s;
+
+   job = ( vul_test_reclaim_job* )arg;
+   t = vul_epoch_thread_register( job->epoch );
+   r = job->index * 2654435761u + 1;
+   for( i = 0; i < VUL_TEST_RECLAIM_OPS; ++i ) {
+      r = r * 1664525u + 1013904223u;
+      s = ( r >> 8 ) % VUL_TEST_RECLAIM_SLOTS;
+      vul_epoch_enter( job->epoch, t );
+      if( ( r >> 30 ) == 0 ) {
+         o = ( vul_test_reclaim_object* )vul_atomic_exchange_ptr( &vul_test_reclaim_slots[ s ],
+                                                                  vul_test_reclaim_new( i ) );
+         vul_epoch_retire( job->epoch, t, o, vul_test_reclaim_free );
+         ++job->retired;
+      } else {
+         o = ( vul_test_reclaim_object* )vul_atomic_load_ptr( &vul_test_reclaim_slots[ s ] );
+         TEST( o->magic == VUL_TEST_RECLAIM_MAGIC );
+      }
+      vul_epoch_exit( t );
+   }
+   vul_epoch_thread_unregister( job->epoch, t );
+   VUL_TEST_THREAD_RETURN;
+}
+
+VUL_TEST_THREAD_FUNC( vul_test_reclaim_hazard_worker )
+{
+   vul_test_reclaim_job *job;
+   vul_hazard_thread *t;
+   vul_test_reclaim_object *o;
+   uint32_t i, r, s;
+
+   job = ( vul_test_reclaim_job* )arg;
+   t = vul_hazard_thread_register( job->hazard );
+   r = job->index * 2654435761u + 1;
+   for( i = 0; i < VUL_TEST_RECLAIM_OPS; ++i ) {
+      r = r * 1664525u + 1013904223u;
+      s = ( r >> 8 ) % VUL_TEST_RECLAIM_SLOTS;
+      if( ( r >> 30 ) == 0 ) {
+         o = ( vul_test_reclaim_object* )vul_atomic_exchange_ptr( &vul_test_reclaim_slots[ s ],
+                                                                  vul_test_reclaim_new( i ) );
+         vul_hazard_retire( job->hazard, t, o, vul_test_reclaim_free );
+         ++job->retired;
+         // Bounded: never more than the scan threshold waiting
+         TEST( t->retired.count <= VUL_TEST_RECLAIM_THREADS + VUL_HAZARD_SCAN_SLACK );
+      } else {
+         o = ( vul_test_reclaim_object* )vul_hazard_protect( t, 0, &vul_test_reclaim_slots[ s ] );
+         TEST( o->magic == VUL_TEST_RECLAIM_MAGIC );
+         vul_hazard_clear( t, 0 );
+      }
+   }
+   vul_hazard_thread_unregister( job->hazard, t );
+   VUL_TEST_THREAD_RETURN;
+}
+
+void vul_test_reclaim_run( vul_test_reclaim_job *jobs, vul_epoch_domain *epoch, vul_hazard_domain *hazard,
+                           vul_thread_func func )
+{
+   vul_thread threads[ VUL_TEST_RECLAIM_THREADS ];
+   vul_thread_attributes attr;
+   uint32_t i;
+
+   memset( &attr, 0, sizeof( attr ) );
+   for( i = 0; i < VUL_TEST_RECLAIM_THREADS; ++i ) {
+      memset( &jobs[ i ], 0, sizeof( vul_test_reclaim_job ) );
+      jobs[ i ].epoch = epoch;
+      jobs[ i ].hazard = hazard;
+      jobs[ i ].index = i;
+      threads[ i ] = vul_thread_create( attr, func, &jobs[ i ] );
+   }
+   for( i = 0; i < VUL_TEST_RECLAIM_THREADS; ++i ) {
+      vul_thread_join( threads[ i ], NULL );
+   }
+}
+
+void vul_test_reclaim_epoch( )
+{
+   vul_epoch_domain *d;
+   vul_epoch_thread *a, *b;
+   vul_test_reclaim_job jobs[ VUL_TEST_RECLAIM_THREADS ];
+   vul_test_reclaim_object *o;
+   uint32_t i, retired;
+
+   // A thread inside a critical section holds back freeing
+   d = vul_epoch_domain_create( malloc, free );
+   a = vul_epoch_thread_register( d );
+   b = vul_epoch_thread_register( d );
+   vul_test_reclaim_freed = 0;
+   vul_epoch_enter( d, b );
+   vul_epoch_enter( d, a );
+   o = vul_test_reclaim_new( 0 );
+   vul_epoch_retire( d, a, o, vul_test_reclaim_free );
+   vul_epoch_exit( a );
+   for( i = 0; i < 4; ++i ) {
+      vul_epoch_reclaim( d, a );
+   }
+   TEST( vul_test_reclaim_freed == 0 );
+   TEST( o->magic == VUL_TEST_RECLAIM_MAGIC );
+   vul_epoch_exit( b );
+   for( i = 0; i < 4; ++i ) {
+      vul_epoch_reclaim( d, a );
+   }
+   TEST( vul_test_reclaim_freed == 1 );
+   vul_epoch_thread_unregister( d, a );
+   vul_epoch_thread_unregister( d, b );
+   TEST( vul_epoch_thread_register( d ) != NULL ); // Reuses a record
+   vul_epoch_domain_destroy( d );
+
+   // Concurrent readers and retirers; everything retired is freed exactly once
+   d = vul_epoch_domain_create( malloc, free );
+   vul_test_reclaim_fill( );
+   vul_test_reclaim_freed = 0;
+   vul_test_reclaim_run( jobs, d, NULL, vul_test_reclaim_epoch_worker );
+   retired = 0;
+   for( i = 0; i < VUL_TEST_RECLAIM_THREADS; ++i ) {
+      retired += jobs[ i ].retired;
+   }
+   TEST( vul_test_reclaim_freed <= retired );
+   vul_epoch_domain_destroy( d );
+   TEST( vul_test_reclaim_freed == retired );
+   vul_test_reclaim_empty( );
+}
+
+void vul_test_reclaim_hazard( )
+{
+   vul_hazard_domain *d;
+   vul_hazard_thread *a, *b;
+   vul_test_reclaim_job jobs[ VUL_TEST_RECLAIM_THREADS ];
+   vul_test_reclaim_object *o;
+   void *volatile tagged;
+   uint32_t i, retired;
+
+   // A published pointer isn't freed, and is once it's cleared
+   d = vul_hazard_domain_create( 2, malloc, free );
+   a = vul_hazard_thread_register( d );
+   b = vul_hazard_thread_register( d );
+   vul_test_reclaim_freed = 0;
+   o = vul_test_reclaim_new( 0 );
+   tagged = ( void* )( ( uintptr_t )o | 1 );
+   TEST( vul_hazard_protect_masked( b, 1, &tagged, 1 ) == tagged );
+   vul_hazard_retire( d, a, o, vul_test_reclaim_free );
+   TEST( vul_hazard_scan( d, a ) == 1 );
+   TEST( o->magic == VUL_TEST_RECLAIM_MAGIC );
+   vul_hazard_clear( b, 1 );
+   TEST( vul_hazard_scan( d, a ) == 0 );
+   TEST( vul_test_reclaim_freed == 1 );
+   vul_hazard_thread_unregister( d, a );
+   vul_hazard_thread_unregister( d, b );
+   vul_hazard_domain_destroy( d );
+
+   // Concurrent readers and retirers
+   d = vul_hazard_domain_create( 1, malloc, free );
+   vul_test_reclaim_fill( );
+   vul_test_reclaim_freed = 0;
+   vul_test_reclaim_run( jobs, NULL, d, vul_test_reclaim_hazard_worker );
+   retired = 0;
+   for( i = 0; i < VUL_TEST_RECLAIM_THREADS; ++i ) {
+      retired += jobs[ i ].retired;
+   }
+   TEST( vul_test_reclaim_freed <= retired );
+   vul_hazard_domain_destroy( d );
+   TEST( vul_test_reclaim_freed == retired );
+   vul_test_reclaim_empty( );
+}
+
+int main( )
+{
+   vul_test_reclaim_epoch( );
+   vul_test_reclaim_hazard( );
+
+   return 0;
+}
+#endif
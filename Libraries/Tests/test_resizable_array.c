@@ -0,0 +1,155 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_resizable_array.h
+ * 
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_RESIZABLE_ARRAY_H
+#define VUL_TEST_RESIZABLE_ARRAY_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+#define VUL_DEFINE
+#include "../vul_resizable_array.h"
+
+static uint32_t vul_test_vector_allocations;
+
+void *vul_test_vector_alloc( size_t size )
+{
+   ++vul_test_vector_allocations;
+   return malloc( size );
+}
+
+void *vul_test_vector_realloc( void *ptr, size_t size )
+{
+   ++vul_test_vector_allocations;
+   return realloc( ptr, size );
+}
+
+void vul_test_vector_check( vul_vector *vec, uint32_t count )
+{
+   uint32_t i;
+
+   TEST( vul_vector_size( vec ) == count );
+   for( i = 0; i < count; ++i ) {
+      TEST( *( uint32_t* )vul_vector_get( vec, i ) == i );
+   }
+}
+
+int main( )
+{
+   vul_vector *vec, *other, stack_vec;
+   vul_vector_arena arena;
+   uint32_t i, buffer[ 8 ];
+   uint8_t *arena_memory, *list;
+   size_t used;
+
+   // Small-buffer: one allocation for the vector and its first 8 elements
+   vul_test_vector_allocations = 0;
+   vec = vul_vector_create_small( sizeof( uint32_t ), 8, vul_test_vector_alloc, free, vul_test_vector_realloc );
+   for( i = 0; i < 8; ++i ) {
+      vul_vector_add( vec, &i );
+   }
+   TEST( vul_test_vector_allocations == 1 );
+   TEST( vec->list == vec->inline_buffer );
+   vul_test_vector_check( vec, 8 );
+   // Spilling to the heap keeps the contents
+   for( ; i < 100; ++i ) {
+      vul_vector_add( vec, &i );
+   }
+   TEST( vec->list != vec->inline_buffer );
+   vul_test_vector_check( vec, 100 );
+   // And shrinking moves them back
+   vul_vector_resize( vec, 5, VUL_FALSE, VUL_FALSE );
+   vul_vector_tighten( vec );
+   TEST( vec->list == vec->inline_buffer && vec->reserved_size == 8 );
+   vul_test_vector_check( vec, 5 );
+   i = 99;
+   vul_vector_insert( vec, &i, 2 );
+   TEST( *( uint32_t* )vul_vector_get( vec, 2 ) == 99 && *( uint32_t* )vul_vector_get( vec, 3 ) == 2 );
+   vul_vector_remove_cascade( vec, 2 );
+   vul_test_vector_check( vec, 5 );
+   vul_vector_freemem( vec );
+   TEST( vec->list == vec->inline_buffer && vul_vector_size( vec ) == 0 );
+   vul_vector_destroy( vec );
+
+   // Caller-owned vector and buffer
+   vul_test_vector_allocations = 0;
+   vul_vector_initialize_buffer( &stack_vec, sizeof( uint32_t ), buffer, 8, vul_test_vector_alloc, free, vul_test_vector_realloc );
+   for( i = 0; i < 8; ++i ) {
+      vul_vector_add( &stack_vec, &i );
+   }
+   TEST( vul_test_vector_allocations == 0 && buffer[ 7 ] == 7 );
+   vul_vector_add( &stack_vec, &i );
+   TEST( vul_test_vector_allocations == 1 );
+   vul_test_vector_check( &stack_vec, 9 );
+   vul_vector_freemem( &stack_vec );
+   TEST( stack_vec.list == ( uint8_t* )buffer );
+
+   // Plain initialize ignores whatever was in the mode fields
+   memset( &stack_vec, 0xab, sizeof( stack_vec ) );
+   stack_vec.element_size = sizeof( uint32_t );
+   stack_vec.allocator = vul_test_vector_alloc;
+   stack_vec.deallocator = free;
+   stack_vec.reallocator = vul_test_vector_realloc;
+   vul_vector_initialize( &stack_vec, 0, 4 );
+   TEST( stack_vec.inline_buffer == NULL && stack_vec.arena == NULL );
+   for( i = 0; i < 20; ++i ) {
+      vul_vector_add( &stack_vec, &i );
+   }
+   vul_test_vector_check( &stack_vec, 20 );
+   vul_vector_freemem( &stack_vec );
+
+   // Arena: the last vector grows in place, others move
+   arena_memory = ( uint8_t* )malloc( 1 << 16 );
+   vul_vector_arena_initialize( &arena, arena_memory, 1 << 16 );
+   other = vul_vector_create_arena( sizeof( uint32_t ), 4, &arena );
+   vec = vul_vector_create_arena( sizeof( uint32_t ), 4, &arena );
+   list = vec->list;
+   for( i = 0; i < 1000; ++i ) {
+      vul_vector_add( vec, &i );
+   }
+   TEST( vec->list == list );
+   vul_test_vector_check( vec, 1000 );
+   used = arena.used;
+   for( i = 0; i < 100; ++i ) {
+      vul_vector_add( other, &i );
+   }
+   TEST( arena.used > used );
+   vul_test_vector_check( other, 100 );
+   vul_vector_swap( other, 0, 1 );
+   TEST( *( uint32_t* )vul_vector_get( other, 0 ) == 1 );
+   vul_vector_destroy( other );
+   vul_vector_arena_reset( &arena );
+   TEST( arena.used == 0 );
+   vec = vul_vector_create_arena( sizeof( uint32_t ), 0, &arena );
+   vul_vector_add( vec, &i );
+   TEST( ( uint8_t* )vec >= arena_memory && vec->list < arena_memory + ( 1 << 16 ) );
+   free( arena_memory );
+
+   return 0;
+}
+#endif
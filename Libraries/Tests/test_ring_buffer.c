@@ -0,0 +1,199 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_ring_buffer.h
+ * Compile with the OS define (VUL_LINUX etc.) and link with pthreads.
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_RING_BUFFER_H
+#define VUL_TEST_RING_BUFFER_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+#define VUL_DEFINE
+#include "../vul_ring_buffer.h"
+
+#define VUL_TEST_RING_COUNT 50000
+#define VUL_TEST_RING_PRODUCERS 3
+#define VUL_TEST_RING_CONSUMERS 3
+
+typedef struct vul_test_ring_job {
+   void *queue;
+   uint32_t index;
+   uint64_t sum;
+   uint32_t count;
+} vul_test_ring_job;
+
+static volatile uint32_t vul_test_ring_consumed;
+
+void *vul_test_spsc_producer( void *arg )
+{
+   vul_spsc_queue *q;
+   uint32_t i, n, batch[ 7 ];
+
+   q = ( vul_spsc_queue* )( ( vul_test_ring_job* )arg )->queue;
+   i = 0;
+   while( i < VUL_TEST_RING_COUNT ) {
+      // Alternate single and batch pushes
+      if( i & 1 ) {
+         if( vul_spsc_queue_push( q, &i ) ) {
+            ++i;
+         }
+      } else {
+         for( n = 0; n < 7; ++n ) {
+            batch[ n ] = i + n;
+         }
+         n = 7 < VUL_TEST_RING_COUNT - i ? 7 : VUL_TEST_RING_COUNT - i;
+         i += vul_spsc_queue_push_batch( q, batch, n );
+      }
+   }
+   return NULL;
+}
+
+void *vul_test_mpmc_producer( void *arg )
+{
+   vul_test_ring_job *job;
+   uint32_t i, n, k, batch[ 5 ];
+
+   job = ( vul_test_ring_job* )arg;
+   i = 0;
+   while( i < VUL_TEST_RING_COUNT ) {
+      n = 5 < VUL_TEST_RING_COUNT - i ? 5 : VUL_TEST_RING_COUNT - i;
+      for( k = 0; k < n; ++k ) {
+         batch[ k ] = ( job->index << 24 ) | ( i + k );
+      }
+      i += vul_mpmc_queue_push_batch( ( vul_mpmc_queue* )job->queue, batch, n );
+   }
+   return NULL;
+}
+
+void *vul_test_mpmc_consumer( void *arg )
+{
+   vul_test_ring_job *job;
+   uint32_t last[ VUL_TEST_RING_PRODUCERS ], batch[ 4 ], n, k, p, v;
+
+   job = ( vul_test_ring_job* )arg;
+   for( p = 0; p < VUL_TEST_RING_PRODUCERS; ++p ) {
+      last[ p ] = 0;
+   }
+   while( vul_atomic_load_u32( &vul_test_ring_consumed ) < VUL_TEST_RING_COUNT * VUL_TEST_RING_PRODUCERS ) {
+      n = vul_mpmc_queue_pop_batch( ( vul_mpmc_queue* )job->queue, batch, 1 + ( job->count & 3 ) );
+      for( k = 0; k < n; ++k ) {
+         p = batch[ k ] >> 24;
+         v = batch[ k ] & 0xffffff;
+         // Each producer's elements must come out in the order they went in
+         TEST( p < VUL_TEST_RING_PRODUCERS && v + 1 > last[ p ] );
+         last[ p ] = v + 1;
+         job->sum += v;
+      }
+      job->count += n;
+      vul_atomic_add_u32( &vul_test_ring_consumed, n );
+   }
+   return NULL;
+}
+
+int main( )
+{
+   vul_spsc_queue *sq;
+   vul_mpmc_queue *mq;
+   vul_thread threads[ VUL_TEST_RING_PRODUCERS + VUL_TEST_RING_CONSUMERS ];
+   vul_test_ring_job jobs[ VUL_TEST_RING_PRODUCERS + VUL_TEST_RING_CONSUMERS ];
+   vul_thread_attributes attr;
+   uint32_t i, v, out[ 8 ], count;
+   uint64_t sum;
+
+   memset( &attr, 0, sizeof( attr ) );
+
+   // Single threaded: capacity rounding, full/empty and wrap-around
+   sq = vul_spsc_queue_create( sizeof( uint32_t ), 5, malloc, free );
+   for( i = 0; i < 8; ++i ) {
+      TEST( vul_spsc_queue_push( sq, &i ) );
+   }
+   TEST( !vul_spsc_queue_push( sq, &i ) );
+   TEST( vul_spsc_queue_size( sq ) == 8 );
+   TEST( vul_spsc_queue_pop_batch( sq, out, 5 ) == 5 );
+   TEST( out[ 0 ] == 0 && out[ 4 ] == 4 );
+   TEST( vul_spsc_queue_push_batch( sq, out, 8 ) == 5 );
+   TEST( vul_spsc_queue_pop_batch( sq, out, 8 ) == 8 );
+   TEST( out[ 0 ] == 5 && out[ 2 ] == 7 && out[ 3 ] == 0 && out[ 7 ] == 4 );
+   TEST( !vul_spsc_queue_pop( sq, &v ) );
+   vul_spsc_queue_destroy( sq );
+
+   mq = vul_mpmc_queue_create( sizeof( uint32_t ), 4, malloc, free );
+   for( i = 0; i < 4; ++i ) {
+      TEST( vul_mpmc_queue_push( mq, &i ) );
+   }
+   TEST( !vul_mpmc_queue_push( mq, &i ) );
+   TEST( vul_mpmc_queue_pop( mq, &v ) && v == 0 );
+   TEST( vul_mpmc_queue_push_batch( mq, out, 3 ) == 1 );
+   TEST( vul_mpmc_queue_size( mq ) == 4 );
+   TEST( vul_mpmc_queue_pop_batch( mq, out, 8 ) == 4 );
+   TEST( out[ 0 ] == 1 && out[ 2 ] == 3 );
+   TEST( !vul_mpmc_queue_pop( mq, &v ) );
+   vul_mpmc_queue_destroy( mq );
+
+   // One producer, one consumer
+   sq = vul_spsc_queue_create( sizeof( uint32_t ), 1024, malloc, free );
+   jobs[ 0 ].queue = sq;
+   threads[ 0 ] = vul_thread_create( attr, vul_test_spsc_producer, &jobs[ 0 ] );
+   i = 0;
+   while( i < VUL_TEST_RING_COUNT ) {
+      count = vul_spsc_queue_pop_batch( sq, out, 1 + ( i & 7 ) );
+      for( v = 0; v < count; ++v ) {
+         TEST( out[ v ] == i + v );
+      }
+      i += count;
+   }
+   vul_thread_join( threads[ 0 ], NULL );
+   TEST( vul_spsc_queue_size( sq ) == 0 );
+   vul_spsc_queue_destroy( sq );
+
+   // Several producers and consumers
+   mq = vul_mpmc_queue_create( sizeof( uint32_t ), 1024, malloc, free );
+   vul_test_ring_consumed = 0;
+   for( i = 0; i < VUL_TEST_RING_PRODUCERS + VUL_TEST_RING_CONSUMERS; ++i ) {
+      memset( &jobs[ i ], 0, sizeof( vul_test_ring_job ) );
+      jobs[ i ].queue = mq;
+      jobs[ i ].index = i;
+      threads[ i ] = vul_thread_create( attr,
+                                        i < VUL_TEST_RING_PRODUCERS ? vul_test_mpmc_producer : vul_test_mpmc_consumer,
+                                        &jobs[ i ] );
+   }
+   sum = 0;
+   count = 0;
+   for( i = 0; i < VUL_TEST_RING_PRODUCERS + VUL_TEST_RING_CONSUMERS; ++i ) {
+      vul_thread_join( threads[ i ], NULL );
+      sum += jobs[ i ].sum;
+      count += jobs[ i ].count;
+   }
+   TEST( count == VUL_TEST_RING_COUNT * VUL_TEST_RING_PRODUCERS );
+   TEST( sum == ( uint64_t )VUL_TEST_RING_PRODUCERS * VUL_TEST_RING_COUNT * ( VUL_TEST_RING_COUNT - 1 ) / 2 );
+   vul_mpmc_queue_destroy( mq );
+
+   return 0;
+}
+#endif
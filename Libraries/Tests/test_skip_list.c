@@ -0,0 +1,183 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_skip_list.h
+ * 
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_SKIP_LIST_H
+#define VUL_TEST_SKIP_LIST_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+#define VUL_DEFINE
+#include "../vul_skip_list.h"
+
+#define VUL_TEST_SKIP_LIST_COUNT 2000
+#define VUL_TEST_SKIP_LIST_KEYS 500
+
+typedef struct vul_test_skip_list_element {
+   uint32_t key;
+   uint32_t seq; // Insertion order, to check stability
+} vul_test_skip_list_element;
+
+int32_t vul_test_skip_list_compare( void *a, void *b )
+{
+   uint32_t ka, kb;
+
+   ka = ( ( vul_test_skip_list_element* )a )->key;
+   kb = ( ( vul_test_skip_list_element* )b )->key;
+
+   return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+/**
+ * Checks the list against a sorted reference array, including every span.
+ */
+void vul_test_skip_list_check( vul_skip_list *list, vul_test_skip_list_element *ref, uint32_t count )
+{
+   vul_skip_list_element *e, *f;
+   vul_test_skip_list_element *d;
+   uint32_t i, l, n;
+
+   TEST( vul_skip_list_size( list ) == count );
+   e = vul_skip_list_first( list );
+   for( i = 0; i < count; ++i ) {
+      TEST( e != NULL );
+      d = ( vul_test_skip_list_element* )e->data;
+      TEST( d->key == ref[ i ].key && d->seq == ref[ i ].seq );
+      TEST( vul_skip_list_at( list, i ) == e );
+      for( l = 0; l < e->levels; ++l ) {
+         n = 0;
+         f = e;
+         while( f != e->nexts[ l ] ) {
+            f = f->nexts[ 0 ];
+            ++n;
+         }
+         TEST( e->spans[ l ] == ( e->nexts[ l ] ? n : n - 1 ) );
+      }
+      e = vul_skip_list_next( e );
+   }
+   TEST( e == NULL );
+   TEST( vul_skip_list_at( list, count ) == NULL );
+}
+
+int main( )
+{
+   vul_skip_list *list, *copy;
+   vul_skip_list_element *e;
+   vul_test_skip_list_element *ref, d;
+   uint32_t count, i, j, lo, hi, r;
+
+   ref = ( vul_test_skip_list_element* )malloc( sizeof( vul_test_skip_list_element ) * VUL_TEST_SKIP_LIST_COUNT );
+   list = vul_skip_list_create( sizeof( vul_test_skip_list_element ), vul_test_skip_list_compare, malloc, free );
+
+   // Random inserts with duplicates must stay sorted and stable
+   srand( 1337 );
+   count = 0;
+   for( i = 0; i < VUL_TEST_SKIP_LIST_COUNT; ++i ) {
+      d.key = ( uint32_t )rand( ) % VUL_TEST_SKIP_LIST_KEYS;
+      d.seq = i;
+      e = vul_skip_list_insert( list, &d );
+      TEST( e != NULL && ( ( vul_test_skip_list_element* )e->data )->seq == i );
+      j = count;
+      while( j > 0 && ref[ j - 1 ].key > d.key ) {
+         ref[ j ] = ref[ j - 1 ];
+         --j;
+      }
+      ref[ j ] = d;
+      ++count;
+   }
+   vul_test_skip_list_check( list, ref, count );
+
+   // Rank, bounds and find
+   for( i = 0; i <= VUL_TEST_SKIP_LIST_KEYS; ++i ) {
+      d.key = i;
+      lo = 0;
+      while( lo < count && ref[ lo ].key < i ) ++lo;
+      hi = lo;
+      while( hi < count && ref[ hi ].key == i ) ++hi;
+      TEST( vul_skip_list_rank( list, &d ) == lo );
+      TEST( vul_skip_list_lower_bound( list, &d ) == vul_skip_list_at( list, lo ) );
+      TEST( vul_skip_list_upper_bound( list, &d ) == vul_skip_list_at( list, hi ) );
+      TEST( vul_skip_list_find( list, &d ) == ( lo != hi ? vul_skip_list_at( list, lo ) : NULL ) );
+   }
+
+   // A range query [100, 200) with a cursor
+   d.key = 100;
+   j = 0;
+   for( e = vul_skip_list_lower_bound( list, &d ); e != NULL; e = vul_skip_list_next( e ) ) {
+      if( ( ( vul_test_skip_list_element* )e->data )->key >= 200 ) break;
+      ++j;
+   }
+   d.key = 200;
+   r = vul_skip_list_rank( list, &d );
+   d.key = 100;
+   TEST( j == r - vul_skip_list_rank( list, &d ) );
+
+   // Remove random elements, including ones among duplicates
+   for( i = 0; i < VUL_TEST_SKIP_LIST_COUNT / 2; ++i ) {
+      r = ( uint32_t )rand( ) % count;
+      vul_skip_list_remove( list, vul_skip_list_at( list, r ) );
+      for( j = r; j + 1 < count; ++j ) {
+         ref[ j ] = ref[ j + 1 ];
+      }
+      --count;
+   }
+   vul_test_skip_list_check( list, ref, count );
+
+   // Copying is a bulk build
+   copy = vul_skip_list_copy( list, malloc, free );
+   vul_test_skip_list_check( copy, ref, count );
+   vul_skip_list_destroy( copy );
+
+   // Bulk build from sorted data, then keep inserting into it
+   copy = vul_skip_list_create_sorted( sizeof( vul_test_skip_list_element ), vul_test_skip_list_compare,
+                                       ref, count, malloc, free );
+   vul_test_skip_list_check( copy, ref, count );
+   e = vul_skip_list_at( copy, 7 ); // Rank 8 gets 4 levels
+   TEST( e->levels == 4 );
+   d.key = 0;
+   d.seq = VUL_TEST_SKIP_LIST_COUNT;
+   vul_skip_list_insert( copy, &d );
+   TEST( vul_skip_list_size( copy ) == count + 1 );
+   d.key = 1; // The new element goes after the other zeroes
+   e = vul_skip_list_at( copy, vul_skip_list_rank( copy, &d ) - 1 );
+   TEST( ( ( vul_test_skip_list_element* )e->data )->seq == VUL_TEST_SKIP_LIST_COUNT );
+   vul_skip_list_destroy( copy );
+
+   // Empty the list completely
+   while( vul_skip_list_size( list ) ) {
+      vul_skip_list_remove( list, vul_skip_list_first( list ) );
+   }
+   TEST( list->levels == 1 );
+   TEST( vul_skip_list_first( list ) == NULL );
+   vul_skip_list_destroy( list );
+
+   free( ref );
+
+   return 0;
+}
+#endif
@@ -0,0 +1,212 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_skip_list_concurrent.h
+ * Compile with the OS define (VUL_LINUX etc.) and link with pthreads.
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_SKIP_LIST_CONCURRENT_H
+#define VUL_TEST_SKIP_LIST_CONCURRENT_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+#define VUL_DEFINE
+#include "../vul_skip_list_concurrent.h"
+
+#define VUL_TEST_CSKIP_THREADS 4
+#define VUL_TEST_CSKIP_KEYS 256
+#define VUL_TEST_CSKIP_OPS 200000
+#define VUL_TEST_CSKIP_DISJOINT 8192
+
+typedef struct vul_test_cskip_element {
+   uint32_t key;
+   uint32_t check;
+} vul_test_cskip_element;
+
+typedef struct vul_test_cskip_job {
+   vul_concurrent_skip_list *list;
+   uint32_t index;
+   int32_t net[ VUL_TEST_CSKIP_KEYS ]; // Successful inserts minus removes per key
+} vul_test_cskip_job;
+
+int32_t vul_test_cskip_compare( void *a, void *b )
+{
+   uint32_t ka, kb;
+
+   ka = ( ( vul_test_cskip_element* )a )->key;
+   kb = ( ( vul_test_cskip_element* )b )->key;
+
+   return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+void *vul_test_cskip_disjoint( void *arg )
+{
+   vul_test_cskip_job *job;
+   vul_concurrent_skip_list_thread *t;
+   vul_test_cskip_element e, out;
+   uint32_t i;
+
+   job = ( vul_test_cskip_job* )arg;
+   t = vul_concurrent_skip_list_thread_register( job->list, job->index + 1 );
+
+   // Interleaved key ranges, so threads insert next to each other's nodes
+   for( i = 0; i < VUL_TEST_CSKIP_DISJOINT; ++i ) {
+      e.key = i * VUL_TEST_CSKIP_THREADS + job->index;
+      e.check = ~e.key;
+      TEST( vul_concurrent_skip_list_insert( job->list, t, &e ) );
+   }
+   for( i = 0; i < VUL_TEST_CSKIP_DISJOINT; ++i ) {
+      e.key = i * VUL_TEST_CSKIP_THREADS + job->index;
+      TEST( vul_concurrent_skip_list_find( job->list, t, &e, &out ) );
+      TEST( out.check == ~e.key );
+   }
+   for( i = 0; i < VUL_TEST_CSKIP_DISJOINT; i += 2 ) {
+      e.key = i * VUL_TEST_CSKIP_THREADS + job->index;
+      TEST( vul_concurrent_skip_list_remove( job->list, t, &e, &out ) );
+      TEST( out.check == ~e.key );
+      TEST( !vul_concurrent_skip_list_find( job->list, t, &e, NULL ) );
+   }
+
+   vul_concurrent_skip_list_thread_unregister( job->list, t );
+   return NULL;
+}
+
+void *vul_test_cskip_contended( void *arg )
+{
+   vul_test_cskip_job *job;
+   vul_concurrent_skip_list_thread *t;
+   vul_test_cskip_element e, out;
+   uint32_t i, r;
+
+   job = ( vul_test_cskip_job* )arg;
+   t = vul_concurrent_skip_list_thread_register( job->list, job->index * 7919 + 13 );
+
+   // Every thread hammers the same small key range
+   r = job->index * 2654435761u + 1;
+   for( i = 0; i < VUL_TEST_CSKIP_OPS; ++i ) {
+      r = r * 1664525u + 1013904223u;
+      e.key = ( r >> 8 ) % VUL_TEST_CSKIP_KEYS;
+      e.check = ~e.key;
+      switch( r >> 30 ) {
+      case 0:
+      case 1:
+         if( vul_concurrent_skip_list_insert( job->list, t, &e ) ) {
+            ++job->net[ e.key ];
+         }
+         break;
+      case 2:
+         if( vul_concurrent_skip_list_remove( job->list, t, &e, &out ) ) {
+            TEST( out.check == ~e.key );
+            --job->net[ e.key ];
+         }
+         break;
+      default:
+         if( vul_concurrent_skip_list_find( job->list, t, &e, &out ) ) {
+            TEST( out.check == ~e.key );
+         }
+         break;
+      }
+   }
+
+   vul_concurrent_skip_list_thread_unregister( job->list, t );
+   return NULL;
+}
+
+void vul_test_cskip_run( vul_concurrent_skip_list *list, vul_test_cskip_job *jobs, vul_thread_func func )
+{
+   vul_thread threads[ VUL_TEST_CSKIP_THREADS ];
+   vul_thread_attributes attr;
+   uint32_t i;
+
+   memset( &attr, 0, sizeof( attr ) );
+   for( i = 0; i < VUL_TEST_CSKIP_THREADS; ++i ) {
+      memset( &jobs[ i ], 0, sizeof( vul_test_cskip_job ) );
+      jobs[ i ].list = list;
+      jobs[ i ].index = i;
+      threads[ i ] = vul_thread_create( attr, func, &jobs[ i ] );
+   }
+   for( i = 0; i < VUL_TEST_CSKIP_THREADS; ++i ) {
+      vul_thread_join( threads[ i ], NULL );
+   }
+}
+
+int main( )
+{
+   vul_concurrent_skip_list *list;
+   vul_concurrent_skip_list_thread *t;
+   vul_test_cskip_job jobs[ VUL_TEST_CSKIP_THREADS ];
+   vul_test_cskip_element e;
+   uint32_t i, j, size;
+   int32_t net;
+
+   // Single threaded basics
+   list = vul_concurrent_skip_list_create( sizeof( vul_test_cskip_element ), vul_test_cskip_compare, malloc, free );
+   t = vul_concurrent_skip_list_thread_register( list, 42 );
+   e.key = 5; e.check = 0;
+   TEST( vul_concurrent_skip_list_insert( list, t, &e ) );
+   TEST( !vul_concurrent_skip_list_insert( list, t, &e ) );
+   TEST( vul_concurrent_skip_list_find( list, t, &e, NULL ) );
+   TEST( vul_concurrent_skip_list_size( list ) == 1 );
+   TEST( vul_concurrent_skip_list_remove( list, t, &e, NULL ) );
+   TEST( !vul_concurrent_skip_list_remove( list, t, &e, NULL ) );
+   TEST( !vul_concurrent_skip_list_find( list, t, &e, NULL ) );
+   TEST( vul_concurrent_skip_list_size( list ) == 0 );
+   vul_concurrent_skip_list_thread_unregister( list, t );
+
+   // Disjoint keys: every operation must succeed
+   vul_test_cskip_run( list, jobs, vul_test_cskip_disjoint );
+   TEST( vul_concurrent_skip_list_size( list ) == VUL_TEST_CSKIP_THREADS * VUL_TEST_CSKIP_DISJOINT / 2 );
+   t = vul_concurrent_skip_list_thread_register( list, 43 );
+   for( i = 0; i < VUL_TEST_CSKIP_THREADS * VUL_TEST_CSKIP_DISJOINT; ++i ) {
+      e.key = i;
+      TEST( vul_concurrent_skip_list_find( list, t, &e, NULL ) == ( ( i / VUL_TEST_CSKIP_THREADS ) & 1 ) );
+   }
+   vul_concurrent_skip_list_thread_unregister( list, t );
+   vul_concurrent_skip_list_destroy( list );
+
+   // Contended keys: the successful operations must add up to the final contents
+   list = vul_concurrent_skip_list_create( sizeof( vul_test_cskip_element ), vul_test_cskip_compare, malloc, free );
+   vul_test_cskip_run( list, jobs, vul_test_cskip_contended );
+   t = vul_concurrent_skip_list_thread_register( list, 44 );
+   size = 0;
+   for( i = 0; i < VUL_TEST_CSKIP_KEYS; ++i ) {
+      net = 0;
+      for( j = 0; j < VUL_TEST_CSKIP_THREADS; ++j ) {
+         net += jobs[ j ].net[ i ];
+      }
+      TEST( net == 0 || net == 1 );
+      e.key = i;
+      TEST( vul_concurrent_skip_list_find( list, t, &e, NULL ) == ( uint32_t )net );
+      size += ( uint32_t )net;
+   }
+   TEST( vul_concurrent_skip_list_size( list ) == size );
+   vul_concurrent_skip_list_thread_unregister( list, t );
+   vul_concurrent_skip_list_destroy( list );
+
+   return 0;
+}
+#endif
@@ -0,0 +1,793 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_sort.h
+ * Compile with the OS define (VUL_LINUX etc.) and link with pthreads to also test
+ * the multithreaded and external sorts. The latter writes files to the working directory. Define VUL_TEST_BENCHMARK as well to time the typed and
+ * radix sorts against the comparator based ones; build with optimizations for that.
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_SORT_H
+#define VUL_TEST_SORT_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+#define VUL_DEFINE
+#if defined( VUL_LINUX ) || defined( VUL_WINDOWS ) || defined( VUL_OSX )
+#include "../vul_thread.h"
+#include "../vul_file.h"
+#endif
+#include "../vul_resizable_array.h"
+#include "../vul_sort.h"
+#ifdef VUL_TEST_BENCHMARK
+#include "../vul_timer.h"
+#endif
+
+#define VUL_TEST_SORT_COUNT 20000
+
+typedef struct vul_test_sort_record {
+   uint32_t key;
+   uint32_t order; // Position before sorting, to check stability
+} vul_test_sort_record;
+
+#define vul_test_sort_record_less( a, b ) ( ( a ).key < ( b ).key )
+VUL_SORT_DEFINE_TYPED( vul_test_sort_records, vul_test_sort_record, vul_test_sort_record_less )
+
+static uint32_t vul_test_sort_rng = 0x9e3779b9u;
+
+uint32_t vul_test_sort_random( )
+{
+   vul_test_sort_rng ^= vul_test_sort_rng << 13;
+   vul_test_sort_rng ^= vul_test_sort_rng >> 17;
+   vul_test_sort_rng ^= vul_test_sort_rng << 5;
+   return vul_test_sort_rng;
+}
+
+// Fills with one of: random, sorted, reversed, few distinct, organ pipe
+void vul_test_sort_fill_u32( uint32_t *a, uint32_t n, uint32_t pattern )
+{
+   uint32_t i;
+
+   for( i = 0; i < n; ++i ) {
+      switch( pattern ) {
+      case 0: a[ i ] = vul_test_sort_random( ); break;
+      case 1: a[ i ] = i; break;
+      case 2: a[ i ] = n - i; break;
+      case 3: a[ i ] = vul_test_sort_random( ) % 4; break;
+      default: a[ i ] = i < n / 2 ? i : n - i; break;
+      }
+   }
+}
+
+void vul_test_sort_primitives( )
+{
+   uint32_t *u, i, n, p;
+   int32_t *s;
+   uint64_t *l;
+   float *f;
+   double *d;
+   uint32_t sizes[ ] = { 0, 1, 2, 3, 17, 100, 1000, VUL_TEST_SORT_COUNT };
+   uint64_t usum, csum;
+
+   u = ( uint32_t* )malloc( sizeof( uint32_t ) * VUL_TEST_SORT_COUNT );
+   s = ( int32_t* )malloc( sizeof( int32_t ) * VUL_TEST_SORT_COUNT );
+   l = ( uint64_t* )malloc( sizeof( uint64_t ) * VUL_TEST_SORT_COUNT );
+   f = ( float* )malloc( sizeof( float ) * VUL_TEST_SORT_COUNT );
+   d = ( double* )malloc( sizeof( double ) * VUL_TEST_SORT_COUNT );
+
+   for( p = 0; p < 5; ++p ) {
+      for( n = 0; n < sizeof( sizes ) / sizeof( sizes[ 0 ] ); ++n ) {
+         vul_test_sort_fill_u32( u, sizes[ n ], p );
+         usum = 0;
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            usum += u[ i ];
+            s[ i ] = ( int32_t )u[ i ];
+            l[ i ] = ( ( uint64_t )u[ i ] << 32 ) | ( u[ i ] ^ 0xffffu );
+            f[ i ] = ( float )( int32_t )u[ i ] * 0.25f;
+            d[ i ] = ( double )( int32_t )u[ i ] * -0.5;
+         }
+         vul_sort_u32( u, sizes[ n ] );
+         vul_sort_s32( s, sizes[ n ] );
+         vul_sort_u64( l, sizes[ n ] );
+         vul_sort_f32( f, sizes[ n ] );
+         vul_sort_f64( d, sizes[ n ] );
+         csum = 0;
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            csum += u[ i ];
+         }
+         TEST( csum == usum ); // Still the same elements
+         for( i = 1; i < sizes[ n ]; ++i ) {
+            TEST( u[ i - 1 ] <= u[ i ] );
+            TEST( s[ i - 1 ] <= s[ i ] );
+            TEST( l[ i - 1 ] <= l[ i ] );
+            TEST( f[ i - 1 ] <= f[ i ] );
+            TEST( d[ i - 1 ] <= d[ i ] );
+         }
+      }
+   }
+
+   free( u );
+   free( s );
+   free( l );
+   free( f );
+   free( d );
+}
+
+void vul_test_sort_small( )
+{
+   uint32_t u[ 130 ], i, n, r;
+   int32_t s[ 130 ];
+   float f[ 130 ];
+   uint64_t usum, ssum;
+
+   // Every size around the sorting network's register counts, with the pad values as keys
+   for( n = 0; n < 130; ++n ) {
+      for( r = 0; r < 4; ++r ) {
+         for( i = 0; i < n; ++i ) {
+            u[ i ] = vul_test_sort_random( ) % ( r == 0 ? 0xffffffffu : 8 );
+            if( u[ i ] % 7 == 1 ) {
+               u[ i ] = 0xffffffffu;
+            }
+            s[ i ] = u[ i ] % 5 == 2 ? 0x7fffffff : ( int32_t )u[ i ];
+            f[ i ] = u[ i ] % 5 == 3 ? 1.f / 0.f : ( float )s[ i ] * -0.5f;
+         }
+         usum = ssum = 0;
+         for( i = 0; i < n; ++i ) {
+            usum += u[ i ];
+            ssum += ( uint64_t )( int64_t )s[ i ];
+         }
+         vul_sort_u32( u, n );
+         vul_sort_s32( s, n );
+         vul_sort_f32( f, n );
+         for( i = 0; i < n; ++i ) {
+            usum -= u[ i ];
+            ssum -= ( uint64_t )( int64_t )s[ i ];
+         }
+         TEST( usum == 0 && ssum == 0 ); // No key replaced by padding
+         for( i = 1; i < n; ++i ) {
+            TEST( u[ i - 1 ] <= u[ i ] );
+            TEST( s[ i - 1 ] <= s[ i ] );
+            TEST( f[ i - 1 ] <= f[ i ] );
+         }
+      }
+   }
+
+   // -0 and +0 compare equal, but both must survive the sort (float min/max would pick one)
+   for( n = 0; n < 130; ++n ) {
+      for( i = 0; i < n; ++i ) {
+         f[ i ] = ( i * 7 ) % 64 < 34 ? -0.f : ( i % 3 ? 0.f : -1.f );
+      }
+      usum = 0;
+      for( i = 0; i < n; ++i ) {
+         usum += signbit( f[ i ] ) && f[ i ] == 0.f;
+      }
+      vul_sort_f32( f, n );
+      for( i = 0; i < n; ++i ) {
+         usum -= signbit( f[ i ] ) && f[ i ] == 0.f;
+      }
+      TEST( usum == 0 );
+      for( i = 1; i < n; ++i ) {
+         TEST( f[ i - 1 ] <= f[ i ] );
+      }
+   }
+}
+
+void vul_test_sort_stable( )
+{
+   vul_test_sort_record *r, *tmp;
+   uint32_t i, n, p;
+   uint32_t sizes[ ] = { 0, 1, 31, 32, 33, 1000, VUL_TEST_SORT_COUNT };
+
+   r = ( vul_test_sort_record* )malloc( sizeof( vul_test_sort_record ) * VUL_TEST_SORT_COUNT );
+   tmp = ( vul_test_sort_record* )malloc( sizeof( vul_test_sort_record ) * VUL_TEST_SORT_COUNT );
+
+   for( p = 0; p < 5; ++p ) {
+      for( n = 0; n < sizeof( sizes ) / sizeof( sizes[ 0 ] ); ++n ) {
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            r[ i ].key = p == 0 ? vul_test_sort_random( ) % 64 : vul_test_sort_random( ) % ( p * 3 );
+            r[ i ].order = i;
+         }
+         vul_test_sort_records_stable( r, sizes[ n ], ( n & 1 ) ? tmp : NULL );
+         for( i = 1; i < sizes[ n ]; ++i ) {
+            TEST( r[ i - 1 ].key <= r[ i ].key );
+            if( r[ i - 1 ].key == r[ i ].key ) {
+               TEST( r[ i - 1 ].order < r[ i ].order );
+            }
+         }
+
+         // The unstable version only needs to order the keys
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            r[ i ].key = vul_test_sort_random( ) % 16;
+         }
+         vul_test_sort_records( r, sizes[ n ] );
+         for( i = 1; i < sizes[ n ]; ++i ) {
+            TEST( r[ i - 1 ].key <= r[ i ].key );
+         }
+      }
+   }
+
+   free( r );
+   free( tmp );
+}
+
+void vul_test_sort_vector( )
+{
+   vul_vector *vec;
+   float *f;
+   uint32_t i;
+
+   // Typed sorts work directly on a vector's storage
+   vec = vul_vector_create( sizeof( float ), 0, malloc, free, realloc );
+   for( i = 0; i < 1000; ++i ) {
+      f = ( float* )vul_vector_add_empty( vec );
+      *f = ( float )( vul_test_sort_random( ) % 1000 ) - 500.f;
+   }
+   vul_sort_f32( ( float* )vul_vector_begin( vec ), vul_vector_size( vec ) );
+   for( i = 1; i < vul_vector_size( vec ); ++i ) {
+      TEST( *( float* )vul_vector_get( vec, i - 1 ) <= *( float* )vul_vector_get( vec, i ) );
+   }
+   vul_vector_destroy( vec );
+}
+
+uint64_t vul_test_sort_record_key( const void *element )
+{
+   return ( ( const vul_test_sort_record* )element )->key;
+}
+
+uint64_t vul_test_sort_record_wide_key( const void *element )
+{
+   // Spreads the key over the high and low bytes, so every level of the MSD sort is used
+   uint64_t k = ( ( const vul_test_sort_record* )element )->key;
+   return ( k << 40 ) | ( k & 0xff );
+}
+
+void vul_test_sort_radix( )
+{
+   uint32_t *u, *uc, *ut, i, n, p;
+   int32_t *s, *sc;
+   uint64_t *l, *lc;
+   float *f, *fc;
+   double *d, *dc;
+   vul_test_sort_record *r;
+   void *tmp;
+   uint32_t sizes[ ] = { 0, 1, 2, 64, 65, 1000, VUL_TEST_SORT_COUNT };
+   float specials[ ] = { -0.f, 0.f, -1e30f, 1e30f, 1e-40f, -1e-40f };
+
+   u = ( uint32_t* )malloc( sizeof( uint32_t ) * VUL_TEST_SORT_COUNT );
+   uc = ( uint32_t* )malloc( sizeof( uint32_t ) * VUL_TEST_SORT_COUNT );
+   ut = ( uint32_t* )malloc( sizeof( uint32_t ) * VUL_TEST_SORT_COUNT );
+   s = ( int32_t* )malloc( sizeof( int32_t ) * VUL_TEST_SORT_COUNT );
+   sc = ( int32_t* )malloc( sizeof( int32_t ) * VUL_TEST_SORT_COUNT );
+   l = ( uint64_t* )malloc( sizeof( uint64_t ) * VUL_TEST_SORT_COUNT );
+   lc = ( uint64_t* )malloc( sizeof( uint64_t ) * VUL_TEST_SORT_COUNT );
+   f = ( float* )malloc( sizeof( float ) * VUL_TEST_SORT_COUNT );
+   fc = ( float* )malloc( sizeof( float ) * VUL_TEST_SORT_COUNT );
+   d = ( double* )malloc( sizeof( double ) * VUL_TEST_SORT_COUNT );
+   dc = ( double* )malloc( sizeof( double ) * VUL_TEST_SORT_COUNT );
+   r = ( vul_test_sort_record* )malloc( sizeof( vul_test_sort_record ) * VUL_TEST_SORT_COUNT );
+   tmp = malloc( sizeof( uint64_t ) * VUL_TEST_SORT_COUNT );
+
+   // The float key must order like the floats themselves, and round trip
+   for( i = 0; i < sizeof( specials ) / sizeof( specials[ 0 ] ); ++i ) {
+      TEST( vul_sort_f32_from_key( vul_sort_f32_key( specials[ i ] ) ) == specials[ i ] );
+      TEST( vul_sort_f64_from_key( vul_sort_f64_key( ( double )specials[ i ] ) ) == ( double )specials[ i ] );
+   }
+   TEST( vul_sort_f32_key( -1e30f ) < vul_sort_f32_key( -1e-40f ) );
+   TEST( vul_sort_f32_key( -1e-40f ) < vul_sort_f32_key( 0.f ) );
+   TEST( vul_sort_f32_key( 0.f ) < vul_sort_f32_key( 1e-40f ) );
+   TEST( vul_sort_f64_key( -2.0 ) < vul_sort_f64_key( -1.0 ) );
+   TEST( vul_sort_f64_key( 1.0 ) < vul_sort_f64_key( 2.0 ) );
+
+   // Check every radix sort against the typed comparison sort
+   for( p = 0; p < 5; ++p ) {
+      for( n = 0; n < sizeof( sizes ) / sizeof( sizes[ 0 ] ); ++n ) {
+         vul_test_sort_fill_u32( u, sizes[ n ], p );
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            s[ i ] = ( int32_t )u[ i ];
+            l[ i ] = ( ( uint64_t )u[ i ] << ( p * 7 ) ) ^ vul_test_sort_random( );
+            f[ i ] = ( float )( int32_t )u[ i ] * 1e-3f;
+            d[ i ] = ( double )( int32_t )u[ i ] * -1e3;
+         }
+         memcpy( uc, u, sizeof( uint32_t ) * sizes[ n ] );
+         memcpy( sc, s, sizeof( int32_t ) * sizes[ n ] );
+         memcpy( lc, l, sizeof( uint64_t ) * sizes[ n ] );
+         memcpy( fc, f, sizeof( float ) * sizes[ n ] );
+         memcpy( dc, d, sizeof( double ) * sizes[ n ] );
+         vul_sort_u32( uc, sizes[ n ] );
+         vul_sort_s32( sc, sizes[ n ] );
+         vul_sort_u64( lc, sizes[ n ] );
+         vul_sort_f32( fc, sizes[ n ] );
+         vul_sort_f64( dc, sizes[ n ] );
+
+         memcpy( ut, u, sizeof( uint32_t ) * sizes[ n ] );
+         vul_sort_radix_u32( ut, sizes[ n ], ( n & 1 ) ? ( uint32_t* )tmp : NULL );
+         TEST( memcmp( ut, uc, sizeof( uint32_t ) * sizes[ n ] ) == 0 );
+         vul_sort_radix_inplace_u32( u, sizes[ n ] );
+         TEST( memcmp( u, uc, sizeof( uint32_t ) * sizes[ n ] ) == 0 );
+         vul_sort_radix_s32( s, sizes[ n ], NULL );
+         TEST( memcmp( s, sc, sizeof( int32_t ) * sizes[ n ] ) == 0 );
+         vul_sort_radix_f32( f, sizes[ n ], ( float* )tmp );
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            TEST( f[ i ] == fc[ i ] );
+         }
+         vul_sort_radix_f64( d, sizes[ n ], NULL );
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            TEST( d[ i ] == dc[ i ] );
+         }
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            l[ i ] = lc[ sizes[ n ] - 1 - i ];
+         }
+         vul_sort_radix_inplace_u64( l, sizes[ n ] );
+         TEST( memcmp( l, lc, sizeof( uint64_t ) * sizes[ n ] ) == 0 );
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            l[ i ] = lc[ ( i * 7919u ) % sizes[ n ] ];
+         }
+         vul_sort_radix_u64( l, sizes[ n ], ( n & 1 ) ? ( uint64_t* )tmp : NULL );
+         for( i = 1; i < sizes[ n ]; ++i ) {
+            TEST( l[ i - 1 ] <= l[ i ] );
+         }
+         vul_sort_radix_inplace_f32( fc, sizes[ n ] );
+         for( i = 1; i < sizes[ n ]; ++i ) {
+            TEST( fc[ i - 1 ] <= fc[ i ] );
+         }
+
+         // Records: LSD is stable, MSD only has to order the keys
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            r[ i ].key = vul_test_sort_random( ) % ( p == 0 ? 100000 : 50 );
+            r[ i ].order = i;
+         }
+         vul_sort_radix_records( r, sizes[ n ], sizeof( vul_test_sort_record ), vul_test_sort_record_key, ( n & 1 ) ? tmp : NULL );
+         for( i = 1; i < sizes[ n ]; ++i ) {
+            TEST( r[ i - 1 ].key <= r[ i ].key );
+            if( r[ i - 1 ].key == r[ i ].key ) {
+               TEST( r[ i - 1 ].order < r[ i ].order );
+            }
+         }
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            r[ i ].key = vul_test_sort_random( ) % ( p == 0 ? 100000 : 50 );
+            r[ i ].order = r[ i ].key ^ 0x5555u;
+         }
+         vul_sort_radix_inplace_records( r, sizes[ n ], sizeof( vul_test_sort_record ), p & 1 ? vul_test_sort_record_wide_key : vul_test_sort_record_key );
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            TEST( r[ i ].order == ( r[ i ].key ^ 0x5555u ) ); // Records moved whole
+            if( i > 0 ) {
+               TEST( r[ i - 1 ].key <= r[ i ].key );
+            }
+         }
+      }
+   }
+
+   free( u );
+   free( uc );
+   free( ut );
+   free( s );
+   free( sc );
+   free( l );
+   free( lc );
+   free( f );
+   free( fc );
+   free( d );
+   free( dc );
+   free( r );
+   free( tmp );
+}
+
+int32_t vul_test_sort_compare_record( const void *a, const void *b )
+{
+   uint32_t ka, kb;
+
+   ka = ( ( const vul_test_sort_record* )a )->key;
+   kb = ( ( const vul_test_sort_record* )b )->key;
+   return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+void vul_test_sort_check_stable( vul_vector *vec )
+{
+   vul_test_sort_record *r;
+   uint32_t i;
+
+   r = ( vul_test_sort_record* )vul_vector_begin( vec );
+   for( i = 1; i < vul_vector_size( vec ); ++i ) {
+      TEST( r[ i - 1 ].key <= r[ i ].key );
+      if( r[ i - 1 ].key == r[ i ].key ) {
+         TEST( r[ i - 1 ].order < r[ i ].order );
+      }
+   }
+}
+
+void vul_test_sort_merge( )
+{
+   vul_vector *vec;
+   vul_test_sort_record *r;
+   uint32_t i, n, t;
+   uint32_t sizes[ ] = { 0, 1, 33, 4095, 4096 * 3 + 17, 100000 };
+#if defined( VUL_LINUX ) || defined( VUL_WINDOWS ) || defined( VUL_OSX )
+   vul_task_pool *pools[ 5 ];
+   uint32_t workers[ ] = { 0, 1, 2, 3, 6 };
+
+   // No pool sorts on the calling thread; the others have 2, 3, 4 and 7 threads
+   pools[ 0 ] = NULL;
+   for( t = 1; t < 5; ++t ) {
+      pools[ t ] = vul_task_pool_create( workers[ t ], malloc, free );
+   }
+#endif
+
+   vec = vul_vector_create( sizeof( vul_test_sort_record ), 0, malloc, free, realloc );
+   for( n = 0; n < sizeof( sizes ) / sizeof( sizes[ 0 ] ); ++n ) {
+      for( t = 0; t < 5; ++t ) {
+         vul_vector_resize( vec, sizes[ n ], VUL_FALSE, VUL_FALSE );
+         r = ( vul_test_sort_record* )vul_vector_begin( vec );
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            // Some runs are presorted, so the merges see unbalanced split points
+            r[ i ].key = ( t & 1 ) ? vul_test_sort_random( ) % 100 : ( i < sizes[ n ] / 2 ? i : vul_test_sort_random( ) % 1000 );
+            r[ i ].order = i;
+         }
+#if defined( VUL_LINUX ) || defined( VUL_WINDOWS ) || defined( VUL_OSX )
+         vul_sort_vector_parallel( vec, vul_test_sort_compare_record, pools[ t ] );
+#else
+         vul_sort_vector_merge( vec, vul_test_sort_compare_record );
+#endif
+         TEST( vul_vector_size( vec ) == sizes[ n ] );
+         vul_test_sort_check_stable( vec );
+      }
+   }
+   vul_vector_destroy( vec );
+#if defined( VUL_LINUX ) || defined( VUL_WINDOWS ) || defined( VUL_OSX )
+   for( t = 1; t < 5; ++t ) {
+      vul_task_pool_destroy( pools[ t ] );
+   }
+#endif
+}
+
+/**
+ * Fills vec with n records with keys below range.
+ */
+void vul_test_sort_fill_records( vul_vector *vec, uint32_t n, uint32_t range )
+{
+   vul_test_sort_record *r;
+   uint32_t i;
+
+   vul_vector_resize( vec, n, VUL_FALSE, VUL_FALSE );
+   r = ( vul_test_sort_record* )vul_vector_begin( vec );
+   for( i = 0; i < n; ++i ) {
+      r[ i ].key = vul_test_sort_random( ) % range;
+      r[ i ].order = i;
+   }
+}
+
+void vul_test_sort_arena( )
+{
+   vul_vector_arena arena;
+   vul_vector *vec;
+   vul_test_sort_record *r;
+#ifdef VUL_THREAD_H
+   vul_task_pool *pool;
+#endif
+   void *memory;
+   size_t used;
+   uint32_t i;
+
+   // Vector sorts take their scratch memory from the arena, and hand it back
+   memory = malloc( 1 << 20 );
+   vul_vector_arena_initialize( &arena, memory, 1 << 20 );
+   vec = vul_vector_create_arena( sizeof( vul_test_sort_record ), 0, &arena );
+   vul_test_sort_fill_records( vec, 60, 10 );
+   used = arena.used;
+   vul_sort_vector_thynn( vec, vul_test_sort_compare_record, 0, 59 );
+   vul_test_sort_check_stable( vec );
+   TEST( arena.used == used );
+
+   vul_test_sort_fill_records( vec, 5000, 100 );
+   used = arena.used;
+   vul_sort_vector_merge( vec, vul_test_sort_compare_record );
+   vul_test_sort_check_stable( vec );
+   TEST( arena.used == used );
+   vul_test_sort_fill_records( vec, 5000, 100 );
+   used = arena.used;
+   vul_sort_vector_nth_element( vec, vul_test_sort_compare_record, 2500 );
+   TEST( arena.used == used );
+   vul_sort_vector_partial( vec, vul_test_sort_compare_record, 100 );
+   r = ( vul_test_sort_record* )vul_vector_begin( vec );
+   for( i = 1; i < 100; ++i ) {
+      TEST( r[ i - 1 ].key <= r[ i ].key );
+   }
+   for( i = 100; i < 5000; ++i ) {
+      TEST( r[ 99 ].key <= r[ i ].key );
+   }
+   TEST( arena.used == used );
+#ifdef VUL_THREAD_H
+   pool = vul_task_pool_create( 3, malloc, free );
+   vul_test_sort_fill_records( vec, 4 * VUL_SORT_PARALLEL_MIN_CHUNK, 100 );
+   used = arena.used;
+   vul_sort_vector_parallel( vec, vul_test_sort_compare_record, pool );
+   vul_test_sort_check_stable( vec );
+   TEST( arena.used == used );
+   vul_task_pool_destroy( pool );
+#endif
+
+   vul_vector_destroy( vec );
+   free( memory );
+}
+
+void vul_test_sort_select( )
+{
+   vul_vector *vec;
+   vul_sort_top_k *top;
+   vul_test_sort_record *r, e, *out;
+   uint32_t *a, *ref, i, n, p, k, ki, kept;
+   uint32_t sizes[ ] = { 0, 1, 2, 17, 100, 5000 };
+
+   a = ( uint32_t* )malloc( sizeof( uint32_t ) * 5000 );
+   ref = ( uint32_t* )malloc( sizeof( uint32_t ) * 5000 );
+   for( n = 0; n < sizeof( sizes ) / sizeof( sizes[ 0 ] ); ++n ) {
+      for( p = 0; p < 5; ++p ) {
+         for( ki = 0; ki < 4; ++ki ) {
+            k = ki == 0 ? 0 : ki == 1 ? sizes[ n ] / 2 : ki == 2 ? sizes[ n ] - 1 : sizes[ n ] / 7;
+            if( k >= sizes[ n ] ) {
+               continue;
+            }
+            vul_test_sort_fill_u32( ref, sizes[ n ], p );
+            memcpy( a, ref, sizeof( uint32_t ) * sizes[ n ] );
+            vul_sort_u32( ref, sizes[ n ] );
+
+            vul_sort_nth_u32( a, sizes[ n ], k );
+            TEST( a[ k ] == ref[ k ] );
+            for( i = 0; i < sizes[ n ]; ++i ) {
+               TEST( i < k ? a[ i ] <= a[ k ] : a[ i ] >= a[ k ] );
+            }
+            vul_sort_partial_u32( a, sizes[ n ], k + 1 );
+            TEST( memcmp( a, ref, sizeof( uint32_t ) * ( k + 1 ) ) == 0 );
+         }
+      }
+   }
+   free( a );
+
+   // Typed instantiation and vector versions on records
+   vec = vul_vector_create( sizeof( vul_test_sort_record ), 0, malloc, free, realloc );
+   vul_vector_resize( vec, VUL_TEST_SORT_COUNT, VUL_FALSE, VUL_FALSE );
+   r = ( vul_test_sort_record* )vul_vector_begin( vec );
+   for( ki = 0; ki < 3; ++ki ) {
+      k = ki == 0 ? 0 : ki == 1 ? 100 : VUL_TEST_SORT_COUNT - 1;
+      for( i = 0; i < VUL_TEST_SORT_COUNT; ++i ) {
+         r[ i ].key = vul_test_sort_random( ) % 1000;
+         r[ i ].order = i;
+      }
+      vul_test_sort_records_nth( r, VUL_TEST_SORT_COUNT, k );
+      for( i = 0; i < VUL_TEST_SORT_COUNT; ++i ) {
+         TEST( i < k ? r[ i ].key <= r[ k ].key : r[ i ].key >= r[ k ].key );
+      }
+      vul_test_sort_records_partial( r, VUL_TEST_SORT_COUNT, k + 1 );
+      for( i = 1; i <= k; ++i ) {
+         TEST( r[ i - 1 ].key <= r[ i ].key );
+      }
+
+      for( i = 0; i < VUL_TEST_SORT_COUNT; ++i ) {
+         r[ i ].key = vul_test_sort_random( ) % 1000;
+      }
+      vul_sort_vector_nth_element( vec, vul_test_sort_compare_record, k );
+      for( i = 0; i < VUL_TEST_SORT_COUNT; ++i ) {
+         TEST( i < k ? r[ i ].key <= r[ k ].key : r[ i ].key >= r[ k ].key );
+      }
+      e = r[ k ];
+      vul_sort_vector_partial( vec, vul_test_sort_compare_record, k + 1 );
+      TEST( r[ k ].key == e.key );
+      for( i = 1; i < VUL_TEST_SORT_COUNT; ++i ) {
+         TEST( i <= k ? r[ i - 1 ].key <= r[ i ].key : r[ i ].key >= r[ k ].key );
+      }
+   }
+
+   // Streaming top-k against a full sort of the same stream
+   out = ( vul_test_sort_record* )malloc( sizeof( vul_test_sort_record ) * 64 );
+   for( ki = 0; ki < 3; ++ki ) {
+      k = ki == 0 ? 1 : ki == 1 ? 10 : 64;
+      n = ki == 2 ? 40 : 5000; // Fewer elements than k in the last case
+      top = vul_sort_top_k_create( sizeof( vul_test_sort_record ), k, vul_test_sort_compare_record, malloc, free );
+      for( i = 0; i < n; ++i ) {
+         e.key = ref[ i ] = vul_test_sort_random( ) % 3000;
+         e.order = i;
+         kept = vul_sort_top_k_push( top, &e );
+         TEST( i >= k || kept );
+      }
+      vul_sort_u32( ref, n );
+      TEST( vul_sort_top_k_count( top ) == ( n < k ? n : k ) );
+      vul_sort_top_k_extract( top, out );
+      for( i = 0; i < vul_sort_top_k_count( top ); ++i ) {
+         TEST( out[ i ].key == ref[ i ] );
+      }
+      // Extracting leaves the heap intact
+      e.key = 0;
+      TEST( vul_sort_top_k_push( top, &e ) == ( ref[ n < k ? n - 1 : k - 1 ] > 0 || n < k ) );
+      vul_sort_top_k_reset( top );
+      TEST( vul_sort_top_k_count( top ) == 0 );
+      vul_sort_top_k_destroy( top );
+   }
+   free( out );
+   free( ref );
+   vul_vector_destroy( vec );
+}
+
+#if defined( VUL_LINUX ) || defined( VUL_WINDOWS ) || defined( VUL_OSX )
+uint32_t vul_test_sort_file_check( const char *path, uint32_t count )
+{
+   vul_test_sort_record *r;
+   vul_vector *vec;
+   FILE *f;
+   uint32_t read;
+
+   f = fopen( path, "rb" );
+   TEST( f != NULL );
+   vec = vul_vector_create( sizeof( vul_test_sort_record ), 0, malloc, free, realloc );
+   vul_vector_resize( vec, count + 1, VUL_FALSE, VUL_FALSE );
+   r = ( vul_test_sort_record* )vul_vector_begin( vec );
+   read = ( uint32_t )fread( r, sizeof( vul_test_sort_record ), count + 1, f );
+   fclose( f );
+   vul_vector_resize( vec, read, VUL_FALSE, VUL_FALSE );
+   vul_test_sort_check_stable( vec );
+   vul_vector_destroy( vec );
+   return read;
+}
+
+void vul_test_sort_file( )
+{
+   const char *in = "vul_test_sort_in.bin", *out = "vul_test_sort_out.bin";
+   vul_test_sort_record r;
+   char *long_out;
+   FILE *f;
+   uint32_t i, n;
+
+   n = 100000;
+   f = fopen( in, "wb" );
+   TEST( f != NULL );
+   for( i = 0; i < n; ++i ) {
+      r.key = vul_test_sort_random( ) % 1000;
+      r.order = i;
+      fwrite( &r, sizeof( r ), 1, f );
+   }
+   fclose( f );
+
+   // 64kB gives 25 runs, and windows that don't line up with the map alignment
+   TEST( vul_sort_file( in, out, sizeof( vul_test_sort_record ), vul_test_sort_compare_record, 65536, malloc, free ) );
+   TEST( vul_test_sort_file_check( out, n ) == n );
+   TEST( !vul_file_exists( "vul_test_sort_out.bin.run0" ) );
+   // Fits in a single run
+   TEST( vul_sort_file( in, out, sizeof( vul_test_sort_record ), vul_test_sort_compare_record, 1 << 24, malloc, free ) );
+   TEST( vul_test_sort_file_check( out, n ) == n );
+   // A length that isn't a whole number of records, and a missing input
+   TEST( !vul_sort_file( in, out, 3, vul_test_sort_compare_record, 65536, malloc, free ) );
+   TEST( !vul_sort_file( "vul_test_sort_missing.bin", out, 8, vul_test_sort_compare_record, 65536, malloc, free ) );
+   // Paths longer than any fixed buffer, here with 1200 characters of "./" in front
+   long_out = ( char* )malloc( 1200 + strlen( out ) + 1 );
+   for( i = 0; i < 600; ++i ) {
+      memcpy( long_out + i * 2, "./", 2 );
+   }
+   strcpy( long_out + 1200, out );
+   TEST( vul_sort_file( in, long_out, sizeof( vul_test_sort_record ), vul_test_sort_compare_record, 65536, malloc, free ) );
+   TEST( vul_test_sort_file_check( out, n ) == n );
+   TEST( !vul_file_exists( "vul_test_sort_out.bin.run0" ) );
+   free( long_out );
+
+   remove( in );
+   remove( out );
+}
+#endif
+
+#ifdef VUL_TEST_BENCHMARK
+int32_t vul_test_sort_compare_f32( const void *a, const void *b )
+{
+   float fa = *( const float* )a, fb = *( const float* )b;
+   return fa < fb ? -1 : fa > fb ? 1 : 0;
+}
+
+void vul_test_sort_benchmark( )
+{
+   vul_vector *vec;
+   vul_timer *clk;
+   vul_task_pool *pool;
+   float *src;
+   uint32_t i, n;
+   uint64_t t_quick, t_typed, t_radix, t_inplace, t_merge, t_parallel;
+
+   n = 1000000;
+   src = ( float* )malloc( sizeof( float ) * n );
+   for( i = 0; i < n; ++i ) {
+      src[ i ] = ( float )vul_test_sort_random( ) / 4294967296.f;
+   }
+   vec = vul_vector_create( sizeof( float ), 0, malloc, free, realloc );
+   vul_vector_resize( vec, n, VUL_FALSE, VUL_TRUE );
+   clk = vul_timer_create( );
+
+   memcpy( vul_vector_begin( vec ), src, sizeof( float ) * n );
+   vul_timer_reset( clk );
+   vul_sort_vector_quick( vec, vul_test_sort_compare_f32, 0, n - 1 );
+   t_quick = vul_timer_get_micros( clk );
+
+   memcpy( vul_vector_begin( vec ), src, sizeof( float ) * n );
+   vul_timer_reset( clk );
+   vul_sort_f32( ( float* )vul_vector_begin( vec ), n );
+   t_typed = vul_timer_get_micros( clk );
+   for( i = 1; i < n; ++i ) {
+      TEST( *( float* )vul_vector_get( vec, i - 1 ) <= *( float* )vul_vector_get( vec, i ) );
+   }
+
+   memcpy( vul_vector_begin( vec ), src, sizeof( float ) * n );
+   vul_timer_reset( clk );
+   vul_sort_radix_f32( ( float* )vul_vector_begin( vec ), n, NULL );
+   t_radix = vul_timer_get_micros( clk );
+
+   memcpy( vul_vector_begin( vec ), src, sizeof( float ) * n );
+   vul_timer_reset( clk );
+   vul_sort_radix_inplace_f32( ( float* )vul_vector_begin( vec ), n );
+   t_inplace = vul_timer_get_micros( clk );
+
+   memcpy( vul_vector_begin( vec ), src, sizeof( float ) * n );
+   vul_timer_reset( clk );
+   vul_sort_vector_merge( vec, vul_test_sort_compare_f32 );
+   t_merge = vul_timer_get_micros( clk );
+
+   memcpy( vul_vector_begin( vec ), src, sizeof( float ) * n );
+   pool = vul_task_pool_create( 3, malloc, free );
+   vul_timer_reset( clk );
+   vul_sort_vector_parallel( vec, vul_test_sort_compare_f32, pool );
+   t_parallel = vul_timer_get_micros( clk );
+   vul_task_pool_destroy( pool );
+   for( i = 1; i < n; ++i ) {
+      TEST( *( float* )vul_vector_get( vec, i - 1 ) <= *( float* )vul_vector_get( vec, i ) );
+   }
+
+   printf( "Sorting %u floats: quick %llu us, typed %llu us, radix %llu us, in-place radix %llu us\n", n,
+           ( unsigned long long )t_quick, ( unsigned long long )t_typed,
+           ( unsigned long long )t_radix, ( unsigned long long )t_inplace );
+   printf( "Sorting %u floats: merge %llu us, parallel merge on 4 threads %llu us\n", n,
+           ( unsigned long long )t_merge, ( unsigned long long )t_parallel );
+
+   vul_timer_destroy( clk );
+   vul_vector_destroy( vec );
+   free( src );
+}
+#endif
+
+int main( )
+{
+   vul_test_sort_primitives( );
+   vul_test_sort_small( );
+   vul_test_sort_stable( );
+   vul_test_sort_vector( );
+   vul_test_sort_radix( );
+   vul_test_sort_merge( );
+   vul_test_sort_select( );
+   vul_test_sort_arena( );
+#if defined( VUL_LINUX ) || defined( VUL_WINDOWS ) || defined( VUL_OSX )
+   vul_test_sort_file( );
+#endif
+#ifdef VUL_TEST_BENCHMARK
+   vul_test_sort_benchmark( );
+#endif
+
+   return 0;
+}
+#endif
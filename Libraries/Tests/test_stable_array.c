@@ -0,0 +1,144 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_stable_array.h
+ * Compile with the OS define (VUL_LINUX etc.) and link with pthreads.
+ * 
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_STABLE_ARRAY_H
+#define VUL_TEST_STABLE_ARRAY_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+#define VUL_DEFINE
+#include "../vul_thread.h"
+#include "../vul_stable_array.h"
+
+#define VUL_TEST_SVECTOR_COUNT 5000
+
+typedef struct vul_test_svector_element {
+   uint32_t key;
+   float value;
+} vul_test_svector_element;
+
+void vul_test_svector_visit( void *data, uint32_t index, void *func_data )
+{
+   vul_test_svector_element *e;
+
+   e = ( vul_test_svector_element* )data;
+   TEST( e->key == index );
+   vul_atomic_add_u32( ( volatile uint32_t* )func_data + index, 1 );
+}
+
+int32_t vul_test_svector_compare( void *a, void *b )
+{
+   return ( ( vul_test_svector_element* )a )->value == ( ( vul_test_svector_element* )b )->value ? 0 : 1;
+}
+
+int main( )
+{
+   vul_svector *vec;
+   vul_svector_soa *soa;
+   vul_task_pool *pool, *pair;
+   vul_test_svector_element e, *found;
+   uint32_t *visits, i, bi, count, total, sizes[ 2 ];
+   float *values, sum, ref;
+
+   vec = vul_svector_create( sizeof( vul_test_svector_element ), 4, malloc, free );
+   for( i = 0; i < VUL_TEST_SVECTOR_COUNT; ++i ) {
+      e.key = i;
+      e.value = ( float )( i % 100 );
+      vul_svector_append( vec, &e );
+   }
+
+   // The buffers cover every element exactly once
+   total = 0;
+   for( bi = 0; bi < vec->buffer_count; ++bi ) {
+      found = ( vul_test_svector_element* )vul_svector_buffer( vec, bi, &count );
+      TEST( count == 0 || found[ 0 ].key == total );
+      total += count;
+   }
+   TEST( total == VUL_TEST_SVECTOR_COUNT );
+
+   // Parallel iteration visits everything once, with small chunks and with whole buffers
+   // on four threads, two threads and the calling thread alone
+   pool = vul_task_pool_create( 3, malloc, free );
+   pair = vul_task_pool_create( 1, malloc, free );
+   visits = ( uint32_t* )calloc( VUL_TEST_SVECTOR_COUNT, sizeof( uint32_t ) );
+   vul_svector_iterate_parallel( vec, vul_test_svector_visit, visits, pool, 7 );
+   vul_svector_iterate_parallel( vec, vul_test_svector_visit, visits, pair, 1 << 20 );
+   vul_svector_iterate_parallel( vec, vul_test_svector_visit, visits, NULL, 64 );
+   for( i = 0; i < VUL_TEST_SVECTOR_COUNT; ++i ) {
+      TEST( visits[ i ] == 3 );
+   }
+   free( visits );
+
+   // Parallel find returns the same (first) match as the sequential one
+   e.value = 42.f;
+   found = ( vul_test_svector_element* )vul_svector_find_parallel( vec, &e, vul_test_svector_compare, pool, 16 );
+   TEST( found != NULL && found == vul_svector_find( vec, &e, vul_test_svector_compare ) && found->key == 42 );
+   e.value = 0.5f;
+   TEST( vul_svector_find_parallel( vec, &e, vul_test_svector_compare, pair, 16 ) == NULL );
+   TEST( vul_svector_find( vec, &e, vul_test_svector_compare ) == NULL );
+   vul_svector_destroy( vec );
+
+   // Nothing to split
+   vec = vul_svector_create( sizeof( vul_test_svector_element ), 4, malloc, free );
+   vul_svector_iterate_parallel( vec, vul_test_svector_visit, NULL, pool, 7 );
+   TEST( vul_svector_find_parallel( vec, &e, vul_test_svector_compare, pool, 16 ) == NULL );
+   vul_svector_destroy( vec );
+   vul_task_pool_destroy( pair );
+   vul_task_pool_destroy( pool );
+
+   // Structure of arrays: scan one column buffer by buffer
+   sizes[ 0 ] = sizeof( uint32_t );
+   sizes[ 1 ] = sizeof( float );
+   soa = vul_svector_soa_create( 2, sizes, 8, malloc, free );
+   ref = 0.f;
+   for( i = 0; i < VUL_TEST_SVECTOR_COUNT; ++i ) {
+      TEST( vul_svector_soa_append_empty( soa ) == i );
+      *( uint32_t* )vul_svector_soa_get( soa, 0, i ) = i;
+      *( float* )vul_svector_soa_get( soa, 1, i ) = ( float )( i & 7 );
+      ref += ( float )( i & 7 );
+   }
+   vec = vul_svector_soa_column( soa, 1 );
+   sum = 0.f;
+   for( bi = 0; bi < vec->buffer_count; ++bi ) {
+      values = ( float* )vul_svector_buffer( vec, bi, &count );
+      for( i = 0; i < count; ++i ) {
+         sum += values[ i ];
+      }
+   }
+   TEST( sum == ref );
+   vul_svector_soa_remove_swap( soa, 3 );
+   TEST( vul_svector_soa_size( soa ) == VUL_TEST_SVECTOR_COUNT - 1 );
+   TEST( *( uint32_t* )vul_svector_soa_get( soa, 0, 3 ) == VUL_TEST_SVECTOR_COUNT - 1 );
+   TEST( *( float* )vul_svector_soa_get( soa, 1, 3 ) == ( float )( ( VUL_TEST_SVECTOR_COUNT - 1 ) & 7 ) );
+   vul_svector_soa_destroy( soa );
+
+   return 0;
+}
+#endif
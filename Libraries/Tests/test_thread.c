@@ -0,0 +1,681 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_thread.h
+ * Compile with the OS define (VUL_LINUX etc.) and link with pthreads.
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_THREAD_H
+#define VUL_TEST_THREAD_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+// Count reported errors instead of asserting, so failure paths can be tested
+static uint32_t vul_test_thread_errors = 0;
+#define VUL_THREAD_ERROR( str, ... ) ++vul_test_thread_errors
+
+#define VUL_DEFINE
+#include "../vul_thread.h"
+
+#define VUL_TEST_TASK_COUNT 10000
+#define VUL_TEST_TASK_FIB 18
+
+typedef struct vul_test_task_fib {
+   vul_task_pool *pool;
+   uint32_t n;
+   uint64_t result;
+} vul_test_task_fib;
+
+static vul_task_pool *vul_test_pool;
+static volatile uint32_t vul_test_task_counter;
+
+void vul_test_task_count( void *arg )
+{
+   vul_atomic_add_u32( &vul_test_task_counter, 1 );
+   ( void )arg;
+}
+
+// Recursive fork-join, with nested waits inside tasks
+void vul_test_task_fib_func( void *arg )
+{
+   vul_test_task_fib *f, a, b;
+   vul_task ta, tb;
+   vul_task_group group;
+
+   f = ( vul_test_task_fib* )arg;
+   if( f->n < 2 ) {
+      f->result = f->n;
+      return;
+   }
+   a.pool = b.pool = f->pool;
+   a.n = f->n - 1;
+   b.n = f->n - 2;
+   vul_task_group_initialize( &group );
+   vul_task_initialize( &ta, vul_test_task_fib_func, &a, &group );
+   vul_task_initialize( &tb, vul_test_task_fib_func, &b, &group );
+   vul_task_pool_submit( f->pool, &ta );
+   vul_task_pool_submit( f->pool, &tb );
+   vul_task_pool_wait( f->pool, &group );
+   f->result = a.result + b.result;
+}
+
+// Each stage checks that the stages it depends on have run
+typedef struct vul_test_task_stage {
+   volatile uint32_t *order;
+   uint32_t index;
+   uint32_t deps[ 2 ];
+   uint32_t dep_count;
+} vul_test_task_stage;
+
+void vul_test_task_stage_func( void *arg )
+{
+   vul_test_task_stage *s;
+   uint32_t i;
+
+   s = ( vul_test_task_stage* )arg;
+   for( i = 0; i < s->dep_count; ++i ) {
+      TEST( vul_atomic_load_u32( &s->order[ s->deps[ i ] ] ) );
+   }
+   vul_atomic_store_u32( &s->order[ s->index ], 1 );
+}
+
+void vul_test_task_independent( )
+{
+   vul_task *tasks;
+   vul_task_group group;
+   uint32_t i;
+
+   tasks = ( vul_task* )malloc( sizeof( vul_task ) * VUL_TEST_TASK_COUNT );
+   vul_test_task_counter = 0;
+   vul_task_group_initialize( &group );
+   for( i = 0; i < VUL_TEST_TASK_COUNT; ++i ) {
+      vul_task_initialize( &tasks[ i ], vul_test_task_count, NULL, &group );
+      vul_task_pool_submit( vul_test_pool, &tasks[ i ] );
+   }
+   vul_task_pool_wait( vul_test_pool, &group );
+   TEST( vul_test_task_counter == VUL_TEST_TASK_COUNT );
+   free( tasks );
+}
+
+void vul_test_task_nested( )
+{
+   vul_test_task_fib f;
+   vul_task t;
+   vul_task_group group;
+
+   f.pool = vul_test_pool;
+   f.n = VUL_TEST_TASK_FIB;
+   vul_task_group_initialize( &group );
+   vul_task_initialize( &t, vul_test_task_fib_func, &f, &group );
+   vul_task_pool_submit( vul_test_pool, &t );
+   vul_task_pool_wait( vul_test_pool, &group );
+   TEST( f.result == 2584 );
+}
+
+void vul_test_task_dependencies( )
+{
+   vul_task tasks[ 64 ];
+   vul_test_task_stage stages[ 64 ];
+   volatile uint32_t order[ 64 ];
+   vul_task_group group;
+   uint32_t i, j, r;
+
+   for( r = 0; r < 50; ++r ) {
+      vul_task_group_initialize( &group );
+      for( i = 0; i < 64; ++i ) {
+         order[ i ] = 0;
+         stages[ i ].order = order;
+         stages[ i ].index = i;
+         stages[ i ].dep_count = 0;
+         vul_task_initialize( &tasks[ i ], vul_test_task_stage_func, &stages[ i ], &group );
+      }
+      // A diamond-ish DAG: each task depends on up to two earlier ones. Submitting
+      // in order means dependencies may already have finished when they are added.
+      for( i = 0; i < 64; ++i ) {
+         for( j = 0; j < 2 && i > 0; ++j ) {
+            stages[ i ].deps[ j ] = j == 0 ? i - 1 : i / 2;
+            stages[ i ].dep_count = j + 1;
+            TEST( vul_task_depends_on( &tasks[ i ], &tasks[ stages[ i ].deps[ j ] ] ) );
+         }
+         vul_task_pool_submit( vul_test_pool, &tasks[ i ] );
+      }
+      vul_task_pool_wait( vul_test_pool, &group );
+      for( i = 0; i < 64; ++i ) {
+         TEST( order[ i ] );
+      }
+   }
+
+   // Dependencies added before the dependency is submitted run strictly after it
+   vul_task_group_initialize( &group );
+   for( i = 0; i < 8; ++i ) {
+      order[ i ] = 0;
+      stages[ i ].index = i;
+      stages[ i ].dep_count = i > 0;
+      stages[ i ].deps[ 0 ] = 0;
+      vul_task_initialize( &tasks[ i ], vul_test_task_stage_func, &stages[ i ], &group );
+   }
+   for( i = 1; i < 8; ++i ) {
+      TEST( vul_task_depends_on( &tasks[ i ], &tasks[ 0 ] ) );
+      vul_task_pool_submit( vul_test_pool, &tasks[ i ] );
+   }
+   TEST( group.pending == 7 );
+   vul_task_pool_submit( vul_test_pool, &tasks[ 0 ] );
+   vul_task_pool_wait( vul_test_pool, &group );
+   for( i = 0; i < 8; ++i ) {
+      TEST( order[ i ] );
+   }
+
+   // One continuation too many is refused rather than dropped, and a finished
+   // dependency is always accepted
+   vul_task_initialize( &tasks[ 0 ], vul_test_task_stage_func, &stages[ 0 ], NULL );
+   for( i = 1; i <= VUL_TASK_MAX_CONTINUATIONS; ++i ) {
+      vul_task_initialize( &tasks[ i ], vul_test_task_stage_func, &stages[ i ], NULL );
+      TEST( vul_task_depends_on( &tasks[ i ], &tasks[ 0 ] ) );
+   }
+   vul_task_initialize( &tasks[ i ], vul_test_task_stage_func, &stages[ i ], NULL );
+   TEST( !vul_task_depends_on( &tasks[ i ], &tasks[ 0 ] ) );
+   TEST( tasks[ i ].dependencies == 1 );
+}
+
+typedef struct vul_test_parallel_ctx {
+   volatile uint32_t *hits;
+   float *values;
+   volatile uint32_t max_chunk;
+} vul_test_parallel_ctx;
+
+void vul_test_parallel_mark( uint32_t begin, uint32_t end, void *ctx )
+{
+   vul_test_parallel_ctx *c;
+   uint32_t i, chunk;
+
+   c = ( vul_test_parallel_ctx* )ctx;
+   for( i = begin; i < end; ++i ) {
+      vul_atomic_add_u32( &c->hits[ i ], 1 );
+   }
+   chunk = end - begin;
+   while( chunk > vul_atomic_load_u32( &c->max_chunk ) ) {
+      vul_atomic_store_u32( &c->max_chunk, chunk ); // Racy, but only needs to catch > grain
+   }
+}
+
+void vul_test_parallel_sum( uint32_t begin, uint32_t end, void *ctx, void *result )
+{
+   vul_test_parallel_ctx *c;
+   uint32_t i;
+
+   c = ( vul_test_parallel_ctx* )ctx;
+   for( i = begin; i < end; ++i ) {
+      *( float* )result += c->values[ i ];
+   }
+}
+
+void vul_test_parallel_add( void *result, const void *other, void *ctx )
+{
+   *( float* )result += *( const float* )other;
+   ( void )ctx;
+}
+
+// Not commutative: the combination order must follow the indices
+typedef struct vul_test_parallel_span {
+   uint32_t first, last, count;
+   uint32_t pad[ 16 ]; // Larger than the stack buffer for partial results
+} vul_test_parallel_span;
+
+void vul_test_parallel_span_reduce( uint32_t begin, uint32_t end, void *ctx, void *result )
+{
+   vul_test_parallel_span *s;
+   uint32_t i;
+
+   s = ( vul_test_parallel_span* )result;
+   for( i = begin; i < end; ++i ) {
+      if( s->count == 0 ) {
+         s->first = i;
+      } else {
+         TEST( s->last + 1 == i );
+      }
+      s->last = i;
+      ++s->count;
+   }
+   ( void )ctx;
+}
+
+void vul_test_parallel_span_combine( void *result, const void *other, void *ctx )
+{
+   vul_test_parallel_span *a;
+   const vul_test_parallel_span *b;
+
+   a = ( vul_test_parallel_span* )result;
+   b = ( const vul_test_parallel_span* )other;
+   if( b->count == 0 ) {
+      return;
+   }
+   if( a->count == 0 ) {
+      *a = *b;
+      return;
+   }
+   TEST( a->last + 1 == b->first );
+   a->last = b->last;
+   a->count += b->count;
+   ( void )ctx;
+}
+
+void vul_test_parallel( )
+{
+   vul_test_parallel_ctx c;
+   vul_test_parallel_span span, span_identity;
+   uint32_t *hits, i, n, g, r;
+   uint32_t sizes[ ] = { 0, 1, 5, 1000, 100000 };
+   uint32_t grains[ ] = { 0, 1, 7, 100000 };
+   float sum, first_sum, zero;
+
+   n = 100000;
+   hits = ( uint32_t* )malloc( sizeof( uint32_t ) * n );
+   c.values = ( float* )malloc( sizeof( float ) * n );
+   c.hits = hits;
+   for( i = 0; i < n; ++i ) {
+      c.values[ i ] = 1.0f / ( float )( i + 1 );
+   }
+
+   for( n = 0; n < sizeof( sizes ) / sizeof( sizes[ 0 ] ); ++n ) {
+      for( g = 0; g < sizeof( grains ) / sizeof( grains[ 0 ] ); ++g ) {
+         // Every index exactly once, in chunks no larger than the grain
+         memset( hits, 0, sizeof( uint32_t ) * sizes[ n ] );
+         c.max_chunk = 0;
+         vul_parallel_for( vul_test_pool, 0, sizes[ n ], grains[ g ], vul_test_parallel_mark, &c );
+         for( i = 0; i < sizes[ n ]; ++i ) {
+            TEST( hits[ i ] == 1 );
+         }
+         TEST( grains[ g ] == 0 || c.max_chunk <= grains[ g ] );
+
+         // Same bits every run
+         zero = 0.0f;
+         for( r = 0; r < 3; ++r ) {
+            vul_parallel_reduce( vul_test_pool, 0, sizes[ n ], grains[ g ], sizeof( float ), &zero,
+                                 vul_test_parallel_sum, vul_test_parallel_add, &c, &sum );
+            if( r == 0 ) {
+               first_sum = sum;
+            }
+            TEST( memcmp( &sum, &first_sum, sizeof( float ) ) == 0 );
+         }
+
+         memset( &span_identity, 0, sizeof( span_identity ) );
+         vul_parallel_reduce( vul_test_pool, 3, sizes[ n ] + 3, grains[ g ], sizeof( span ), &span_identity,
+                              vul_test_parallel_span_reduce, vul_test_parallel_span_combine, NULL, &span );
+         TEST( span.count == sizes[ n ] );
+         TEST( span.count == 0 || ( span.first == 3 && span.last == sizes[ n ] + 2 ) );
+      }
+   }
+   free( hits );
+   free( c.values );
+}
+
+#define VUL_TEST_SYNC_THREADS 4
+#define VUL_TEST_SYNC_ROUNDS 2000
+
+typedef struct vul_test_sync {
+   vul_mutex mutex;
+   vul_condition not_empty, not_full;
+   uint32_t queue[ 8 ], head, tail; // Guarded by mutex
+   uint64_t consumed_sum;           // Guarded by mutex
+   vul_semaphore items, slots;
+   volatile uint32_t semaphore_sum;
+   vul_barrier barrier;
+   volatile uint32_t arrived[ VUL_TEST_SYNC_ROUNDS ];
+   volatile uint32_t serial;
+   vul_event start;
+   volatile uint32_t started;
+} vul_test_sync;
+
+static vul_test_sync vul_test_sync_state;
+
+#ifdef VUL_WINDOWS
+#define VUL_TEST_THREAD_FUNC( name ) DWORD WINAPI name( LPVOID arg )
+#define VUL_TEST_THREAD_RETURN return 0
+#else
+#define VUL_TEST_THREAD_FUNC( name ) void *name( void *arg )
+#define VUL_TEST_THREAD_RETURN return NULL
+#endif
+
+VUL_TEST_THREAD_FUNC( vul_test_sync_worker )
+{
+   vul_test_sync *s;
+   uint32_t i, r, v;
+
+   s = &vul_test_sync_state;
+   ( void )arg;
+
+   // Nobody gets past the event before it is set
+   vul_event_wait( &s->start );
+   vul_atomic_add_u32( &s->started, 1 );
+
+   // Consumers on a condition variable guarded queue; the main thread produces
+   for( i = 0; i < VUL_TEST_SYNC_ROUNDS / VUL_TEST_SYNC_THREADS; ++i ) {
+      vul_mutex_wait_and_lock( &s->mutex );
+      while( s->head == s->tail ) {
+         vul_condition_wait( &s->not_empty, &s->mutex );
+      }
+      v = s->queue[ s->head++ % 8 ];
+      s->consumed_sum += v;
+      vul_condition_signal( &s->not_full );
+      vul_mutex_release( &s->mutex );
+   }
+
+   // Same with semaphores
+   for( i = 0; i < VUL_TEST_SYNC_ROUNDS / VUL_TEST_SYNC_THREADS; ++i ) {
+      vul_semaphore_wait( &s->items );
+      vul_atomic_add_u32( &s->semaphore_sum, 1 );
+      vul_semaphore_post( &s->slots, 1 );
+   }
+
+   // Nobody may start round r + 1 before everyone has arrived in round r
+   for( r = 0; r < VUL_TEST_SYNC_ROUNDS; ++r ) {
+      vul_atomic_add_u32( &s->arrived[ r ], 1 );
+      if( vul_barrier_wait( &s->barrier ) ) {
+         vul_atomic_add_u32( &s->serial, 1 );
+      }
+      TEST( vul_atomic_load_u32( &s->arrived[ r ] ) == VUL_TEST_SYNC_THREADS );
+   }
+
+   VUL_TEST_THREAD_RETURN;
+}
+
+void vul_test_sync_primitives( )
+{
+   vul_test_sync *s;
+   vul_thread threads[ VUL_TEST_SYNC_THREADS ];
+   vul_thread_attributes attr;
+   uint64_t sum;
+   uint32_t i;
+
+   s = &vul_test_sync_state;
+   memset( s, 0, sizeof( vul_test_sync ) );
+   s->mutex = vul_mutex_create( 0, NULL );
+   s->not_empty = vul_condition_create( );
+   s->not_full = vul_condition_create( );
+   s->items = vul_semaphore_create( 0 );
+   s->slots = vul_semaphore_create( 3 );
+   s->barrier = vul_barrier_create( VUL_TEST_SYNC_THREADS );
+   s->start = vul_event_create( 0 );
+
+   TEST( !vul_event_is_set( &s->start ) );
+   TEST( vul_semaphore_try_wait( &s->slots ) );
+   vul_semaphore_post( &s->slots, 1 );
+
+   memset( &attr, 0, sizeof( attr ) );
+   for( i = 0; i < VUL_TEST_SYNC_THREADS; ++i ) {
+      threads[ i ] = vul_thread_create( attr, vul_test_sync_worker, NULL );
+   }
+   TEST( vul_atomic_load_u32( &s->started ) == 0 );
+   vul_event_set( &s->start );
+   TEST( vul_event_is_set( &s->start ) );
+
+   sum = 0;
+   for( i = 0; i < VUL_TEST_SYNC_ROUNDS; ++i ) {
+      vul_mutex_wait_and_lock( &s->mutex );
+      while( s->tail - s->head == 8 ) {
+         vul_condition_wait( &s->not_full, &s->mutex );
+      }
+      s->queue[ s->tail++ % 8 ] = i;
+      sum += i;
+      vul_condition_signal( &s->not_empty );
+      vul_mutex_release( &s->mutex );
+   }
+   for( i = 0; i < VUL_TEST_SYNC_ROUNDS; ++i ) {
+      vul_semaphore_wait( &s->slots );
+      vul_semaphore_post( &s->items, 1 );
+   }
+
+   for( i = 0; i < VUL_TEST_SYNC_THREADS; ++i ) {
+      vul_thread_join( threads[ i ], NULL );
+   }
+   TEST( s->consumed_sum == sum );
+   TEST( s->semaphore_sum == VUL_TEST_SYNC_ROUNDS );
+   TEST( s->serial == VUL_TEST_SYNC_ROUNDS );
+   TEST( vul_semaphore_try_wait( &s->slots ) );
+   TEST( !vul_semaphore_try_wait( &s->items ) );
+
+   vul_event_reset( &s->start );
+   TEST( !vul_event_is_set( &s->start ) );
+   vul_mutex_destroy( &s->mutex );
+   vul_condition_destroy( &s->not_empty );
+   vul_condition_destroy( &s->not_full );
+   vul_semaphore_destroy( &s->items );
+   vul_semaphore_destroy( &s->slots );
+   vul_barrier_destroy( &s->barrier );
+   vul_event_destroy( &s->start );
+}
+
+#define VUL_TEST_LOCK_ITERATIONS 20000
+
+typedef struct vul_test_lock_state {
+   vul_adaptive_mutex mutex;
+   uint64_t counter;          // Guarded by mutex
+   vul_rwlock rwlock;
+   uint32_t pair[ 2 ];        // Guarded by rwlock; always equal outside the write lock
+   volatile uint32_t torn;
+} vul_test_lock_state;
+
+static vul_test_lock_state vul_test_locks_state;
+
+VUL_TEST_THREAD_FUNC( vul_test_lock_worker )
+{
+   vul_test_lock_state *l;
+   uint32_t i, index;
+
+   l = &vul_test_locks_state;
+   index = ( uint32_t )( uintptr_t )arg;
+   for( i = 0; i < VUL_TEST_LOCK_ITERATIONS; ++i ) {
+      vul_adaptive_mutex_lock( &l->mutex );
+      ++l->counter;
+      vul_adaptive_mutex_unlock( &l->mutex );
+
+      // One writer every 16 operations, readers otherwise
+      if( ( i + index ) % 16 == 0 ) {
+         vul_rwlock_write_lock( &l->rwlock );
+         ++l->pair[ 0 ];
+         vul_cpu_relax( );
+         ++l->pair[ 1 ];
+         vul_rwlock_write_unlock( &l->rwlock );
+      } else {
+         vul_rwlock_read_lock( &l->rwlock );
+         if( l->pair[ 0 ] != l->pair[ 1 ] ) {
+            vul_atomic_add_u32( &l->torn, 1 );
+         }
+         vul_rwlock_read_unlock( &l->rwlock );
+      }
+   }
+   VUL_TEST_THREAD_RETURN;
+}
+
+void vul_test_locks( )
+{
+   vul_test_lock_state *l;
+   vul_thread threads[ VUL_TEST_SYNC_THREADS ];
+   vul_thread_attributes attr;
+   vul_lock_stats stats, reads, writes;
+   uint32_t i;
+
+   l = &vul_test_locks_state;
+   memset( l, 0, sizeof( vul_test_lock_state ) );
+   l->mutex = vul_adaptive_mutex_create( );
+   vul_rwlock_initialize( &l->rwlock );
+   TEST( ( ( uintptr_t )l->rwlock.slots & 63 ) == 0 ); // Reader slots don't straddle cache lines
+
+   TEST( vul_adaptive_mutex_try_lock( &l->mutex ) );
+   TEST( !vul_adaptive_mutex_try_lock( &l->mutex ) );
+   vul_adaptive_mutex_unlock( &l->mutex );
+   vul_adaptive_mutex_reset_stats( &l->mutex );
+
+   memset( &attr, 0, sizeof( attr ) );
+   for( i = 0; i < VUL_TEST_SYNC_THREADS; ++i ) {
+      threads[ i ] = vul_thread_create( attr, vul_test_lock_worker, ( void* )( uintptr_t )i );
+   }
+   for( i = 0; i < VUL_TEST_SYNC_THREADS; ++i ) {
+      vul_thread_join( threads[ i ], NULL );
+   }
+
+   TEST( l->counter == ( uint64_t )VUL_TEST_SYNC_THREADS * VUL_TEST_LOCK_ITERATIONS );
+   TEST( l->torn == 0 );
+   TEST( l->pair[ 0 ] == l->pair[ 1 ] );
+   vul_adaptive_mutex_stats( &l->mutex, &stats );
+   TEST( stats.acquisitions == l->counter );
+   TEST( stats.contended <= stats.acquisitions );
+   vul_rwlock_stats( &l->rwlock, &reads, &writes );
+   TEST( writes.acquisitions == l->pair[ 0 ] );
+   TEST( reads.acquisitions + writes.acquisitions == ( uint64_t )VUL_TEST_SYNC_THREADS * VUL_TEST_LOCK_ITERATIONS );
+   vul_rwlock_reset_stats( &l->rwlock );
+   vul_rwlock_stats( &l->rwlock, &reads, &writes );
+   TEST( reads.acquisitions == 0 && writes.acquisitions == 0 );
+
+   vul_adaptive_mutex_destroy( &l->mutex );
+   vul_rwlock_destroy( &l->rwlock );
+}
+
+#define VUL_TEST_PLACEMENT_BYTES ( 1 << 20 )
+
+static volatile uint32_t vul_test_placement_ok;
+
+VUL_TEST_THREAD_FUNC( vul_test_placement_worker )
+{
+   uint8_t *mem;
+   uint32_t i;
+#ifdef VUL_LINUX
+   char name[ 16 ];
+
+   prctl( PR_GET_NAME, name, 0, 0, 0 );
+   TEST( strcmp( name, "vul_test_placem" ) == 0 ); // Truncated to 15 characters
+#endif
+   // First touch from the pinned thread
+   mem = ( uint8_t* )vul_numa_alloc( VUL_TEST_PLACEMENT_BYTES, 0 );
+   TEST( mem );
+   for( i = 0; i < VUL_TEST_PLACEMENT_BYTES; i += 4096 ) {
+      mem[ i ] = ( uint8_t )i;
+   }
+   vul_numa_free( mem, VUL_TEST_PLACEMENT_BYTES );
+   vul_atomic_store_u32( &vul_test_placement_ok, 1 );
+   ( void )arg;
+   VUL_TEST_THREAD_RETURN;
+}
+
+void vul_test_placement( )
+{
+   vul_cpu_set set;
+   vul_thread_attributes attr;
+   vul_thread t;
+
+   vul_cpu_set_clear( &set );
+   TEST( vul_cpu_set_count( &set ) == 0 );
+   vul_cpu_set_add( &set, 0 );
+   vul_cpu_set_add( &set, 65 );
+   vul_cpu_set_add( &set, VUL_THREAD_MAX_CPUS ); // Out of range, ignored
+   TEST( vul_cpu_set_count( &set ) == 2 );
+   TEST( vul_cpu_set_contains( &set, 65 ) && !vul_cpu_set_contains( &set, 64 ) );
+
+   TEST( vul_numa_node_count( ) >= 1 );
+   TEST( vul_numa_node_cpus( 0, &set ) );
+   TEST( vul_cpu_set_count( &set ) >= 1 );
+   TEST( !vul_numa_node_cpus( vul_numa_node_count( ), &set ) );
+
+   memset( &attr, 0, sizeof( attr ) );
+   attr.name = "vul_test_placement";
+   attr.pin_to_numa_node = 1;
+   attr.numa_node = 0;
+   t = vul_thread_create( attr, vul_test_placement_worker, NULL );
+   vul_thread_join( t, NULL );
+   TEST( vul_test_placement_ok );
+}
+
+static uint32_t vul_test_alloc_fail_at, vul_test_alloc_count;
+static int32_t vul_test_alloc_live;
+
+void *vul_test_failing_alloc( size_t size )
+{
+   if( vul_test_alloc_count++ == vul_test_alloc_fail_at ) {
+      return NULL;
+   }
+   ++vul_test_alloc_live;
+   return malloc( size );
+}
+
+void vul_test_failing_free( void *ptr )
+{
+   --vul_test_alloc_live;
+   free( ptr );
+}
+
+void vul_test_task_pool_failure( )
+{
+   vul_task_pool *pool;
+   uint32_t errors;
+
+   // The pool, its worker array and three deques: failing any of them unwinds the rest
+   for( vul_test_alloc_fail_at = 0; vul_test_alloc_fail_at < 5; ++vul_test_alloc_fail_at ) {
+      errors = vul_test_thread_errors;
+      vul_test_alloc_count = 0;
+      vul_test_alloc_live = 0;
+      pool = vul_task_pool_create( 3, vul_test_failing_alloc, vul_test_failing_free );
+      TEST( pool == NULL );
+      TEST( vul_test_alloc_live == 0 );
+      TEST( vul_test_thread_errors == errors + 1 );
+   }
+   vul_test_alloc_count = 0;
+   pool = vul_task_pool_create( 3, vul_test_failing_alloc, vul_test_failing_free );
+   TEST( pool != NULL );
+   vul_task_pool_destroy( pool );
+   TEST( vul_test_alloc_live == 0 );
+   vul_test_thread_errors = 0;
+}
+
+int main( )
+{
+   uint32_t workers[ ] = { 0, 1, 4 };
+   uint32_t i;
+
+   TEST( vul_thread_processor_count( ) >= 1 );
+   vul_test_sync_primitives( );
+   vul_test_locks( );
+   vul_test_placement( );
+   for( i = 0; i < sizeof( workers ) / sizeof( workers[ 0 ] ); ++i ) {
+      vul_test_pool = vul_task_pool_create( workers[ i ], malloc, free );
+      TEST( vul_task_pool_worker_count( vul_test_pool ) >= 1 );
+      TEST( vul_task_pool_worker_index( vul_test_pool ) == vul_task_pool_worker_count( vul_test_pool ) );
+      vul_test_task_independent( );
+      vul_test_task_nested( );
+      vul_test_task_dependencies( );
+      vul_test_parallel( );
+      vul_task_pool_destroy( vul_test_pool );
+   }
+   vul_test_pool = vul_task_pool_create_pinned( 4, malloc, free );
+   vul_test_task_nested( );
+   vul_test_parallel( );
+   vul_task_pool_destroy( vul_test_pool );
+   TEST( vul_test_thread_errors == 0 );
+   vul_test_task_pool_failure( );
+
+   return 0;
+}
+#endif
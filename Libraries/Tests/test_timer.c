@@ -0,0 +1,86 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains tests for vul_timer.h
+ * Compile with the OS define (VUL_LINUX etc.). Also run it with VUL_TIMER_NO_TSC
+ * defined to test the OS clock fallback.
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_TEST_TIMER_H
+#define VUL_TEST_TIMER_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+//----------------------
+// The actual tests
+//
+
+#define TEST( expr ) if( !( expr ) ) {\
+   fprintf( stderr, #expr );\
+   assert( 0 );\
+   exit( 1 );\
+}
+
+#define VUL_DEFINE
+#include "../vul_timer.h"
+
+void vul_test_tsc( )
+{
+   const vul_tsc_info *info;
+   vul_timer timer;
+   uint64_t a, b, i, nanos, micros;
+
+   vul_tsc_calibrate( );
+   info = vul_tsc_get_info( );
+   TEST( info->calibrated );
+   TEST( info->ticks_per_second > 0 );
+   TEST( !info->hardware || info->invariant );
+#ifdef VUL_TIMER_NO_TSC
+   TEST( !info->hardware );
+#endif
+
+   // Monotonic, and serialized reads bracket unserialized ones
+   a = vul_tsc_begin( );
+   for( i = 0; i < 1000; ++i ) {
+      b = vul_tsc_now( );
+      TEST( b >= a );
+      a = b;
+   }
+   b = vul_tsc_end( );
+   TEST( b >= a );
+   TEST( vul_tsc_to_nanos( info->overhead ) < 100000 );
+
+   // Agrees with the OS clock on a sleep (loosely, since we may be descheduled)
+   vul_timer_reset( &timer );
+   a = vul_tsc_begin( );
+   vul_sleep( 20 );
+   b = vul_tsc_end( );
+   micros = vul_timer_get_micros( &timer );
+   nanos = vul_tsc_to_nanos( b - a );
+   TEST( nanos >= 19000000 );
+   TEST( nanos <= micros * 1000 + 1000000 );
+   TEST( vul_tsc_to_seconds( info->ticks_per_second ) > 0.999 );
+   TEST( vul_tsc_to_seconds( info->ticks_per_second ) < 1.001 );
+   TEST( vul_tsc_to_nanos( 0 ) == 0 );
+}
+
+int main( )
+{
+   vul_test_tsc( );
+
+   return 0;
+}
+#endif
@@ -2,6 +2,11 @@
  * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
  *
  * This file contains auxilliary functions for benchmarking.
+ * On Linux the runners can also capture hardware performance counters (cycles,
+ * instructions, cache and branch misses) per iteration; see vul_benchmark_set_counters.
+ * Results can be collected in a report and written as JSON or CSV, and a report
+ * read back from JSON can serve as a baseline that vul_benchmark_compare checks
+ * later runs against for statistically significant regressions.
  * @TODO: Plotting (bar diagram of all iterations, histogram, smooth graf)
  * nanovg should be useful for this; hide the whole thing behind a define.
  * 
@@ -24,6 +29,20 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
+#ifdef VUL_LINUX
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#if defined( _M_X64 ) || defined( _M_IX86 )
+#include <intrin.h>
+#define VUL__BENCHMARK_CPUID_MSVC
+#elif defined( __x86_64__ ) || defined( __i386__ )
+#include <cpuid.h>
+#define VUL__BENCHMARK_CPUID_GCC
+#endif
 
 #ifndef VUL_TYPES_H
 #include <stdint.h>
@@ -34,11 +53,38 @@
 #define u64 uint64_t
 #endif
 
+/**
+ * Hardware counters the runners can capture alongside the time.
+ */
+typedef enum vul_benchmark_counter {
+   VUL_BENCHMARK_CYCLES,
+   VUL_BENCHMARK_INSTRUCTIONS,
+   VUL_BENCHMARK_CACHE_MISSES,
+   VUL_BENCHMARK_BRANCH_MISSES,
+   VUL_BENCHMARK_COUNTER_COUNT
+} vul_benchmark_counter;
+
+#define VUL_BENCHMARK_COUNTER_BIT( counter ) ( 1u << ( counter ) )
+#define VUL_BENCHMARK_ALL_COUNTERS ( ( 1u << VUL_BENCHMARK_COUNTER_COUNT ) - 1 )
+
+typedef struct vul_benchmark_counters {
+   u32 available; // Mask of VUL_BENCHMARK_COUNTER_BIT of the counters that were measured
+   f64 per_iteration[ VUL_BENCHMARK_COUNTER_COUNT ]; // Mean count per iteration, 0 if not available
+} vul_benchmark_counters;
+
+typedef enum vul_benchmark_unit {
+   VUL_BENCHMARK_MILLIS,
+   VUL_BENCHMARK_MICROS
+} vul_benchmark_unit;
+
 typedef struct vul_benchmark_result {
    u32 iterations;
    f64 mean;
    u64 median;
    f64 std_deviation;
+   vul_benchmark_counters counters;
+   vul_benchmark_unit unit; // Of all the times above
+   u64 *samples; // Time of every iteration in run order if kept (see vul_benchmark_keep_samples), else NULL
 } vul_benchmark_result;
 
 typedef struct vul_benchmark_histogram {
@@ -46,9 +92,35 @@ typedef struct vul_benchmark_histogram {
    u64 smallest, largest;
 } vul_benchmark_histogram;
 
+typedef struct vul_benchmark_entry {
+   char *name;
+   vul_benchmark_result result; // The report owns the samples
+} vul_benchmark_entry;
+
+/**
+ * A named collection of results that can be written out and read back.
+ */
+typedef struct vul_benchmark_report {
+   vul_benchmark_entry *entries;
+   u32 count, capacity;
+} vul_benchmark_report;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
+/**
+ * Selects the hardware counters the runners capture, as a mask of
+ * VUL_BENCHMARK_COUNTER_BIT( counter ). The default, 0, captures none. Counters
+ * are read with perf_event_open on Linux. Those the CPU, the kernel or
+ * perf_event_paranoid don't allow (and all of them on other platforms, or in
+ * most virtual machines) are left out of the result's available mask; the
+ * timing is unaffected. Counting is limited to user space. Not thread safe.
+ */
+void vul_benchmark_set_counters( u32 mask );
+/**
+ * Returns a short name of the given counter, like "cycles".
+ */
+const char *vul_benchmark_counter_name( vul_benchmark_counter counter );
 /**
  * Runs the given function the given amount of times, calculating mean, median and
  * std_deviation over the runs. All times in milliseconds.
@@ -85,6 +157,64 @@ void vul_benchmark_print_histogram_millis( u64 *times, u32 left, u32 right, u32
  * Print a histogram to stdout with a given number of buckets.
  */
 void vul_benchmark_print_histogram_micros( u64 *times, u32 left, u32 right, u32 buckets );
+/**
+ * Makes the runners keep the time of every iteration in the result's samples
+ * (default off). Free them with vul_benchmark_result_free. Comparing against
+ * a baseline and writing percentiles both need them. Not thread safe.
+ */
+void vul_benchmark_keep_samples( u32 keep );
+/**
+ * Frees the samples of a result, if it has any.
+ */
+void vul_benchmark_result_free( vul_benchmark_result *result );
+/**
+ * Creates an empty report.
+ */
+vul_benchmark_report *vul_benchmark_report_create( );
+/**
+ * Destroys a report and everything in it.
+ */
+void vul_benchmark_report_destroy( vul_benchmark_report *report );
+/**
+ * Adds a copy of the result, including its samples, to the report under the given name.
+ */
+void vul_benchmark_report_add( vul_benchmark_report *report, const char *name, const vul_benchmark_result *result );
+/**
+ * Writes the report as JSON: a description of the machine and build, and for
+ * every benchmark the summary, percentiles, counters and samples. This is
+ * the format vul_benchmark_report_read_json reads. Returns 0 on a write error.
+ */
+u32 vul_benchmark_report_write_json( const vul_benchmark_report *report, FILE *f );
+/**
+ * Writes the report as CSV, one row per benchmark with the samples space
+ * separated in the last column. The machine and build description goes
+ * first, in lines starting with '#'. Returns 0 on a write error.
+ */
+u32 vul_benchmark_report_write_csv( const vul_benchmark_report *report, FILE *f );
+/**
+ * Reads a report written by vul_benchmark_report_write_json. Returns NULL if
+ * the file isn't one.
+ */
+vul_benchmark_report *vul_benchmark_report_read_json( FILE *f );
+/**
+ * One sided Mann-Whitney U test: the probability of the samples in b ranking
+ * this high against those in a if both came from the same distribution. Small
+ * values mean b is reliably slower than a. Makes no assumption about the
+ * distribution (times rarely are normal) and handles ties. Uses the normal
+ * approximation, which is good from about 8 samples each.
+ */
+f64 vul_benchmark_mann_whitney( const u64 *a, u32 na, const u64 *b, u32 nb );
+/**
+ * Compares every benchmark in current against the one of the same name in
+ * baseline. One has regressed if it is slower with a p-value below alpha
+ * (see vul_benchmark_mann_whitney) and its median grew by more than min_change
+ * (relative, 0.05 for 5%), so tiny but consistent differences don't fail a
+ * build. Benchmarks without samples or without a baseline are never
+ * regressions. Writes a table to out, if not NULL. Returns the number of
+ * regressions, so a CI job can fail when it isn't 0.
+ */
+u32 vul_benchmark_compare( const vul_benchmark_report *baseline, const vul_benchmark_report *current,
+                           f64 alpha, f64 min_change, FILE *out );
 
 #ifdef __cplusplus
 }
@@ -114,12 +244,7 @@ void vul_benchmark_print_histogram_micros( u64 *times, u32 left, u32 right, u32
 extern "C" {
 #endif
 /**
- * Helper function used to find the median. This is the median-of-median
- * algorithm, and all the median-function does is pretend the k-argument doesn't exist.
- */
-static u32 vul__benchmark_select( u64 *times, u32 left, u32 right, u32 k );
-/**
- * Finds the median element of an array of times. O(n)
+ * Finds the median element of times[ left, right ). Reorders the array. O(n)
  */
 static u64 vul__benchmark_median( u64 *times, u32 left, u32 right );
 /**
@@ -136,61 +261,228 @@ static f64 vul__benchmark_standard_deviation( u64 *times, u32 left, u32 right, f
 static void vul__benchmark_create_histogram( vul_benchmark_histogram *hist, u64 *times, 
                                              u32 left, u32 right, u32 buckets );
 
+/**
+ * An open group of hardware counters. The first counter that opens leads the
+ * group, so all of them count over exactly the same instructions.
+ */
+typedef struct vul__benchmark_counter_group {
+   int leader; // -1 if no counter could be opened
+   int fds[ VUL_BENCHMARK_COUNTER_COUNT ];
+   u32 slot[ VUL_BENCHMARK_COUNTER_COUNT ]; // Position of each counter in a group read
+   u32 available;
+   u64 enabled, running; // Totals at the last read
+   u32 samples;
+   f64 sums[ VUL_BENCHMARK_COUNTER_COUNT ];
+} vul__benchmark_counter_group;
+/**
+ * Opens the counters selected with vul_benchmark_set_counters that are available.
+ */
+static void vul__benchmark_counters_open( vul__benchmark_counter_group *group );
+/**
+ * Resets and starts the counters.
+ */
+static void vul__benchmark_counters_start( vul__benchmark_counter_group *group );
+/**
+ * Stops the counters and adds their values to the sums.
+ */
+static void vul__benchmark_counters_stop( vul__benchmark_counter_group *group );
+/**
+ * Closes the counters and writes the per iteration means to out.
+ */
+static void vul__benchmark_counters_close( vul__benchmark_counter_group *group, vul_benchmark_counters *out );
+/**
+ * Runs iterations [first, last) of a benchmark, storing the time elapsed() reports for each
+ * and counting them in group.
+ */
+static void vul__benchmark_run( u64 *times, u32 first, u32 last, vul_timer *clk, u64 ( *elapsed )( vul_timer *c ),
+                                vul__benchmark_counter_group *group,
+                                void ( *function )( void *data ), void *func_data );
+/**
+ * Returns a copy of times[ 0, count ) if samples are kept, otherwise NULL.
+ */
+static u64 *vul__benchmark_keep( const u64 *times, u32 count );
+
 //-------------------------
 // Implementation
 //
 
-u32 vul__benchmark_select( u64 *times, u32 left, u32 right, u32 k )
+static u32 vul__benchmark_counter_mask = 0;
+static u32 vul__benchmark_keep_samples = 0;
+
+void vul_benchmark_set_counters( u32 mask )
 {
-   u64 order[ 5 ], time;
-   u32 i, l, count, median;
-   s32 j;
+   vul__benchmark_counter_mask = mask & VUL_BENCHMARK_ALL_COUNTERS;
+}
 
-   count = right - left;
-   if( count < 5 )
-   {
-      // Just find the k-th element the hard way
-      l = 1;
-      order[ 0 ] = times[ left ];
-      for( i = 1; i < count + 1; ++i ) 
-      {
-         time = times[ left + i ];
-         if( time < order[ l - 1 ] ) {
-            for( j = l - 1; j >= 0 && time < order[ j ]; --j )
-            {
-               order[ j + 1 ] = order[ j ];
-            }
-            order[ ++j ] = time;
-            ++l;
-         } else {
-            order[ l++ ] = time;
-         }
+const char *vul_benchmark_counter_name( vul_benchmark_counter counter )
+{
+   switch( counter ) {
+   case VUL_BENCHMARK_CYCLES: return "cycles";
+   case VUL_BENCHMARK_INSTRUCTIONS: return "instructions";
+   case VUL_BENCHMARK_CACHE_MISSES: return "cache_misses";
+   case VUL_BENCHMARK_BRANCH_MISSES: return "branch_misses";
+   default: return "unknown";
+   }
+}
+
+#ifdef VUL_LINUX
+void vul__benchmark_counters_open( vul__benchmark_counter_group *group )
+{
+   static const u64 configs[ VUL_BENCHMARK_COUNTER_COUNT ] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_BRANCH_MISSES
+   };
+   struct perf_event_attr attr;
+   u32 i, count;
+   int fd;
+
+   memset( group, 0, sizeof( vul__benchmark_counter_group ) );
+   group->leader = -1;
+   count = 0;
+   for( i = 0; i < VUL_BENCHMARK_COUNTER_COUNT; ++i ) {
+      group->fds[ i ] = -1;
+      if( !( vul__benchmark_counter_mask & VUL_BENCHMARK_COUNTER_BIT( i ) ) ) {
+         continue;
       }
-      for( i = 0; i < 5; ++i ) {
-         if ( order[ k ] == times[ left + i ] ) {
-            return left + i;
-         }
+      memset( &attr, 0, sizeof( attr ) );
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof( attr );
+      attr.config = configs[ i ];
+      attr.disabled = group->leader == -1; // Members follow the leader
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fd = ( int )syscall( SYS_perf_event_open, &attr, 0, -1, group->leader, 0 );
+      if( fd < 0 ) {
+         continue; // Not supported or not permitted; leave it out
       }
+      if( group->leader == -1 ) {
+         group->leader = fd;
+      }
+      group->fds[ i ] = fd;
+      group->slot[ i ] = count++;
+      group->available |= VUL_BENCHMARK_COUNTER_BIT( i );
    }
+}
 
-   for( i = 0; i < ( count / 5 ) + 1; ++i )
-   {
-      l = 5 * i; // Left bound of new array
-      j = ( l + 4 ) > right ? right : ( l + 4 ); // Right bound of new array
-      
-      median = vul__benchmark_select( times, l, j, 2 ); // 0-indexed k
+void vul__benchmark_counters_start( vul__benchmark_counter_group *group )
+{
+   if( group->leader == -1 ) {
+      return;
+   }
+   ioctl( group->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+   ioctl( group->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+}
+
+void vul__benchmark_counters_stop( vul__benchmark_counter_group *group )
+{
+   u64 values[ 3 + VUL_BENCHMARK_COUNTER_COUNT ], enabled, running;
+   f64 scale;
+   u32 i;
+
+   if( group->leader == -1 ) {
+      return;
+   }
+   ioctl( group->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP );
+   if( read( group->leader, values, sizeof( values ) ) < ( ssize_t )( 3 * sizeof( u64 ) ) ) {
+      return;
+   }
+   // Reset only clears the counts, the times keep accumulating
+   enabled = values[ 1 ] - group->enabled;
+   running = values[ 2 ] - group->running;
+   group->enabled = values[ 1 ];
+   group->running = values[ 2 ];
+   if( running == 0 ) {
+      return; // Never got onto the PMU, so there's nothing to scale
+   }
+   // If the kernel multiplexed the PMU we only counted part of the time
+   scale = ( f64 )enabled / ( f64 )running;
+   for( i = 0; i < VUL_BENCHMARK_COUNTER_COUNT; ++i ) {
+      if( group->available & VUL_BENCHMARK_COUNTER_BIT( i ) ) {
+         group->sums[ i ] += ( f64 )values[ 3 + group->slot[ i ] ] * scale;
+      }
+   }
+   ++group->samples;
+}
+
+void vul__benchmark_counters_close( vul__benchmark_counter_group *group, vul_benchmark_counters *out )
+{
+   u32 i;
+
+   out->available = group->samples ? group->available : 0;
+   for( i = 0; i < VUL_BENCHMARK_COUNTER_COUNT; ++i ) {
+      out->per_iteration[ i ] = out->available & VUL_BENCHMARK_COUNTER_BIT( i )
+                              ? group->sums[ i ] / ( f64 )group->samples : 0.0;
+      if( group->fds[ i ] != -1 ) {
+         close( group->fds[ i ] );
+      }
+   }
+}
+#else
+void vul__benchmark_counters_open( vul__benchmark_counter_group *group )
+{
+   group->leader = -1;
+}
+
+void vul__benchmark_counters_start( vul__benchmark_counter_group *group )
+{
+   ( void )group;
+}
+
+void vul__benchmark_counters_stop( vul__benchmark_counter_group *group )
+{
+   ( void )group;
+}
+
+void vul__benchmark_counters_close( vul__benchmark_counter_group *group, vul_benchmark_counters *out )
+{
+   u32 i;
+
+   ( void )group;
+   out->available = 0;
+   for( i = 0; i < VUL_BENCHMARK_COUNTER_COUNT; ++i ) {
+      out->per_iteration[ i ] = 0.0;
+   }
+}
+#endif
 
-      time = times[ median ];
-      times[ median ] = times[ i ];
-      times[ i ] = time;
+u64 *vul__benchmark_keep( const u64 *times, u32 count )
+{
+   u64 *samples;
+
+   if( !vul__benchmark_keep_samples ) {
+      return NULL;
    }
+   samples = ( u64* )malloc( sizeof( u64 ) * count );
+   memcpy( samples, times, sizeof( u64 ) * count );
+   return samples;
+}
+
+void vul__benchmark_run( u64 *times, u32 first, u32 last, vul_timer *clk, u64 ( *elapsed )( vul_timer *c ),
+                         vul__benchmark_counter_group *group,
+                         void ( *function )( void *data ), void *func_data )
+{
+   u32 r;
 
-   return vul__benchmark_select( times, 0, count / 5, count / 10 );
+   for( r = first; r < last; ++r ) {
+      // Counters go outside the timed region so the ioctls don't add to the time
+      vul__benchmark_counters_start( group );
+      vul_timer_reset( clk );
+      function( func_data );
+      times[ r ] = elapsed( clk );
+      vul__benchmark_counters_stop( group );
+   }
 }
 
 u64 vul__benchmark_median( u64 *times, u32 left, u32 right )
 {
-   return times[ vul__benchmark_select( times, left, right, ( right - left ) / 2 ) ];
+   u32 k;
+
+   k = ( right - left - 1 ) / 2;
+   vul_sort_nth_u64( times + left, right - left, k );
+   return times[ left + k ];
 }
 
 f64 vul__benchmark_mean( u64 *times, u32 left, u32 right )
@@ -213,6 +505,9 @@ f64 vul__benchmark_standard_deviation( u64 *times, u32 left, u32 right, f64 mean
    u32 i;
    f64 d, dev, inv_count;
 
+   if( right - left < 2 ) {
+      return 0.0; // Undefined for a single sample
+   }
    inv_count = 1.0 / ( f64 )( ( right - left ) - 1 );
    dev = 0;
    for( i = left; i < right; ++i )
@@ -228,27 +523,28 @@ f64 vul__benchmark_standard_deviation( u64 *times, u32 left, u32 right, f64 mean
 vul_benchmark_result vul_benchmark_millis( u32 repetitions, 
                                            void ( *function )( void *data ), void* func_data )
 {
-   u32 r;
    u64 *times;
    vul_timer *clk;
+   vul__benchmark_counter_group group;
    vul_benchmark_result res;
 
    times = ( u64* )malloc( sizeof( u64 ) * repetitions );
    clk = vul_timer_create( );
+   vul__benchmark_counters_open( &group );
 
    // Run the benchmark
-   for( r = 0; r < repetitions; ++r ) {
-      vul_timer_reset( clk );
-      function( func_data );
-      times[ r ] = vul_timer_get_millis( clk );
-   }
+   vul__benchmark_run( times, 0, repetitions, clk, vul_timer_get_millis, &group, function, func_data );
    
    res.iterations = repetitions;
    res.mean = vul__benchmark_mean( times, 0, repetitions );
+   res.unit = VUL_BENCHMARK_MILLIS;
+   res.samples = vul__benchmark_keep( times, repetitions );
    res.median = vul__benchmark_median( times, 0, repetitions );
    res.std_deviation = vul__benchmark_standard_deviation( times, 0, repetitions, res.mean );
+   vul__benchmark_counters_close( &group, &res.counters );
 
    vul_timer_destroy( clk );
+   free( times );
 
    return res;
 }
@@ -256,27 +552,28 @@ vul_benchmark_result vul_benchmark_millis( u32 repetitions,
 vul_benchmark_result vul_benchmark_micros( u32 repetitions, 
                                            void ( *function )( void *data ), void *func_data )
 {
-   u32 r;
    u64 *times;
    vul_timer *clk;
+   vul__benchmark_counter_group group;
    vul_benchmark_result res;
 
    times = ( u64* )malloc( sizeof( u64 ) * repetitions );
    clk = vul_timer_create( );
+   vul__benchmark_counters_open( &group );
 
    // Run the benchmark
-   for( r = 0; r < repetitions; ++r ) {
-      vul_timer_reset( clk );
-      function( func_data );
-      times[ r ] = vul_timer_get_micros( clk );
-   }
+   vul__benchmark_run( times, 0, repetitions, clk, vul_timer_get_micros, &group, function, func_data );
    
-   res.mean = vul__benchmark_mean( times, 0, repetitions - 1 );
-   res.median = vul__benchmark_median( times, 0, repetitions - 1 );
-   res.std_deviation = vul__benchmark_standard_deviation( times, 0, repetitions - 1, res.mean );
+   res.mean = vul__benchmark_mean( times, 0, repetitions );
+   res.unit = VUL_BENCHMARK_MICROS;
+   res.samples = vul__benchmark_keep( times, repetitions );
+   res.median = vul__benchmark_median( times, 0, repetitions );
+   res.std_deviation = vul__benchmark_standard_deviation( times, 0, repetitions, res.mean );
    res.iterations = repetitions;
+   vul__benchmark_counters_close( &group, &res.counters );
 
    vul_timer_destroy( clk );
+   free( times );
 
    return res;
 }
@@ -287,12 +584,14 @@ vul_benchmark_result vul_benchmark_millis_confidence( f32 ci, f32 error, u32 min
    u32 iter, count;
    u64 *times;
    vul_timer *clk;
+   vul__benchmark_counter_group group;
    vul_benchmark_result res;
 
    times = 0;
    iter = 0;
    count = min_iter;
    clk = vul_timer_create( );
+   vul__benchmark_counters_open( &group );
 
    while( count <= max_iter ) {
       // (re)allocate the times array, maintaining the values we already have
@@ -302,15 +601,12 @@ vul_benchmark_result vul_benchmark_millis_confidence( f32 ci, f32 error, u32 min
          times = ( u64* )realloc( times, sizeof( u64 ) * count );
       }
       // Run the benchmark
-      while( iter < count ) {
-         vul_timer_reset( clk );
-         function( func_data );
-         times[ iter++ ] = vul_timer_get_millis( clk );
-      }
+      vul__benchmark_run( times, iter, count, clk, vul_timer_get_millis, &group, function, func_data );
+      iter = count;
       
       // Calculate important values to determine if finished
-      res.mean = vul__benchmark_mean( times, 0, count - 1 );
-      res.std_deviation = vul__benchmark_standard_deviation( times, 0, count - 1, res.mean );
+      res.mean = vul__benchmark_mean( times, 0, count );
+      res.std_deviation = vul__benchmark_standard_deviation( times, 0, count, res.mean );
       res.iterations = count;
 
       // Calculate teh size of error relative to the std.dev.
@@ -327,9 +623,13 @@ vul_benchmark_result vul_benchmark_millis_confidence( f32 ci, f32 error, u32 min
       }
    }
    // Calculate the median after, because it's slow and we don't need it each run
-   res.median = vul__benchmark_median( times, 0, count - 1 );
+   res.unit = VUL_BENCHMARK_MILLIS;
+   res.samples = vul__benchmark_keep( times, count );
+   res.median = vul__benchmark_median( times, 0, count );
+   vul__benchmark_counters_close( &group, &res.counters );
 
    vul_timer_destroy( clk );
+   free( times );
 
    return res;
 }
@@ -340,12 +640,14 @@ vul_benchmark_result vul_benchmark_micros_confidence( f32 ci, f32 error, u32 min
    u32 iter, count;
    u64 *times;
    vul_timer *clk;
+   vul__benchmark_counter_group group;
    vul_benchmark_result res;
 
    times = 0;
    iter = 0;
    count = min_iter;
    clk = vul_timer_create( );
+   vul__benchmark_counters_open( &group );
 
    while( count <= max_iter ) {
       // (re)allocate the times array, maintaining the values we already have
@@ -355,15 +657,12 @@ vul_benchmark_result vul_benchmark_micros_confidence( f32 ci, f32 error, u32 min
          times = ( u64* )realloc( times, sizeof( u64 ) * count );
       }
       // Run the benchmark
-      while( iter < count ) {
-         vul_timer_reset( clk );
-         function( func_data );
-         times[ iter++ ] = vul_timer_get_micros( clk );
-      }
+      vul__benchmark_run( times, iter, count, clk, vul_timer_get_micros, &group, function, func_data );
+      iter = count;
       
       // Calculate important values to determine if finished
-      res.mean = vul__benchmark_mean( times, 0, count - 1 );
-      res.std_deviation = vul__benchmark_standard_deviation( times, 0, count - 1, res.mean );
+      res.mean = vul__benchmark_mean( times, 0, count );
+      res.std_deviation = vul__benchmark_standard_deviation( times, 0, count, res.mean );
       res.iterations = count;
 
       // Calculate teh size of error relative to the std.dev.
@@ -380,9 +679,13 @@ vul_benchmark_result vul_benchmark_micros_confidence( f32 ci, f32 error, u32 min
       }
    }
    // Calculate the median after, because it's slow and we don't need it each run
-   res.median = vul__benchmark_median( times, 0, count - 1 );
+   res.unit = VUL_BENCHMARK_MICROS;
+   res.samples = vul__benchmark_keep( times, count );
+   res.median = vul__benchmark_median( times, 0, count );
+   vul__benchmark_counters_close( &group, &res.counters );
 
    vul_timer_destroy( clk );
+   free( times );
 
    return res;
 }
@@ -521,6 +824,703 @@ void vul_benchmark_print_histogram_micros( u64 *times, u32 left, u32 right, u32
    free( hist.buckets );
 }
 
+void vul_benchmark_keep_samples( u32 keep )
+{
+   vul__benchmark_keep_samples = keep;
+}
+
+void vul_benchmark_result_free( vul_benchmark_result *result )
+{
+   if( result->samples ) {
+      free( result->samples );
+      result->samples = NULL;
+   }
+}
+
+//-------------------------
+// Reports
+//
+
+typedef struct vul__benchmark_environment {
+   const char *os, *architecture;
+   char compiler[ 128 ];
+   char cpu[ 64 ];
+   u32 cpu_count;
+   u64 timestamp;
+} vul__benchmark_environment;
+
+static const u32 vul__benchmark_percentiles[ ] = { 0, 5, 25, 50, 75, 95, 99, 100 };
+#define VUL__BENCHMARK_PERCENTILE_COUNT ( sizeof( vul__benchmark_percentiles ) / sizeof( vul__benchmark_percentiles[ 0 ] ) )
+
+static void vul__benchmark_get_environment( vul__benchmark_environment *env )
+{
+#if defined( VUL__BENCHMARK_CPUID_MSVC ) || defined( VUL__BENCHMARK_CPUID_GCC )
+   unsigned int regs[ 12 ], i;
+#endif
+#ifdef VUL_WINDOWS
+   SYSTEM_INFO info;
+#endif
+
+   memset( env, 0, sizeof( vul__benchmark_environment ) );
+#if defined( VUL_WINDOWS )
+   env->os = "windows";
+#elif defined( VUL_OSX )
+   env->os = "osx";
+#elif defined( VUL_LINUX )
+   env->os = "linux";
+#endif
+#if defined( __x86_64__ ) || defined( _M_X64 )
+   env->architecture = "x86_64";
+#elif defined( __i386__ ) || defined( _M_IX86 )
+   env->architecture = "x86";
+#elif defined( __aarch64__ ) || defined( _M_ARM64 )
+   env->architecture = "arm64";
+#elif defined( __arm__ ) || defined( _M_ARM )
+   env->architecture = "arm";
+#else
+   env->architecture = "unknown";
+#endif
+#if defined( __clang__ )
+   snprintf( env->compiler, sizeof( env->compiler ), "clang %s", __clang_version__ );
+#elif defined( __GNUC__ )
+   snprintf( env->compiler, sizeof( env->compiler ), "gcc %s", __VERSION__ );
+#elif defined( _MSC_VER )
+   snprintf( env->compiler, sizeof( env->compiler ), "msvc %d", _MSC_FULL_VER );
+#else
+   snprintf( env->compiler, sizeof( env->compiler ), "unknown" );
+#endif
+#ifndef NDEBUG
+   strncat( env->compiler, " (assertions on)", sizeof( env->compiler ) - strlen( env->compiler ) - 1 );
+#endif
+
+   // The brand string, from CPUID where we have it
+   snprintf( env->cpu, sizeof( env->cpu ), "unknown" );
+#if defined( VUL__BENCHMARK_CPUID_MSVC )
+   __cpuid( ( int* )regs, 0x80000000 );
+   if( regs[ 0 ] >= 0x80000004 ) {
+      for( i = 0; i < 3; ++i ) {
+         __cpuid( ( int* )&regs[ i * 4 ], 0x80000002 + i );
+      }
+#elif defined( VUL__BENCHMARK_CPUID_GCC )
+   if( __get_cpuid_max( 0x80000000, NULL ) >= 0x80000004 ) {
+      for( i = 0; i < 3; ++i ) {
+         __get_cpuid( 0x80000002 + i, &regs[ i * 4 ], &regs[ i * 4 + 1 ], &regs[ i * 4 + 2 ], &regs[ i * 4 + 3 ] );
+      }
+#endif
+#if defined( VUL__BENCHMARK_CPUID_MSVC ) || defined( VUL__BENCHMARK_CPUID_GCC )
+      memcpy( env->cpu, regs, 48 );
+      env->cpu[ 48 ] = 0;
+      for( i = 0; env->cpu[ i ] == ' '; ++i ) ; // Intel pads it at the front
+      memmove( env->cpu, env->cpu + i, strlen( env->cpu + i ) + 1 );
+   }
+#endif
+
+#ifdef VUL_WINDOWS
+   GetSystemInfo( &info );
+   env->cpu_count = ( u32 )info.dwNumberOfProcessors;
+#else
+   env->cpu_count = ( u32 )sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+   env->timestamp = ( u64 )time( NULL );
+}
+
+static const char *vul__benchmark_unit_name( vul_benchmark_unit unit )
+{
+   return unit == VUL_BENCHMARK_MILLIS ? "ms" : "us";
+}
+
+/**
+ * Writes s as a JSON string body.
+ */
+static void vul__benchmark_write_json_string( FILE *f, const char *s )
+{
+   for( ; *s; ++s ) {
+      if( *s == '"' || *s == '\\' ) {
+         fputc( '\\', f );
+         fputc( *s, f );
+      } else if( ( unsigned char )*s < 0x20 ) {
+         fprintf( f, "\\u%04x", ( unsigned char )*s );
+      } else {
+         fputc( *s, f );
+      }
+   }
+}
+
+/**
+ * Fills out[ VUL__BENCHMARK_PERCENTILE_COUNT ] with the nearest rank percentiles of
+ * the samples of a result. Returns 0 if it has none.
+ */
+static u32 vul__benchmark_get_percentiles( const vul_benchmark_result *result, u64 *out )
+{
+   u64 *sorted;
+   u32 i, n, rank;
+
+   n = result->iterations;
+   if( !result->samples || n == 0 ) {
+      return 0;
+   }
+   sorted = ( u64* )malloc( sizeof( u64 ) * n );
+   memcpy( sorted, result->samples, sizeof( u64 ) * n );
+   vul_sort_u64( sorted, n );
+   for( i = 0; i < VUL__BENCHMARK_PERCENTILE_COUNT; ++i ) {
+      rank = ( u32 )ceil( ( f64 )vul__benchmark_percentiles[ i ] / 100.0 * ( f64 )n );
+      out[ i ] = sorted[ rank ? rank - 1 : 0 ];
+   }
+   free( sorted );
+   return 1;
+}
+
+vul_benchmark_report *vul_benchmark_report_create( )
+{
+   vul_benchmark_report *report;
+
+   report = ( vul_benchmark_report* )malloc( sizeof( vul_benchmark_report ) );
+   report->entries = NULL;
+   report->count = report->capacity = 0;
+   return report;
+}
+
+void vul_benchmark_report_destroy( vul_benchmark_report *report )
+{
+   u32 i;
+
+   for( i = 0; i < report->count; ++i ) {
+      free( report->entries[ i ].name );
+      vul_benchmark_result_free( &report->entries[ i ].result );
+   }
+   free( report->entries );
+   free( report );
+}
+
+/**
+ * Appends an empty entry to the report.
+ */
+static vul_benchmark_entry *vul__benchmark_report_push( vul_benchmark_report *report )
+{
+   vul_benchmark_entry *e;
+
+   if( report->count == report->capacity ) {
+      report->capacity = report->capacity ? report->capacity * 2 : 16;
+      report->entries = ( vul_benchmark_entry* )realloc( report->entries,
+                                                         sizeof( vul_benchmark_entry ) * report->capacity );
+   }
+   e = &report->entries[ report->count++ ];
+   memset( e, 0, sizeof( vul_benchmark_entry ) );
+   return e;
+}
+
+void vul_benchmark_report_add( vul_benchmark_report *report, const char *name, const vul_benchmark_result *result )
+{
+   vul_benchmark_entry *e;
+   size_t len;
+
+   e = vul__benchmark_report_push( report );
+   len = strlen( name );
+   e->name = ( char* )malloc( len + 1 );
+   memcpy( e->name, name, len + 1 );
+   e->result = *result;
+   if( result->samples ) {
+      e->result.samples = ( u64* )malloc( sizeof( u64 ) * result->iterations );
+      memcpy( e->result.samples, result->samples, sizeof( u64 ) * result->iterations );
+   }
+}
+
+u32 vul_benchmark_report_write_json( const vul_benchmark_report *report, FILE *f )
+{
+   vul__benchmark_environment env;
+   const vul_benchmark_result *r;
+   u64 percentiles[ VUL__BENCHMARK_PERCENTILE_COUNT ];
+   u32 i, j, first;
+
+   vul__benchmark_get_environment( &env );
+   fprintf( f, "{\n\"environment\":{\"os\":\"%s\",\"architecture\":\"%s\",\"compiler\":\"", env.os, env.architecture );
+   vul__benchmark_write_json_string( f, env.compiler );
+   fprintf( f, "\",\"cpu\":\"" );
+   vul__benchmark_write_json_string( f, env.cpu );
+   fprintf( f, "\",\"cpu_count\":%u,\"timestamp\":%llu},\n\"benchmarks\":[",
+            env.cpu_count, ( unsigned long long )env.timestamp );
+   for( i = 0; i < report->count; ++i ) {
+      r = &report->entries[ i ].result;
+      fprintf( f, "%s\n{\"name\":\"", i ? "," : "" );
+      vul__benchmark_write_json_string( f, report->entries[ i ].name );
+      fprintf( f, "\",\"unit\":\"%s\",\"iterations\":%u,\"mean\":%.17g,\"median\":%llu,\"std_deviation\":%.17g",
+               vul__benchmark_unit_name( r->unit ), r->iterations, r->mean,
+               ( unsigned long long )r->median, r->std_deviation );
+      if( vul__benchmark_get_percentiles( r, percentiles ) ) {
+         fprintf( f, ",\n \"percentiles\":{" );
+         for( j = 0; j < VUL__BENCHMARK_PERCENTILE_COUNT; ++j ) {
+            fprintf( f, "%s\"p%u\":%llu", j ? "," : "", vul__benchmark_percentiles[ j ],
+                     ( unsigned long long )percentiles[ j ] );
+         }
+         fprintf( f, "}" );
+      }
+      fprintf( f, ",\n \"counters\":{" );
+      for( j = 0, first = 1; j < VUL_BENCHMARK_COUNTER_COUNT; ++j ) {
+         if( r->counters.available & VUL_BENCHMARK_COUNTER_BIT( j ) ) {
+            fprintf( f, "%s\"%s\":%.17g", first ? "" : ",", vul_benchmark_counter_name( ( vul_benchmark_counter )j ),
+                     r->counters.per_iteration[ j ] );
+            first = 0;
+         }
+      }
+      fprintf( f, "},\n \"samples\":[" );
+      for( j = 0; r->samples && j < r->iterations; ++j ) {
+         fprintf( f, "%s%llu", j ? "," : "", ( unsigned long long )r->samples[ j ] );
+      }
+      fprintf( f, "]}" );
+   }
+   fprintf( f, "\n]}\n" );
+   return !ferror( f );
+}
+
+u32 vul_benchmark_report_write_csv( const vul_benchmark_report *report, FILE *f )
+{
+   vul__benchmark_environment env;
+   const vul_benchmark_result *r;
+   const char *c;
+   u64 percentiles[ VUL__BENCHMARK_PERCENTILE_COUNT ];
+   u32 i, j, has_percentiles;
+
+   vul__benchmark_get_environment( &env );
+   fprintf( f, "# os: %s\n# architecture: %s\n# compiler: %s\n# cpu: %s\n# cpu_count: %u\n# timestamp: %llu\n",
+            env.os, env.architecture, env.compiler, env.cpu, env.cpu_count, ( unsigned long long )env.timestamp );
+   fprintf( f, "name,unit,iterations,mean,median,std_deviation" );
+   for( j = 0; j < VUL__BENCHMARK_PERCENTILE_COUNT; ++j ) {
+      fprintf( f, ",p%u", vul__benchmark_percentiles[ j ] );
+   }
+   for( j = 0; j < VUL_BENCHMARK_COUNTER_COUNT; ++j ) {
+      fprintf( f, ",%s", vul_benchmark_counter_name( ( vul_benchmark_counter )j ) );
+   }
+   fprintf( f, ",samples\n" );
+
+   for( i = 0; i < report->count; ++i ) {
+      r = &report->entries[ i ].result;
+      fputc( '"', f );
+      for( c = report->entries[ i ].name; *c; ++c ) {
+         if( *c == '"' ) {
+            fputc( '"', f ); // Quotes are doubled
+         }
+         fputc( *c, f );
+      }
+      fprintf( f, "\",%s,%u,%.17g,%llu,%.17g", vul__benchmark_unit_name( r->unit ), r->iterations,
+               r->mean, ( unsigned long long )r->median, r->std_deviation );
+      has_percentiles = vul__benchmark_get_percentiles( r, percentiles );
+      for( j = 0; j < VUL__BENCHMARK_PERCENTILE_COUNT; ++j ) {
+         if( has_percentiles ) {
+            fprintf( f, ",%llu", ( unsigned long long )percentiles[ j ] );
+         } else {
+            fputc( ',', f );
+         }
+      }
+      for( j = 0; j < VUL_BENCHMARK_COUNTER_COUNT; ++j ) {
+         if( r->counters.available & VUL_BENCHMARK_COUNTER_BIT( j ) ) {
+            fprintf( f, ",%.17g", r->counters.per_iteration[ j ] );
+         } else {
+            fputc( ',', f );
+         }
+      }
+      fprintf( f, ",\"" );
+      for( j = 0; r->samples && j < r->iterations; ++j ) {
+         fprintf( f, "%s%llu", j ? " " : "", ( unsigned long long )r->samples[ j ] );
+      }
+      fprintf( f, "\"\n" );
+   }
+   return !ferror( f );
+}
+
+//-------------------------
+// Reading reports back. Only needs to handle JSON, not all of it well.
+//
+
+typedef struct vul__benchmark_json {
+   const char *c;
+   u32 failed;
+} vul__benchmark_json;
+
+static void vul__benchmark_json_space( vul__benchmark_json *j )
+{
+   while( *j->c == ' ' || *j->c == '\t' || *j->c == '\n' || *j->c == '\r' ) {
+      ++j->c;
+   }
+}
+
+/**
+ * Skips whitespace and then ch if it is next. Returns whether it was.
+ */
+static u32 vul__benchmark_json_accept( vul__benchmark_json *j, char ch )
+{
+   vul__benchmark_json_space( j );
+   if( *j->c == ch ) {
+      ++j->c;
+      return 1;
+   }
+   return 0;
+}
+
+static void vul__benchmark_json_expect( vul__benchmark_json *j, char ch )
+{
+   if( !vul__benchmark_json_accept( j, ch ) ) {
+      j->failed = 1;
+   }
+}
+
+/**
+ * Reads a string into a new buffer. Escaped characters outside ASCII become '?'.
+ */
+static char *vul__benchmark_json_string( vul__benchmark_json *j )
+{
+   const char *start;
+   char *str, *o;
+   unsigned int code;
+
+   if( !vul__benchmark_json_accept( j, '"' ) ) {
+      j->failed = 1;
+      return NULL;
+   }
+   // Escapes only shrink, so the raw length is enough
+   for( start = j->c; *j->c && *j->c != '"'; ++j->c ) {
+      if( *j->c == '\\' && j->c[ 1 ] ) {
+         ++j->c;
+      }
+   }
+   if( *j->c != '"' ) {
+      j->failed = 1;
+      return NULL;
+   }
+   str = ( char* )malloc( j->c - start + 1 );
+   for( o = str; start < j->c; ++start ) {
+      if( *start != '\\' ) {
+         *o++ = *start;
+         continue;
+      }
+      switch( *++start ) {
+      case 'n': *o++ = '\n'; break;
+      case 't': *o++ = '\t'; break;
+      case 'r': *o++ = '\r'; break;
+      case 'b': *o++ = '\b'; break;
+      case 'f': *o++ = '\f'; break;
+      case 'u':
+         if( start + 4 < j->c && sscanf( start + 1, "%4x", &code ) == 1 ) {
+            *o++ = code && code < 0x80 ? ( char )code : '?';
+            start += 4;
+         }
+         break;
+      default: *o++ = *start; break;
+      }
+   }
+   *o = 0;
+   ++j->c;
+   return str;
+}
+
+static f64 vul__benchmark_json_number( vul__benchmark_json *j )
+{
+   char *end;
+   f64 v;
+
+   vul__benchmark_json_space( j );
+   v = strtod( j->c, &end );
+   if( end == j->c ) {
+      j->failed = 1;
+   }
+   j->c = end;
+   return v;
+}
+
+/**
+ * Skips any value.
+ */
+static void vul__benchmark_json_skip( vul__benchmark_json *j )
+{
+   char *s;
+
+   vul__benchmark_json_space( j );
+   if( *j->c == '"' ) {
+      s = vul__benchmark_json_string( j );
+      free( s );
+   } else if( vul__benchmark_json_accept( j, '{' ) ) {
+      if( vul__benchmark_json_accept( j, '}' ) ) {
+         return;
+      }
+      do {
+         s = vul__benchmark_json_string( j );
+         free( s );
+         vul__benchmark_json_expect( j, ':' );
+         vul__benchmark_json_skip( j );
+      } while( !j->failed && vul__benchmark_json_accept( j, ',' ) );
+      vul__benchmark_json_expect( j, '}' );
+   } else if( vul__benchmark_json_accept( j, '[' ) ) {
+      if( vul__benchmark_json_accept( j, ']' ) ) {
+         return;
+      }
+      do {
+         vul__benchmark_json_skip( j );
+      } while( !j->failed && vul__benchmark_json_accept( j, ',' ) );
+      vul__benchmark_json_expect( j, ']' );
+   } else if( strncmp( j->c, "true", 4 ) == 0 || strncmp( j->c, "null", 4 ) == 0 ) {
+      j->c += 4;
+   } else if( strncmp( j->c, "false", 5 ) == 0 ) {
+      j->c += 5;
+   } else {
+      vul__benchmark_json_number( j );
+   }
+}
+
+static void vul__benchmark_json_entry( vul__benchmark_json *j, vul_benchmark_entry *e )
+{
+   char *key, *value;
+   u32 count, capacity, i;
+
+   count = capacity = 0;
+   vul__benchmark_json_expect( j, '{' );
+   if( j->failed || vul__benchmark_json_accept( j, '}' ) ) {
+      j->failed = 1; // Needs at least a name
+      return;
+   }
+   do {
+      key = vul__benchmark_json_string( j );
+      vul__benchmark_json_expect( j, ':' );
+      if( j->failed ) {
+         free( key );
+         return;
+      }
+      if( strcmp( key, "name" ) == 0 ) {
+         free( e->name );
+         e->name = vul__benchmark_json_string( j );
+      } else if( strcmp( key, "unit" ) == 0 ) {
+         value = vul__benchmark_json_string( j );
+         e->result.unit = value && strcmp( value, "ms" ) == 0 ? VUL_BENCHMARK_MILLIS : VUL_BENCHMARK_MICROS;
+         free( value );
+      } else if( strcmp( key, "iterations" ) == 0 ) {
+         e->result.iterations = ( u32 )vul__benchmark_json_number( j );
+      } else if( strcmp( key, "mean" ) == 0 ) {
+         e->result.mean = vul__benchmark_json_number( j );
+      } else if( strcmp( key, "median" ) == 0 ) {
+         e->result.median = ( u64 )vul__benchmark_json_number( j );
+      } else if( strcmp( key, "std_deviation" ) == 0 ) {
+         e->result.std_deviation = vul__benchmark_json_number( j );
+      } else if( strcmp( key, "counters" ) == 0 ) {
+         vul__benchmark_json_expect( j, '{' );
+         if( !j->failed && !vul__benchmark_json_accept( j, '}' ) ) {
+            do {
+               value = vul__benchmark_json_string( j );
+               vul__benchmark_json_expect( j, ':' );
+               for( i = 0; value && i < VUL_BENCHMARK_COUNTER_COUNT; ++i ) {
+                  if( strcmp( value, vul_benchmark_counter_name( ( vul_benchmark_counter )i ) ) == 0 ) {
+                     break;
+                  }
+               }
+               if( value && i < VUL_BENCHMARK_COUNTER_COUNT ) {
+                  e->result.counters.available |= VUL_BENCHMARK_COUNTER_BIT( i );
+                  e->result.counters.per_iteration[ i ] = vul__benchmark_json_number( j );
+               } else {
+                  vul__benchmark_json_skip( j );
+               }
+               free( value );
+            } while( !j->failed && vul__benchmark_json_accept( j, ',' ) );
+            vul__benchmark_json_expect( j, '}' );
+         }
+      } else if( strcmp( key, "samples" ) == 0 ) {
+         vul__benchmark_json_expect( j, '[' );
+         if( !j->failed && !vul__benchmark_json_accept( j, ']' ) ) {
+            do {
+               if( count == capacity ) {
+                  capacity = capacity ? capacity * 2 : 64;
+                  e->result.samples = ( u64* )realloc( e->result.samples, sizeof( u64 ) * capacity );
+               }
+               e->result.samples[ count++ ] = ( u64 )vul__benchmark_json_number( j );
+            } while( !j->failed && vul__benchmark_json_accept( j, ',' ) );
+            vul__benchmark_json_expect( j, ']' );
+         }
+      } else {
+         vul__benchmark_json_skip( j );
+      }
+      free( key );
+   } while( !j->failed && vul__benchmark_json_accept( j, ',' ) );
+   vul__benchmark_json_expect( j, '}' );
+
+   // The samples are all of the iterations, or none
+   if( !e->name || ( count && count != e->result.iterations ) ) {
+      j->failed = 1;
+   }
+}
+
+vul_benchmark_report *vul_benchmark_report_read_json( FILE *f )
+{
+   vul_benchmark_report *report;
+   vul__benchmark_json j;
+   char *buffer, *key;
+   size_t size, capacity;
+
+   // Read all of it; it may be a pipe, so we can't ask for the size
+   size = 0;
+   capacity = 4096;
+   buffer = ( char* )malloc( capacity );
+   for( ;; ) {
+      size += fread( buffer + size, 1, capacity - size - 1, f );
+      if( size < capacity - 1 ) {
+         break;
+      }
+      capacity *= 2;
+      buffer = ( char* )realloc( buffer, capacity );
+   }
+   buffer[ size ] = 0;
+
+   report = vul_benchmark_report_create( );
+   j.c = buffer;
+   j.failed = 0;
+   vul__benchmark_json_expect( &j, '{' );
+   if( !j.failed && !vul__benchmark_json_accept( &j, '}' ) ) {
+      do {
+         key = vul__benchmark_json_string( &j );
+         vul__benchmark_json_expect( &j, ':' );
+         if( !j.failed && strcmp( key, "benchmarks" ) == 0 ) {
+            vul__benchmark_json_expect( &j, '[' );
+            if( !j.failed && !vul__benchmark_json_accept( &j, ']' ) ) {
+               do {
+                  vul__benchmark_json_entry( &j, vul__benchmark_report_push( report ) );
+               } while( !j.failed && vul__benchmark_json_accept( &j, ',' ) );
+               vul__benchmark_json_expect( &j, ']' );
+            }
+         } else if( !j.failed ) {
+            vul__benchmark_json_skip( &j );
+         }
+         free( key );
+      } while( !j.failed && vul__benchmark_json_accept( &j, ',' ) );
+      vul__benchmark_json_expect( &j, '}' );
+   }
+   free( buffer );
+   if( j.failed || ferror( f ) ) {
+      vul_benchmark_report_destroy( report );
+      return NULL;
+   }
+   return report;
+}
+
+//-------------------------
+// Comparison
+//
+
+f64 vul_benchmark_mann_whitney( const u64 *a, u32 na, const u64 *b, u32 nb )
+{
+   u64 *sa, *sb, v;
+   u32 i, j, ca, cb;
+   f64 rank, rank_sum_b, ties, n, u, mean, variance, z;
+
+   if( na == 0 || nb == 0 ) {
+      return 1.0;
+   }
+   sa = ( u64* )malloc( sizeof( u64 ) * na );
+   sb = ( u64* )malloc( sizeof( u64 ) * nb );
+   memcpy( sa, a, sizeof( u64 ) * na );
+   memcpy( sb, b, sizeof( u64 ) * nb );
+   vul_sort_u64( sa, na );
+   vul_sort_u64( sb, nb );
+
+   // Walk both in order; a run of equal values all get the mean of their ranks
+   i = j = 0;
+   rank = 1.0;
+   rank_sum_b = ties = 0.0;
+   while( i < na || j < nb ) {
+      v = j == nb || ( i < na && sa[ i ] < sb[ j ] ) ? sa[ i ] : sb[ j ];
+      for( ca = 0; i < na && sa[ i ] == v; ++i, ++ca ) ;
+      for( cb = 0; j < nb && sb[ j ] == v; ++j, ++cb ) ;
+      n = ( f64 )( ca + cb );
+      rank_sum_b += ( f64 )cb * ( rank + ( n - 1.0 ) * 0.5 );
+      ties += n * n * n - n;
+      rank += n;
+   }
+   free( sa );
+   free( sb );
+
+   n = ( f64 )na + ( f64 )nb;
+   u = rank_sum_b - ( f64 )nb * ( ( f64 )nb + 1.0 ) * 0.5;
+   mean = ( f64 )na * ( f64 )nb * 0.5;
+   variance = ( f64 )na * ( f64 )nb / 12.0 * ( ( n + 1.0 ) - ties / ( n * ( n - 1.0 ) ) );
+   if( variance <= 0.0 ) {
+      return 1.0; // All equal
+   }
+   z = ( u - mean - 0.5 ) / sqrt( variance ); // With continuity correction
+   return 0.5 * erfc( z / sqrt( 2.0 ) );
+}
+
+/**
+ * Returns the samples of a result in microseconds, in a new array.
+ */
+static u64 *vul__benchmark_samples_micros( const vul_benchmark_result *r )
+{
+   u64 *s;
+   u32 i;
+
+   s = ( u64* )malloc( sizeof( u64 ) * r->iterations );
+   for( i = 0; i < r->iterations; ++i ) {
+      s[ i ] = r->unit == VUL_BENCHMARK_MILLIS ? r->samples[ i ] * 1000 : r->samples[ i ];
+   }
+   return s;
+}
+
+u32 vul_benchmark_compare( const vul_benchmark_report *baseline, const vul_benchmark_report *current,
+                           f64 alpha, f64 min_change, FILE *out )
+{
+   const vul_benchmark_result *b, *c;
+   const char *verdict;
+   u64 *sb, *sc;
+   u32 i, k, regressions;
+   f64 mb, mc, change, p;
+
+   if( out ) {
+      fprintf( out, "%-40s %14s %14s %9s %9s\n", "Benchmark", "Baseline (us)", "Current (us)", "Change", "p" );
+   }
+   regressions = 0;
+   for( i = 0; i < current->count; ++i ) {
+      c = &current->entries[ i ].result;
+      for( k = 0; k < baseline->count; ++k ) {
+         if( strcmp( baseline->entries[ k ].name, current->entries[ i ].name ) == 0 ) {
+            break;
+         }
+      }
+      if( k == baseline->count ) {
+         if( out ) {
+            fprintf( out, "%-40s %14s %14.1f %9s %9s  new\n", current->entries[ i ].name, "-",
+                     c->unit == VUL_BENCHMARK_MILLIS ? ( f64 )c->median * 1000.0 : ( f64 )c->median, "-", "-" );
+         }
+         continue;
+      }
+      b = &baseline->entries[ k ].result;
+      mb = b->unit == VUL_BENCHMARK_MILLIS ? ( f64 )b->median * 1000.0 : ( f64 )b->median;
+      mc = c->unit == VUL_BENCHMARK_MILLIS ? ( f64 )c->median * 1000.0 : ( f64 )c->median;
+      change = mb > 0.0 ? ( mc - mb ) / mb : ( mc > 0.0 ? 1.0 : 0.0 );
+
+      if( !b->samples || !c->samples ) {
+         verdict = "no samples";
+         p = -1.0;
+      } else {
+         sb = vul__benchmark_samples_micros( b );
+         sc = vul__benchmark_samples_micros( c );
+         p = vul_benchmark_mann_whitney( sb, b->iterations, sc, c->iterations );
+         verdict = "";
+         if( p < alpha && change > min_change ) {
+            verdict = "REGRESSION";
+            ++regressions;
+         } else if( vul_benchmark_mann_whitney( sc, c->iterations, sb, b->iterations ) < alpha
+                    && change < -min_change ) {
+            verdict = "improved";
+         }
+         free( sb );
+         free( sc );
+      }
+      if( out ) {
+         fprintf( out, "%-40s %14.1f %14.1f %+8.1f%% ", current->entries[ i ].name, mb, mc, change * 100.0 );
+         if( p < 0.0 ) {
+            fprintf( out, "%9s", "-" );
+         } else {
+            fprintf( out, "%9.2g", p );
+         }
+         fprintf( out, "  %s\n", verdict );
+      }
+   }
+   return regressions;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,497 @@
+/*
+* Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+*
+* This file describes a generic, indexed priority queue implemented as an
+* array-backed d-ary heap (4-ary by default, define VUL_DARY_HEAP_ARITY to change it).
+*
+* Elements are copied into a contiguous array and never move; the heap itself only
+* shuffles 32-bit indices. Every push returns a handle that stays valid until the
+* element is popped or removed, and can be used to read, decrease the key of, update
+* or remove the element. Handles of removed elements are reused.
+*
+* This has the same interface as vul_priority_heap.h (plus the handle functions), and
+* is usually the better choice: it does no allocation per push and is cache friendly.
+*
+* Define VUL_DEFINE in exactly one compilation unit.
+*
+* ? If public domain is not legally valid in your legal jurisdiction
+*   the MIT licence applies (see the LICENCE file)
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+#ifndef VUL_DARY_HEAP_H
+#define VUL_DARY_HEAP_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef VUL_DATATYPES_CUSTOM_ASSERT
+#include <assert.h>
+#define VUL_DATATYPES_CUSTOM_ASSERT assert
+#endif
+
+#ifndef VUL_TYPES_H
+#include <stdint.h>
+#define u32 uint32_t
+#define b32 uint32_t
+#endif
+
+#ifndef VUL_DARY_HEAP_ARITY
+#define VUL_DARY_HEAP_ARITY 4
+#endif
+
+/**
+ * Marks a handle slot that holds no element.
+ */
+#define VUL_DARY_HEAP_INVALID 0xffffffff
+
+typedef u32 vul_dary_heap_handle;
+
+/**
+ * The heap structure.
+ */
+typedef struct vul_dary_heap {
+   void *data;      // element_size * capacity bytes, indexed by handle
+   u32 *heap;       // Heap order -> handle
+   u32 *position;   // Handle -> heap order, or VUL_DARY_HEAP_INVALID if unused
+   u32 *free_handles;
+
+   u32 size;
+   u32 capacity;
+   u32 handle_count; // Number of handle slots that have ever been used
+   u32 free_count;
+   u32 element_size;
+
+   int ( *comparator )( void *a, void *b );
+
+   void *( *allocator )( size_t size );
+   void ( *deallocator )( void *ptr );
+} vul_dary_heap;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+//-----------------------
+// The external API
+//
+
+/**
+ * Create a new d-ary heap with room for initial_capacity elements (it grows as needed).
+ * Takes a comparison function for elements and memory management functions.
+ */
+vul_dary_heap *vul_dary_heap_create( u32 element_size, u32 initial_capacity,
+                                     int ( *comparison_func )( void* a, void* b ),
+                                     void *( *allocator )( size_t size ),
+                                     void ( *deallocator )( void *ptr ) );
+/**
+ * Returns true if the heap is empty
+ */
+b32 vul_dary_heap_is_empty( vul_dary_heap *heap );
+/**
+ * Destroys a heap
+ */
+void vul_dary_heap_destroy( vul_dary_heap *heap );
+/**
+ * Pushes an element into the heap. Copies the data.
+ * Returns a handle to the element.
+ */
+vul_dary_heap_handle vul_dary_heap_push( vul_dary_heap *heap, void *data );
+/**
+ * Pops the next element out of the heap and copies it to data_out
+ */
+void vul_dary_heap_pop( vul_dary_heap *heap, void *data_out );
+/**
+ * Peeks at the next element of the heap. Returns NULL if the heap is empty.
+ */
+void *vul_dary_heap_peek( vul_dary_heap *heap );
+/**
+ * Returns the handle of the next element of the heap, or VUL_DARY_HEAP_INVALID if empty.
+ */
+vul_dary_heap_handle vul_dary_heap_peek_handle( vul_dary_heap *heap );
+/**
+ * Returns the number of elements in the heap.
+ */
+u32 vul_dary_heap_size( vul_dary_heap *heap );
+/**
+ * Returns true if the handle refers to an element currently in the heap.
+ */
+b32 vul_dary_heap_contains( vul_dary_heap *heap, vul_dary_heap_handle handle );
+/**
+ * Returns a pointer to the element of the given handle. Do not alter the parts
+ * of the element the comparator looks at through this pointer, use
+ * vul_dary_heap_decrease_key or vul_dary_heap_update instead!
+ */
+void *vul_dary_heap_get( vul_dary_heap *heap, vul_dary_heap_handle handle );
+/**
+ * Overwrites the element of the given handle with data, which must not compare
+ * greater than the old element. O(log n).
+ */
+void vul_dary_heap_decrease_key( vul_dary_heap *heap, vul_dary_heap_handle handle, void *data );
+/**
+ * Overwrites the element of the given handle with data, which may compare
+ * both lower or greater than the old element.
+ */
+void vul_dary_heap_update( vul_dary_heap *heap, vul_dary_heap_handle handle, void *data );
+/**
+ * Removes the element of the given handle from the heap. If data_out is not NULL
+ * the element is copied to it.
+ */
+void vul_dary_heap_remove( vul_dary_heap *heap, vul_dary_heap_handle handle, void *data_out );
+/**
+ * Merges two heaps into one. Do not use the old heaps afterwards!
+ * Handles from heap1 remain valid, handles from heap2 are offset by
+ * heap1->handle_count as it was before the merge.
+ */
+vul_dary_heap *vul_dary_heap_merge( vul_dary_heap *heap1, vul_dary_heap *heap2 );
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef b32
+#endif
+
+#endif // VUL_DARY_HEAP_H
+
+#ifdef VUL_DEFINE
+
+#ifndef VUL_TYPES_H
+#define u32 uint32_t
+#define b32 uint32_t
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------
+// Internal helpers
+
+static void *vul__dary_heap_element( vul_dary_heap *heap, u32 handle )
+{
+   return ( char* )heap->data + ( size_t )handle * heap->element_size;
+}
+
+static int vul__dary_heap_compare( vul_dary_heap *heap, u32 a, u32 b )
+{
+   return heap->comparator( vul__dary_heap_element( heap, heap->heap[ a ] ),
+                            vul__dary_heap_element( heap, heap->heap[ b ] ) );
+}
+
+static void vul__dary_heap_set( vul_dary_heap *heap, u32 pos, u32 handle )
+{
+   heap->heap[ pos ] = handle;
+   heap->position[ handle ] = pos;
+}
+
+static void vul__dary_heap_sift_up( vul_dary_heap *heap, u32 pos )
+{
+   u32 handle, parent;
+   void *e;
+
+   handle = heap->heap[ pos ];
+   e = vul__dary_heap_element( heap, handle );
+   while( pos > 0 ) {
+      parent = ( pos - 1 ) / VUL_DARY_HEAP_ARITY;
+      if( heap->comparator( e, vul__dary_heap_element( heap, heap->heap[ parent ] ) ) >= 0 ) {
+         break;
+      }
+      vul__dary_heap_set( heap, pos, heap->heap[ parent ] );
+      pos = parent;
+   }
+   vul__dary_heap_set( heap, pos, handle );
+}
+
+static void vul__dary_heap_sift_down( vul_dary_heap *heap, u32 pos )
+{
+   u32 handle, child, last, best, i;
+   void *e;
+
+   handle = heap->heap[ pos ];
+   e = vul__dary_heap_element( heap, handle );
+   while( 1 ) {
+      child = pos * VUL_DARY_HEAP_ARITY + 1;
+      if( child >= heap->size ) {
+         break;
+      }
+      // Find the smallest child
+      last = child + VUL_DARY_HEAP_ARITY < heap->size ? child + VUL_DARY_HEAP_ARITY : heap->size;
+      best = child;
+      for( i = child + 1; i < last; ++i ) {
+         if( vul__dary_heap_compare( heap, i, best ) < 0 ) {
+            best = i;
+         }
+      }
+      if( heap->comparator( vul__dary_heap_element( heap, heap->heap[ best ] ), e ) >= 0 ) {
+         break;
+      }
+      vul__dary_heap_set( heap, pos, heap->heap[ best ] );
+      pos = best;
+   }
+   vul__dary_heap_set( heap, pos, handle );
+}
+
+static void vul__dary_heap_reserve( vul_dary_heap *heap, u32 capacity )
+{
+   void *odata;
+   u32 *oheap, *oposition, *ofree;
+
+   if( capacity <= heap->capacity ) {
+      return;
+   }
+
+   odata = heap->data;
+   oheap = heap->heap;
+   oposition = heap->position;
+   ofree = heap->free_handles;
+
+   heap->data = heap->allocator( ( size_t )heap->element_size * capacity );
+   heap->heap = ( u32* )heap->allocator( sizeof( u32 ) * capacity );
+   heap->position = ( u32* )heap->allocator( sizeof( u32 ) * capacity );
+   heap->free_handles = ( u32* )heap->allocator( sizeof( u32 ) * capacity );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap->data );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap->heap );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap->position );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap->free_handles );
+
+   if( odata != NULL ) {
+      memcpy( heap->data, odata, ( size_t )heap->element_size * heap->handle_count );
+      memcpy( heap->heap, oheap, sizeof( u32 ) * heap->size );
+      memcpy( heap->position, oposition, sizeof( u32 ) * heap->handle_count );
+      memcpy( heap->free_handles, ofree, sizeof( u32 ) * heap->free_count );
+      heap->deallocator( odata );
+      heap->deallocator( oheap );
+      heap->deallocator( oposition );
+      heap->deallocator( ofree );
+   }
+   heap->capacity = capacity;
+}
+
+static u32 vul__dary_heap_remove_at( vul_dary_heap *heap, u32 pos )
+{
+   u32 handle, last;
+
+   handle = heap->heap[ pos ];
+   last = --heap->size;
+   if( pos != last ) {
+      // Move the last element into the hole and restore the invariant in whichever direction is needed
+      vul__dary_heap_set( heap, pos, heap->heap[ last ] );
+      if( pos > 0 && vul__dary_heap_compare( heap, pos, ( pos - 1 ) / VUL_DARY_HEAP_ARITY ) < 0 ) {
+         vul__dary_heap_sift_up( heap, pos );
+      } else {
+         vul__dary_heap_sift_down( heap, pos );
+      }
+   }
+
+   // Free the handle
+   heap->position[ handle ] = VUL_DARY_HEAP_INVALID;
+   heap->free_handles[ heap->free_count++ ] = handle;
+
+   return handle;
+}
+
+//-------------
+// Public API
+
+vul_dary_heap *vul_dary_heap_create( u32 element_size, u32 initial_capacity,
+                                     int ( *comparison_func )( void* a, void* b ),
+                                     void *( *allocator )( size_t size ),
+                                     void ( *deallocator )( void *ptr ) )
+{
+   vul_dary_heap *heap;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( allocator );
+   heap = ( vul_dary_heap* )allocator( sizeof( vul_dary_heap ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   heap->element_size = element_size;
+   heap->comparator = comparison_func;
+   heap->allocator = allocator;
+   heap->deallocator = deallocator;
+   heap->data = NULL;
+   heap->heap = NULL;
+   heap->position = NULL;
+   heap->free_handles = NULL;
+   heap->size = 0;
+   heap->capacity = 0;
+   heap->handle_count = 0;
+   heap->free_count = 0;
+
+   vul__dary_heap_reserve( heap, initial_capacity > 0 ? initial_capacity : 8 );
+
+   return heap;
+}
+
+b32 vul_dary_heap_is_empty( vul_dary_heap *heap )
+{
+   return heap->size == 0 ? 1 : 0;
+}
+
+void vul_dary_heap_destroy( vul_dary_heap *heap )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+
+   heap->deallocator( heap->data );
+   heap->deallocator( heap->heap );
+   heap->deallocator( heap->position );
+   heap->deallocator( heap->free_handles );
+   heap->deallocator( heap );
+}
+
+vul_dary_heap_handle vul_dary_heap_push( vul_dary_heap *heap, void *data )
+{
+   u32 handle;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+
+   if( heap->free_count > 0 ) {
+      handle = heap->free_handles[ --heap->free_count ];
+   } else {
+      if( heap->handle_count == heap->capacity ) {
+         vul__dary_heap_reserve( heap, heap->capacity * 2 );
+      }
+      handle = heap->handle_count++;
+   }
+   memcpy( vul__dary_heap_element( heap, handle ), data, heap->element_size );
+
+   vul__dary_heap_set( heap, heap->size++, handle );
+   vul__dary_heap_sift_up( heap, heap->size - 1 );
+
+   return handle;
+}
+
+void vul_dary_heap_pop( vul_dary_heap *heap, void *data_out )
+{
+   u32 handle;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap->size != 0 ); // @TODO(thynn): Fail graciously if there's nothing to pop?
+
+   handle = vul__dary_heap_remove_at( heap, 0 );
+   // The slot is free but not overwritten until the next push, so this is safe
+   memcpy( data_out, vul__dary_heap_element( heap, handle ), heap->element_size );
+}
+
+void *vul_dary_heap_peek( vul_dary_heap *heap )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   return heap->size == 0 ? NULL : vul__dary_heap_element( heap, heap->heap[ 0 ] );
+}
+
+vul_dary_heap_handle vul_dary_heap_peek_handle( vul_dary_heap *heap )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   return heap->size == 0 ? VUL_DARY_HEAP_INVALID : heap->heap[ 0 ];
+}
+
+u32 vul_dary_heap_size( vul_dary_heap *heap )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   return heap->size;
+}
+
+b32 vul_dary_heap_contains( vul_dary_heap *heap, vul_dary_heap_handle handle )
+{
+   return handle < heap->handle_count && heap->position[ handle ] != VUL_DARY_HEAP_INVALID;
+}
+
+void *vul_dary_heap_get( vul_dary_heap *heap, vul_dary_heap_handle handle )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( vul_dary_heap_contains( heap, handle ) );
+   return vul__dary_heap_element( heap, handle );
+}
+
+void vul_dary_heap_decrease_key( vul_dary_heap *heap, vul_dary_heap_handle handle, void *data )
+{
+   void *e;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( vul_dary_heap_contains( heap, handle ) );
+   e = vul__dary_heap_element( heap, handle );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap->comparator( data, e ) <= 0 );
+
+   memcpy( e, data, heap->element_size );
+   vul__dary_heap_sift_up( heap, heap->position[ handle ] );
+}
+
+void vul_dary_heap_update( vul_dary_heap *heap, vul_dary_heap_handle handle, void *data )
+{
+   void *e;
+   int c;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( vul_dary_heap_contains( heap, handle ) );
+   e = vul__dary_heap_element( heap, handle );
+   c = heap->comparator( data, e );
+
+   memcpy( e, data, heap->element_size );
+   if( c < 0 ) {
+      vul__dary_heap_sift_up( heap, heap->position[ handle ] );
+   } else if( c > 0 ) {
+      vul__dary_heap_sift_down( heap, heap->position[ handle ] );
+   }
+}
+
+void vul_dary_heap_remove( vul_dary_heap *heap, vul_dary_heap_handle handle, void *data_out )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( vul_dary_heap_contains( heap, handle ) );
+
+   vul__dary_heap_remove_at( heap, heap->position[ handle ] );
+   if( data_out != NULL ) {
+      memcpy( data_out, vul__dary_heap_element( heap, handle ), heap->element_size );
+   }
+}
+
+vul_dary_heap *vul_dary_heap_merge( vul_dary_heap *heap1, vul_dary_heap *heap2 )
+{
+   u32 offset, i, handle;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( heap1 );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap2 );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap1->element_size == heap2->element_size );
+
+   // Append heap2's handle slots after heap1's, so we can keep heap1 and reuse its arrays
+   offset = heap1->handle_count;
+   vul__dary_heap_reserve( heap1, heap1->handle_count + heap2->handle_count );
+   memcpy( vul__dary_heap_element( heap1, offset ), heap2->data,
+           ( size_t )heap2->element_size * heap2->handle_count );
+   for( i = 0; i < heap2->handle_count; ++i ) {
+      heap1->position[ offset + i ] = VUL_DARY_HEAP_INVALID;
+   }
+   for( i = 0; i < heap2->free_count; ++i ) {
+      heap1->free_handles[ heap1->free_count++ ] = heap2->free_handles[ i ] + offset;
+   }
+   heap1->handle_count += heap2->handle_count;
+
+   // Append heap2's elements, then heapify bottom-up, which is linear in the total size
+   for( i = 0; i < heap2->size; ++i ) {
+      handle = heap2->heap[ i ] + offset;
+      vul__dary_heap_set( heap1, heap1->size++, handle );
+   }
+   if( heap1->size > 1 ) {
+      i = ( heap1->size - 2 ) / VUL_DARY_HEAP_ARITY + 1;
+      while( i-- > 0 ) {
+         vul__dary_heap_sift_down( heap1, i );
+      }
+   }
+
+   vul_dary_heap_destroy( heap2 );
+
+   return heap1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef b32
+#endif
+
+#endif // VUL_DEFINE
@@ -6,8 +6,15 @@
  * The hash function used is given in the constructor, allowing this implementation
  * to be released under the licence (or lack thereof) described above while
  * still being able to take advantage of hash fucntions by smarter people than me.
- * @TODO: Dynamic slot-resizing; like resizable array, if population reaches a threshold,
- *        grow the bucket_count and rehash all elements into new buckets.
+ *
+ * When the number of elements exceeds bucket_count * factor the bucket array is doubled
+ * and all elements are relinked into their new buckets (the hash of each element is stored
+ * in its node, so keys are not rehashed). Set factor to 0 after creation to disable growth.
+ * The default factor may be overridden by defining VUL_HASH_MAP_LINKED_LIST_LOAD_FACTOR.
+ * Chain nodes are taken from slabs owned by the map instead of being allocated one by one;
+ * removed nodes are kept on a free list and reused, and all slabs are freed on destroy.
+ * The first slab holds VUL_HASH_MAP_LINKED_LIST_FIRST_SLAB nodes (may be overridden) and
+ * each following slab is twice the size of the previous one.
  *
  * For fast, good hash functions, these should be equivalent:
  *  - http://www.azillionmonkeys.com/qed/hash.html : LGPL 2.1
@@ -52,34 +59,68 @@
 #include <stdint.h>
 #define u32 uint32_t
 #define u8 uint8_t
+#define f32 float
+#endif
+
+#ifndef VUL_HASH_MAP_LINKED_LIST_LOAD_FACTOR
+#define VUL_HASH_MAP_LINKED_LIST_LOAD_FACTOR 1.f
+#endif
+
+#ifndef VUL_HASH_MAP_LINKED_LIST_FIRST_SLAB
+#define VUL_HASH_MAP_LINKED_LIST_FIRST_SLAB 16
 #endif
 
 typedef u32 ( *vul_hash_function )( const u8* data, u32 len );
 
+typedef struct vul_hash_map_element {
+   void *key;
+   void *data;
+
+   u32 key_size;
+   u32 data_size;
+} vul_hash_map_element;
+
+/**
+ * A chain node. The list element links the chain and points its data at element,
+ * so the map's buckets remain valid vul_linked_list lists.
+ */
+typedef struct vul__hash_map_node {
+   vul_list_element link;
+   vul_hash_map_element element;
+   u32 hash;
+} vul__hash_map_node;
+
+/**
+ * A slab of nodes. The nodes follow the header in the same allocation.
+ */
+typedef struct vul__hash_map_slab {
+   struct vul__hash_map_slab *next;
+   u32 count;
+} vul__hash_map_slab;
+
 typedef struct vul_hash_map {
    u32 bucket_count;
    vul_list_element **buckets;
+   u32 count;
+   f32 factor; // Maximum elements per bucket before we grow. 0 disables growth.
    vul_hash_function hash;
    int (*comparator)( void* a, void *b ); // Comparison function
 
+   /* Node pool */
+   vul__hash_map_slab *slabs;
+   vul__hash_map_node *free_nodes; // Linked through link.next
+   u32 slab_used;                  // Nodes handed out from the newest slab
+
    /* Memory management functions */
    void *( *allocator )( size_t size );
    void  ( *deallocator )( void *ptr );
 } vul_hash_map;
 
-typedef struct vul_hash_map_element {
-   void *key;
-   void *data;
-
-   u32 key_size;
-   u32 data_size;
-} vul_hash_map_element;
-
 #ifdef __cplusplus
 extern "C" {
 #endif
 /**
- * Creates a new hash map. Takes the number of slots to use, the hash function
+ * Creates a new hash map. Takes the initial number of slots to use, the hash function
  * and a comparison function as arguments.
  * The comparison function takes an entire vul_hash_map_element (casted to a void*) as it's input.
  * but must only compare keys. This is both natural, and demanded by the get/get_const functions, which only
@@ -109,6 +150,10 @@ vul_hash_map_element *vul_map_get( vul_hash_map *map, void *key, u32 key_size );
  * Returns NULL if no matching element is found.
  */
 const vul_hash_map_element *vul_map_get_const( vul_hash_map *map, void *key, u32 key_size );
+/**
+ * Returns the number of elements in the map.
+ */
+u32 vul_map_size( vul_hash_map *map );
 /**
  * Destroys the given has map, deallocating all it's used memory.
  */
@@ -127,6 +172,7 @@ void vul_map_iterate( vul_hash_map *map, void ( *func )( vul_list_element *e ) )
 #ifndef VUL_TYPES_H
 #undef u32
 #undef u8
+#undef f32
 #endif
 
 #endif // VUL_HASH_MAP_LINKED_LIST_H
@@ -136,12 +182,121 @@ void vul_map_iterate( vul_hash_map *map, void ( *func )( vul_list_element *e ) )
 #ifndef VUL_TYPES_H
 #define u32 uint32_t
 #define u8 uint8_t
+#define f32 float
 #endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+//--------------------
+// Internal helpers
+
+static vul__hash_map_node *vul__map_slab_nodes( vul__hash_map_slab *slab )
+{
+   return ( vul__hash_map_node* )( slab + 1 );
+}
+
+static vul__hash_map_node *vul__map_node_alloc( vul_hash_map *map )
+{
+   vul__hash_map_slab *slab;
+   vul__hash_map_node *n;
+   u32 count;
+
+   // Reuse removed nodes first
+   if( map->free_nodes != NULL ) {
+      n = map->free_nodes;
+      map->free_nodes = ( vul__hash_map_node* )n->link.next;
+      return n;
+   }
+
+   // Allocate a new slab when the newest one is used up. Each slab is twice the size
+   // of the previous one, so the number of allocations is logarithmic in the element count.
+   if( map->slabs == NULL || map->slab_used == map->slabs->count ) {
+      count = map->slabs != NULL ? map->slabs->count * 2
+                                 : VUL_HASH_MAP_LINKED_LIST_FIRST_SLAB;
+      slab = ( vul__hash_map_slab* )map->allocator( sizeof( vul__hash_map_slab ) 
+                                                   + sizeof( vul__hash_map_node ) * count );
+      VUL_DATATYPES_CUSTOM_ASSERT( slab != NULL ); // Make sure allocation didn't fail
+      slab->count = count;
+      slab->next = map->slabs;
+      map->slabs = slab;
+      map->slab_used = 0;
+   }
+
+   return &vul__map_slab_nodes( map->slabs )[ map->slab_used++ ];
+}
+
+static void vul__map_node_free( vul_hash_map *map, vul__hash_map_node *n )
+{
+#ifdef VUL_DEBUG
+   memset( n, 0, sizeof( vul__hash_map_node ) );
+#endif
+   n->link.next = ( vul_list_element* )map->free_nodes;
+   map->free_nodes = n;
+}
+
+static void vul__map_link( vul_hash_map *map, u32 bucket, vul__hash_map_node *n )
+{
+   vul_list_element *before, *head;
+
+   head = map->buckets[ bucket ];
+   n->link.prev = NULL;
+   n->link.next = NULL;
+   if( head == NULL ) {
+      map->buckets[ bucket ] = &n->link;
+      return;
+   }
+
+   // Keep the chain sorted and stable, like vul_list_insert does
+   before = vul_list_find( head, n->link.data, map->comparator );
+   if( before == NULL ) {
+      // New head
+      n->link.next = head;
+      head->prev = &n->link;
+      map->buckets[ bucket ] = &n->link;
+   } else {
+      n->link.prev = before;
+      n->link.next = before->next;
+      if( before->next != NULL ) {
+         before->next->prev = &n->link;
+      }
+      before->next = &n->link;
+   }
+}
+
+static void vul__map_grow( vul_hash_map *map )
+{
+   vul_list_element **obuckets, *e, *next;
+   vul__hash_map_node *n;
+   u32 ocount, b;
+
+   obuckets = map->buckets;
+   ocount = map->bucket_count;
+
+   map->bucket_count *= 2;
+   map->buckets = ( vul_list_element** )map->allocator( sizeof( vul_list_element* ) * map->bucket_count );
+   VUL_DATATYPES_CUSTOM_ASSERT( map->buckets != NULL ); // Make sure allocation didn't fail
+   memset( map->buckets, 0, sizeof( vul_list_element* ) * map->bucket_count );
+
+   // Relink all nodes into their new buckets; no node is moved or reallocated,
+   // so element pointers returned earlier remain valid.
+   for( b = 0; b < ocount; ++b ) {
+      e = obuckets[ b ];
+      while( e != NULL ) {
+         next = e->next;
+         n = ( vul__hash_map_node* )e;
+         vul__map_link( map, n->hash % map->bucket_count, n );
+         e = next;
+      }
+   }
+
+   map->deallocator( obuckets );
+}
+
+//-------------
+// Public API
+
 vul_hash_map *vul_map_create( u32 bucket_count,
                               vul_hash_function hash_function,
                               int( *comparator )( void* a, void *b ),
@@ -149,50 +304,49 @@ vul_hash_map *vul_map_create( u32 bucket_count,
                               void( *deallocator )( void *ptr ) )
 {
    vul_hash_map *map;
-   u32 i;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( bucket_count > 0 );
 
    map = ( vul_hash_map* )allocator( sizeof( vul_hash_map ) );
    VUL_DATATYPES_CUSTOM_ASSERT( map != NULL ); // Make sure allocation didn't fail
    map->bucket_count = bucket_count;
+   map->count = 0;
+   map->factor = VUL_HASH_MAP_LINKED_LIST_LOAD_FACTOR;
    map->hash = hash_function;
    map->comparator = comparator;
    map->buckets = ( vul_list_element** )allocator( sizeof( vul_list_element* ) * bucket_count );
+   map->slabs = NULL;
+   map->free_nodes = NULL;
+   map->slab_used = 0;
    map->allocator = allocator;
    map->deallocator = deallocator;
    VUL_DATATYPES_CUSTOM_ASSERT( map->buckets != NULL ); // Make sure allocation didn't fail
-   for( i = 0; i < bucket_count; ++i )
-   {
-      map->buckets[ i ] = NULL;
-   }
+   memset( map->buckets, 0, sizeof( vul_list_element* ) * bucket_count );
 
    return map;
 }
 
 vul_hash_map_element *vul_map_insert( vul_hash_map *map, const vul_hash_map_element *ref )
 {
-   u32 bucket;
-   vul_list_element *e;
+   vul__hash_map_node *n;
 
-   // Find the bucket
-   bucket = map->hash( ( u8* )ref->key, ref->key_size ) % map->bucket_count;
-
-   // Insert it into the list at that bucket.
-   // vul_list_insert copies entire element, so both data and key.
-   if( map->buckets[ bucket ] == NULL ) {
-      map->buckets[ bucket ] = vul_list_insert( NULL, ( void* )ref, 
-                                                sizeof( vul_hash_map_element ),
-                                                map->comparator, map->allocator );
-      return ( vul_hash_map_element* )map->buckets[ bucket ]->data;
-   } else {
-      e = vul_list_insert( map->buckets[ bucket ], ( void* )ref, 
-                           sizeof( vul_hash_map_element ),
-                           map->comparator, map->allocator );
-      if( e->prev == NULL ) {
-         // We have changed head of the list!
-         map->buckets[ bucket ] = e;
-      }
-      return ( vul_hash_map_element* )e->data;
+   // Grow before inserting if we would exceed the load factor
+   if( map->factor > 0.f && ( f32 )( map->count + 1 ) > ( f32 )map->bucket_count * map->factor ) {
+      vul__map_grow( map );
    }
+
+   // Copy the entire element, so both data and key pointers.
+   n = vul__map_node_alloc( map );
+   n->element = *ref;
+   n->link.data = &n->element;
+   n->link.data_size = sizeof( vul_hash_map_element );
+   n->hash = map->hash( ( u8* )ref->key, ref->key_size );
+
+   // Insert it into the list at its bucket.
+   vul__map_link( map, n->hash % map->bucket_count, n );
+   ++map->count;
+
+   return &n->element;
 }
 
 void vul_map_remove( vul_hash_map *map, const vul_hash_map_element *ref )
@@ -202,6 +356,9 @@ void vul_map_remove( vul_hash_map *map, const vul_hash_map_element *ref )
 
    // Find the bucket
    bucket = map->hash( ( u8* )ref->key, ref->key_size ) % map->bucket_count;
+   if( map->buckets[ bucket ] == NULL ) {
+      return;
+   }
 
    // Find the element
    e = vul_list_find( map->buckets[ bucket ], ( void* )ref, map->comparator );
@@ -211,8 +368,14 @@ void vul_map_remove( vul_hash_map *map, const vul_hash_map_element *ref )
    {
       if( e->prev == NULL ) {
          map->buckets[ bucket ] = e->next;
+      } else {
+         e->prev->next = e->next;
       }
-      vul_list_remove( e, map->deallocator );
+      if( e->next != NULL ) {
+         e->next->prev = e->prev;
+      }
+      vul__map_node_free( map, ( vul__hash_map_node* )e );
+      --map->count;
    }
 }
 
@@ -248,18 +411,24 @@ const vul_hash_map_element *vul_map_get_const( vul_hash_map *map, void *key, u32
    return vul_map_get( map, key, key_size );
 }
 
-void vul_map_destroy( vul_hash_map *map )
+u32 vul_map_size( vul_hash_map *map )
 {
-   u32 b;
+   return map->count;
+}
 
-   for( b = 0; b < map->bucket_count; ++b )
-   {
-      if( map->buckets[ b ] != NULL )
-      {
-         vul_list_destroy( map->buckets[ b ], map->deallocator );
-         map->buckets[ b ] = NULL;
-      }
+void vul_map_destroy( vul_hash_map *map )
+{
+   vul__hash_map_slab *slab, *next;
+
+   // All nodes live in the slabs, so we only free those
+   slab = map->slabs;
+   while( slab != NULL ) {
+      next = slab->next;
+      map->deallocator( slab );
+      slab = next;
    }
+   map->slabs = NULL;
+   map->free_nodes = NULL;
 
    map->deallocator( map->buckets );
    map->buckets = NULL;
@@ -287,6 +456,7 @@ void vul_map_iterate( vul_hash_map *map, void ( *func )( vul_list_element *e ) )
 #ifndef VUL_TYPES_H
 #undef u32
 #undef u8
+#undef f32
 #endif
 
 #endif // VUL_DEFINE
@@ -3,6 +3,14 @@
  *
  * This file describes a doubly linked list.
  * 
+ * Besides the plain list (vul_list_element, where every insert allocates the element
+ * and a copy of the data) there are two allocation free alternatives:
+ *  - Pooled elements (vul_list_pool): the element and its data share one slot in a
+ *    pool of fixed size slots, and removed elements go on a free list for reuse.
+ *  - Intrusive lists (vul_list_intrusive): the links are a vul_list_node embedded in
+ *    the user's own struct, so the list never allocates at all. Good for LRU caches
+ *    where the same objects move around between lists.
+ * 
  * ? If public domain is not legally valid in your legal jurisdiction
  *   the MIT licence applies (see the LICENCE file)
  *
@@ -18,6 +26,7 @@
 #define VUL_LINKED_LIST_H
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 
 #ifndef VUL_DATATYPES_CUSTOM_ASSERT
@@ -28,6 +37,7 @@
 #ifndef VUL_TYPES_H
 #include <stdint.h>
 #define u32 uint32_t
+#define u8 uint8_t
 #endif
 
 /**
@@ -43,6 +53,48 @@ typedef struct vul_list_element
    struct vul_list_element *next;
 } vul_list_element;
 
+/**
+ * A pool of fixed size list elements with room for data_size bytes of data each.
+ * Slots are allocated elements_per_block at a time and never returned before
+ * vul_list_pool_destroy; freed slots are reused before new blocks are allocated.
+ */
+typedef struct vul_list_pool
+{
+   u8 *blocks; // Each block starts with a pointer to the next block
+   vul_list_element *free_list; // Linked through next
+   u32 data_size;
+   u32 stride;
+   u32 elements_per_block;
+
+   void *( *allocator )( size_t size );
+   void ( *deallocator )( void *ptr );
+} vul_list_pool;
+
+/**
+ * The links of an intrusive list. Embed it in a struct and get back to the struct
+ * with VUL_LIST_CONTAINER_OF. A node may be in one list at a time.
+ */
+typedef struct vul_list_node
+{
+   struct vul_list_node *prev;
+   struct vul_list_node *next;
+} vul_list_node;
+
+/**
+ * An intrusive list. The list is circular through the sentinel head, so there are
+ * no special cases for the ends.
+ */
+typedef struct vul_list_intrusive
+{
+   vul_list_node head;
+   u32 count;
+} vul_list_intrusive;
+
+/**
+ * Returns the struct of the given type containing the given node as member.
+ */
+#define VUL_LIST_CONTAINER_OF( node, type, member ) ( ( type* )( ( char* )( node ) - offsetof( type, member ) ) )
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -94,12 +146,108 @@ void vul_list_destroy( vul_list_element *list_head, void ( *deallocator )( void
  * Creates a copy of the given list.
  */
 vul_list_element *vul_list_copy( vul_list_element *list_head, void *( *allocator )( size_t size ) );
+
+//--------------------
+// Pooled elements
+
+/**
+ * Initializes a pool of elements holding data_size bytes of data each, which allocates
+ * elements_per_block elements at a time.
+ */
+void vul_list_pool_initialize( vul_list_pool *pool, u32 data_size, u32 elements_per_block,
+                               void *( *allocator )( size_t size ), void ( *deallocator )( void *ptr ) );
+/**
+ * Makes sure at least count elements can be taken from the pool without allocating.
+ */
+void vul_list_pool_reserve( vul_list_pool *pool, u32 count );
+/**
+ * Frees all memory of the pool. Every list using it becomes invalid.
+ */
+void vul_list_pool_destroy( vul_list_pool *pool );
+/**
+ * Creates a new element from the pool and adds it after the given element, or creates a
+ * new list if e is NULL. Copies pool->data_size bytes of data into the element.
+ */
+vul_list_element *vul_list_add_after_pooled( vul_list_element *e, void *data, vul_list_pool *pool );
+/**
+ * As vul_list_insert, with the element taken from the pool.
+ */
+vul_list_element *vul_list_insert_pooled( vul_list_element *list_head, void *data,
+                                          int( *comparator )( void *a, void *b ),
+                                          vul_list_pool *pool );
+/**
+ * Removes the given element from its list and returns it to the pool.
+ */
+void vul_list_remove_pooled( vul_list_element *e, vul_list_pool *pool );
+/**
+ * Returns all elements of the list to the pool.
+ */
+void vul_list_destroy_pooled( vul_list_element *list_head, vul_list_pool *pool );
+/**
+ * Creates a copy of the given list with elements from the pool.
+ */
+vul_list_element *vul_list_copy_pooled( vul_list_element *list_head, vul_list_pool *pool );
+
+//--------------------
+// Intrusive lists
+
+/**
+ * Initializes an empty intrusive list.
+ */
+void vul_list_intrusive_initialize( vul_list_intrusive *list );
+/**
+ * Returns the number of nodes in the list. O(1).
+ */
+u32 vul_list_intrusive_size( vul_list_intrusive *list );
+/**
+ * Returns the first/last node of the list, or NULL if it is empty.
+ */
+vul_list_node *vul_list_intrusive_first( vul_list_intrusive *list );
+vul_list_node *vul_list_intrusive_last( vul_list_intrusive *list );
+/**
+ * Returns the node after/before the given one, or NULL at the end of the list.
+ */
+vul_list_node *vul_list_intrusive_next( vul_list_intrusive *list, vul_list_node *node );
+vul_list_node *vul_list_intrusive_prev( vul_list_intrusive *list, vul_list_node *node );
+/**
+ * Links the node in after pos, which must be in the list. node must not be in any list.
+ */
+void vul_list_intrusive_insert_after( vul_list_intrusive *list, vul_list_node *pos, vul_list_node *node );
+/**
+ * Links the node in before pos, which must be in the list. node must not be in any list.
+ */
+void vul_list_intrusive_insert_before( vul_list_intrusive *list, vul_list_node *pos, vul_list_node *node );
+/**
+ * Links the node in at the front/back of the list. node must not be in any list.
+ */
+void vul_list_intrusive_push_front( vul_list_intrusive *list, vul_list_node *node );
+void vul_list_intrusive_push_back( vul_list_intrusive *list, vul_list_node *node );
+/**
+ * Unlinks the node from the list. Nothing is freed.
+ */
+void vul_list_intrusive_remove( vul_list_intrusive *list, vul_list_node *node );
+/**
+ * Unlinks and returns the first/last node, or NULL if the list is empty.
+ */
+vul_list_node *vul_list_intrusive_pop_front( vul_list_intrusive *list );
+vul_list_node *vul_list_intrusive_pop_back( vul_list_intrusive *list );
+/**
+ * Moves a node that is in the list to the front of it; the "touch" of an LRU cache.
+ */
+void vul_list_intrusive_move_to_front( vul_list_intrusive *list, vul_list_node *node );
+/**
+ * Inserts the node while keeping the list sorted and stable: it goes after all
+ * nodes it is not smaller than. comparator gets the nodes themselves.
+ */
+void vul_list_intrusive_insert_sorted( vul_list_intrusive *list, vul_list_node *node,
+                                       int (*comparator)( vul_list_node *a, vul_list_node *b ) );
 #ifdef __cplusplus
 }
 #endif
 
 #ifndef VUL_TYPES_H
 #undef u32
+#undef u8
 #endif
 
 #endif // VUL_LINKED_LIST_H
@@ -108,25 +256,18 @@ vul_list_element *vul_list_copy( vul_list_element *list_head, void *( *allocator
 
 #ifndef VUL_TYPES_H
 #define u32 uint32_t
+#define u8 uint8_t
 #endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-vul_list_element *vul__list_add_after( vul_list_element *e, 
-                                       void *data, u32 data_size,
-                                       void *( *allocator )( size_t size ) )
+/**
+ * Links ret in after e, or makes it a list of its own if e is NULL.
+ */
+static void vul__list_link_after( vul_list_element *e, vul_list_element *ret )
 {
-   vul_list_element *ret;
-
-   ret = ( vul_list_element* )allocator( sizeof( vul_list_element ) );
-   VUL_DATATYPES_CUSTOM_ASSERT( ret != NULL ); // Make sure malloc didn't fail
-   ret->data = allocator( data_size );
-   VUL_DATATYPES_CUSTOM_ASSERT( ret->data != NULL ); // Make sure malloc didn't fail
-   ret->data_size = data_size;
-   memcpy( ret->data, data, data_size );
-
    if ( e != NULL )
    {
       ret->prev = e;
@@ -143,6 +284,22 @@ vul_list_element *vul__list_add_after( vul_list_element *e,
       ret->prev = NULL;
       ret->next = NULL;
    }
+}
+
+vul_list_element *vul__list_add_after( vul_list_element *e, 
+                                       void *data, u32 data_size,
+                                       void *( *allocator )( size_t size ) )
+{
+   vul_list_element *ret;
+
+   ret = ( vul_list_element* )allocator( sizeof( vul_list_element ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( ret != NULL ); // Make sure malloc didn't fail
+   ret->data = allocator( data_size );
+   VUL_DATATYPES_CUSTOM_ASSERT( ret->data != NULL ); // Make sure malloc didn't fail
+   ret->data_size = data_size;
+   memcpy( ret->data, data, data_size );
+
+   vul__list_link_after( e, ret );
 
    return ret;
 }
@@ -276,12 +433,284 @@ vul_list_element *vul_list_copy( vul_list_element *list_head, void *( *allocator
    return nhead;
 }
 
+//--------------------
+// Pooled elements
+
+// Keeps the data in each slot, and each block's elements, 16 byte aligned
+#define VUL__LIST_POOL_ALIGN( x ) ( ( ( x ) + 15 ) & ~( size_t )15 )
+
+void vul_list_pool_initialize( vul_list_pool *pool, u32 data_size, u32 elements_per_block,
+                               void *( *allocator )( size_t size ), void ( *deallocator )( void *ptr ) )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( elements_per_block > 0 );
+
+   pool->blocks = NULL;
+   pool->free_list = NULL;
+   pool->data_size = data_size;
+   pool->stride = ( u32 )VUL__LIST_POOL_ALIGN( VUL__LIST_POOL_ALIGN( sizeof( vul_list_element ) ) + data_size );
+   pool->elements_per_block = elements_per_block;
+   pool->allocator = allocator;
+   pool->deallocator = deallocator;
+}
+
+/**
+ * Allocates one more block and puts all its slots on the free list.
+ */
+static void vul__list_pool_grow( vul_list_pool *pool )
+{
+   vul_list_element *e;
+   u8 *block;
+   u32 i;
+
+   block = ( u8* )pool->allocator( VUL__LIST_POOL_ALIGN( sizeof( u8* ) )
+                                   + ( size_t )pool->stride * pool->elements_per_block );
+   VUL_DATATYPES_CUSTOM_ASSERT( block != NULL ); // Make sure malloc didn't fail
+   *( u8** )block = pool->blocks;
+   pool->blocks = block;
+
+   // Push in reverse, so slots are handed out in address order
+   block += VUL__LIST_POOL_ALIGN( sizeof( u8* ) );
+   for( i = pool->elements_per_block; i > 0; --i ) {
+      e = ( vul_list_element* )( block + ( size_t )( i - 1 ) * pool->stride );
+      e->data = ( u8* )e + VUL__LIST_POOL_ALIGN( sizeof( vul_list_element ) );
+      e->data_size = pool->data_size;
+      e->next = pool->free_list;
+      pool->free_list = e;
+   }
+}
+
+void vul_list_pool_reserve( vul_list_pool *pool, u32 count )
+{
+   vul_list_element *e;
+   u32 available;
+
+   available = 0;
+   for( e = pool->free_list; e != NULL && available < count; e = e->next ) {
+      ++available;
+   }
+   while( available < count ) {
+      vul__list_pool_grow( pool );
+      available += pool->elements_per_block;
+   }
+}
+
+void vul_list_pool_destroy( vul_list_pool *pool )
+{
+   u8 *next;
+
+   while( pool->blocks != NULL ) {
+      next = *( u8** )pool->blocks;
+      pool->deallocator( pool->blocks );
+      pool->blocks = next;
+   }
+   pool->free_list = NULL;
+}
+
+vul_list_element *vul_list_add_after_pooled( vul_list_element *e, void *data, vul_list_pool *pool )
+{
+   vul_list_element *ret;
+
+   if( pool->free_list == NULL ) {
+      vul__list_pool_grow( pool );
+   }
+   ret = pool->free_list;
+   pool->free_list = ret->next;
+   memcpy( ret->data, data, pool->data_size );
+
+   vul__list_link_after( e, ret );
+
+   return ret;
+}
+
+vul_list_element *vul_list_insert_pooled( vul_list_element *list_head, void *data,
+                                          int( *comparator )( void *a, void *b ),
+                                          vul_list_pool *pool )
+{
+   vul_list_element *before, *ret;
+
+   if( list_head == NULL ) {
+      return vul_list_add_after_pooled( NULL, data, pool );
+   }
+   before = vul_list_find( list_head, data, comparator );
+   ret = vul_list_add_after_pooled( before, data, pool );
+   if( before == NULL ) {
+      ret->next = list_head;
+      list_head->prev = ret;
+   }
+   return ret;
+}
+
+void vul_list_remove_pooled( vul_list_element *e, vul_list_pool *pool )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( e != NULL );
+
+   if( e->prev != NULL ) {
+      e->prev->next = e->next;
+   }
+   if( e->next != NULL ) {
+      e->next->prev = e->prev;
+   }
+   e->prev = NULL;
+   e->next = pool->free_list;
+   pool->free_list = e;
+}
+
+void vul_list_destroy_pooled( vul_list_element *list_head, vul_list_pool *pool )
+{
+   vul_list_element *next;
+
+   while( list_head != NULL ) {
+      next = list_head->next;
+      list_head->prev = NULL;
+      list_head->next = pool->free_list;
+      pool->free_list = list_head;
+      list_head = next;
+   }
+}
+
+vul_list_element *vul_list_copy_pooled( vul_list_element *list_head, vul_list_pool *pool )
+{
+   vul_list_element *nhead, *n;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( list_head->data_size == pool->data_size );
+   nhead = vul_list_add_after_pooled( NULL, list_head->data, pool );
+   n = nhead;
+   while( list_head->next ) {
+      list_head = list_head->next;
+      n = vul_list_add_after_pooled( n, list_head->data, pool );
+   }
+
+   return nhead;
+}
+
+#undef VUL__LIST_POOL_ALIGN
+
+//--------------------
+// Intrusive lists
+
+void vul_list_intrusive_initialize( vul_list_intrusive *list )
+{
+   list->head.prev = &list->head;
+   list->head.next = &list->head;
+   list->count = 0;
+}
+
+u32 vul_list_intrusive_size( vul_list_intrusive *list )
+{
+   return list->count;
+}
+
+vul_list_node *vul_list_intrusive_first( vul_list_intrusive *list )
+{
+   return list->head.next != &list->head ? list->head.next : NULL;
+}
+
+vul_list_node *vul_list_intrusive_last( vul_list_intrusive *list )
+{
+   return list->head.prev != &list->head ? list->head.prev : NULL;
+}
+
+vul_list_node *vul_list_intrusive_next( vul_list_intrusive *list, vul_list_node *node )
+{
+   return node->next != &list->head ? node->next : NULL;
+}
+
+vul_list_node *vul_list_intrusive_prev( vul_list_intrusive *list, vul_list_node *node )
+{
+   return node->prev != &list->head ? node->prev : NULL;
+}
+
+void vul_list_intrusive_insert_after( vul_list_intrusive *list, vul_list_node *pos, vul_list_node *node )
+{
+   node->prev = pos;
+   node->next = pos->next;
+   pos->next->prev = node;
+   pos->next = node;
+   ++list->count;
+}
+
+void vul_list_intrusive_insert_before( vul_list_intrusive *list, vul_list_node *pos, vul_list_node *node )
+{
+   vul_list_intrusive_insert_after( list, pos->prev, node );
+}
+
+void vul_list_intrusive_push_front( vul_list_intrusive *list, vul_list_node *node )
+{
+   vul_list_intrusive_insert_after( list, &list->head, node );
+}
+
+void vul_list_intrusive_push_back( vul_list_intrusive *list, vul_list_node *node )
+{
+   vul_list_intrusive_insert_after( list, list->head.prev, node );
+}
+
+void vul_list_intrusive_remove( vul_list_intrusive *list, vul_list_node *node )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( node != &list->head && list->count > 0 );
+
+   node->prev->next = node->next;
+   node->next->prev = node->prev;
+   // By setting to null we are much more likely to crash if it is removed twice
+   node->prev = NULL;
+   node->next = NULL;
+   --list->count;
+}
+
+vul_list_node *vul_list_intrusive_pop_front( vul_list_intrusive *list )
+{
+   vul_list_node *node;
+
+   node = vul_list_intrusive_first( list );
+   if( node != NULL ) {
+      vul_list_intrusive_remove( list, node );
+   }
+   return node;
+}
+
+vul_list_node *vul_list_intrusive_pop_back( vul_list_intrusive *list )
+{
+   vul_list_node *node;
+
+   node = vul_list_intrusive_last( list );
+   if( node != NULL ) {
+      vul_list_intrusive_remove( list, node );
+   }
+   return node;
+}
+
+void vul_list_intrusive_move_to_front( vul_list_intrusive *list, vul_list_node *node )
+{
+   if( list->head.next == node ) {
+      return;
+   }
+   node->prev->next = node->next;
+   node->next->prev = node->prev;
+   node->prev = &list->head;
+   node->next = list->head.next;
+   list->head.next->prev = node;
+   list->head.next = node;
+}
+
+void vul_list_intrusive_insert_sorted( vul_list_intrusive *list, vul_list_node *node,
+                                       int (*comparator)( vul_list_node *a, vul_list_node *b ) )
+{
+   vul_list_node *pos;
+
+   // Walk from the back, so sorted input appends in O(1)
+   pos = list->head.prev;
+   while( pos != &list->head && comparator( node, pos ) < 0 ) {
+      pos = pos->prev;
+   }
+   vul_list_intrusive_insert_after( list, pos, node );
+}
+
 #ifdef __cplusplus
 }
 #endif
 
 #ifndef VUL_TYPES_H
 #undef u32
+#undef u8
 #endif
 
 #endif // VUL_DEFINE
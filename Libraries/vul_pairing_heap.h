@@ -0,0 +1,391 @@
+/*
+* Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+*
+* This file describes a generic priority queue, implemented as a pairing heap.
+* It has the same interface as vul_priority_heap.h, and is usually faster for mixed
+* push/pop workloads: push and merge are O(1), pop is O(log n) amortized.
+*
+* Nodes store their element inline and are taken from slabs owned by the heap;
+* popped nodes are reused, so a heap in steady state does no allocation.
+*
+* Define VUL_DEFINE in exactly one compilation unit.
+*
+* ? If public domain is not legally valid in your legal jurisdiction
+*   the MIT licence applies (see the LICENCE file)
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+#ifndef VUL_PAIRING_HEAP_H
+#define VUL_PAIRING_HEAP_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef VUL_DATATYPES_CUSTOM_ASSERT
+#include <assert.h>
+#define VUL_DATATYPES_CUSTOM_ASSERT assert
+#endif
+
+#ifndef VUL_TYPES_H
+#include <stdint.h>
+#define u32 uint32_t
+#define b32 uint32_t
+#endif
+
+/**
+ * The internal node representation. The element follows the node in memory.
+ */
+typedef struct vul__pheap_node {
+   struct vul__pheap_node *child;
+   struct vul__pheap_node *sibling; // Also links the free list
+} vul__pheap_node;
+
+/**
+ * A slab of nodes. The nodes follow the header in the same allocation.
+ */
+typedef struct vul__pheap_slab {
+   struct vul__pheap_slab *next;
+   u32 count;
+} vul__pheap_slab;
+
+/**
+ * The pairing heap structure.
+ */
+typedef struct vul_pairing_heap {
+   vul__pheap_node *root;
+
+   u32 size;
+   u32 element_size;
+   u32 node_size;
+
+   vul__pheap_slab *slabs;
+   vul__pheap_node *free_nodes;
+   u32 slab_used;
+
+   int ( *comparator )( void *a, void *b );
+
+   void *( *allocator )( size_t size );
+   void ( *deallocator )( void *ptr );
+} vul_pairing_heap;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+//-----------------------
+// The external API
+//
+
+/**
+ * Create a new pairing heap.
+ * Takes a comparison function for elements and
+ * memory management functions.
+ */
+vul_pairing_heap *vul_pairing_heap_create( u32 element_size,
+                                           int ( *comparison_func )( void* a, void* b ),
+                                           void *( *allocator )( size_t size ),
+                                           void ( *deallocator )( void *ptr ) );
+/**
+ * Returns true if the heap is empty
+ */
+b32 vul_pairing_heap_is_empty( vul_pairing_heap *heap );
+/**
+ * Destroys a pairing heap
+ */
+void vul_pairing_heap_destroy( vul_pairing_heap *heap );
+/**
+ * Pushes an element into the heap. Copies the data.
+ */
+void vul_pairing_heap_push( vul_pairing_heap *heap, void *data );
+/**
+ * Pops the next element out of the heap and copies it to data_out
+ */
+void vul_pairing_heap_pop( vul_pairing_heap *heap, void *data_out );
+/**
+ * Peeks at the next element of the heap
+ */
+void *vul_pairing_heap_peek( vul_pairing_heap *heap );
+/**
+ * Returns the number of elements in the heap.
+ */
+u32 vul_pairing_heap_size( vul_pairing_heap *heap );
+/**
+ * Merges two heaps into one. Do not use the old heaps afterwards!
+ * The heaps must have the same element size and comparator.
+ */
+vul_pairing_heap *vul_pairing_heap_merge( vul_pairing_heap *heap1, vul_pairing_heap *heap2 );
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef b32
+#endif
+
+#endif // VUL_PAIRING_HEAP_H
+
+#ifdef VUL_DEFINE
+
+#ifndef VUL_TYPES_H
+#define u32 uint32_t
+#define b32 uint32_t
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------
+// Internal helpers
+
+static void *vul__pheap_data( vul__pheap_node *n )
+{
+   return n + 1;
+}
+
+static vul__pheap_node *vul__pheap_node_alloc( vul_pairing_heap *heap )
+{
+   vul__pheap_slab *slab;
+   vul__pheap_node *n;
+   u32 count;
+
+   // Reuse popped nodes first
+   if( heap->free_nodes != NULL ) {
+      n = heap->free_nodes;
+      heap->free_nodes = n->sibling;
+      return n;
+   }
+
+   // Grab a new slab, twice the size of the last one, when the newest one is used up
+   if( heap->slabs == NULL || heap->slab_used == heap->slabs->count ) {
+      count = heap->slabs != NULL ? heap->slabs->count * 2 : 16;
+      slab = ( vul__pheap_slab* )heap->allocator( sizeof( vul__pheap_slab )
+                                                  + ( size_t )heap->node_size * count );
+      VUL_DATATYPES_CUSTOM_ASSERT( slab != NULL );
+      slab->count = count;
+      slab->next = heap->slabs;
+      heap->slabs = slab;
+      heap->slab_used = 0;
+   }
+
+   n = ( vul__pheap_node* )( ( char* )( heap->slabs + 1 ) + ( size_t )heap->node_size * heap->slab_used++ );
+   return n;
+}
+
+static vul__pheap_node *vul__pheap_link( vul_pairing_heap *heap, vul__pheap_node *a, vul__pheap_node *b )
+{
+   vul__pheap_node *t;
+
+   if( heap->comparator( vul__pheap_data( b ), vul__pheap_data( a ) ) < 0 ) {
+      t = a; a = b; b = t;
+   }
+   // Make b the first child of a
+   b->sibling = a->child;
+   a->child = b;
+   a->sibling = NULL;
+   return a;
+}
+
+static vul__pheap_node *vul__pheap_combine_siblings( vul_pairing_heap *heap, vul__pheap_node *first )
+{
+   vul__pheap_node *list, *a, *b, *next;
+
+   if( first == NULL ) {
+      return NULL;
+   }
+
+   // First pass: link pairs left to right, collecting the results in reverse order
+   list = NULL;
+   while( first != NULL ) {
+      a = first;
+      b = a->sibling;
+      if( b == NULL ) {
+         a->sibling = list;
+         list = a;
+         break;
+      }
+      next = b->sibling;
+      a = vul__pheap_link( heap, a, b );
+      a->sibling = list;
+      list = a;
+      first = next;
+   }
+
+   // Second pass: link the results right to left
+   a = list;
+   list = list->sibling;
+   a->sibling = NULL;
+   while( list != NULL ) {
+      next = list->sibling;
+      a = vul__pheap_link( heap, a, list );
+      list = next;
+   }
+
+   return a;
+}
+
+//-------------
+// Public API
+
+vul_pairing_heap *vul_pairing_heap_create( u32 element_size,
+                                           int ( *comparison_func )( void* a, void* b ),
+                                           void *( *allocator )( size_t size ),
+                                           void ( *deallocator )( void *ptr ) )
+{
+   vul_pairing_heap *heap;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( allocator );
+   heap = ( vul_pairing_heap* )allocator( sizeof( vul_pairing_heap ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   heap->element_size = element_size;
+   // Keep the nodes pointer aligned
+   heap->node_size = ( u32 )( ( sizeof( vul__pheap_node ) + element_size + sizeof( void* ) - 1 )
+                              & ~( sizeof( void* ) - 1 ) );
+   heap->comparator = comparison_func;
+   heap->allocator = allocator;
+   heap->deallocator = deallocator;
+   heap->root = NULL;
+   heap->size = 0;
+   heap->slabs = NULL;
+   heap->free_nodes = NULL;
+   heap->slab_used = 0;
+
+   return heap;
+}
+
+b32 vul_pairing_heap_is_empty( vul_pairing_heap *heap )
+{
+   return heap->size == 0 ? 1 : 0;
+}
+
+void vul_pairing_heap_destroy( vul_pairing_heap *heap )
+{
+   vul__pheap_slab *slab, *next;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+
+   // All nodes live in the slabs, so no need to walk the heap
+   slab = heap->slabs;
+   while( slab != NULL ) {
+      next = slab->next;
+      heap->deallocator( slab );
+      slab = next;
+   }
+   heap->deallocator( heap );
+}
+
+void vul_pairing_heap_push( vul_pairing_heap *heap, void *data )
+{
+   vul__pheap_node *n;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+
+   n = vul__pheap_node_alloc( heap );
+   n->child = NULL;
+   n->sibling = NULL;
+   memcpy( vul__pheap_data( n ), data, heap->element_size );
+
+   heap->root = heap->root == NULL ? n : vul__pheap_link( heap, heap->root, n );
+   ++heap->size;
+}
+
+void vul_pairing_heap_pop( vul_pairing_heap *heap, void *data_out )
+{
+   vul__pheap_node *n;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap->root ); // @TODO(thynn): Fail graciously if there's nothing to pop?
+
+   n = heap->root;
+   memcpy( data_out, vul__pheap_data( n ), heap->element_size );
+
+   heap->root = vul__pheap_combine_siblings( heap, n->child );
+   --heap->size;
+
+   n->sibling = heap->free_nodes;
+   heap->free_nodes = n;
+}
+
+void *vul_pairing_heap_peek( vul_pairing_heap *heap )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   return heap->root == NULL ? NULL : vul__pheap_data( heap->root );
+}
+
+u32 vul_pairing_heap_size( vul_pairing_heap *heap )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   return heap->size;
+}
+
+vul_pairing_heap *vul_pairing_heap_merge( vul_pairing_heap *heap1, vul_pairing_heap *heap2 )
+{
+   vul__pheap_slab *slab;
+   vul__pheap_node *n;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( heap1 );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap2 );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap1->node_size == heap2->node_size );
+
+   // Link the roots
+   if( heap1->root == NULL ) {
+      heap1->root = heap2->root;
+   } else if( heap2->root != NULL ) {
+      heap1->root = vul__pheap_link( heap1, heap1->root, heap2->root );
+   }
+   heap1->size += heap2->size;
+
+   // heap2's nodes now belong to heap1, so we take its slabs. Keep heap1's newest slab
+   // at the front, since that is the only one we still hand out nodes from.
+   if( heap2->slabs != NULL ) {
+      if( heap1->slabs == NULL ) {
+         heap1->slabs = heap2->slabs;
+         heap1->slab_used = heap2->slab_used;
+      } else {
+         slab = heap2->slabs;
+         while( slab->next != NULL ) {
+            slab = slab->next;
+         }
+         slab->next = heap1->slabs->next;
+         heap1->slabs->next = heap2->slabs;
+
+         // The unused tail of heap2's newest slab would be lost, so put it on the free list
+         while( heap2->slab_used < heap2->slabs->count ) {
+            n = ( vul__pheap_node* )( ( char* )( heap2->slabs + 1 )
+                                      + ( size_t )heap2->node_size * heap2->slab_used++ );
+            n->sibling = heap1->free_nodes;
+            heap1->free_nodes = n;
+         }
+      }
+   }
+   if( heap2->free_nodes != NULL ) {
+      n = heap2->free_nodes;
+      while( n->sibling != NULL ) {
+         n = n->sibling;
+      }
+      n->sibling = heap1->free_nodes;
+      heap1->free_nodes = heap2->free_nodes;
+   }
+
+   heap2->deallocator( heap2 );
+
+   return heap1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef b32
+#endif
+
+#endif // VUL_DEFINE
@@ -418,7 +418,7 @@ void vul_priority_heap_pop( vul_priority_heap *heap, void *data_out )
    VUL_DATATYPES_CUSTOM_ASSERT( heap );
 
    vul__fheap_element *el = vul__fheap_dequeue_min( heap );
-   VUL_DATATYPES_CUSTOM_ASSERT( heap->el ); // @TODO(thynn): Fail graciously if there's nothing to pop?
+   VUL_DATATYPES_CUSTOM_ASSERT( el ); // @TODO(thynn): Fail graciously if there's nothing to pop?
    
    memcpy( data_out, el->data, heap->element_size );
 
@@ -0,0 +1,708 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains an instrumenting zone profiler. Mark zones with
+ * VUL_PROFILE_BEGIN( "name" ) and VUL_PROFILE_END( ), or VUL_PROFILE_SCOPE( "name" )
+ * in C++ (and C with GCC/clang) to end the zone when the scope exits. Zones nest.
+ *
+ * Each thread records timestamped begin/end events into its own single producer ring
+ * buffer, so recording takes no locks and costs a counter read and two stores. The
+ * thread that collects (vul_profiler_collect) drains the rings; do that often enough
+ * (say once a frame) that they don't fill up, or events are dropped. Whole zones are
+ * dropped, never just their begin or end, so the zones that are kept nest correctly.
+ * Collected events can be written as a Chrome trace (load it in chrome://tracing or
+ * Perfetto), or summarized as a flat table per zone name or a call tree per thread.
+ *
+ * The macros compile to nothing unless VUL_PROFILER_ENABLED is defined, so they can
+ * stay in shipping code. Zone and thread names must be string literals, or otherwise
+ * outlive the profiler, since only the pointers are recorded.
+ *
+ * Timestamps come from vul_timer.h's cycle counter and atomics from vul_thread.h;
+ * define VUL_WINDOWS, VUL_LINUX or VUL_OSX.
+ *
+ * Define VUL_DEFINE in exactly one compilation unit.
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_PROFILER_H
+#define VUL_PROFILER_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "vul_timer.h"
+#include "vul_thread.h"
+
+#ifndef VUL_PROFILER_CUSTOM_ASSERT
+#include <assert.h>
+#define VUL_PROFILER_CUSTOM_ASSERT assert
+#endif
+
+#ifndef VUL_TYPES_H
+#include <stdint.h>
+#define u32 uint32_t
+#define u64 uint64_t
+#define f64 double
+#define b32 uint32_t
+#endif
+
+/**
+ * Events each thread's ring buffer holds between collections. Must be a power of two.
+ */
+#ifndef VUL_PROFILER_RING_SIZE
+#define VUL_PROFILER_RING_SIZE 16384
+#endif
+/**
+ * Zones nested deeper than this are left out of the summaries (but not the trace).
+ */
+#ifndef VUL_PROFILER_MAX_DEPTH
+#define VUL_PROFILER_MAX_DEPTH 128
+#endif
+
+#ifdef VUL_PROFILER_ENABLED
+   #define VUL_PROFILE_BEGIN( name ) vul_profiler_begin( name )
+   #define VUL_PROFILE_END( ) vul_profiler_end( )
+   #define VUL_PROFILE_THREAD_NAME( name ) vul_profiler_set_thread_name( name )
+   #define VUL__PROFILE_CONCAT2( a, b ) a##b
+   #define VUL__PROFILE_CONCAT( a, b ) VUL__PROFILE_CONCAT2( a, b )
+   #if defined( __cplusplus )
+      #define VUL_PROFILE_SCOPE( name ) \
+         vul_profile_scope VUL__PROFILE_CONCAT( vul__profile_scope_, __LINE__ )( name )
+   #elif defined( __GNUC__ ) || defined( __clang__ )
+      #define VUL_PROFILE_SCOPE( name ) \
+         const char *VUL__PROFILE_CONCAT( vul__profile_scope_, __LINE__ ) \
+            __attribute__( ( cleanup( vul__profile_scope_end ), unused ) ) = vul__profile_scope_begin( name )
+   #endif
+#else
+   #define VUL_PROFILE_BEGIN( name )
+   #define VUL_PROFILE_END( )
+   #define VUL_PROFILE_THREAD_NAME( name )
+   #define VUL_PROFILE_SCOPE( name )
+#endif
+
+/**
+ * A recorded event. A NULL name marks the end of the innermost open zone.
+ */
+typedef struct vul__profiler_event {
+   u64 time;
+   const char *name;
+} vul__profiler_event;
+
+/**
+ * Per-thread recording state, created on a thread's first event.
+ */
+typedef struct vul__profiler_thread {
+   vul__profiler_event *ring;
+   volatile u32 head;            // Written by the owning thread only
+   volatile u32 tail;            // Written by the collecting thread only
+   volatile u32 dropped;
+   u32 open_depth;               // Recorded zones not yet ended; their ends have room reserved
+   u32 skip_depth;               // Zones being dropped, the outermost one because the ring was full
+   u32 id;
+   const char *volatile name;
+
+   vul__profiler_event *captured; // Drained events, owned by the collecting thread
+   u32 captured_count, captured_capacity;
+
+   struct vul__profiler_thread *next; // Registry link; records live until shutdown
+} vul__profiler_thread;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Sets up the profiler, calibrating vul_timer.h's cycle counter. Call before any
+ * thread records events; events recorded before this are ignored. The allocator and
+ * deallocator must be thread safe.
+ */
+void vul_profiler_initialize( void *( *allocator )( size_t size ),
+                              void( *deallocator )( void *ptr ) );
+/**
+ * Frees everything. No thread may record events during or after this, until the
+ * profiler is initialized again.
+ */
+void vul_profiler_shutdown( );
+/**
+ * Opens a zone on the calling thread. Use the macros instead to let them compile out.
+ */
+void vul_profiler_begin( const char *name );
+/**
+ * Closes the innermost open zone on the calling thread.
+ */
+void vul_profiler_end( );
+/**
+ * Names the calling thread in traces and summaries.
+ */
+void vul_profiler_set_thread_name( const char *name );
+/**
+ * Moves every thread's recorded events into the profiler's storage, making room in
+ * the rings. Only one thread may collect (or call the functions below) at a time.
+ */
+void vul_profiler_collect( );
+/**
+ * Collects and discards everything recorded so far, e.g. to profile only one frame.
+ */
+void vul_profiler_reset( );
+/**
+ * Returns the number of events dropped because a thread's ring was full.
+ */
+u64 vul_profiler_dropped( );
+/**
+ * Collects, then writes every event as Chrome trace_event JSON. Returns false if
+ * writing failed.
+ */
+b32 vul_profiler_write_chrome_trace( FILE *f );
+/**
+ * Collects, then writes a text summary. The flat one has a line per zone name
+ * over all threads, sorted by self time (time not spent in nested zones); a
+ * recursive zone's total counts the nested calls again. The hierarchical one has
+ * a call tree per thread with totals per call path.
+ */
+void vul_profiler_write_summary( FILE *f, b32 hierarchical );
+
+// Used by VUL_PROFILE_SCOPE in C
+const char *vul__profile_scope_begin( const char *name );
+void vul__profile_scope_end( const char **name );
+
+#ifdef __cplusplus
+}
+
+struct vul_profile_scope {
+   vul_profile_scope( const char *name ) { vul_profiler_begin( name ); }
+   ~vul_profile_scope( ) { vul_profiler_end( ); }
+};
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef u64
+#undef f64
+#undef b32
+#endif
+
+#endif // VUL_PROFILER_H
+
+#ifdef VUL_DEFINE
+
+#ifndef VUL_TYPES_H
+#define u32 uint32_t
+#define u64 uint64_t
+#define f64 double
+#define b32 uint32_t
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct vul__profiler_state {
+   vul__profiler_thread *volatile threads;
+   volatile u32 thread_count;
+   volatile u32 active;
+   volatile u32 generation;   // Bumped on initialize, so stale thread-local records are dropped
+   u64 start;
+
+   /* Memory management functions */
+   void *( *allocator )( size_t size );
+   void( *deallocator )( void *ptr );
+} vul__profiler_state;
+
+static vul__profiler_state vul__profiler;
+static VUL_THREAD_LOCAL vul__profiler_thread *vul__profiler_local;
+static VUL_THREAD_LOCAL u32 vul__profiler_local_generation;
+
+/**
+ * A node in the summary call tree. Roots are threads.
+ */
+typedef struct vul__profiler_node {
+   const char *name;
+   u32 parent, first_child, last_child, next_sibling;
+   u32 thread;                // Thread id, for roots
+   u64 calls, inclusive, children;
+} vul__profiler_node;
+
+typedef struct vul__profiler_tree {
+   vul__profiler_node *nodes;
+   u32 count, capacity;
+} vul__profiler_tree;
+
+typedef struct vul__profiler_flat {
+   const char *name;
+   u64 calls, inclusive, self;
+} vul__profiler_flat;
+
+#define VUL__PROFILER_NONE 0xffffffffu
+
+//--------------------
+// Internal helpers
+
+static vul__profiler_thread *vul__profiler_register( )
+{
+   vul__profiler_thread *t;
+
+   t = ( vul__profiler_thread* )vul__profiler.allocator( sizeof( vul__profiler_thread ) );
+   VUL_PROFILER_CUSTOM_ASSERT( t != NULL ); // Make sure allocation didn't fail
+   memset( t, 0, sizeof( vul__profiler_thread ) );
+   t->ring = ( vul__profiler_event* )vul__profiler.allocator( sizeof( vul__profiler_event ) * VUL_PROFILER_RING_SIZE );
+   VUL_PROFILER_CUSTOM_ASSERT( t->ring != NULL ); // Make sure allocation didn't fail
+   t->id = vul_atomic_add_u32( &vul__profiler.thread_count, 1 );
+   do {
+      t->next = ( vul__profiler_thread* )vul_atomic_load_ptr( ( void *volatile* )&vul__profiler.threads );
+   } while( !vul_atomic_cas_ptr( ( void *volatile* )&vul__profiler.threads, t->next, t ) );
+
+   vul__profiler_local = t;
+   vul__profiler_local_generation = vul__profiler.generation;
+   return t;
+}
+
+static void vul__profiler_record( const char *name )
+{
+   vul__profiler_thread *t;
+   u32 h, used;
+
+   if( !vul__profiler.active ) {
+      return;
+   }
+   t = vul__profiler_local;
+   if( t == NULL || vul__profiler_local_generation != vul__profiler.generation ) {
+      t = vul__profiler_register( );
+   }
+
+   h = t->head;
+   used = h - vul_atomic_load_u32( &t->tail );
+   if( name != NULL ) {
+      // A begin needs room for itself and the ends of every open zone, its own included.
+      // Once one is dropped, so is everything inside it.
+      if( t->skip_depth != 0 || used + t->open_depth + 2 > VUL_PROFILER_RING_SIZE ) {
+         ++t->skip_depth;
+         vul_atomic_add_u32( &t->dropped, 1 );
+         return;
+      }
+      ++t->open_depth;
+   } else if( t->skip_depth != 0 ) {
+      --t->skip_depth;
+      vul_atomic_add_u32( &t->dropped, 1 );
+      return;
+   } else if( t->open_depth != 0 ) {
+      --t->open_depth;
+   } else if( used >= VUL_PROFILER_RING_SIZE ) {
+      vul_atomic_add_u32( &t->dropped, 1 ); // An end without a begin, and no room for it
+      return;
+   }
+   t->ring[ h & ( VUL_PROFILER_RING_SIZE - 1 ) ].time = vul_tsc_now( );
+   t->ring[ h & ( VUL_PROFILER_RING_SIZE - 1 ) ].name = name;
+   vul_atomic_store_u32( &t->head, h + 1 );
+}
+
+static void vul__profiler_drain( vul__profiler_thread *t )
+{
+   vul__profiler_event *grown;
+   u32 h, tail, n, capacity;
+
+   tail = t->tail;
+   h = vul_atomic_load_u32( &t->head );
+   n = h - tail;
+   if( n == 0 ) {
+      return;
+   }
+   if( t->captured_count + n > t->captured_capacity ) {
+      capacity = t->captured_capacity ? t->captured_capacity : 1024;
+      while( capacity < t->captured_count + n ) {
+         capacity *= 2;
+      }
+      grown = ( vul__profiler_event* )vul__profiler.allocator( sizeof( vul__profiler_event ) * capacity );
+      VUL_PROFILER_CUSTOM_ASSERT( grown != NULL ); // Make sure allocation didn't fail
+      if( t->captured ) {
+         memcpy( grown, t->captured, sizeof( vul__profiler_event ) * t->captured_count );
+         vul__profiler.deallocator( t->captured );
+      }
+      t->captured = grown;
+      t->captured_capacity = capacity;
+   }
+   for( ; tail != h; ++tail ) {
+      t->captured[ t->captured_count++ ] = t->ring[ tail & ( VUL_PROFILER_RING_SIZE - 1 ) ];
+   }
+   vul_atomic_store_u32( &t->tail, h );
+}
+
+/**
+ * Writes s as a JSON string body.
+ */
+static void vul__profiler_write_json_string( FILE *f, const char *s )
+{
+   for( ; *s; ++s ) {
+      if( *s == '"' || *s == '\\' ) {
+         fputc( '\\', f );
+         fputc( *s, f );
+      } else if( ( unsigned char )*s < 0x20 ) {
+         fprintf( f, "\\u%04x", ( unsigned char )*s );
+      } else {
+         fputc( *s, f );
+      }
+   }
+}
+
+static u32 vul__profiler_tree_add( vul__profiler_tree *tree, const char *name, u32 parent )
+{
+   vul__profiler_node *grown, *n;
+   u32 capacity, i;
+
+   if( tree->count == tree->capacity ) {
+      capacity = tree->capacity ? tree->capacity * 2 : 64;
+      grown = ( vul__profiler_node* )vul__profiler.allocator( sizeof( vul__profiler_node ) * capacity );
+      VUL_PROFILER_CUSTOM_ASSERT( grown != NULL ); // Make sure allocation didn't fail
+      if( tree->nodes ) {
+         memcpy( grown, tree->nodes, sizeof( vul__profiler_node ) * tree->count );
+         vul__profiler.deallocator( tree->nodes );
+      }
+      tree->nodes = grown;
+      tree->capacity = capacity;
+   }
+   i = tree->count++;
+   n = &tree->nodes[ i ];
+   memset( n, 0, sizeof( vul__profiler_node ) );
+   n->name = name;
+   n->parent = parent;
+   n->first_child = VUL__PROFILER_NONE;
+   n->last_child = VUL__PROFILER_NONE;
+   n->next_sibling = VUL__PROFILER_NONE;
+   if( parent != VUL__PROFILER_NONE ) {
+      // Append, so children print in the order they were first seen
+      if( tree->nodes[ parent ].last_child == VUL__PROFILER_NONE ) {
+         tree->nodes[ parent ].first_child = i;
+      } else {
+         tree->nodes[ tree->nodes[ parent ].last_child ].next_sibling = i;
+      }
+      tree->nodes[ parent ].last_child = i;
+   }
+   return i;
+}
+
+static u32 vul__profiler_tree_child( vul__profiler_tree *tree, u32 parent, const char *name )
+{
+   u32 c;
+
+   for( c = tree->nodes[ parent ].first_child; c != VUL__PROFILER_NONE; c = tree->nodes[ c ].next_sibling ) {
+      if( tree->nodes[ c ].name == name || strcmp( tree->nodes[ c ].name, name ) == 0 ) {
+         return c;
+      }
+   }
+   return vul__profiler_tree_add( tree, name, parent );
+}
+
+/**
+ * Builds the call tree of every thread's collected events. Zones still open at the
+ * end, and ends without a begin (their zone began before initialize), are left out.
+ */
+static void vul__profiler_build_tree( vul__profiler_tree *tree )
+{
+   vul__profiler_thread *t;
+   vul__profiler_event *e;
+   const char *name;
+   u32 stack[ VUL_PROFILER_MAX_DEPTH ];
+   u64 begins[ VUL_PROFILER_MAX_DEPTH ];
+   u32 depth, overflow, i, n;
+   u64 dt;
+
+   memset( tree, 0, sizeof( vul__profiler_tree ) );
+   for( t = vul__profiler.threads; t != NULL; t = t->next ) {
+      name = ( const char* )vul_atomic_load_ptr( ( void *volatile* )&t->name );
+      stack[ 0 ] = vul__profiler_tree_add( tree, name ? name : "", VUL__PROFILER_NONE );
+      tree->nodes[ stack[ 0 ] ].thread = t->id;
+      depth = 1;
+      overflow = 0;
+      for( i = 0; i < t->captured_count; ++i ) {
+         e = &t->captured[ i ];
+         if( e->name != NULL ) {
+            if( depth == VUL_PROFILER_MAX_DEPTH ) {
+               ++overflow;
+               continue;
+            }
+            n = vul__profiler_tree_child( tree, stack[ depth - 1 ], e->name );
+            stack[ depth ] = n;
+            begins[ depth ] = e->time;
+            ++depth;
+         } else if( overflow ) {
+            --overflow;
+         } else if( depth > 1 ) {
+            --depth;
+            dt = e->time - begins[ depth ];
+            tree->nodes[ stack[ depth ] ].calls += 1;
+            tree->nodes[ stack[ depth ] ].inclusive += dt;
+            tree->nodes[ stack[ depth - 1 ] ].children += dt;
+         }
+      }
+      // A thread's root spans its direct children
+      tree->nodes[ stack[ 0 ] ].inclusive = tree->nodes[ stack[ 0 ] ].children;
+   }
+}
+
+static void vul__profiler_write_node( FILE *f, vul__profiler_tree *tree, u32 n, u32 depth )
+{
+   vul__profiler_node *node, *parent;
+   f64 total, self, share;
+   u32 c, pad;
+
+   node = &tree->nodes[ n ];
+   parent = &tree->nodes[ node->parent ];
+   total = ( f64 )vul_tsc_to_nanos( node->inclusive ) / 1e6;
+   self = ( f64 )vul_tsc_to_nanos( node->inclusive - ( node->children < node->inclusive ? node->children : node->inclusive ) ) / 1e6;
+   share = parent->inclusive ? 100.0 * ( f64 )node->inclusive / ( f64 )parent->inclusive : 100.0;
+   pad = 2 * depth < 40 ? 40 - 2 * depth : 0;
+   fprintf( f, "%*s%-*s %10llu %12.3f %12.3f %8.1f%%\n", ( int )( 2 * depth ), "", ( int )pad, node->name,
+            ( unsigned long long )node->calls, total, self, share );
+   for( c = node->first_child; c != VUL__PROFILER_NONE; c = tree->nodes[ c ].next_sibling ) {
+      vul__profiler_write_node( f, tree, c, depth + 1 );
+   }
+}
+
+static int vul__profiler_flat_compare( const void *a, const void *b )
+{
+   u64 sa, sb;
+
+   sa = ( ( const vul__profiler_flat* )a )->self;
+   sb = ( ( const vul__profiler_flat* )b )->self;
+   return sa > sb ? -1 : sa < sb ? 1 : 0;
+}
+
+//-------------
+// Public API
+
+void vul_profiler_initialize( void *( *allocator )( size_t size ),
+                              void( *deallocator )( void *ptr ) )
+{
+   u32 generation;
+
+   generation = vul__profiler.generation;
+   memset( &vul__profiler, 0, sizeof( vul__profiler_state ) );
+   vul__profiler.generation = generation + 1;
+   vul__profiler.allocator = allocator;
+   vul__profiler.deallocator = deallocator;
+
+   vul_tsc_calibrate( );
+   vul__profiler.start = vul_tsc_now( );
+   vul_atomic_store_u32( &vul__profiler.active, 1 );
+}
+
+void vul_profiler_shutdown( )
+{
+   vul__profiler_thread *t, *next;
+
+   vul_atomic_store_u32( &vul__profiler.active, 0 );
+   for( t = vul__profiler.threads; t != NULL; t = next ) {
+      next = t->next;
+      if( t->captured ) {
+         vul__profiler.deallocator( t->captured );
+      }
+      vul__profiler.deallocator( t->ring );
+      vul__profiler.deallocator( t );
+   }
+   vul__profiler.threads = NULL;
+}
+
+void vul_profiler_begin( const char *name )
+{
+   vul__profiler_record( name );
+}
+
+void vul_profiler_end( )
+{
+   vul__profiler_record( NULL );
+}
+
+const char *vul__profile_scope_begin( const char *name )
+{
+   vul__profiler_record( name );
+   return name;
+}
+
+void vul__profile_scope_end( const char **name )
+{
+   ( void )name;
+   vul__profiler_record( NULL );
+}
+
+void vul_profiler_set_thread_name( const char *name )
+{
+   vul__profiler_thread *t;
+
+   if( !vul__profiler.active ) {
+      return;
+   }
+   t = vul__profiler_local;
+   if( t == NULL || vul__profiler_local_generation != vul__profiler.generation ) {
+      t = vul__profiler_register( );
+   }
+   vul_atomic_store_ptr( ( void *volatile* )&t->name, ( void* )name );
+}
+
+void vul_profiler_collect( )
+{
+   vul__profiler_thread *t;
+
+   t = ( vul__profiler_thread* )vul_atomic_load_ptr( ( void *volatile* )&vul__profiler.threads );
+   for( ; t != NULL; t = t->next ) {
+      vul__profiler_drain( t );
+   }
+}
+
+void vul_profiler_reset( )
+{
+   vul__profiler_thread *t;
+
+   vul_profiler_collect( );
+   for( t = vul__profiler.threads; t != NULL; t = t->next ) {
+      t->captured_count = 0;
+   }
+}
+
+u64 vul_profiler_dropped( )
+{
+   vul__profiler_thread *t;
+   u64 n;
+
+   n = 0;
+   t = ( vul__profiler_thread* )vul_atomic_load_ptr( ( void *volatile* )&vul__profiler.threads );
+   for( ; t != NULL; t = t->next ) {
+      n += vul_atomic_load_u32( &t->dropped );
+   }
+   return n;
+}
+
+b32 vul_profiler_write_chrome_trace( FILE *f )
+{
+   vul__profiler_thread *t;
+   vul__profiler_event *e;
+   const char *name;
+   b32 first;
+   u32 i;
+
+   vul_profiler_collect( );
+
+   fprintf( f, "{\"traceEvents\":[\n" );
+   first = 1;
+   for( t = vul__profiler.threads; t != NULL; t = t->next ) {
+      name = ( const char* )vul_atomic_load_ptr( ( void *volatile* )&t->name );
+      if( name ) {
+         fprintf( f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"",
+                  first ? "" : ",\n", t->id );
+         vul__profiler_write_json_string( f, name );
+         fprintf( f, "\"}}" );
+         first = 0;
+      }
+      for( i = 0; i < t->captured_count; ++i ) {
+         e = &t->captured[ i ];
+         // Microseconds since initialize, with nanosecond precision
+         fprintf( f, "%s{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f", first ? "" : ",\n",
+                  e->name ? 'B' : 'E', t->id,
+                  ( f64 )vul_tsc_to_nanos( e->time - vul__profiler.start ) / 1000.0 );
+         if( e->name ) {
+            fprintf( f, ",\"name\":\"" );
+            vul__profiler_write_json_string( f, e->name );
+            fputc( '"', f );
+         }
+         fputc( '}', f );
+         first = 0;
+      }
+   }
+   fprintf( f, "\n],\"displayTimeUnit\":\"ns\"}\n" );
+
+   return !ferror( f );
+}
+
+void vul_profiler_write_summary( FILE *f, b32 hierarchical )
+{
+   vul__profiler_tree tree;
+   vul__profiler_flat *flat;
+   vul__profiler_node *n;
+   u32 i, j, count;
+   u64 self;
+
+   vul_profiler_collect( );
+   vul__profiler_build_tree( &tree );
+
+   if( hierarchical ) {
+      fprintf( f, "%-40s %10s %12s %12s %9s\n", "Zone", "Calls", "Total (ms)", "Self (ms)", "Parent" );
+      for( i = 0; i < tree.count; ++i ) {
+         n = &tree.nodes[ i ];
+         if( n->parent == VUL__PROFILER_NONE ) {
+            fprintf( f, "Thread %u %s (%.3f ms in zones)\n", n->thread, n->name,
+                     ( f64 )vul_tsc_to_nanos( n->inclusive ) / 1e6 );
+            for( j = n->first_child; j != VUL__PROFILER_NONE; j = tree.nodes[ j ].next_sibling ) {
+               vul__profiler_write_node( f, &tree, j, 1 );
+            }
+         }
+      }
+   } else {
+      // Merge call paths by zone name
+      count = 0;
+      flat = tree.count ? ( vul__profiler_flat* )vul__profiler.allocator( sizeof( vul__profiler_flat ) * tree.count ) : NULL;
+      VUL_PROFILER_CUSTOM_ASSERT( tree.count == 0 || flat != NULL ); // Make sure allocation didn't fail
+      for( i = 0; i < tree.count; ++i ) {
+         n = &tree.nodes[ i ];
+         if( n->parent == VUL__PROFILER_NONE ) {
+            continue;
+         }
+         for( j = 0; j < count; ++j ) {
+            if( flat[ j ].name == n->name || strcmp( flat[ j ].name, n->name ) == 0 ) {
+               break;
+            }
+         }
+         if( j == count ) {
+            memset( &flat[ count++ ], 0, sizeof( vul__profiler_flat ) );
+            flat[ j ].name = n->name;
+         }
+         self = n->inclusive - ( n->children < n->inclusive ? n->children : n->inclusive );
+         flat[ j ].calls += n->calls;
+         flat[ j ].inclusive += n->inclusive;
+         flat[ j ].self += self;
+      }
+      qsort( flat, count, sizeof( vul__profiler_flat ), vul__profiler_flat_compare );
+
+      fprintf( f, "%-40s %10s %12s %12s %12s\n", "Zone", "Calls", "Total (ms)", "Self (ms)", "Avg (us)" );
+      for( i = 0; i < count; ++i ) {
+         fprintf( f, "%-40s %10llu %12.3f %12.3f %12.3f\n", flat[ i ].name,
+                  ( unsigned long long )flat[ i ].calls,
+                  ( f64 )vul_tsc_to_nanos( flat[ i ].inclusive ) / 1e6,
+                  ( f64 )vul_tsc_to_nanos( flat[ i ].self ) / 1e6,
+                  flat[ i ].calls ? ( f64 )vul_tsc_to_nanos( flat[ i ].inclusive ) / 1e3 / ( f64 )flat[ i ].calls : 0.0 );
+      }
+      if( flat ) {
+         vul__profiler.deallocator( flat );
+      }
+   }
+   if( vul_profiler_dropped( ) ) {
+      fprintf( f, "(%llu events dropped; collect more often or raise VUL_PROFILER_RING_SIZE)\n",
+               ( unsigned long long )vul_profiler_dropped( ) );
+   }
+
+   if( tree.nodes ) {
+      vul__profiler.deallocator( tree.nodes );
+   }
+}
+
+#undef VUL__PROFILER_NONE
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef u64
+#undef f64
+#undef b32
+#endif
+
+#endif // VUL_DEFINE
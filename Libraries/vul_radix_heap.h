@@ -0,0 +1,426 @@
+/*
+* Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+*
+* This file describes a generic monotone priority queue, implemented as a radix heap.
+* Priorities are unsigned 64-bit integer keys taken from the elements by a key function
+* given at creation, and every pushed key must be greater than or equal to the key of the
+* last popped element. This holds for Dijkstra's algorithm and for event simulation, and
+* there the radix heap is much cheaper than the comparison based heaps: elements are only
+* ever moved to lower buckets, for O(log C) amortized work per element where C is the
+* largest key difference.
+*
+* Use vul_radix_heap_key_f32 and vul_radix_heap_key_f64 in the key function to order
+* floating point priorities.
+*
+* Apart from the key function at creation this has the same interface as vul_priority_heap.h.
+*
+* Define VUL_DEFINE in exactly one compilation unit.
+*
+* ? If public domain is not legally valid in your legal jurisdiction
+*   the MIT licence applies (see the LICENCE file)
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+#ifndef VUL_RADIX_HEAP_H
+#define VUL_RADIX_HEAP_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef VUL_DATATYPES_CUSTOM_ASSERT
+#include <assert.h>
+#define VUL_DATATYPES_CUSTOM_ASSERT assert
+#endif
+
+#ifndef VUL_TYPES_H
+#include <stdint.h>
+#define u32 uint32_t
+#define u64 uint64_t
+#define f32 float
+#define f64 double
+#define b32 uint32_t
+#endif
+
+/**
+ * Bucket 0 holds keys equal to the last popped key, bucket i > 0 the keys
+ * whose highest bit differing from it is bit i - 1.
+ */
+#define VUL_RADIX_HEAP_BUCKETS 65
+
+/**
+ * A bucket is an unordered array of entries. An entry is the key
+ * followed by the element.
+ */
+typedef struct vul__radix_heap_bucket {
+   char *entries;
+   u32 count;
+   u32 capacity;
+} vul__radix_heap_bucket;
+
+/**
+ * The radix heap structure.
+ */
+typedef struct vul_radix_heap {
+   vul__radix_heap_bucket buckets[ VUL_RADIX_HEAP_BUCKETS ];
+   u64 last;
+
+   u32 size;
+   u32 element_size;
+   u32 entry_size;
+
+   u64 ( *key )( void *data );
+
+   void *( *allocator )( size_t size );
+   void ( *deallocator )( void *ptr );
+} vul_radix_heap;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+//-----------------------
+// The external API
+//
+
+/**
+ * Create a new radix heap.
+ * Takes a function returning the priority key of an element and
+ * memory management functions.
+ */
+vul_radix_heap *vul_radix_heap_create( u32 element_size,
+                                       u64 ( *key_func )( void *data ),
+                                       void *( *allocator )( size_t size ),
+                                       void ( *deallocator )( void *ptr ) );
+/**
+ * Returns true if the heap is empty
+ */
+b32 vul_radix_heap_is_empty( vul_radix_heap *heap );
+/**
+ * Destroys a radix heap
+ */
+void vul_radix_heap_destroy( vul_radix_heap *heap );
+/**
+ * Pushes an element into the heap. Copies the data.
+ * The key of the element must not be lower than that of the last popped element.
+ */
+void vul_radix_heap_push( vul_radix_heap *heap, void *data );
+/**
+ * Pops the next element out of the heap and copies it to data_out
+ */
+void vul_radix_heap_pop( vul_radix_heap *heap, void *data_out );
+/**
+ * Peeks at the next element of the heap
+ */
+void *vul_radix_heap_peek( vul_radix_heap *heap );
+/**
+ * Returns the number of elements in the heap.
+ */
+u32 vul_radix_heap_size( vul_radix_heap *heap );
+/**
+ * Merges two heaps into one. Do not use the old heaps afterwards!
+ * The heaps must have the same element size and key function. The returned
+ * heap only accepts keys of at least the lower of the two heaps' last popped keys.
+ */
+vul_radix_heap *vul_radix_heap_merge( vul_radix_heap *heap1, vul_radix_heap *heap2 );
+/**
+ * Maps a float to a key with the same order. Note that -0 sorts before 0.
+ */
+u64 vul_radix_heap_key_f32( f32 f );
+/**
+ * Maps a double to a key with the same order. Note that -0 sorts before 0.
+ */
+u64 vul_radix_heap_key_f64( f64 f );
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef u64
+#undef f32
+#undef f64
+#undef b32
+#endif
+
+#endif // VUL_RADIX_HEAP_H
+
+#ifdef VUL_DEFINE
+
+#ifndef VUL_TYPES_H
+#define u32 uint32_t
+#define u64 uint64_t
+#define f32 float
+#define f64 double
+#define b32 uint32_t
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------
+// Internal helpers
+
+static u32 vul__radix_heap_bucket_index( u64 key, u64 last )
+{
+   u64 x;
+   u32 n;
+
+   // Number of significant bits of key ^ last, by binary search
+   x = key ^ last;
+   if( x == 0 ) {
+      return 0;
+   }
+   n = 1;
+   if( x >> 32 ) { n += 32; x >>= 32; }
+   if( x >> 16 ) { n += 16; x >>= 16; }
+   if( x >>  8 ) { n +=  8; x >>=  8; }
+   if( x >>  4 ) { n +=  4; x >>=  4; }
+   if( x >>  2 ) { n +=  2; x >>=  2; }
+   if( x >>  1 ) { n +=  1; }
+   return n;
+}
+
+static char *vul__radix_heap_entry( vul_radix_heap *heap, vul__radix_heap_bucket *b, u32 i )
+{
+   return b->entries + ( size_t )heap->entry_size * i;
+}
+
+static u64 vul__radix_heap_entry_key( char *entry )
+{
+   u64 k;
+   memcpy( &k, entry, sizeof( u64 ) );
+   return k;
+}
+
+static char *vul__radix_heap_bucket_push( vul_radix_heap *heap, vul__radix_heap_bucket *b )
+{
+   char *old;
+
+   if( b->count == b->capacity ) {
+      old = b->entries;
+      b->capacity = b->capacity == 0 ? 16 : b->capacity * 2;
+      b->entries = ( char* )heap->allocator( ( size_t )heap->entry_size * b->capacity );
+      VUL_DATATYPES_CUSTOM_ASSERT( b->entries );
+      if( old != NULL ) {
+         memcpy( b->entries, old, ( size_t )heap->entry_size * b->count );
+         heap->deallocator( old );
+      }
+   }
+   return vul__radix_heap_entry( heap, b, b->count++ );
+}
+
+static void vul__radix_heap_insert_entry( vul_radix_heap *heap, char *entry )
+{
+   u32 i;
+
+   i = vul__radix_heap_bucket_index( vul__radix_heap_entry_key( entry ), heap->last );
+   memcpy( vul__radix_heap_bucket_push( heap, &heap->buckets[ i ] ), entry, heap->entry_size );
+}
+
+/**
+ * Makes sure bucket 0 is non-empty by moving the smallest non-empty bucket down.
+ * Every moved entry lands in a strictly lower bucket.
+ */
+static void vul__radix_heap_refill( vul_radix_heap *heap )
+{
+   vul__radix_heap_bucket *b;
+   u64 k, min;
+   u32 i, j;
+
+   if( heap->buckets[ 0 ].count != 0 ) {
+      return;
+   }
+
+   for( i = 1; i < VUL_RADIX_HEAP_BUCKETS && heap->buckets[ i ].count == 0; ++i )
+      ;
+   VUL_DATATYPES_CUSTOM_ASSERT( i < VUL_RADIX_HEAP_BUCKETS );
+   b = &heap->buckets[ i ];
+
+   // Find the new last key
+   min = vul__radix_heap_entry_key( vul__radix_heap_entry( heap, b, 0 ) );
+   for( j = 1; j < b->count; ++j ) {
+      k = vul__radix_heap_entry_key( vul__radix_heap_entry( heap, b, j ) );
+      min = k < min ? k : min;
+   }
+   heap->last = min;
+
+   // Redistribute
+   for( j = 0; j < b->count; ++j ) {
+      vul__radix_heap_insert_entry( heap, vul__radix_heap_entry( heap, b, j ) );
+   }
+   b->count = 0;
+}
+
+//-------------
+// Public API
+
+vul_radix_heap *vul_radix_heap_create( u32 element_size,
+                                       u64 ( *key_func )( void *data ),
+                                       void *( *allocator )( size_t size ),
+                                       void ( *deallocator )( void *ptr ) )
+{
+   vul_radix_heap *heap;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( allocator );
+   heap = ( vul_radix_heap* )allocator( sizeof( vul_radix_heap ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   memset( heap->buckets, 0, sizeof( heap->buckets ) );
+   heap->last = 0;
+   heap->size = 0;
+   heap->element_size = element_size;
+   // Keep the keys 8-byte aligned
+   heap->entry_size = ( u32 )( ( sizeof( u64 ) + element_size + 7 ) & ~7 );
+   heap->key = key_func;
+   heap->allocator = allocator;
+   heap->deallocator = deallocator;
+
+   return heap;
+}
+
+b32 vul_radix_heap_is_empty( vul_radix_heap *heap )
+{
+   return heap->size == 0 ? 1 : 0;
+}
+
+void vul_radix_heap_destroy( vul_radix_heap *heap )
+{
+   u32 i;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   for( i = 0; i < VUL_RADIX_HEAP_BUCKETS; ++i ) {
+      if( heap->buckets[ i ].entries != NULL ) {
+         heap->deallocator( heap->buckets[ i ].entries );
+      }
+   }
+   heap->deallocator( heap );
+}
+
+void vul_radix_heap_push( vul_radix_heap *heap, void *data )
+{
+   char *e;
+   u64 k;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+
+   k = heap->key( data );
+   VUL_DATATYPES_CUSTOM_ASSERT( k >= heap->last && "Radix heap keys must be monotone" );
+
+   e = vul__radix_heap_bucket_push( heap, &heap->buckets[ vul__radix_heap_bucket_index( k, heap->last ) ] );
+   memcpy( e, &k, sizeof( u64 ) );
+   memcpy( e + sizeof( u64 ), data, heap->element_size );
+   ++heap->size;
+}
+
+void vul_radix_heap_pop( vul_radix_heap *heap, void *data_out )
+{
+   vul__radix_heap_bucket *b;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap->size != 0 ); // @TODO(thynn): Fail graciously if there's nothing to pop?
+
+   vul__radix_heap_refill( heap );
+
+   // All entries in bucket 0 share the same key, so take the last one
+   b = &heap->buckets[ 0 ];
+   memcpy( data_out, vul__radix_heap_entry( heap, b, --b->count ) + sizeof( u64 ), heap->element_size );
+   --heap->size;
+}
+
+void *vul_radix_heap_peek( vul_radix_heap *heap )
+{
+   vul__radix_heap_bucket *b;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   if( heap->size == 0 ) {
+      return NULL;
+   }
+
+   vul__radix_heap_refill( heap );
+   b = &heap->buckets[ 0 ];
+   return vul__radix_heap_entry( heap, b, b->count - 1 ) + sizeof( u64 );
+}
+
+u32 vul_radix_heap_size( vul_radix_heap *heap )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( heap );
+   return heap->size;
+}
+
+vul_radix_heap *vul_radix_heap_merge( vul_radix_heap *heap1, vul_radix_heap *heap2 )
+{
+   vul__radix_heap_bucket old;
+   u32 i, j;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( heap1 );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap2 );
+   VUL_DATATYPES_CUSTOM_ASSERT( heap1->entry_size == heap2->entry_size );
+
+   // If heap2 is behind heap1 all of heap1's entries must be rebucketed relative to the lower key
+   if( heap2->last < heap1->last ) {
+      heap1->last = heap2->last;
+      for( i = 0; i < VUL_RADIX_HEAP_BUCKETS; ++i ) {
+         old = heap1->buckets[ i ];
+         if( old.count == 0 ) {
+            continue;
+         }
+         heap1->buckets[ i ].entries = NULL;
+         heap1->buckets[ i ].count = 0;
+         heap1->buckets[ i ].capacity = 0;
+         for( j = 0; j < old.count; ++j ) {
+            vul__radix_heap_insert_entry( heap1, vul__radix_heap_entry( heap1, &old, j ) );
+         }
+         heap1->deallocator( old.entries );
+      }
+   }
+
+   for( i = 0; i < VUL_RADIX_HEAP_BUCKETS; ++i ) {
+      for( j = 0; j < heap2->buckets[ i ].count; ++j ) {
+         vul__radix_heap_insert_entry( heap1, vul__radix_heap_entry( heap2, &heap2->buckets[ i ], j ) );
+      }
+   }
+   heap1->size += heap2->size;
+
+   vul_radix_heap_destroy( heap2 );
+
+   return heap1;
+}
+
+u64 vul_radix_heap_key_f32( f32 f )
+{
+   u32 u;
+
+   // Flip all bits of negatives, and just the sign bit of positives
+   memcpy( &u, &f, sizeof( u32 ) );
+   u ^= ( u32 )( -( int32_t )( u >> 31 ) ) | 0x80000000u;
+   return ( u64 )u;
+}
+
+u64 vul_radix_heap_key_f64( f64 f )
+{
+   u64 u;
+
+   memcpy( &u, &f, sizeof( u64 ) );
+   u ^= ( u64 )( -( int64_t )( u >> 63 ) ) | 0x8000000000000000ull;
+   return u;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef u64
+#undef f32
+#undef f64
+#undef b32
+#endif
+
+#endif // VUL_DEFINE
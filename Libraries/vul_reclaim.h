@@ -0,0 +1,659 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file contains safe memory reclamation for lock-free containers: a removed
+ * node may still be read by other threads, so it can't be handed to the deallocator
+ * right away. Two schemes are provided; both take a pointer and the deallocator to
+ * eventually call on it, so a container's deallocator callback can be routed through
+ * them as is.
+ *
+ * Epoch based reclamation (vul_epoch_*): threads enter and exit critical sections,
+ * and retired pointers go on per-thread limbo lists that are freed once every thread
+ * has moved two epochs on. Entering and exiting is cheap and reads need no extra
+ * work, but a thread that stalls inside a critical section holds back all freeing.
+ *
+ * Hazard pointers (vul_hazard_*): threads publish the few pointers they are about to
+ * dereference, and retired pointers are freed once no thread has them published.
+ * Every read of a shared pointer costs a store and a reload, but the number of
+ * unfreed pointers stays bounded even if a thread stalls.
+ *
+ * Every thread that uses a domain must register with it first and pass its thread
+ * record to every call. The allocator and deallocator given to a domain are used for
+ * thread records and retire lists, and must be thread safe.
+ *
+ * Depends on vul_thread.h for atomics; define VUL_WINDOWS, VUL_LINUX or VUL_OSX.
+ *
+ * Define VUL_DEFINE in exactly one compilation unit.
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_RECLAIM_H
+#define VUL_RECLAIM_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef VUL_DATATYPES_CUSTOM_ASSERT
+#include <assert.h>
+#define VUL_DATATYPES_CUSTOM_ASSERT assert
+#endif
+
+#include "vul_thread.h"
+
+#ifndef VUL_TYPES_H
+#include <stdint.h>
+#define u32 uint32_t
+#define u64 uint64_t
+#define b32 uint32_t
+#endif
+
+/**
+ * A thread tries to advance the global epoch and free its limbo lists
+ * every this many retires.
+ */
+#ifndef VUL_EPOCH_RECLAIM_THRESHOLD
+#define VUL_EPOCH_RECLAIM_THRESHOLD 64
+#endif
+/**
+ * A thread scans the hazard pointers once it has retired this many more pointers
+ * than there are hazard pointers in total. Larger values scan less often.
+ */
+#ifndef VUL_HAZARD_SCAN_SLACK
+#define VUL_HAZARD_SCAN_SLACK 64
+#endif
+
+typedef struct vul__reclaim_entry {
+   void *ptr;
+   void( *deallocator )( void *ptr );
+} vul__reclaim_entry;
+
+typedef struct vul__reclaim_list {
+   vul__reclaim_entry *entries;
+   u32 count, capacity;
+} vul__reclaim_list;
+
+/**
+ * Per-thread epoch state. Obtain one from vul_epoch_thread_register.
+ */
+typedef struct vul_epoch_thread {
+   volatile u64 epoch; // Local epoch << 1 | active
+   volatile u32 in_use;
+
+   vul__reclaim_list limbo[ 3 ];
+   u64 limbo_epoch[ 3 ];
+   u32 retired_count;
+
+   struct vul_epoch_thread *next; // Registry link; records are never unlinked
+} vul_epoch_thread;
+
+typedef struct vul_epoch_domain {
+   volatile u64 epoch;
+   vul_epoch_thread *volatile threads;
+
+   /* Memory management functions */
+   void *( *allocator )( size_t size );
+   void( *deallocator )( void *ptr );
+} vul_epoch_domain;
+
+/**
+ * Per-thread hazard pointer state. Obtain one from vul_hazard_thread_register.
+ */
+typedef struct vul_hazard_thread {
+   void *volatile *hazards; // The domain's slots_per_thread published pointers
+   volatile u32 in_use;
+
+   vul__reclaim_list retired;
+   void **scratch;         // Sorted copy of all hazards while scanning
+   u32 scratch_capacity;
+
+   struct vul_hazard_thread *next; // Registry link; records are never unlinked
+} vul_hazard_thread;
+
+typedef struct vul_hazard_domain {
+   vul_hazard_thread *volatile threads;
+   volatile u32 thread_count;
+   u32 slots_per_thread;
+
+   /* Memory management functions */
+   void *( *allocator )( size_t size );
+   void( *deallocator )( void *ptr );
+} vul_hazard_domain;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//-----------------
+// Epoch based reclamation
+//
+
+/**
+ * Creates an epoch domain. Containers sharing a domain share reclamation.
+ */
+vul_epoch_domain *vul_epoch_domain_create( void *( *allocator )( size_t size ),
+                                           void( *deallocator )( void *ptr ) );
+/**
+ * Frees everything still retired, all thread records and the domain. No thread may
+ * use the domain at this point.
+ */
+void vul_epoch_domain_destroy( vul_epoch_domain *d );
+/**
+ * Registers the calling thread with the domain. Thread safe.
+ */
+vul_epoch_thread *vul_epoch_thread_register( vul_epoch_domain *d );
+/**
+ * Unregisters a thread, which must not be in a critical section. Anything it retired
+ * stays with the record, and is freed by its next owner or on destroy.
+ */
+void vul_epoch_thread_unregister( vul_epoch_domain *d, vul_epoch_thread *t );
+/**
+ * Enters a critical section. Shared pointers read inside it stay valid until the
+ * matching vul_epoch_exit. Not reentrant.
+ */
+void vul_epoch_enter( vul_epoch_domain *d, vul_epoch_thread *t );
+/**
+ * Exits a critical section.
+ */
+void vul_epoch_exit( vul_epoch_thread *t );
+/**
+ * Calls deallocator( ptr ) once no thread can still see ptr. The pointer must be
+ * unreachable for threads entering from now on. Call inside a critical section.
+ */
+void vul_epoch_retire( vul_epoch_domain *d, vul_epoch_thread *t,
+                       void *ptr, void( *deallocator )( void *ptr ) );
+/**
+ * Tries to advance the epoch and frees what the thread retired that is now safe.
+ * Retire does this every VUL_EPOCH_RECLAIM_THRESHOLD calls; call it to free sooner.
+ */
+void vul_epoch_reclaim( vul_epoch_domain *d, vul_epoch_thread *t );
+
+//-----------------
+// Hazard pointers
+//
+
+/**
+ * Creates a hazard pointer domain where each thread can protect up to
+ * slots_per_thread pointers at once.
+ */
+vul_hazard_domain *vul_hazard_domain_create( u32 slots_per_thread,
+                                             void *( *allocator )( size_t size ),
+                                             void( *deallocator )( void *ptr ) );
+/**
+ * Frees everything still retired, all thread records and the domain. No thread may
+ * use the domain at this point.
+ */
+void vul_hazard_domain_destroy( vul_hazard_domain *d );
+/**
+ * Registers the calling thread with the domain. Thread safe.
+ */
+vul_hazard_thread *vul_hazard_thread_register( vul_hazard_domain *d );
+/**
+ * Clears the thread's hazards and unregisters it. Anything it retired that is still
+ * protected stays with the record, and is freed by its next owner or on destroy.
+ */
+void vul_hazard_thread_unregister( vul_hazard_domain *d, vul_hazard_thread *t );
+/**
+ * Reads *src into the given slot until the published value is stable, and returns
+ * it. The pointer stays valid until the slot is cleared or reused.
+ */
+void *vul_hazard_protect( vul_hazard_thread *t, u32 slot, void *volatile *src );
+/**
+ * As vul_hazard_protect, for pointers with tag bits: the bits in mask are cleared
+ * before the pointer is published, but the tagged value is returned.
+ */
+void *vul_hazard_protect_masked( vul_hazard_thread *t, u32 slot, void *volatile *src, uintptr_t mask );
+/**
+ * Publishes ptr in the given slot. The caller must check that ptr is still reachable
+ * afterwards before it relies on it.
+ */
+void vul_hazard_set( vul_hazard_thread *t, u32 slot, void *ptr );
+/**
+ * Clears the given slot.
+ */
+void vul_hazard_clear( vul_hazard_thread *t, u32 slot );
+/**
+ * Calls deallocator( ptr ) once no thread has ptr published. The pointer must be
+ * unreachable for new readers.
+ */
+void vul_hazard_retire( vul_hazard_domain *d, vul_hazard_thread *t,
+                        void *ptr, void( *deallocator )( void *ptr ) );
+/**
+ * Frees whatever the thread retired that isn't protected. Returns how many
+ * pointers are still waiting.
+ */
+u32 vul_hazard_scan( vul_hazard_domain *d, vul_hazard_thread *t );
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef u64
+#undef b32
+#endif
+
+#endif // VUL_RECLAIM_H
+
+#ifdef VUL_DEFINE
+
+#ifndef VUL_TYPES_H
+#define u32 uint32_t
+#define u64 uint64_t
+#define b32 uint32_t
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------
+// Internal helpers
+
+static void vul__reclaim_list_push( vul__reclaim_list *l, void *ptr, void( *deallocator )( void *ptr ),
+                                    void *( *allocator )( size_t size ),
+                                    void( *list_deallocator )( void *ptr ) )
+{
+   vul__reclaim_entry *e;
+   u32 capacity;
+
+   if( l->count == l->capacity ) {
+      capacity = l->capacity ? l->capacity * 2 : 16;
+      e = ( vul__reclaim_entry* )allocator( sizeof( vul__reclaim_entry ) * capacity );
+      VUL_DATATYPES_CUSTOM_ASSERT( e != NULL ); // Make sure allocation didn't fail
+      if( l->entries ) {
+         memcpy( e, l->entries, sizeof( vul__reclaim_entry ) * l->count );
+         list_deallocator( l->entries );
+      }
+      l->entries = e;
+      l->capacity = capacity;
+   }
+   l->entries[ l->count ].ptr = ptr;
+   l->entries[ l->count ].deallocator = deallocator;
+   ++l->count;
+}
+
+static void vul__reclaim_list_free( vul__reclaim_list *l )
+{
+   u32 i;
+
+   for( i = 0; i < l->count; ++i ) {
+      l->entries[ i ].deallocator( l->entries[ i ].ptr );
+   }
+   l->count = 0;
+}
+
+static void vul__reclaim_list_destroy( vul__reclaim_list *l, void( *list_deallocator )( void *ptr ) )
+{
+   vul__reclaim_list_free( l );
+   if( l->entries ) {
+      list_deallocator( l->entries );
+   }
+   l->entries = NULL;
+   l->capacity = 0;
+}
+
+/**
+ * Frees the limbo lists that were retired two or more epochs before g.
+ */
+static void vul__epoch_free_old( vul_epoch_thread *t, u64 g )
+{
+   u32 i;
+
+   for( i = 0; i < 3; ++i ) {
+      if( t->limbo[ i ].count && t->limbo_epoch[ i ] + 2 <= g ) {
+         vul__reclaim_list_free( &t->limbo[ i ] );
+      }
+   }
+}
+
+static void vul__epoch_try_advance( vul_epoch_domain *d )
+{
+   vul_epoch_thread *t;
+   u64 g, e;
+
+   g = vul_atomic_load_u64( &d->epoch );
+   t = ( vul_epoch_thread* )vul_atomic_load_ptr( ( void *volatile* )&d->threads );
+   while( t != NULL ) {
+      if( vul_atomic_load_u32( &t->in_use ) ) {
+         e = vul_atomic_load_u64( &t->epoch );
+         if( ( e & 1 ) && ( e >> 1 ) != g ) {
+            return; // Someone is still in an older epoch
+         }
+      }
+      t = t->next;
+   }
+   vul_atomic_cas_u64( &d->epoch, g, g + 1 );
+}
+
+static int vul__hazard_compare( const void *a, const void *b )
+{
+   uintptr_t pa, pb;
+
+   pa = ( uintptr_t )*( void *const* )a;
+   pb = ( uintptr_t )*( void *const* )b;
+   return pa < pb ? -1 : pa > pb ? 1 : 0;
+}
+
+//-------------
+// Public API
+
+vul_epoch_domain *vul_epoch_domain_create( void *( *allocator )( size_t size ),
+                                           void( *deallocator )( void *ptr ) )
+{
+   vul_epoch_domain *d;
+
+   d = ( vul_epoch_domain* )allocator( sizeof( vul_epoch_domain ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( d != NULL ); // Make sure allocation didn't fail
+   d->epoch = 0;
+   d->threads = NULL;
+   d->allocator = allocator;
+   d->deallocator = deallocator;
+
+   return d;
+}
+
+void vul_epoch_domain_destroy( vul_epoch_domain *d )
+{
+   vul_epoch_thread *t, *tn;
+   u32 i;
+
+   t = d->threads;
+   while( t != NULL ) {
+      tn = t->next;
+      for( i = 0; i < 3; ++i ) {
+         vul__reclaim_list_destroy( &t->limbo[ i ], d->deallocator );
+      }
+      d->deallocator( t );
+      t = tn;
+   }
+   d->deallocator( d );
+}
+
+vul_epoch_thread *vul_epoch_thread_register( vul_epoch_domain *d )
+{
+   vul_epoch_thread *t;
+
+   // Reuse a record that has been unregistered
+   t = ( vul_epoch_thread* )vul_atomic_load_ptr( ( void *volatile* )&d->threads );
+   while( t != NULL ) {
+      if( vul_atomic_load_u32( &t->in_use ) == 0 && vul_atomic_cas_u32( &t->in_use, 0, 1 ) ) {
+         break;
+      }
+      t = t->next;
+   }
+
+   if( t == NULL ) {
+      t = ( vul_epoch_thread* )d->allocator( sizeof( vul_epoch_thread ) );
+      VUL_DATATYPES_CUSTOM_ASSERT( t != NULL ); // Make sure allocation didn't fail
+      memset( t, 0, sizeof( vul_epoch_thread ) );
+      t->in_use = 1;
+      do {
+         t->next = ( vul_epoch_thread* )vul_atomic_load_ptr( ( void *volatile* )&d->threads );
+      } while( !vul_atomic_cas_ptr( ( void *volatile* )&d->threads, t->next, t ) );
+   }
+
+   vul_atomic_store_u64( &t->epoch, 0 );
+   return t;
+}
+
+void vul_epoch_thread_unregister( vul_epoch_domain *d, vul_epoch_thread *t )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( ( t->epoch & 1 ) == 0 );
+   ( void )d;
+   vul_atomic_store_u32( &t->in_use, 0 );
+}
+
+void vul_epoch_enter( vul_epoch_domain *d, vul_epoch_thread *t )
+{
+   u64 g;
+
+   // Publish the epoch we are in. Retry if it moved before we were visible.
+   do {
+      g = vul_atomic_load_u64( &d->epoch );
+      vul_atomic_store_u64( &t->epoch, ( g << 1 ) | 1 );
+   } while( vul_atomic_load_u64( &d->epoch ) != g );
+
+   // Pointers retired two or more epochs ago can no longer be seen by anyone
+   vul__epoch_free_old( t, g );
+}
+
+void vul_epoch_exit( vul_epoch_thread *t )
+{
+   vul_atomic_store_u64( &t->epoch, t->epoch & ~( u64 )1 );
+}
+
+void vul_epoch_retire( vul_epoch_domain *d, vul_epoch_thread *t,
+                       void *ptr, void( *deallocator )( void *ptr ) )
+{
+   u64 g;
+   u32 s;
+
+   // Tag with the global epoch read after the pointer became unreachable
+   g = vul_atomic_load_u64( &d->epoch );
+   s = ( u32 )( g % 3 );
+   if( t->limbo[ s ].count && t->limbo_epoch[ s ] != g ) {
+      // The old contents are from epoch g - 3 or earlier, so they are safe to free
+      vul__reclaim_list_free( &t->limbo[ s ] );
+   }
+   t->limbo_epoch[ s ] = g;
+   vul__reclaim_list_push( &t->limbo[ s ], ptr, deallocator, d->allocator, d->deallocator );
+
+   if( ++t->retired_count >= VUL_EPOCH_RECLAIM_THRESHOLD ) {
+      t->retired_count = 0;
+      vul__epoch_try_advance( d );
+   }
+}
+
+void vul_epoch_reclaim( vul_epoch_domain *d, vul_epoch_thread *t )
+{
+   vul__epoch_try_advance( d );
+   vul__epoch_free_old( t, vul_atomic_load_u64( &d->epoch ) );
+}
+
+vul_hazard_domain *vul_hazard_domain_create( u32 slots_per_thread,
+                                             void *( *allocator )( size_t size ),
+                                             void( *deallocator )( void *ptr ) )
+{
+   vul_hazard_domain *d;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( slots_per_thread > 0 );
+   d = ( vul_hazard_domain* )allocator( sizeof( vul_hazard_domain ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( d != NULL ); // Make sure allocation didn't fail
+   d->threads = NULL;
+   d->thread_count = 0;
+   d->slots_per_thread = slots_per_thread;
+   d->allocator = allocator;
+   d->deallocator = deallocator;
+
+   return d;
+}
+
+void vul_hazard_domain_destroy( vul_hazard_domain *d )
+{
+   vul_hazard_thread *t, *tn;
+
+   t = d->threads;
+   while( t != NULL ) {
+      tn = t->next;
+      vul__reclaim_list_destroy( &t->retired, d->deallocator );
+      if( t->scratch ) {
+         d->deallocator( t->scratch );
+      }
+      d->deallocator( t );
+      t = tn;
+   }
+   d->deallocator( d );
+}
+
+vul_hazard_thread *vul_hazard_thread_register( vul_hazard_domain *d )
+{
+   vul_hazard_thread *t;
+
+   // Reuse a record that has been unregistered
+   t = ( vul_hazard_thread* )vul_atomic_load_ptr( ( void *volatile* )&d->threads );
+   while( t != NULL ) {
+      if( vul_atomic_load_u32( &t->in_use ) == 0 && vul_atomic_cas_u32( &t->in_use, 0, 1 ) ) {
+         return t;
+      }
+      t = t->next;
+   }
+
+   // The hazard slots follow the record
+   t = ( vul_hazard_thread* )d->allocator( sizeof( vul_hazard_thread ) + sizeof( void* ) * d->slots_per_thread );
+   VUL_DATATYPES_CUSTOM_ASSERT( t != NULL ); // Make sure allocation didn't fail
+   memset( t, 0, sizeof( vul_hazard_thread ) + sizeof( void* ) * d->slots_per_thread );
+   t->hazards = ( void *volatile* )( t + 1 );
+   t->in_use = 1;
+   // Count before linking, so scans never see more records than they made room for
+   vul_atomic_add_u32( &d->thread_count, 1 );
+   do {
+      t->next = ( vul_hazard_thread* )vul_atomic_load_ptr( ( void *volatile* )&d->threads );
+   } while( !vul_atomic_cas_ptr( ( void *volatile* )&d->threads, t->next, t ) );
+
+   return t;
+}
+
+void vul_hazard_thread_unregister( vul_hazard_domain *d, vul_hazard_thread *t )
+{
+   u32 i;
+
+   for( i = 0; i < d->slots_per_thread; ++i ) {
+      vul_atomic_store_ptr( &t->hazards[ i ], NULL );
+   }
+   vul_hazard_scan( d, t );
+   vul_atomic_store_u32( &t->in_use, 0 );
+}
+
+void *vul_hazard_protect_masked( vul_hazard_thread *t, u32 slot, void *volatile *src, uintptr_t mask )
+{
+   void *p, *q;
+
+   p = vul_atomic_load_ptr( src );
+   while( 1 ) {
+      vul_atomic_store_ptr( &t->hazards[ slot ], ( void* )( ( uintptr_t )p & ~mask ) );
+      // If *src still holds p after we published it, p was reachable while it was
+      // published, so any later retire of it will see the hazard
+      q = vul_atomic_load_ptr( src );
+      if( q == p ) {
+         return p;
+      }
+      p = q;
+   }
+}
+
+void *vul_hazard_protect( vul_hazard_thread *t, u32 slot, void *volatile *src )
+{
+   return vul_hazard_protect_masked( t, slot, src, 0 );
+}
+
+void vul_hazard_set( vul_hazard_thread *t, u32 slot, void *ptr )
+{
+   vul_atomic_store_ptr( &t->hazards[ slot ], ptr );
+}
+
+void vul_hazard_clear( vul_hazard_thread *t, u32 slot )
+{
+   vul_atomic_store_ptr( &t->hazards[ slot ], NULL );
+}
+
+void vul_hazard_retire( vul_hazard_domain *d, vul_hazard_thread *t,
+                        void *ptr, void( *deallocator )( void *ptr ) )
+{
+   u32 threshold;
+
+   vul__reclaim_list_push( &t->retired, ptr, deallocator, d->allocator, d->deallocator );
+   threshold = vul_atomic_load_u32( &d->thread_count ) * d->slots_per_thread + VUL_HAZARD_SCAN_SLACK;
+   if( t->retired.count >= threshold ) {
+      vul_hazard_scan( d, t );
+   }
+}
+
+/**
+ * Makes room for capacity hazards in t's scratch, keeping the first used ones.
+ */
+static void vul__hazard_reserve( vul_hazard_domain *d, vul_hazard_thread *t, u32 used, u32 capacity )
+{
+   void **scratch;
+
+   if( capacity <= t->scratch_capacity ) {
+      return;
+   }
+   if( capacity < t->scratch_capacity * 2 ) {
+      capacity = t->scratch_capacity * 2;
+   }
+   scratch = ( void** )d->allocator( sizeof( void* ) * capacity );
+   VUL_DATATYPES_CUSTOM_ASSERT( scratch != NULL ); // Make sure allocation didn't fail
+   if( t->scratch ) {
+      memcpy( scratch, t->scratch, sizeof( void* ) * used );
+      d->deallocator( t->scratch );
+   }
+   t->scratch = scratch;
+   t->scratch_capacity = capacity;
+}
+
+u32 vul_hazard_scan( vul_hazard_domain *d, vul_hazard_thread *t )
+{
+   vul_hazard_thread *o;
+   void *p;
+   u32 i, n, kept, capacity;
+
+   if( t->retired.count == 0 ) {
+      return 0;
+   }
+
+   // Snapshot every published hazard. Records linked after we read the registry
+   // can only protect pointers that are still reachable, so none of ours.
+   // Records are counted before they are linked, so reading the head first means the
+   // count covers every record reachable from it.
+   o = ( vul_hazard_thread* )vul_atomic_load_ptr( ( void *volatile* )&d->threads );
+   capacity = vul_atomic_load_u32( &d->thread_count ) * d->slots_per_thread;
+   vul__hazard_reserve( d, t, 0, capacity );
+   n = 0;
+   while( o != NULL ) {
+      vul__hazard_reserve( d, t, n, n + d->slots_per_thread );
+      for( i = 0; i < d->slots_per_thread; ++i ) {
+         p = vul_atomic_load_ptr( &o->hazards[ i ] );
+         if( p != NULL ) {
+            t->scratch[ n++ ] = p;
+         }
+      }
+      o = o->next;
+   }
+   qsort( t->scratch, n, sizeof( void* ), vul__hazard_compare );
+
+   // Free what isn't protected, keep the rest
+   kept = 0;
+   for( i = 0; i < t->retired.count; ++i ) {
+      p = t->retired.entries[ i ].ptr;
+      if( n && bsearch( &p, t->scratch, n, sizeof( void* ), vul__hazard_compare ) ) {
+         t->retired.entries[ kept++ ] = t->retired.entries[ i ];
+      } else {
+         t->retired.entries[ i ].deallocator( p );
+      }
+   }
+   t->retired.count = kept;
+
+   return kept;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef u64
+#undef b32
+#endif
+
+#endif // VUL_DEFINE
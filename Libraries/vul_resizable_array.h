@@ -4,6 +4,13 @@
  * This file describes an alternative to the STL vector class. This is mostly 
  * based on Tom Forsyth's ArbitraryList found here: https://home.comcast.net/~tom_forsyth/blog.wiki.html
  * This version is not templated (so pure C). Sorting of this list is available in vul_sort.h
+ *
+ * Besides the allocator-backed vectors there are two modes for short-lived vectors:
+ *  - Small-buffer vectors (vul_vector_create_small/vul_vector_initialize_buffer) start out
+ *    using inline storage and only allocate once they outgrow it.
+ *  - Arena vectors (vul_vector_create_arena) take all their memory from a caller-supplied
+ *    vul_vector_arena. A vector that was the last one to allocate grows in place; freeing is
+ *    a no-op, and everything is released at once with vul_vector_arena_reset.
  * 
  * ? If public domain is not legally valid in your legal jurisdiction
  *   the MIT licence applies (see the LICENCE file)
@@ -49,6 +56,16 @@
  */
 //#define VUL_DEBUG
 
+/**
+ * A linear allocator for vectors. The memory is owned by the caller.
+ */
+typedef struct vul_vector_arena {
+   u8 *memory;
+   size_t capacity;
+   size_t used;
+   size_t last; // Offset of the most recent allocation, which may grow in place
+} vul_vector_arena;
+
 /**
 * An alternative to the STL vector class. This is mostly based on Tom Forsyth's ArbitraryList
 * found here: https://home.comcast.net/~tom_forsyth/blog.wiki.html
@@ -79,6 +96,16 @@ typedef struct vul_vector {
    void *( *allocator )( size_t size );
    void ( *deallocator )( void *ptr );
    void *( *reallocator )( void *ptr, size_t size );
+
+   /**
+   * Inline storage used until the vector outgrows it, or NULL.
+   */
+   u8 *inline_buffer;
+   u32 inline_capacity;
+   /**
+   * If not NULL, all memory comes from this arena instead of the functions above.
+   */
+   vul_vector_arena *arena;
 } vul_vector;
 
 #ifdef __cplusplus
@@ -128,7 +155,9 @@ void *vul_vector_resize( vul_vector *vec, u32 size,
 */
 void vul_vector_reserve( vul_vector *vec, u32 size, s32 allocExactly );
 /**
-* Initializes the list
+* Initializes the list as a plain allocator-backed vector; only element_size and the
+* memory management functions need to be set. Small-buffer and arena vectors are set
+* up with vul_vector_initialize_buffer, vul_vector_create_small and vul_vector_create_arena.
 * @param initialSize Initial size of list
 * @param initialReservedSize Initial size of reserved space.
 */
@@ -148,6 +177,39 @@ vul_vector *vul_vector_create( u32 sizeOfType,
                                void  ( *deallocator )( void *ptr ),
                                void *( *reallocator )( void *ptr, size_t size ) );
 /**
+* Constructor for a small-buffer vector. Room for inlineCapacity elements is allocated
+* together with the vector itself, and the allocator is only used once it grows past that.
+*/
+vul_vector *vul_vector_create_small( u32 sizeOfType,
+                                     u32 inlineCapacity,
+                                     void *( *allocator )( size_t size ),
+                                     void  ( *deallocator )( void *ptr ),
+                                     void *( *reallocator )( void *ptr, size_t size ) );
+/**
+* Initializes a caller-owned vector (f.ex. on the stack) that uses the given buffer of
+* capacity elements until it outgrows it. Call vul_vector_freemem when done with it.
+*/
+void vul_vector_initialize_buffer( vul_vector *vec, u32 sizeOfType,
+                                   void *buffer, u32 capacity,
+                                   void *( *allocator )( size_t size ),
+                                   void  ( *deallocator )( void *ptr ),
+                                   void *( *reallocator )( void *ptr, size_t size ) );
+/**
+* Sets up an arena over the given memory.
+*/
+void vul_vector_arena_initialize( vul_vector_arena *arena, void *memory, size_t capacity );
+/**
+* Releases everything allocated from the arena. All vectors created from it become invalid.
+*/
+void vul_vector_arena_reset( vul_vector_arena *arena );
+/**
+* Constructor for a vector that lives in, and takes all its memory from, the given arena.
+* Running out of arena memory is treated like a failed allocation.
+*/
+vul_vector *vul_vector_create_arena( u32 sizeOfType,
+                                     u32 initialSize,
+                                     vul_vector_arena *arena );
+/**
 * Deletes the list and cleans up.
 */
 void vul_vector_destroy( vul_vector *vec );
@@ -247,6 +309,20 @@ u32 vul_vector_find_comparator( vul_vector *vec, void *item, s32 ( *comparator )
 * Shrinks the vector to fit the current size.
 */
 void vul_vector_tighten( vul_vector *vec );
+/**
+* Allocates size bytes of temporary memory (f.ex. for sorting) from wherever the vector
+* gets its memory: its arena or its allocator. Free it with vul_vector_scratch_free before
+* allocating more; an arena only takes back its latest allocation.
+*/
+void *vul_vector_scratch_alloc( vul_vector *vec, size_t size );
+/**
+* Frees memory from vul_vector_scratch_alloc.
+*/
+void vul_vector_scratch_free( vul_vector *vec, void *ptr, size_t size );
+/**
+* Creates an empty vector that takes its memory from the same place as vec.
+*/
+vul_vector *vul_vector_create_like( vul_vector *vec, u32 sizeOfType, u32 initialSize );
 
 
 // ----------------
@@ -327,6 +403,98 @@ void vul_vector_tighten( vul_vector *vec );
 extern "C" {
 #endif
 
+//--------------------
+// Internal helpers
+
+#define VUL__VECTOR_ARENA_ALIGN 16
+
+static void *vul__vector_arena_alloc( vul_vector_arena *arena, size_t size )
+{
+   size_t start;
+
+   start = ( arena->used + VUL__VECTOR_ARENA_ALIGN - 1 ) & ~( size_t )( VUL__VECTOR_ARENA_ALIGN - 1 );
+   if( start + size > arena->capacity ) {
+      return NULL;
+   }
+   arena->last = start;
+   arena->used = start + size;
+   return arena->memory + start;
+}
+
+static void vul__vector_arena_free( vul_vector_arena *arena, void *ptr, size_t size )
+{
+   // Only the most recent allocation can be handed back
+   if( ( u8* )ptr == arena->memory + arena->last && arena->last + size == arena->used ) {
+      arena->used = arena->last;
+   }
+}
+
+/**
+ * Moves the vector's storage to one of new_size elements, in whichever memory the vector uses.
+ */
+static u8 *vul__vector_reallocate( vul_vector *vec, u32 new_size )
+{
+   u8 *list;
+   size_t old_bytes, new_bytes;
+
+   old_bytes = ( size_t )vec->element_size * vec->reserved_size;
+   new_bytes = ( size_t )vec->element_size * new_size;
+
+   if( vec->arena ) {
+      if( vec->list == vec->arena->memory + vec->arena->last && vec->arena->last + old_bytes == vec->arena->used ) {
+         // We were the last allocation, so grow (or shrink) in place
+         if( vec->arena->last + new_bytes > vec->arena->capacity ) {
+            return NULL;
+         }
+         vec->arena->used = vec->arena->last + new_bytes;
+         return vec->list;
+      }
+      list = ( u8* )vul__vector_arena_alloc( vec->arena, new_bytes );
+      if( list && vec->list ) {
+         memcpy( list, vec->list, old_bytes < new_bytes ? old_bytes : new_bytes );
+      }
+      return list;
+   }
+   if( vec->inline_buffer && new_size <= vec->inline_capacity ) {
+      // Shrinking back into the inline buffer
+      if( vec->list != vec->inline_buffer ) {
+         memcpy( vec->inline_buffer, vec->list, new_bytes );
+         vec->deallocator( vec->list );
+      }
+      return vec->inline_buffer;
+   }
+   if( vec->list == NULL || vec->list == vec->inline_buffer ) {
+      list = ( u8* )vec->allocator( new_bytes );
+      if( list && vec->list ) {
+         memcpy( list, vec->list, old_bytes );
+      }
+      return list;
+   }
+#ifdef VUL_WINDOWS
+#pragma warning(suppress: 6308) // We know it might leak, but the VUL_DATATYPES_CUSTOM_ASSERT will trigger if it does!
+#endif
+   return ( u8* )vec->reallocator( vec->list, new_bytes );
+}
+
+/**
+ * Frees the vector's storage. Small-buffer vectors fall back to their inline buffer.
+ */
+static void vul__vector_release( vul_vector *vec )
+{
+   if( vec->arena ) {
+      if( vec->list ) {
+         vul__vector_arena_free( vec->arena, vec->list, ( size_t )vec->element_size * vec->reserved_size );
+      }
+   } else if( vec->list && vec->list != vec->inline_buffer ) {
+      vec->deallocator( vec->list );
+   }
+   vec->list = vec->inline_buffer;
+   vec->reserved_size = vec->inline_buffer ? vec->inline_capacity : 0;
+}
+
+//-------------
+// Public API
+
 void *vul_vector_begin( vul_vector *vec )
 {
    VUL_DATATYPES_CUSTOM_ASSERT( vec != NULL );
@@ -369,7 +537,7 @@ void *vul_vector_resize( vul_vector *vec, u32 size, u32 free_zero, u32 alloc_exa
    if( vec->size == vec->reserved_size ) {
       // Size matches exactly. Assert that things are well then leave.
       if( vec->reserved_size == 0 ) {
-         VUL_DATATYPES_CUSTOM_ASSERT( vec->list == NULL );
+         VUL_DATATYPES_CUSTOM_ASSERT( vec->list == NULL || vec->list == vec->inline_buffer );
       } else  {
          VUL_DATATYPES_CUSTOM_ASSERT( vec->list != NULL );
       }
@@ -378,13 +546,11 @@ void *vul_vector_resize( vul_vector *vec, u32 size, u32 free_zero, u32 alloc_exa
       // We have enough room.
       if( ( vec->size == 0 ) && free_zero ) {
          // New size is zero and freeing is wanted
-         vec->deallocator( vec->list );
-         vec->list = NULL;
-         vec->reserved_size = 0;
-         return NULL;
+         vul__vector_release( vec );
+         return vec->list;
       }
-      if( !alloc_exactly ) {
-         // No resizing needed
+      if( !alloc_exactly || vec->list == vec->inline_buffer ) {
+         // No resizing needed; the inline buffer is never shrunk
          return vec->list;
       }
    }
@@ -399,20 +565,10 @@ void *vul_vector_resize( vul_vector *vec, u32 size, u32 free_zero, u32 alloc_exa
       }
       VUL_DATATYPES_CUSTOM_ASSERT( new_size > vec->reserved_size );
    }
-   if( vec->list == NULL ) {
-      VUL_DATATYPES_CUSTOM_ASSERT( vec->reserved_size == 0 );
-      vec->list = ( u8* )vec->allocator( vec->element_size * new_size );
-      VUL_DATATYPES_CUSTOM_ASSERT( vec->list != NULL ); // Make sure allocation didn't fail
-   } else {
-      VUL_DATATYPES_CUSTOM_ASSERT( vec->reserved_size > 0 );
-#ifdef VUL_WINDOWS
-#pragma warning(suppress: 6308) // We know it might leak, but the VUL_DATATYPES_CUSTOM_ASSERT will trigger if it does!
-#endif
-      vec->list = ( u8* )vec->reallocator( vec->list, vec->element_size * new_size );
-      VUL_DATATYPES_CUSTOM_ASSERT( vec->list != NULL ); // Make sure reallocation didn't fail
-   }
-   VUL_DATATYPES_CUSTOM_ASSERT( vec->list != NULL );
-   vec->reserved_size = new_size;
+   VUL_DATATYPES_CUSTOM_ASSERT( vec->list != NULL || vec->reserved_size == 0 );
+   vec->list = vul__vector_reallocate( vec, new_size );
+   VUL_DATATYPES_CUSTOM_ASSERT( vec->list != NULL ); // Make sure (re)allocation didn't fail
+   vec->reserved_size = vec->list == vec->inline_buffer ? vec->inline_capacity : new_size;
    return vec->list;
 }
 
@@ -431,12 +587,15 @@ void vul_vector_reserve( vul_vector *vec, u32 size, s32 allocExactly )
    vec->size = old_size;
 }
 
-void vul_vector_initialize( vul_vector *vec, u32 initialSize, u32 initialReservedSize )
+/**
+ * Initializes the list in whichever memory mode the vector's fields already describe.
+ */
+static void vul__vector_initialize( vul_vector *vec, u32 initialSize, u32 initialReservedSize )
 {
    VUL_DATATYPES_CUSTOM_ASSERT( vec != NULL );
-   vec->list = NULL;
+   vec->list = vec->inline_buffer;
    vec->size = 0;
-   vec->reserved_size = 0;
+   vec->reserved_size = vec->inline_buffer ? vec->inline_capacity : 0;
    if( initialReservedSize > initialSize ) {
       vul_vector_reserve( vec, initialReservedSize, VUL_TRUE );
       vul_vector_resize( vec, initialSize, VUL_FALSE, VUL_FALSE );
@@ -445,6 +604,15 @@ void vul_vector_initialize( vul_vector *vec, u32 initialSize, u32 initialReserve
    }
 }
 
+void vul_vector_initialize( vul_vector *vec, u32 initialSize, u32 initialReservedSize )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( vec != NULL );
+   vec->inline_buffer = NULL;
+   vec->inline_capacity = 0;
+   vec->arena = NULL;
+   vul__vector_initialize( vec, initialSize, initialReservedSize );
+}
+
 vul_vector *vul_vector_create( unsigned int sizeOfType,
                                unsigned int initialSize,
                                void *( *allocator )( size_t size ),
@@ -461,6 +629,77 @@ vul_vector *vul_vector_create( unsigned int sizeOfType,
    return vec;
 }
 
+vul_vector *vul_vector_create_small( u32 sizeOfType,
+                                     u32 inlineCapacity,
+                                     void *( *allocator )( size_t size ),
+                                     void  ( *deallocator )( void *ptr ),
+                                     void *( *reallocator )( void *ptr, size_t size ) )
+{
+   vul_vector *vec;
+   size_t offset;
+
+   // The inline buffer follows the vector, aligned for any element type
+   offset = ( sizeof( vul_vector ) + 15 ) & ~( size_t )15;
+   vec = ( vul_vector* )allocator( offset + ( size_t )sizeOfType * inlineCapacity );
+   VUL_DATATYPES_CUSTOM_ASSERT( vec != NULL ); // Make sure allocation didn't fail
+   vul_vector_initialize_buffer( vec, sizeOfType, inlineCapacity ? ( u8* )vec + offset : NULL, inlineCapacity,
+                                 allocator, deallocator, reallocator );
+   return vec;
+}
+
+void vul_vector_initialize_buffer( vul_vector *vec, u32 sizeOfType,
+                                   void *buffer, u32 capacity,
+                                   void *( *allocator )( size_t size ),
+                                   void  ( *deallocator )( void *ptr ),
+                                   void *( *reallocator )( void *ptr, size_t size ) )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( vec != NULL );
+   VUL_DATATYPES_CUSTOM_ASSERT( ( buffer == NULL ) == ( capacity == 0 ) );
+   vec->element_size = sizeOfType;
+   vec->allocator = allocator;
+   vec->deallocator = deallocator;
+   vec->reallocator = reallocator;
+   vec->inline_buffer = ( u8* )buffer;
+   vec->inline_capacity = capacity;
+   vec->arena = NULL;
+   vul__vector_initialize( vec, 0, 0 );
+}
+
+void vul_vector_arena_initialize( vul_vector_arena *arena, void *memory, size_t capacity )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( arena != NULL );
+   arena->memory = ( u8* )memory;
+   arena->capacity = capacity;
+   arena->used = 0;
+   arena->last = 0;
+}
+
+void vul_vector_arena_reset( vul_vector_arena *arena )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( arena != NULL );
+   arena->used = 0;
+   arena->last = 0;
+}
+
+vul_vector *vul_vector_create_arena( u32 sizeOfType,
+                                     u32 initialSize,
+                                     vul_vector_arena *arena )
+{
+   vul_vector *vec;
+
+   vec = ( vul_vector* )vul__vector_arena_alloc( arena, sizeof( vul_vector ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( vec != NULL ); // Make sure allocation didn't fail
+   vec->element_size = sizeOfType;
+   vec->allocator = NULL;
+   vec->deallocator = NULL;
+   vec->reallocator = NULL;
+   vec->inline_buffer = NULL;
+   vec->inline_capacity = 0;
+   vec->arena = arena;
+   vul__vector_initialize( vec, 0, initialSize );
+   return vec;
+}
+
 void vul_vector_destroy( vul_vector *vec )
 {
    VUL_DATATYPES_CUSTOM_ASSERT( vec != NULL );
@@ -469,13 +708,14 @@ void vul_vector_destroy( vul_vector *vec )
       VUL_DATATYPES_CUSTOM_ASSERT( vec->size == 0 );
    } else {
       VUL_DATATYPES_CUSTOM_ASSERT( vec->reserved_size > 0 );
-      VUL_DATATYPES_CUSTOM_ASSERT( vec->size >= 0 );
-      vec->deallocator( vec->list );
-      vec->reserved_size = 0;
+      vul__vector_release( vec );
       vec->size = 0;
-      vec->list = NULL;
    }
-   vec->deallocator( vec );
+   if( vec->arena ) {
+      vul__vector_arena_free( vec->arena, vec, sizeof( vul_vector ) );
+   } else {
+      vec->deallocator( vec );
+   }
 }
 
 void vul_vector_freemem( vul_vector *vec )
@@ -535,7 +775,7 @@ void *vul_vector_insert_empty( vul_vector *vec, u32 index )
    VUL_DATATYPES_CUSTOM_ASSERT( index <= vec->size );
 
    vul_vector_resize( vec, vec->size + 1, VUL_TRUE, VUL_FALSE );
-   last = vec->size - 1;
+   last = vec->size * vec->element_size - 1;
    first = ( index + 1 ) * vec->element_size;
    for( i = last; i >= first; --i ) {
       vec->list[ i ] = vec->list[ i - vec->element_size ];
@@ -555,17 +795,21 @@ void vul_vector_insert( vul_vector *vec, void *item, u32 index )
 
 void vul_vector_swap( vul_vector *vec, u32 indexA, u32 indexB )
 {
-   void *temp;
+   u8 *a, *b, temp;
+   u32 i;
 
    VUL_DATATYPES_CUSTOM_ASSERT( vec != NULL );
    VUL_DATATYPES_CUSTOM_ASSERT( indexA < vec->size );
    VUL_DATATYPES_CUSTOM_ASSERT( indexB < vec->size );
 
-   temp = vec->allocator( vec->element_size );
-   VUL_DATATYPES_CUSTOM_ASSERT( temp != NULL ); // Make sure allocation didn't fail
-   memcpy( temp, &vec->list[ indexA * vec->element_size ], vec->element_size );
-   memcpy( &vec->list[ indexA * vec->element_size ], &vec->list[ indexB * vec->element_size ], vec->element_size );
-   memcpy( &vec->list[ indexB * vec->element_size ], temp, vec->element_size );
+   // Swap bytewise, so we don't need a temporary allocation (arena vectors have no allocator)
+   a = &vec->list[ indexA * vec->element_size ];
+   b = &vec->list[ indexB * vec->element_size ];
+   for( i = 0; i < vec->element_size; ++i ) {
+      temp = a[ i ];
+      a[ i ] = b[ i ];
+      b[ i ] = temp;
+   }
 }
 
 void vul_vector_copy( vul_vector *dest, u32 index, 
@@ -662,6 +906,34 @@ void vul_vector_tighten( vul_vector *vec )
    vul_vector_resize( vec, vec->size, VUL_TRUE, VUL_TRUE );
 }
 
+void *vul_vector_scratch_alloc( vul_vector *vec, size_t size )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( vec != NULL );
+   if( vec->arena ) {
+      return vul__vector_arena_alloc( vec->arena, size );
+   }
+   return vec->allocator( size );
+}
+
+void vul_vector_scratch_free( vul_vector *vec, void *ptr, size_t size )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( vec != NULL );
+   if( vec->arena ) {
+      vul__vector_arena_free( vec->arena, ptr, size );
+   } else {
+      vec->deallocator( ptr );
+   }
+}
+
+vul_vector *vul_vector_create_like( vul_vector *vec, u32 sizeOfType, u32 initialSize )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( vec != NULL );
+   if( vec->arena ) {
+      return vul_vector_create_arena( sizeOfType, initialSize, vec->arena );
+   }
+   return vul_vector_create( sizeOfType, initialSize, vec->allocator, vec->deallocator, vec->reallocator );
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -672,5 +944,7 @@ void vul_vector_tighten( vul_vector *vec )
 #undef u8
 #endif
 
+#undef VUL__VECTOR_ARENA_ALIGN
+
 #endif // VUL_DEFINE
 
@@ -0,0 +1,467 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file describes two bounded, lock-free ring buffer queues for handing
+ * data between threads, as an alternative to wrapping a vul_queue in a mutex:
+ *  - vul_spsc_queue: one producer thread and one consumer thread. Push and pop
+ *    are a copy plus one atomic store each; each side caches the other side's
+ *    index so it only touches the shared cache line when it looks full/empty.
+ *  - vul_mpmc_queue: any number of producers and consumers (Vyukov's bounded
+ *    queue). Every slot has a sequence number, so claiming a slot is one CAS.
+ * Both copy elements of a fixed size in and out, have a power of two capacity
+ * (requests are rounded up) and never allocate after creation. Head and tail live
+ * on separate cache lines. The batch functions move as many elements as they
+ * can with one index update and return how many they moved.
+ *
+ * Depends on vul_thread.h for atomics; define VUL_WINDOWS, VUL_LINUX or VUL_OSX.
+ *
+ * Define VUL_DEFINE in exactly one compilation unit.
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_RING_BUFFER_H
+#define VUL_RING_BUFFER_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef VUL_DATATYPES_CUSTOM_ASSERT
+#include <assert.h>
+#define VUL_DATATYPES_CUSTOM_ASSERT assert
+#endif
+
+#include "vul_thread.h"
+
+#ifndef VUL_TYPES_H
+#include <stdint.h>
+#define u32 uint32_t
+#define s32 int32_t
+#define u8 uint8_t
+#define b32 uint32_t
+#endif
+
+/**
+ * Size of a cache line; fields written by different threads are kept this far apart.
+ */
+#ifndef VUL_RING_BUFFER_CACHE_LINE
+#define VUL_RING_BUFFER_CACHE_LINE 64
+#endif
+
+typedef struct vul_spsc_queue {
+   u8 *data;
+   u32 mask;
+   u32 data_size;
+   void *( *allocator )( size_t size );
+   void( *deallocator )( void *ptr );
+   u8 pad0[ VUL_RING_BUFFER_CACHE_LINE ];
+
+   volatile u32 tail;  // Written by the producer
+   u32 cached_head;    // Producer's last seen head
+   u8 pad1[ VUL_RING_BUFFER_CACHE_LINE - 2 * sizeof( u32 ) ];
+
+   volatile u32 head;  // Written by the consumer
+   u32 cached_tail;    // Consumer's last seen tail
+   u8 pad2[ VUL_RING_BUFFER_CACHE_LINE - 2 * sizeof( u32 ) ];
+} vul_spsc_queue;
+
+typedef struct vul_mpmc_queue {
+   u8 *cells; // Each cell is a u32 sequence number followed by the element
+   u32 mask;
+   u32 data_size;
+   u32 cell_size;
+   void *( *allocator )( size_t size );
+   void( *deallocator )( void *ptr );
+   u8 pad0[ VUL_RING_BUFFER_CACHE_LINE ];
+
+   volatile u32 tail;
+   u8 pad1[ VUL_RING_BUFFER_CACHE_LINE - sizeof( u32 ) ];
+
+   volatile u32 head;
+   u8 pad2[ VUL_RING_BUFFER_CACHE_LINE - sizeof( u32 ) ];
+} vul_mpmc_queue;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * Creates a single producer, single consumer queue of at least the given capacity.
+ */
+vul_spsc_queue *vul_spsc_queue_create( u32 element_size, u32 capacity,
+                                       void *( *allocator )( size_t size ),
+                                       void( *deallocator )( void *ptr ) );
+/**
+ * Pushes a copy of data. Returns false if the queue is full. Producer only.
+ */
+b32 vul_spsc_queue_push( vul_spsc_queue *q, void *data );
+/**
+ * Pushes up to count elements from data. Returns the number pushed. Producer only.
+ */
+u32 vul_spsc_queue_push_batch( vul_spsc_queue *q, void *data, u32 count );
+/**
+ * Pops an element into out. Returns false if the queue is empty. Consumer only.
+ */
+b32 vul_spsc_queue_pop( vul_spsc_queue *q, void *out );
+/**
+ * Pops up to count elements into out. Returns the number popped. Consumer only.
+ */
+u32 vul_spsc_queue_pop_batch( vul_spsc_queue *q, void *out, u32 count );
+/**
+ * Returns the number of elements in the queue. Only a snapshot if the queue is in use.
+ */
+u32 vul_spsc_queue_size( vul_spsc_queue *q );
+/**
+ * Destroys the queue. No thread may use it at this point.
+ */
+void vul_spsc_queue_destroy( vul_spsc_queue *q );
+
+/**
+ * Creates a multi producer, multi consumer queue of at least the given capacity.
+ */
+vul_mpmc_queue *vul_mpmc_queue_create( u32 element_size, u32 capacity,
+                                       void *( *allocator )( size_t size ),
+                                       void( *deallocator )( void *ptr ) );
+/**
+ * Pushes a copy of data. Returns false if the queue is full.
+ */
+b32 vul_mpmc_queue_push( vul_mpmc_queue *q, void *data );
+/**
+ * Pushes up to count elements from data as one contiguous run. Returns the number pushed.
+ */
+u32 vul_mpmc_queue_push_batch( vul_mpmc_queue *q, void *data, u32 count );
+/**
+ * Pops an element into out. Returns false if the queue is empty.
+ */
+b32 vul_mpmc_queue_pop( vul_mpmc_queue *q, void *out );
+/**
+ * Pops up to count consecutive elements into out. Returns the number popped.
+ */
+u32 vul_mpmc_queue_pop_batch( vul_mpmc_queue *q, void *out, u32 count );
+/**
+ * Returns the number of elements in the queue. Only a snapshot if the queue is in use.
+ */
+u32 vul_mpmc_queue_size( vul_mpmc_queue *q );
+/**
+ * Destroys the queue. No thread may use it at this point.
+ */
+void vul_mpmc_queue_destroy( vul_mpmc_queue *q );
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef s32
+#undef u8
+#undef b32
+#endif
+
+#endif // VUL_RING_BUFFER_H
+
+#ifdef VUL_DEFINE
+
+#ifndef VUL_TYPES_H
+#define u32 uint32_t
+#define s32 int32_t
+#define u8 uint8_t
+#define b32 uint32_t
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------
+// Internal helpers
+
+static u32 vul__ring_buffer_capacity( u32 capacity )
+{
+   u32 c;
+
+   // Indices wrap at 2^32, and we compare them as signed distances
+   VUL_DATATYPES_CUSTOM_ASSERT( capacity > 0 && capacity <= ( 1u << 30 ) );
+   c = 1;
+   while( c < capacity ) {
+      c <<= 1;
+   }
+   return c;
+}
+
+/**
+ * Copies count elements between the ring and a linear buffer, starting at ring index i.
+ */
+static void vul__spsc_queue_copy( vul_spsc_queue *q, u32 i, u8 *linear, u32 count, b32 to_ring )
+{
+   u32 first, n;
+
+   first = i & q->mask;
+   n = q->mask + 1 - first;
+   if( n > count ) {
+      n = count;
+   }
+   if( to_ring ) {
+      memcpy( q->data + first * q->data_size, linear, n * q->data_size );
+      memcpy( q->data, linear + n * q->data_size, ( count - n ) * q->data_size );
+   } else {
+      memcpy( linear, q->data + first * q->data_size, n * q->data_size );
+      memcpy( linear + n * q->data_size, q->data, ( count - n ) * q->data_size );
+   }
+}
+
+static volatile u32 *vul__mpmc_queue_seq( vul_mpmc_queue *q, u32 i )
+{
+   return ( volatile u32* )( q->cells + ( size_t )( i & q->mask ) * q->cell_size );
+}
+
+static void *vul__mpmc_queue_data( vul_mpmc_queue *q, u32 i )
+{
+   return q->cells + ( size_t )( i & q->mask ) * q->cell_size + sizeof( u32 );
+}
+
+//-------------
+// Public API
+
+vul_spsc_queue *vul_spsc_queue_create( u32 element_size, u32 capacity,
+                                       void *( *allocator )( size_t size ),
+                                       void( *deallocator )( void *ptr ) )
+{
+   vul_spsc_queue *ret;
+   u32 c;
+
+   c = vul__ring_buffer_capacity( capacity );
+   ret = ( vul_spsc_queue* )allocator( sizeof( vul_spsc_queue ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( ret != NULL ); // Make sure allocation didn't fail
+   ret->data = ( u8* )allocator( ( size_t )c * element_size );
+   VUL_DATATYPES_CUSTOM_ASSERT( ret->data != NULL ); // Make sure allocation didn't fail
+   ret->mask = c - 1;
+   ret->data_size = element_size;
+   ret->allocator = allocator;
+   ret->deallocator = deallocator;
+   ret->tail = 0;
+   ret->cached_head = 0;
+   ret->head = 0;
+   ret->cached_tail = 0;
+
+   return ret;
+}
+
+b32 vul_spsc_queue_push( vul_spsc_queue *q, void *data )
+{
+   return vul_spsc_queue_push_batch( q, data, 1 ) == 1;
+}
+
+u32 vul_spsc_queue_push_batch( vul_spsc_queue *q, void *data, u32 count )
+{
+   u32 t, room;
+
+   t = q->tail; // Only we write it
+   room = q->mask + 1 - ( t - q->cached_head );
+   if( room < count ) {
+      q->cached_head = vul_atomic_load_u32( &q->head );
+      room = q->mask + 1 - ( t - q->cached_head );
+      if( room < count ) {
+         count = room;
+      }
+   }
+   if( count == 0 ) {
+      return 0;
+   }
+
+   vul__spsc_queue_copy( q, t, ( u8* )data, count, 1 );
+   vul_atomic_store_u32( &q->tail, t + count ); // Publishes the elements
+
+   return count;
+}
+
+b32 vul_spsc_queue_pop( vul_spsc_queue *q, void *out )
+{
+   return vul_spsc_queue_pop_batch( q, out, 1 ) == 1;
+}
+
+u32 vul_spsc_queue_pop_batch( vul_spsc_queue *q, void *out, u32 count )
+{
+   u32 h, used;
+
+   h = q->head; // Only we write it
+   used = q->cached_tail - h;
+   if( used < count ) {
+      q->cached_tail = vul_atomic_load_u32( &q->tail );
+      used = q->cached_tail - h;
+      if( used < count ) {
+         count = used;
+      }
+   }
+   if( count == 0 ) {
+      return 0;
+   }
+
+   vul__spsc_queue_copy( q, h, ( u8* )out, count, 0 );
+   vul_atomic_store_u32( &q->head, h + count ); // Hands the slots back
+
+   return count;
+}
+
+u32 vul_spsc_queue_size( vul_spsc_queue *q )
+{
+   u32 h;
+
+   h = vul_atomic_load_u32( &q->head );
+   return vul_atomic_load_u32( &q->tail ) - h;
+}
+
+void vul_spsc_queue_destroy( vul_spsc_queue *q )
+{
+   q->deallocator( q->data );
+   q->deallocator( q );
+}
+
+vul_mpmc_queue *vul_mpmc_queue_create( u32 element_size, u32 capacity,
+                                       void *( *allocator )( size_t size ),
+                                       void( *deallocator )( void *ptr ) )
+{
+   vul_mpmc_queue *ret;
+   u32 c, i;
+
+   c = vul__ring_buffer_capacity( capacity );
+   ret = ( vul_mpmc_queue* )allocator( sizeof( vul_mpmc_queue ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( ret != NULL ); // Make sure allocation didn't fail
+   ret->mask = c - 1;
+   ret->data_size = element_size;
+   ret->cell_size = ( u32 )( ( sizeof( u32 ) + element_size + 7 ) & ~( u32 )7 ); // Keep elements 4/8-aligned
+   ret->cells = ( u8* )allocator( ( size_t )c * ret->cell_size );
+   VUL_DATATYPES_CUSTOM_ASSERT( ret->cells != NULL ); // Make sure allocation didn't fail
+   ret->allocator = allocator;
+   ret->deallocator = deallocator;
+   ret->tail = 0;
+   ret->head = 0;
+
+   // Cell i is free for the push at position i
+   for( i = 0; i < c; ++i ) {
+      *vul__mpmc_queue_seq( ret, i ) = i;
+   }
+
+   return ret;
+}
+
+b32 vul_mpmc_queue_push( vul_mpmc_queue *q, void *data )
+{
+   return vul_mpmc_queue_push_batch( q, data, 1 ) == 1;
+}
+
+u32 vul_mpmc_queue_push_batch( vul_mpmc_queue *q, void *data, u32 count )
+{
+   u32 t, n, i;
+   s32 d;
+
+   if( count == 0 ) {
+      return 0;
+   }
+   t = vul_atomic_load_u32( &q->tail );
+   while( 1 ) {
+      // Count how many cells from t on have been released by their consumers
+      for( n = 0; n < count; ++n ) {
+         d = ( s32 )( vul_atomic_load_u32( vul__mpmc_queue_seq( q, t + n ) ) - ( t + n ) );
+         if( d != 0 ) {
+            break;
+         }
+      }
+      if( n == 0 ) {
+         if( d < 0 ) {
+            return 0; // Full
+         }
+         t = vul_atomic_load_u32( &q->tail ); // Another producer got here first
+         continue;
+      }
+      // The cells stay ours to fill as long as nobody moved the tail meanwhile
+      if( vul_atomic_cas_u32( &q->tail, t, t + n ) ) {
+         break;
+      }
+      t = vul_atomic_load_u32( &q->tail );
+   }
+
+   for( i = 0; i < n; ++i ) {
+      memcpy( vul__mpmc_queue_data( q, t + i ), ( u8* )data + ( size_t )i * q->data_size, q->data_size );
+      vul_atomic_store_u32( vul__mpmc_queue_seq( q, t + i ), t + i + 1 );
+   }
+   return n;
+}
+
+b32 vul_mpmc_queue_pop( vul_mpmc_queue *q, void *out )
+{
+   return vul_mpmc_queue_pop_batch( q, out, 1 ) == 1;
+}
+
+u32 vul_mpmc_queue_pop_batch( vul_mpmc_queue *q, void *out, u32 count )
+{
+   u32 h, n, i;
+   s32 d;
+
+   if( count == 0 ) {
+      return 0;
+   }
+   h = vul_atomic_load_u32( &q->head );
+   while( 1 ) {
+      // Count how many cells from h on have been filled by their producers
+      for( n = 0; n < count; ++n ) {
+         d = ( s32 )( vul_atomic_load_u32( vul__mpmc_queue_seq( q, h + n ) ) - ( h + n + 1 ) );
+         if( d != 0 ) {
+            break;
+         }
+      }
+      if( n == 0 ) {
+         if( d < 0 ) {
+            return 0; // Empty
+         }
+         h = vul_atomic_load_u32( &q->head ); // Another consumer got here first
+         continue;
+      }
+      if( vul_atomic_cas_u32( &q->head, h, h + n ) ) {
+         break;
+      }
+      h = vul_atomic_load_u32( &q->head );
+   }
+
+   for( i = 0; i < n; ++i ) {
+      memcpy( ( u8* )out + ( size_t )i * q->data_size, vul__mpmc_queue_data( q, h + i ), q->data_size );
+      // Free the cell for the push one lap later
+      vul_atomic_store_u32( vul__mpmc_queue_seq( q, h + i ), h + i + q->mask + 1 );
+   }
+   return n;
+}
+
+u32 vul_mpmc_queue_size( vul_mpmc_queue *q )
+{
+   u32 h, t;
+
+   h = vul_atomic_load_u32( &q->head );
+   t = vul_atomic_load_u32( &q->tail );
+   return ( s32 )( t - h ) > 0 ? t - h : 0;
+}
+
+void vul_mpmc_queue_destroy( vul_mpmc_queue *q )
+{
+   q->deallocator( q->cells );
+   q->deallocator( q );
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef s32
+#undef u8
+#undef b32
+#endif
+
+#endif // VUL_DEFINE
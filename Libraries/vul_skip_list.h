@@ -1,8 +1,12 @@
 /*
  * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
  *
- * This file describes a singly linked skip list. The current implementation is
- * not indexable.
+ * This file describes a singly linked, indexable skip list. Every link stores how
+ * many elements it skips (its span), so elements can be looked up by rank and
+ * the rank of a key found in O(log n). Range queries are done with cursors:
+ * vul_skip_list_lower_bound( a ) and then vul_skip_list_next until an element
+ * compares >= b. A list can be built in O(n) from sorted data, in which case
+ * levels are assigned deterministically (a perfect skip list) instead of randomly.
  *
  * Define VUL_DEFINE in exactly one compilation unit.
  * 
@@ -35,15 +39,22 @@
 #define f32 float
 #endif
 
+/**
+ * The maximum number of levels of the list.
+ */
+#define VUL_SKIP_LIST_MAX_LEVEL 32
+
 typedef struct vul_skip_list_element {
    void *data;
    u32 levels;
    struct vul_skip_list_element** nexts;
+   u32 *spans; // Number of elements nexts[ l ] is ahead of this one, or to the end if NULL
 } vul_skip_list_element;
 
 typedef struct vul_skip_list {
    u32 levels;
-   vul_skip_list_element **heads;
+   vul_skip_list_element *head; // Sentinel with VUL_SKIP_LIST_MAX_LEVEL levels and no data
+   u32 count;
    u32 data_size;
    s32 (*comparator)( void *a, void *b );
 
@@ -68,11 +79,48 @@ vul_skip_list *vul_skip_list_create( u32 data_size,
                                      s32( *comparator )( void *a, void *b ),
                                      void *( *allocator )( size_t size ),
                                      void( *deallocator )( void *ptr ) );
+/**
+ * Creates a new skip list from count elements of data_size bytes that are already
+ * sorted according to comparator. Runs in O(n): element i (1-based) gets
+ * 1 + (number of trailing zero bits in i) levels.
+ */
+vul_skip_list *vul_skip_list_create_sorted( u32 data_size,
+                                            s32( *comparator )( void *a, void *b ),
+                                            void *data, u32 count,
+                                            void *( *allocator )( size_t size ),
+                                            void( *deallocator )( void *ptr ) );
 /**
  * Finds the element in the list which matches the given data key. If
- * no match is found, returns NULL.
+ * no match is found, returns NULL. If there are several, returns the first.
  */
 vul_skip_list_element *vul_skip_list_find( vul_skip_list *list, void *data );
+/**
+ * Returns the first element that does not compare less than the given key,
+ * or NULL if there is none.
+ */
+vul_skip_list_element *vul_skip_list_lower_bound( vul_skip_list *list, void *data );
+/**
+ * Returns the first element that compares greater than the given key,
+ * or NULL if there is none.
+ */
+vul_skip_list_element *vul_skip_list_upper_bound( vul_skip_list *list, void *data );
+/**
+ * Returns the first element of the list, or NULL if it is empty.
+ */
+vul_skip_list_element *vul_skip_list_first( vul_skip_list *list );
+/**
+ * Returns the element following e, or NULL if e is the last one.
+ */
+vul_skip_list_element *vul_skip_list_next( vul_skip_list_element *e );
+/**
+ * Returns the element at the given 0-based index, or NULL if it is out of range.
+ */
+vul_skip_list_element *vul_skip_list_at( vul_skip_list *list, u32 index );
+/**
+ * Returns the number of elements that compare less than the given key, which is
+ * the index of vul_skip_list_lower_bound( list, data ).
+ */
+u32 vul_skip_list_rank( vul_skip_list *list, void *data );
 /**
  * Removes the given element from the list, and deletes it.
  */
@@ -101,6 +149,7 @@ void vul_skip_list_destroy( vul_skip_list *list );
  * Creates a copy of the given skip list. It does NOT maintain the same lanes,
  * meaning it copies the data and maintains the sorting invariant, but it may look
  * differently internally, and thus may perform slightly different.
+ * Since the source is sorted this is O(n), like vul_skip_list_create_sorted.
  */
 vul_skip_list *vul_skip_list_copy( vul_skip_list *src,
                                    void *( *allocator )( size_t size ),
@@ -129,153 +178,333 @@ vul_skip_list *vul_skip_list_copy( vul_skip_list *src,
 extern "C" {
 #endif
 
+//--------------------
+// Internal helpers
+
 static s32 vul__skip_list_coin_flip( )
 {
    return ( ( f32 )rand( ) / ( f32 )RAND_MAX ) > 0.5;
 }
 
+/**
+ * Allocates an element with the given number of levels. The links, spans and
+ * data live in the same allocation as the element.
+ */
+static vul_skip_list_element *vul__skip_list_element_create( vul_skip_list *list, u32 levels, void *data )
+{
+   vul_skip_list_element *e;
+   size_t spans, data_offset;
+
+   spans = sizeof( vul_skip_list_element ) + sizeof( vul_skip_list_element* ) * levels;
+   data_offset = ( spans + sizeof( u32 ) * levels + 7 ) & ~( size_t )7;
+
+   e = ( vul_skip_list_element* )list->allocator( data_offset + ( data ? list->data_size : 0 ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( e != NULL ); // Make sure allocation didn't fail
+   e->levels = levels;
+   e->nexts = ( vul_skip_list_element** )( e + 1 );
+   e->spans = ( u32* )( ( char* )e + spans );
+   e->data = NULL;
+   if( data ) {
+      e->data = ( char* )e + data_offset;
+      memcpy( e->data, data, list->data_size );
+   }
+   return e;
+}
+
+/**
+ * Appends data to a list under construction. last[ l ] and last_rank[ l ] hold
+ * the last element on each level and its 1-based rank (0 for the head).
+ */
+static void vul__skip_list_append( vul_skip_list *list, vul_skip_list_element **last, u32 *last_rank, void *data )
+{
+   vul_skip_list_element *e;
+   u32 r, l, levels;
+
+   r = list->count + 1;
+   levels = 1;
+   while( levels < VUL_SKIP_LIST_MAX_LEVEL && ( r & ( 1u << ( levels - 1 ) ) ) == 0 ) {
+      ++levels;
+   }
+
+   e = vul__skip_list_element_create( list, levels, data );
+   for( l = 0; l < levels; ++l ) {
+      e->nexts[ l ] = NULL;
+      last[ l ]->nexts[ l ] = e;
+      last[ l ]->spans[ l ] = r - last_rank[ l ];
+      last[ l ] = e;
+      last_rank[ l ] = r;
+   }
+   if( levels > list->levels ) {
+      list->levels = levels;
+   }
+   list->count = r;
+}
+
+static void vul__skip_list_append_finish( vul_skip_list *list, vul_skip_list_element **last, u32 *last_rank )
+{
+   u32 l;
+
+   for( l = 0; l < list->levels; ++l ) {
+      last[ l ]->spans[ l ] = list->count - last_rank[ l ];
+   }
+}
+
+static void vul__skip_list_append_begin( vul_skip_list *list, vul_skip_list_element **last, u32 *last_rank )
+{
+   u32 l;
+
+   for( l = 0; l < VUL_SKIP_LIST_MAX_LEVEL; ++l ) {
+      last[ l ] = list->head;
+      last_rank[ l ] = 0;
+   }
+}
+
+//-------------
+// Public API
+
 vul_skip_list *vul_skip_list_create( u32 data_size,
                                      s32( *comparator )( void *a, void *b ),
                                      void *( *allocator )( size_t size ),
                                      void( *deallocator )( void *ptr ) )
 {
    vul_skip_list *ret;
-   s32 l;
+   u32 l;
 
    ret = ( vul_skip_list* )allocator( sizeof( vul_skip_list ) );
    VUL_DATATYPES_CUSTOM_ASSERT( ret != NULL ); // Make sure allocation didn't fail
    ret->levels = 1;
-   ret->heads = ( vul_skip_list_element** )allocator( sizeof( vul_skip_list_element* ) );
-   VUL_DATATYPES_CUSTOM_ASSERT( ret->heads != NULL ); // Make sure allocation didn't fail
+   ret->count = 0;
    ret->comparator = comparator;
    ret->data_size = data_size;
    ret->allocator = allocator;
    ret->deallocator = deallocator;
 
-   for( l = ret->levels - 1; l >= 0; --l )
-   {
-      ret->heads[ l ] = NULL;
+   ret->head = vul__skip_list_element_create( ret, VUL_SKIP_LIST_MAX_LEVEL, NULL );
+   for( l = 0; l < VUL_SKIP_LIST_MAX_LEVEL; ++l ) {
+      ret->head->nexts[ l ] = NULL;
+      ret->head->spans[ l ] = 0;
    }
 
    return ret;
 }
 
-vul_skip_list_element *vul_skip_list_find( vul_skip_list *list, void *data )
+vul_skip_list *vul_skip_list_create_sorted( u32 data_size,
+                                            s32( *comparator )( void *a, void *b ),
+                                            void *data, u32 count,
+                                            void *( *allocator )( size_t size ),
+                                            void( *deallocator )( void *ptr ) )
+{
+   vul_skip_list *ret;
+   vul_skip_list_element *last[ VUL_SKIP_LIST_MAX_LEVEL ];
+   u32 last_rank[ VUL_SKIP_LIST_MAX_LEVEL ], i;
+   char *d;
+
+   ret = vul_skip_list_create( data_size, comparator, allocator, deallocator );
+
+   d = ( char* )data;
+   vul__skip_list_append_begin( ret, last, last_rank );
+   for( i = 0; i < count; ++i ) {
+      VUL_DATATYPES_CUSTOM_ASSERT( i == 0 || comparator( d - data_size, d ) <= 0 ); // Input must be sorted
+      vul__skip_list_append( ret, last, last_rank, d );
+      d += data_size;
+   }
+   vul__skip_list_append_finish( ret, last, last_rank );
+
+   return ret;
+}
+
+vul_skip_list_element *vul_skip_list_lower_bound( vul_skip_list *list, void *data )
 {
    s32 l;
-   vul_skip_list_element *e = NULL;
+   vul_skip_list_element *e;
 
-   if( list == NULL || list->heads == NULL ) return NULL;
+   e = list->head;
+   for( l = ( s32 )list->levels - 1; l >= 0; --l ) {
+      while( e->nexts[ l ] != NULL && list->comparator( e->nexts[ l ]->data, data ) < 0 ) {
+         e = e->nexts[ l ];
+      }
+   }
 
-   for( l = list->levels - 1; l >= 0; --l )
-   {
-      e = list->heads[ l ];
-      while( list->comparator( e->data, data ) < 0 )
-      {
+   return e->nexts[ 0 ];
+}
+
+vul_skip_list_element *vul_skip_list_upper_bound( vul_skip_list *list, void *data )
+{
+   s32 l;
+   vul_skip_list_element *e;
+
+   e = list->head;
+   for( l = ( s32 )list->levels - 1; l >= 0; --l ) {
+      while( e->nexts[ l ] != NULL && list->comparator( e->nexts[ l ]->data, data ) <= 0 ) {
          e = e->nexts[ l ];
       }
    }
 
+   return e->nexts[ 0 ];
+}
+
+vul_skip_list_element *vul_skip_list_find( vul_skip_list *list, void *data )
+{
+   vul_skip_list_element *e;
+
+   if( list == NULL || list->head == NULL ) return NULL;
+
+   e = vul_skip_list_lower_bound( list, data );
    if( e && list->comparator( e->data, data ) == 0 ) return e;
    return NULL;
 }
 
-void vul_skip_list_remove( vul_skip_list *list, vul_skip_list_element *e )
+vul_skip_list_element *vul_skip_list_first( vul_skip_list *list )
+{
+   return list->head->nexts[ 0 ];
+}
+
+vul_skip_list_element *vul_skip_list_next( vul_skip_list_element *e )
+{
+   return e->nexts[ 0 ];
+}
+
+vul_skip_list_element *vul_skip_list_at( vul_skip_list *list, u32 index )
 {
    s32 l;
-   vul_skip_list_element *p, *h;
+   u32 r;
+   vul_skip_list_element *e;
 
-   VUL_DATATYPES_CUSTOM_ASSERT( e != NULL );
+   if( index >= list->count ) return NULL;
 
-   // For every level
-   for( l = list->levels - 1; l >= 0; --l )
-   {
-      p = NULL;
-      h = list->heads[ l ];
-      // See if e exists on this level
-      while( h != NULL && h != e ) {
-         p = h;
-         h = h->nexts[ l ];
+   // Ranks are 1-based here; the head has rank 0
+   e = list->head;
+   r = 0;
+   for( l = ( s32 )list->levels - 1; l >= 0; --l ) {
+      while( e->nexts[ l ] != NULL && r + e->spans[ l ] <= index + 1 ) {
+         r += e->spans[ l ];
+         e = e->nexts[ l ];
       }
-      // And if it does, remove it's link
-      if( h == e ) {
-         p->nexts[ l ] = e->nexts[ l ];
+      if( r == index + 1 ) {
+         break;
       }
    }
 
-   list->deallocator( e->data );
-   list->deallocator( e->nexts );
-   list->deallocator( e );
-   // By setting to null we are much more likely to trigger asserts if used after deallocation
-   e->data = NULL;
-   e->nexts = NULL;
-   e = NULL;
+   return e;
 }
 
-vul_skip_list_element *vul_skip_list_insert( vul_skip_list *list, void *data )
+u32 vul_skip_list_rank( vul_skip_list *list, void *data )
 {
    s32 l;
-   vul_skip_list_element **el, *e, *ret;
+   u32 r;
+   vul_skip_list_element *e;
 
-   if( list == NULL || list->heads == NULL ) return NULL;
+   e = list->head;
+   r = 0;
+   for( l = ( s32 )list->levels - 1; l >= 0; --l ) {
+      while( e->nexts[ l ] != NULL && list->comparator( e->nexts[ l ]->data, data ) < 0 ) {
+         r += e->spans[ l ];
+         e = e->nexts[ l ];
+      }
+   }
 
-   el = ( vul_skip_list_element** )list->allocator( list->levels * sizeof( vul_skip_list_element* ) );
-   VUL_DATATYPES_CUSTOM_ASSERT( el != NULL ); // Make sure allocation didn't fail
+   return r;
+}
 
-   for( l = list->levels - 1; l >= 0; --l )
-   {
-      e = list->heads[ l ];
-      while( list->comparator( e->data, data ) < 0 )
-      {
-         if( e->nexts[ l ] == NULL ) {
-            break;
-         }
-         e = e->nexts[ l ];
+void vul_skip_list_remove( vul_skip_list *list, vul_skip_list_element *e )
+{
+   s32 l;
+   vul_skip_list_element *update[ VUL_SKIP_LIST_MAX_LEVEL ], *p;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( e != NULL );
+
+   // Find the last element before e's key on every level
+   p = list->head;
+   for( l = ( s32 )list->levels - 1; l >= 0; --l ) {
+      while( p->nexts[ l ] != NULL && list->comparator( p->nexts[ l ]->data, e->data ) < 0 ) {
+         p = p->nexts[ l ];
       }
-      el[ l ] = e; // Store the last elements in each level
+      update[ l ] = p;
+   }
+   // Elements with an equal key may come before e; walk past them on the bottom level
+   p = p->nexts[ 0 ];
+   while( p != e ) {
+      VUL_DATATYPES_CUSTOM_ASSERT( p != NULL ); // e must be in the list
+      for( l = 0; l < ( s32 )p->levels; ++l ) {
+         update[ l ] = p;
+      }
+      p = p->nexts[ 0 ];
    }
 
-   // Create our element
-   ret = ( vul_skip_list_element* )list->allocator( sizeof( vul_skip_list_element ) );
-   VUL_DATATYPES_CUSTOM_ASSERT( ret != NULL ); // Make sure allocation didn't fail
-   ret->data = list->allocator( list->data_size );
-   VUL_DATATYPES_CUSTOM_ASSERT( ret->data != NULL ); // Make sure allocation didn't fail
-   memcpy( ret->data, data, list->data_size );
-   ret->levels = 1;
-   while( vul__skip_list_coin_flip( ) ) ++ret->levels;
-   ret->nexts = ( vul_skip_list_element** )list->allocator( ret->levels * sizeof( vul_skip_list_element* ) );
-   VUL_DATATYPES_CUSTOM_ASSERT( ret->nexts != NULL ); // Make sure allocation didn't fail
-   /* @TODO: THIS IS NOT WORKING YET! */ assert( false && "Skip lists aren't correctly implemented here." );
-   // Insert it at bottom level, and each above if coinflip is false
-   for( l = ret->levels - 1; l >= 0; --l )
-   {
-      ret->nexts[ l ] = el[ l ]->nexts[ l ];
+   for( l = 0; l < ( s32 )list->levels; ++l ) {
+      if( update[ l ]->nexts[ l ] == e ) {
+         update[ l ]->spans[ l ] += e->spans[ l ] - 1;
+         update[ l ]->nexts[ l ] = e->nexts[ l ];
+      } else {
+         --update[ l ]->spans[ l ];
+      }
+   }
+   while( list->levels > 1 && list->head->nexts[ list->levels - 1 ] == NULL ) {
+      --list->levels;
    }
-   return NULL; // @NOTE: never reached due to the above todo: we assert false!
+   --list->count;
+
+   list->deallocator( e );
 }
 
-unsigned int vul_skip_list_size( vul_skip_list *list )
+vul_skip_list_element *vul_skip_list_insert( vul_skip_list *list, void *data )
 {
-   s32 c;
-   vul_skip_list_element *e;
+   s32 l;
+   u32 levels, rank[ VUL_SKIP_LIST_MAX_LEVEL ];
+   vul_skip_list_element *update[ VUL_SKIP_LIST_MAX_LEVEL ], *e, *ret;
+
+   if( list == NULL || list->head == NULL ) return NULL;
+
+   // Find the last element not greater than data on each level (so equal elements
+   // keep their insertion order), and its rank
+   e = list->head;
+   for( l = ( s32 )list->levels - 1; l >= 0; --l ) {
+      rank[ l ] = l == ( s32 )list->levels - 1 ? 0 : rank[ l + 1 ];
+      while( e->nexts[ l ] != NULL && list->comparator( e->nexts[ l ]->data, data ) <= 0 ) {
+         rank[ l ] += e->spans[ l ];
+         e = e->nexts[ l ];
+      }
+      update[ l ] = e;
+   }
 
-   // Count elements in the lowest list.
-   e = list->heads[ 0 ];
-   c = 0;
-   while( e != NULL )
-   {
-      ++c;
-      e = e->nexts[ 0 ];
+   levels = 1;
+   while( levels < VUL_SKIP_LIST_MAX_LEVEL && vul__skip_list_coin_flip( ) ) ++levels;
+   if( levels > list->levels ) {
+      for( l = ( s32 )list->levels; l < ( s32 )levels; ++l ) {
+         rank[ l ] = 0;
+         update[ l ] = list->head;
+         list->head->spans[ l ] = list->count;
+      }
+      list->levels = levels;
    }
 
-   return c;
+   // Create our element and link it in on its levels
+   ret = vul__skip_list_element_create( list, levels, data );
+   for( l = 0; l < ( s32 )levels; ++l ) {
+      ret->nexts[ l ] = update[ l ]->nexts[ l ];
+      update[ l ]->nexts[ l ] = ret;
+      ret->spans[ l ] = update[ l ]->spans[ l ] - ( rank[ 0 ] - rank[ l ] );
+      update[ l ]->spans[ l ] = rank[ 0 ] - rank[ l ] + 1;
+   }
+   // Links above it now skip one more element
+   for( l = ( s32 )levels; l < ( s32 )list->levels; ++l ) {
+      ++update[ l ]->spans[ l ];
+   }
+   ++list->count;
+
+   return ret;
+}
+
+unsigned int vul_skip_list_size( vul_skip_list *list )
+{
+   return list->count;
 }
 
 void vul_skip_list_iterate( vul_skip_list *list, void( *func )( vul_skip_list_element *e ) )
 {
    vul_skip_list_element *e;
 
-   e = list->heads[ 0 ];
+   e = list->head->nexts[ 0 ];
    while( e != NULL ) {
       func( e );
       e = e->nexts[ 0 ];
@@ -287,30 +516,18 @@ void vul_skip_list_destroy( vul_skip_list *list )
    vul_skip_list_element *e, *n;
 
    // Destroy all elements from the list at level 0
-   e = list->heads[ 0 ];
+   e = list->head->nexts[ 0 ];
    while( e != NULL )
    {
       n = e->nexts[ 0 ];
-
-      list->deallocator( e->data );
-      list->deallocator( e->nexts );
       list->deallocator( e );
-      // By setting to null we are much more likely to trigger asserts if used after deallocation.
-      e->data = NULL;
-      e->nexts = NULL;
-      e = NULL;
-
       e = n;
    }
 
-   // Then deallocate the other heads
-   list->deallocator( list->heads );
+   // Then deallocate the head
+   list->deallocator( list->head );
    // And finally, the list
    list->deallocator( list );
-
-   // By setting to null we are much more likely to trigger asserts if used after deallocation.
-   list->heads = NULL;
-   list = NULL;
 }
 
 vul_skip_list *vul_skip_list_copy( vul_skip_list *src,
@@ -318,16 +535,19 @@ vul_skip_list *vul_skip_list_copy( vul_skip_list *src,
                                    void( *deallocator )( void *ptr ) )
 {
    vul_skip_list *dst;
-   vul_skip_list_element *e;
+   vul_skip_list_element *e, *last[ VUL_SKIP_LIST_MAX_LEVEL ];
+   u32 last_rank[ VUL_SKIP_LIST_MAX_LEVEL ];
 
    dst = vul_skip_list_create( src->data_size, src->comparator, allocator, deallocator );
 
-   e = src->heads[ 0 ];
+   vul__skip_list_append_begin( dst, last, last_rank );
+   e = src->head->nexts[ 0 ];
    while( e != NULL )
    {
-      vul_skip_list_insert( dst, e->data );
+      vul__skip_list_append( dst, last, last_rank, e->data );
       e = e->nexts[ 0 ];
    }
+   vul__skip_list_append_finish( dst, last, last_rank );
 
    return dst;
 }
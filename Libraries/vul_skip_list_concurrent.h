@@ -0,0 +1,586 @@
+/*
+ * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain?
+ *
+ * This file describes a lock-free concurrent skip list (Herlihy & Shavit's
+ * variant of Fraser's skip list) for use as an ordered set shared between threads.
+ * Insert and remove are lock-free and use CAS only, find is wait-free and never writes
+ * to the list, so readers never block and never contend with each other.
+ *
+ * Keys are unique: the comparator orders elements (and must only look at the key parts),
+ * and insert fails if an equal element is already present. Elements are copied into the
+ * nodes, and find copies them back out, since a node may be removed and freed as soon
+ * as the finding thread leaves the list.
+ *
+ * Every thread that uses the list must register with it first and pass its
+ * vul_concurrent_skip_list_thread to every call. The thread record holds the thread's
+ * RNG used to pick node levels (so there is no shared rand( ) state), and its state for
+ * epoch based memory reclamation (see vul_reclaim.h): removed nodes are put on
+ * per-thread limbo lists and only freed once every thread that could still see them
+ * has left the list.
+ *
+ * Depends on vul_reclaim.h and vul_thread.h; define VUL_WINDOWS, VUL_LINUX or VUL_OSX.
+ *
+ * Define VUL_DEFINE in exactly one compilation unit.
+ *
+ * ? If public domain is not legally valid in your legal jurisdiction
+ *   the MIT licence applies (see the LICENCE file)
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VUL_SKIP_LIST_CONCURRENT_H
+#define VUL_SKIP_LIST_CONCURRENT_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef VUL_DATATYPES_CUSTOM_ASSERT
+#include <assert.h>
+#define VUL_DATATYPES_CUSTOM_ASSERT assert
+#endif
+
+#include "vul_reclaim.h"
+
+#ifndef VUL_TYPES_H
+#include <stdint.h>
+#define u32 uint32_t
+#define u64 uint64_t
+#define s32 int32_t
+#define b32 uint32_t
+#endif
+
+/**
+ * The maximum number of levels of a node. 2^32 elements is plenty.
+ */
+#define VUL_CONCURRENT_SKIP_LIST_MAX_LEVEL 32
+
+/**
+ * The internal node representation. The lowest bit of a next pointer marks the
+ * node as (logically) removed on that level. The element follows the next array.
+ */
+typedef struct vul__cskip_node {
+   volatile u32 flags;
+   u32 height;
+   void *volatile next[ 1 ];
+} vul__cskip_node;
+
+/**
+ * Per-thread state. Obtain one from vul_concurrent_skip_list_thread_register.
+ */
+typedef struct vul_concurrent_skip_list_thread {
+   vul_epoch_thread *epoch;
+   volatile u32 in_use;
+   u64 rng;
+
+   struct vul_concurrent_skip_list_thread *next; // Registry link; records are never unlinked
+} vul_concurrent_skip_list_thread;
+
+typedef struct vul_concurrent_skip_list {
+   vul__cskip_node *head;
+   vul_epoch_domain *reclaim;
+   vul_concurrent_skip_list_thread *volatile threads;
+   volatile u32 count;
+
+   u32 data_size;
+   s32 (*comparator)( void *a, void *b );
+
+   /* Memory management functions */
+   void *( *allocator )( size_t size );
+   void( *deallocator )( void *ptr );
+} vul_concurrent_skip_list;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * Creates a new concurrent skip list. Takes the size of an element and a comparison
+ * function as arguments and returns an empty list. The allocator and deallocator
+ * must be thread safe.
+ */
+vul_concurrent_skip_list *vul_concurrent_skip_list_create( u32 data_size,
+                                                           s32( *comparator )( void *a, void *b ),
+                                                           void *( *allocator )( size_t size ),
+                                                           void( *deallocator )( void *ptr ) );
+/**
+ * Registers the calling thread with the list. The seed is used for the thread's
+ * level RNG and should differ between threads. Thread safe.
+ */
+vul_concurrent_skip_list_thread *vul_concurrent_skip_list_thread_register( vul_concurrent_skip_list *list,
+                                                                           u64 seed );
+/**
+ * Unregisters a thread. The record may be handed out again by a later register.
+ */
+void vul_concurrent_skip_list_thread_unregister( vul_concurrent_skip_list *list,
+                                                 vul_concurrent_skip_list_thread *thread );
+/**
+ * Copies the given data into a new element and inserts it into the list.
+ * Returns false if an element with an equal key is already in the list.
+ */
+b32 vul_concurrent_skip_list_insert( vul_concurrent_skip_list *list,
+                                     vul_concurrent_skip_list_thread *thread,
+                                     void *data );
+/**
+ * Finds the element matching the given key and copies it to data_out if that is
+ * not NULL. Returns false if no match is found. Wait-free.
+ */
+b32 vul_concurrent_skip_list_find( vul_concurrent_skip_list *list,
+                                   vul_concurrent_skip_list_thread *thread,
+                                   void *key, void *data_out );
+/**
+ * Removes the element matching the given key, copying it to data_out if that is
+ * not NULL. Returns false if no match was found.
+ */
+b32 vul_concurrent_skip_list_remove( vul_concurrent_skip_list *list,
+                                     vul_concurrent_skip_list_thread *thread,
+                                     void *key, void *data_out );
+/**
+ * Returns the number of elements in the list. Only exact if no other thread
+ * is modifying the list.
+ */
+u32 vul_concurrent_skip_list_size( vul_concurrent_skip_list *list );
+/**
+ * Destroys the list, all elements in it and all thread records. No other thread
+ * may use the list at this point.
+ */
+void vul_concurrent_skip_list_destroy( vul_concurrent_skip_list *list );
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef u64
+#undef s32
+#undef b32
+#endif
+
+#endif // VUL_SKIP_LIST_CONCURRENT_H
+
+#ifdef VUL_DEFINE
+
+#ifndef VUL_TYPES_H
+#define u32 uint32_t
+#define u64 uint64_t
+#define s32 int32_t
+#define b32 uint32_t
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VUL__CSKIP_INSERTED 1
+#define VUL__CSKIP_REMOVED 2
+
+#define VUL__CSKIP_IS_MARKED( p ) ( ( ( uintptr_t )( p ) & 1 ) != 0 )
+#define VUL__CSKIP_MARK( p ) ( ( void* )( ( uintptr_t )( p ) | 1 ) )
+#define VUL__CSKIP_UNMARK( p ) ( ( vul__cskip_node* )( ( uintptr_t )( p ) & ~( uintptr_t )1 ) )
+
+//--------------------
+// Internal helpers
+
+static size_t vul__cskip_data_offset( u32 height )
+{
+   size_t o;
+
+   // Elements are 8-byte aligned after the next pointers
+   o = sizeof( vul__cskip_node ) + sizeof( void* ) * ( height - 1 );
+   return ( o + 7 ) & ~( size_t )7;
+}
+
+static void *vul__cskip_data( vul__cskip_node *n )
+{
+   return ( char* )n + vul__cskip_data_offset( n->height );
+}
+
+static void *vul__cskip_next( vul__cskip_node *n, s32 l )
+{
+   return vul_atomic_load_ptr( &n->next[ l ] );
+}
+
+static u32 vul__cskip_random_height( vul_concurrent_skip_list_thread *t )
+{
+   u64 r;
+   u32 h;
+
+   // xorshift64*, private to the thread
+   t->rng ^= t->rng >> 12;
+   t->rng ^= t->rng << 25;
+   t->rng ^= t->rng >> 27;
+   r = t->rng * 2685821657736338717ull;
+
+   // Geometric distribution with p = 0.5
+   h = 1;
+   while( ( r & 1 ) && h < VUL_CONCURRENT_SKIP_LIST_MAX_LEVEL ) {
+      ++h;
+      r >>= 1;
+   }
+   return h;
+}
+
+/**
+ * Finds the predecessors and successors of key on every level, unlinking marked
+ * nodes along the way. Returns true if succs[ 0 ] is an unmarked node equal to key.
+ */
+static b32 vul__cskip_find( vul_concurrent_skip_list *list, void *key,
+                            vul__cskip_node **preds, vul__cskip_node **succs )
+{
+   vul__cskip_node *pred, *curr;
+   void *raw;
+   s32 l;
+
+retry:
+   pred = list->head;
+   for( l = VUL_CONCURRENT_SKIP_LIST_MAX_LEVEL - 1; l >= 0; --l ) {
+      curr = VUL__CSKIP_UNMARK( vul__cskip_next( pred, l ) );
+      while( curr != NULL ) {
+         raw = vul__cskip_next( curr, l );
+         if( VUL__CSKIP_IS_MARKED( raw ) ) {
+            // Snip the removed node; if pred changed under us, start over
+            if( !vul_atomic_cas_ptr( &pred->next[ l ], curr, VUL__CSKIP_UNMARK( raw ) ) ) {
+               goto retry;
+            }
+            curr = VUL__CSKIP_UNMARK( raw );
+            continue;
+         }
+         if( list->comparator( vul__cskip_data( curr ), key ) >= 0 ) {
+            break;
+         }
+         pred = curr;
+         curr = VUL__CSKIP_UNMARK( raw );
+      }
+      preds[ l ] = pred;
+      succs[ l ] = curr;
+   }
+   return succs[ 0 ] != NULL && list->comparator( vul__cskip_data( succs[ 0 ] ), key ) == 0;
+}
+
+/**
+ * Unlinks a marked node from every level. Unlike vul__cskip_find this looks for the
+ * node itself, so it also gets past a newer element with the same key.
+ */
+static void vul__cskip_unlink( vul_concurrent_skip_list *list, vul__cskip_node *n )
+{
+   vul__cskip_node *base, *pred, *curr;
+   void *raw, *key;
+   s32 l, c;
+
+   key = vul__cskip_data( n );
+retry:
+   base = list->head;
+   for( l = VUL_CONCURRENT_SKIP_LIST_MAX_LEVEL - 1; l >= 0; --l ) {
+      pred = base;
+      curr = VUL__CSKIP_UNMARK( vul__cskip_next( pred, l ) );
+      while( curr != NULL ) {
+         raw = vul__cskip_next( curr, l );
+         if( VUL__CSKIP_IS_MARKED( raw ) ) {
+            if( !vul_atomic_cas_ptr( &pred->next[ l ], curr, VUL__CSKIP_UNMARK( raw ) ) ) {
+               goto retry;
+            }
+            curr = VUL__CSKIP_UNMARK( raw );
+            continue;
+         }
+         c = list->comparator( vul__cskip_data( curr ), key );
+         if( c > 0 ) {
+            break;
+         }
+         if( c < 0 ) {
+            base = curr; // Only descend from nodes strictly before the key
+         }
+         pred = curr;
+         curr = VUL__CSKIP_UNMARK( raw );
+      }
+   }
+}
+
+//-------------
+// Public API
+
+vul_concurrent_skip_list *vul_concurrent_skip_list_create( u32 data_size,
+                                                           s32( *comparator )( void *a, void *b ),
+                                                           void *( *allocator )( size_t size ),
+                                                           void( *deallocator )( void *ptr ) )
+{
+   vul_concurrent_skip_list *ret;
+   u32 l;
+
+   ret = ( vul_concurrent_skip_list* )allocator( sizeof( vul_concurrent_skip_list ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( ret != NULL ); // Make sure allocation didn't fail
+   ret->head = ( vul__cskip_node* )allocator( vul__cskip_data_offset( VUL_CONCURRENT_SKIP_LIST_MAX_LEVEL ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( ret->head != NULL ); // Make sure allocation didn't fail
+   ret->head->flags = 0;
+   ret->head->height = VUL_CONCURRENT_SKIP_LIST_MAX_LEVEL;
+   for( l = 0; l < VUL_CONCURRENT_SKIP_LIST_MAX_LEVEL; ++l ) {
+      ret->head->next[ l ] = NULL;
+   }
+   ret->reclaim = vul_epoch_domain_create( allocator, deallocator );
+   ret->threads = NULL;
+   ret->count = 0;
+   ret->data_size = data_size;
+   ret->comparator = comparator;
+   ret->allocator = allocator;
+   ret->deallocator = deallocator;
+
+   return ret;
+}
+
+vul_concurrent_skip_list_thread *vul_concurrent_skip_list_thread_register( vul_concurrent_skip_list *list,
+                                                                           u64 seed )
+{
+   vul_concurrent_skip_list_thread *t;
+
+   // Reuse a record that has been unregistered
+   t = ( vul_concurrent_skip_list_thread* )vul_atomic_load_ptr( ( void *volatile* )&list->threads );
+   while( t != NULL ) {
+      if( vul_atomic_load_u32( &t->in_use ) == 0 && vul_atomic_cas_u32( &t->in_use, 0, 1 ) ) {
+         break;
+      }
+      t = t->next;
+   }
+
+   if( t == NULL ) {
+      t = ( vul_concurrent_skip_list_thread* )list->allocator( sizeof( vul_concurrent_skip_list_thread ) );
+      VUL_DATATYPES_CUSTOM_ASSERT( t != NULL ); // Make sure allocation didn't fail
+      memset( t, 0, sizeof( vul_concurrent_skip_list_thread ) );
+      t->in_use = 1;
+      do {
+         t->next = ( vul_concurrent_skip_list_thread* )vul_atomic_load_ptr( ( void *volatile* )&list->threads );
+      } while( !vul_atomic_cas_ptr( ( void *volatile* )&list->threads, t->next, t ) );
+   }
+
+   t->epoch = vul_epoch_thread_register( list->reclaim );
+   t->rng = seed != 0 ? seed : 0x9e3779b97f4a7c15ull; // xorshift must not be seeded with 0
+   return t;
+}
+
+void vul_concurrent_skip_list_thread_unregister( vul_concurrent_skip_list *list,
+                                                 vul_concurrent_skip_list_thread *thread )
+{
+   // The limbo lists stay with the epoch record, and are freed by its next owner or on destroy
+   vul_epoch_thread_unregister( list->reclaim, thread->epoch );
+   vul_atomic_store_u32( &thread->in_use, 0 );
+}
+
+b32 vul_concurrent_skip_list_insert( vul_concurrent_skip_list *list,
+                                     vul_concurrent_skip_list_thread *thread,
+                                     void *data )
+{
+   vul__cskip_node *preds[ VUL_CONCURRENT_SKIP_LIST_MAX_LEVEL ], *succs[ VUL_CONCURRENT_SKIP_LIST_MAX_LEVEL ];
+   vul__cskip_node *n;
+   void *raw;
+   u32 height, l, prev;
+
+   vul_epoch_enter( list->reclaim, thread->epoch );
+
+   n = NULL;
+   height = vul__cskip_random_height( thread );
+   while( 1 ) {
+      if( vul__cskip_find( list, data, preds, succs ) ) {
+         if( n != NULL ) {
+            list->deallocator( n ); // Never published, so we can free it directly
+         }
+         vul_epoch_exit( thread->epoch );
+         return 0;
+      }
+      if( n == NULL ) {
+         n = ( vul__cskip_node* )list->allocator( vul__cskip_data_offset( height ) + list->data_size );
+         VUL_DATATYPES_CUSTOM_ASSERT( n != NULL ); // Make sure allocation didn't fail
+         n->flags = 0;
+         n->height = height;
+         memcpy( vul__cskip_data( n ), data, list->data_size );
+      }
+      for( l = 0; l < height; ++l ) {
+         n->next[ l ] = succs[ l ];
+      }
+      // Linking the bottom level is what makes the element part of the list
+      if( vul_atomic_cas_ptr( &preds[ 0 ]->next[ 0 ], succs[ 0 ], n ) ) {
+         break;
+      }
+   }
+   vul_atomic_add_u32( &list->count, 1 );
+
+   // Link the upper levels. Stop if someone starts removing the node meanwhile.
+   for( l = 1; l < height; ++l ) {
+      while( 1 ) {
+         raw = vul__cskip_next( n, l );
+         if( VUL__CSKIP_IS_MARKED( raw ) ) {
+            goto linked;
+         }
+         if( raw != succs[ l ] && !vul_atomic_cas_ptr( &n->next[ l ], raw, succs[ l ] ) ) {
+            continue;
+         }
+         if( vul_atomic_cas_ptr( &preds[ l ]->next[ l ], succs[ l ], n ) ) {
+            break;
+         }
+         // Our view is stale; refresh it. If we are no longer in the list, give up.
+         vul__cskip_find( list, data, preds, succs );
+         if( succs[ 0 ] != n ) {
+            goto linked;
+         }
+      }
+   }
+linked:
+   // If the node was removed while we were linking it, we may have linked it back
+   // in above after the remover unlinked it, so the last one of us out cleans up.
+   prev = vul_atomic_add_u32( &n->flags, VUL__CSKIP_INSERTED );
+   if( prev & VUL__CSKIP_REMOVED ) {
+      vul__cskip_unlink( list, n );
+      vul_epoch_retire( list->reclaim, thread->epoch, n, list->deallocator );
+   }
+
+   vul_epoch_exit( thread->epoch );
+   return 1;
+}
+
+b32 vul_concurrent_skip_list_find( vul_concurrent_skip_list *list,
+                                   vul_concurrent_skip_list_thread *thread,
+                                   void *key, void *data_out )
+{
+   vul__cskip_node *pred, *curr;
+   void *raw;
+   s32 l;
+   b32 found;
+
+   vul_epoch_enter( list->reclaim, thread->epoch );
+
+   // Like vul__cskip_find, but skip marked nodes instead of unlinking them
+   pred = list->head;
+   curr = NULL;
+   for( l = VUL_CONCURRENT_SKIP_LIST_MAX_LEVEL - 1; l >= 0; --l ) {
+      curr = VUL__CSKIP_UNMARK( vul__cskip_next( pred, l ) );
+      while( curr != NULL ) {
+         raw = vul__cskip_next( curr, l );
+         if( VUL__CSKIP_IS_MARKED( raw ) ) {
+            curr = VUL__CSKIP_UNMARK( raw );
+            continue;
+         }
+         if( list->comparator( vul__cskip_data( curr ), key ) >= 0 ) {
+            break;
+         }
+         pred = curr;
+         curr = VUL__CSKIP_UNMARK( raw );
+      }
+   }
+
+   found = curr != NULL && list->comparator( vul__cskip_data( curr ), key ) == 0;
+   if( found && data_out != NULL ) {
+      memcpy( data_out, vul__cskip_data( curr ), list->data_size );
+   }
+
+   vul_epoch_exit( thread->epoch );
+   return found;
+}
+
+b32 vul_concurrent_skip_list_remove( vul_concurrent_skip_list *list,
+                                     vul_concurrent_skip_list_thread *thread,
+                                     void *key, void *data_out )
+{
+   vul__cskip_node *preds[ VUL_CONCURRENT_SKIP_LIST_MAX_LEVEL ], *succs[ VUL_CONCURRENT_SKIP_LIST_MAX_LEVEL ];
+   vul__cskip_node *n;
+   void *raw;
+   s32 l;
+   u32 prev;
+
+   vul_epoch_enter( list->reclaim, thread->epoch );
+
+   if( !vul__cskip_find( list, key, preds, succs ) ) {
+      vul_epoch_exit( thread->epoch );
+      return 0;
+   }
+   n = succs[ 0 ];
+
+   // Mark the upper levels top-down, so no new links can be made through them
+   for( l = ( s32 )n->height - 1; l >= 1; --l ) {
+      raw = vul__cskip_next( n, l );
+      while( !VUL__CSKIP_IS_MARKED( raw ) ) {
+         vul_atomic_cas_ptr( &n->next[ l ], raw, VUL__CSKIP_MARK( raw ) );
+         raw = vul__cskip_next( n, l );
+      }
+   }
+
+   // Whoever marks the bottom level removes the element
+   raw = vul__cskip_next( n, 0 );
+   while( 1 ) {
+      if( VUL__CSKIP_IS_MARKED( raw ) ) {
+         vul_epoch_exit( thread->epoch );
+         return 0;
+      }
+      if( vul_atomic_cas_ptr( &n->next[ 0 ], raw, VUL__CSKIP_MARK( raw ) ) ) {
+         break;
+      }
+      raw = vul__cskip_next( n, 0 );
+   }
+   vul_atomic_add_u32( &list->count, ( u32 )-1 );
+
+   if( data_out != NULL ) {
+      memcpy( data_out, vul__cskip_data( n ), list->data_size );
+   }
+
+   // Unlink it, and retire it unless the inserter is still linking it
+   vul__cskip_unlink( list, n );
+   prev = vul_atomic_add_u32( &n->flags, VUL__CSKIP_REMOVED );
+   if( prev & VUL__CSKIP_INSERTED ) {
+      vul__cskip_unlink( list, n );
+      vul_epoch_retire( list->reclaim, thread->epoch, n, list->deallocator );
+   }
+
+   vul_epoch_exit( thread->epoch );
+   return 1;
+}
+
+u32 vul_concurrent_skip_list_size( vul_concurrent_skip_list *list )
+{
+   return vul_atomic_load_u32( &list->count );
+}
+
+void vul_concurrent_skip_list_destroy( vul_concurrent_skip_list *list )
+{
+   vul_concurrent_skip_list_thread *t, *tn;
+   vul__cskip_node *n, *next;
+
+   // Everything still linked on the bottom level, including marked nodes not yet
+   // unlinked. Retired nodes are never linked, so nothing is freed twice.
+   n = VUL__CSKIP_UNMARK( list->head->next[ 0 ] );
+   while( n != NULL ) {
+      next = VUL__CSKIP_UNMARK( n->next[ 0 ] );
+      list->deallocator( n );
+      n = next;
+   }
+   list->deallocator( list->head );
+
+   vul_epoch_domain_destroy( list->reclaim );
+
+   t = list->threads;
+   while( t != NULL ) {
+      tn = t->next;
+      list->deallocator( t );
+      t = tn;
+   }
+
+   list->deallocator( list );
+}
+
+#undef VUL__CSKIP_INSERTED
+#undef VUL__CSKIP_REMOVED
+#undef VUL__CSKIP_IS_MARKED
+#undef VUL__CSKIP_MARK
+#undef VUL__CSKIP_UNMARK
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef VUL_TYPES_H
+#undef u32
+#undef u64
+#undef s32
+#undef b32
+#endif
+
+#endif // VUL_DEFINE
@@ -8,10 +8,18 @@
  *	-Shell sort	( Fastest for small vectors [10^3, 10^4] )
  *  -Quicksort ( Fastest for medium sized vectors [10^4 ,10^5] )
  *  -Thynnsort ( Fastest for large vectors [10^4, inf] )
+ *  -Merge sort ( Stable, bottom-up. With vul_thread.h, also a multithreaded version )
+ * External merge sort for files larger than memory, if vul_file.h is included first.
+ * Typed sorts for plain arrays (and vul_vector's list), where the comparison is inlined:
+ *  -VUL_SORT_DEFINE_TYPED generates an introsort and a stable merge sort for a type
+ *  -vul_sort_u32/s32/u64/f32/f64 are ready-made instances for primitive keys. For 32-bit
+ *   keys, small partitions are finished with a bitonic sorting network in AVX2 or SSE4.1
+ *   registers when the compiler targets those (define VUL_SORT_NO_SIMD to opt out)
+ * Radix sorts for integer and float keys, and records with an extracted key:
+ *  -vul_sort_radix_* is a stable LSD radix sort that needs a buffer as large as the input
+ *  -vul_sort_radix_inplace_* is an unstable, in-place MSD (American flag) radix sort
  * @TODO: Make a stable version of vul_sort that doesn't use shell sort.
- * @TODO: Bottom-up merge sort
  * @TODO: Heap sort
- * @TODO: Radix sort
  * 
  * ? If public domain is not legally valid in your legal jurisdiction
  *   the MIT licence applies (see the LICENCE file)
@@ -28,6 +36,7 @@
 #define VUL_SORT_H
 
 #include <stdlib.h>
+#include <string.h>
 #ifndef VUL_OSX
 #include <malloc.h>
 #endif
@@ -44,6 +53,17 @@
 	#include "vul_resizable_array.h"
 #endif
 
+#ifndef VUL_TYPES_H
+#include <stdint.h>
+#define u8 uint8_t
+#define s32 int32_t
+#define u32 uint32_t
+#define u64 uint64_t
+#define b32 uint32_t
+#define f32 float
+#define f64 double
+#endif
+
 /**
  * Minimum number of elements per merge run (thynnsort)
  */
@@ -64,6 +84,244 @@
  */
 #define VUL_SORT_MIN_SIZE_USE_THYNN 2048
 
+/**
+ * Partitions at or below this size are left to insertion sort in the typed sorts.
+ */
+#ifndef VUL_SORT_TYPED_INSERTION_CUTOFF
+#define VUL_SORT_TYPED_INSERTION_CUTOFF 16
+#endif
+/**
+ * Length of the insertion sorted runs the typed stable sort starts merging from.
+ */
+#ifndef VUL_SORT_TYPED_RUN
+#define VUL_SORT_TYPED_RUN 32
+#endif
+
+#if defined( __GNUC__ ) || defined( __clang__ )
+	#define VUL__SORT_UNUSED __attribute__( ( unused ) )
+#else
+	#define VUL__SORT_UNUSED
+#endif
+
+//------------------
+// Typed sorts
+//
+// VUL_SORT_DEFINE_TYPED( name, T, less ) generates static functions
+//    void name( T *a, uint32_t n );                  Unstable introsort
+//    void name##_stable( T *a, uint32_t n, T *tmp );  Stable merge sort. tmp holds n elements, or is NULL to malloc it
+//    void name##_nth( T *a, uint32_t n, uint32_t k ); Introselect: a[ k ] ends up where sorting would put it,
+//                                                     with nothing larger before it and nothing smaller after
+//    void name##_partial( T *a, uint32_t n, uint32_t k ); Sorts only the k first elements of the sorted order
+// where less( x, y ) is a macro or inline function that is true if x must come before y.
+// Elements are moved by assignment, and less is expanded in place, so there are no
+// function pointer calls or memcpys. For a vul_vector, pass ( T* )vul_vector_begin( vec ) and vul_vector_size( vec ).
+// Example:
+//    #define by_depth( x, y ) ( ( x ).depth < ( y ).depth )
+//    VUL_SORT_DEFINE_TYPED( sort_draws, draw_call, by_depth )
+//
+
+#define VUL_SORT_DEFINE_TYPED( name, T, less )\
+	VUL__SORT_DEFINE_TYPED_BASE( name, T, less, name##_insertion, VUL_SORT_TYPED_INSERTION_CUTOFF )
+
+// As above, but the introsort finishes partitions of at most cutoff elements with small( a, n )
+#define VUL__SORT_DEFINE_TYPED_BASE( name, T, less, small, cutoff )\
+VUL__SORT_UNUSED static void name##_insertion( T *a, uint32_t n )\
+{\
+	uint32_t i, j;\
+	T v;\
+	for( i = 1; i < n; ++i ) {\
+		v = a[ i ];\
+		j = i;\
+		while( j > 0 && less( v, a[ j - 1 ] ) ) {\
+			a[ j ] = a[ j - 1 ];\
+			--j;\
+		}\
+		a[ j ] = v;\
+	}\
+}\
+VUL__SORT_UNUSED static void name##_sift_down( T *a, uint32_t i, uint32_t n )\
+{\
+	uint32_t c;\
+	T v;\
+	v = a[ i ];\
+	while( ( c = 2 * i + 1 ) < n ) {\
+		if( c + 1 < n && less( a[ c ], a[ c + 1 ] ) ) {\
+			++c;\
+		}\
+		if( !less( v, a[ c ] ) ) {\
+			break;\
+		}\
+		a[ i ] = a[ c ];\
+		i = c;\
+	}\
+	a[ i ] = v;\
+}\
+VUL__SORT_UNUSED static void name##_heap( T *a, uint32_t n )\
+{\
+	uint32_t i;\
+	T v;\
+	for( i = n / 2; i > 0; --i ) {\
+		name##_sift_down( a, i - 1, n );\
+	}\
+	for( i = n - 1; i > 0; --i ) {\
+		v = a[ 0 ]; a[ 0 ] = a[ i ]; a[ i ] = v;\
+		name##_sift_down( a, 0, i );\
+	}\
+}\
+/* Partitions n >= 3 elements so [ 0, i ) <= pivot <= [ *right, n ), and returns i */\
+VUL__SORT_UNUSED static uint32_t name##_partition( T *a, uint32_t n, uint32_t *right )\
+{\
+	uint32_t i, j, m;\
+	T p, v;\
+	/* Median of three, which also puts sentinels at both ends */\
+	m = n >> 1;\
+	if( less( a[ m ], a[ 0 ] ) ) { v = a[ m ]; a[ m ] = a[ 0 ]; a[ 0 ] = v; }\
+	if( less( a[ n - 1 ], a[ m ] ) ) {\
+		v = a[ m ]; a[ m ] = a[ n - 1 ]; a[ n - 1 ] = v;\
+		if( less( a[ m ], a[ 0 ] ) ) { v = a[ m ]; a[ m ] = a[ 0 ]; a[ 0 ] = v; }\
+	}\
+	p = a[ m ];\
+	i = 1;\
+	j = n - 2;\
+	while( 1 ) {\
+		while( less( a[ i ], p ) ) ++i;\
+		while( less( p, a[ j ] ) ) --j;\
+		if( i >= j ) break;\
+		v = a[ i ]; a[ i ] = a[ j ]; a[ j ] = v;\
+		++i;\
+		--j;\
+	}\
+	*right = j + 1;\
+	return i;\
+}\
+VUL__SORT_UNUSED static void name##_intro( T *a, uint32_t n, uint32_t depth )\
+{\
+	uint32_t i, r;\
+	while( n > cutoff ) {\
+		if( depth-- == 0 ) {\
+			name##_heap( a, n ); /* Too many bad pivots */\
+			return;\
+		}\
+		/* Recurse on the smaller side, loop on the larger */\
+		i = name##_partition( a, n, &r );\
+		if( i < n - r ) {\
+			name##_intro( a, i, depth );\
+			a += r;\
+			n -= r;\
+		} else {\
+			name##_intro( a + r, n - r, depth );\
+			n = i;\
+		}\
+	}\
+	small( a, n );\
+}\
+VUL__SORT_UNUSED static void name( T *a, uint32_t n )\
+{\
+	uint32_t depth, k;\
+	depth = 0;\
+	for( k = n; k > 1; k >>= 1 ) {\
+		depth += 2;\
+	}\
+	name##_intro( a, n, depth );\
+}\
+VUL__SORT_UNUSED static void name##_nth( T *a, uint32_t n, uint32_t k )\
+{\
+	uint32_t depth, i, r;\
+	T v;\
+	if( k >= n ) {\
+		return;\
+	}\
+	depth = 0;\
+	for( i = n; i > 1; i >>= 1 ) {\
+		depth += 2;\
+	}\
+	while( n > cutoff ) {\
+		if( depth-- == 0 ) {\
+			/* Too many bad pivots: heap select, max-heap of the k + 1 smallest at the front */\
+			for( i = ( k + 1 ) / 2; i > 0; --i ) {\
+				name##_sift_down( a, i - 1, k + 1 );\
+			}\
+			for( i = k + 1; i < n; ++i ) {\
+				if( less( a[ i ], a[ 0 ] ) ) {\
+					v = a[ 0 ]; a[ 0 ] = a[ i ]; a[ i ] = v;\
+					name##_sift_down( a, 0, k + 1 );\
+				}\
+			}\
+			v = a[ 0 ]; a[ 0 ] = a[ k ]; a[ k ] = v;\
+			return;\
+		}\
+		i = name##_partition( a, n, &r );\
+		if( k < i ) {\
+			n = i;\
+		} else if( k >= r ) {\
+			a += r;\
+			n -= r;\
+			k -= r;\
+		} else {\
+			return; /* Between the halves everything equals the pivot */\
+		}\
+	}\
+	small( a, n );\
+}\
+VUL__SORT_UNUSED static void name##_partial( T *a, uint32_t n, uint32_t k )\
+{\
+	if( k == 0 ) {\
+		return;\
+	}\
+	if( k < n ) {\
+		name##_nth( a, n, k - 1 );\
+	}\
+	name( a, k < n ? k : n );\
+}\
+VUL__SORT_UNUSED static void name##_merge( T *dst, const T *src, uint32_t lo, uint32_t mid, uint32_t hi )\
+{\
+	uint32_t i, j, k;\
+	i = lo; j = mid; k = lo;\
+	while( i < mid && j < hi ) {\
+		/* Take from the right only if strictly smaller, which keeps it stable */\
+		if( less( src[ j ], src[ i ] ) ) {\
+			dst[ k++ ] = src[ j++ ];\
+		} else {\
+			dst[ k++ ] = src[ i++ ];\
+		}\
+	}\
+	while( i < mid ) dst[ k++ ] = src[ i++ ];\
+	while( j < hi ) dst[ k++ ] = src[ j++ ];\
+}\
+VUL__SORT_UNUSED static void name##_stable( T *a, uint32_t n, T *tmp )\
+{\
+	uint32_t w, lo, mid, hi;\
+	T *src, *dst, *swap, *buffer;\
+	for( lo = 0; lo < n; lo += VUL_SORT_TYPED_RUN ) {\
+		name##_insertion( a + lo, n - lo < VUL_SORT_TYPED_RUN ? n - lo : VUL_SORT_TYPED_RUN );\
+	}\
+	if( n <= VUL_SORT_TYPED_RUN ) {\
+		return;\
+	}\
+	buffer = tmp ? tmp : ( T* )malloc( sizeof( T ) * n );\
+	VUL_DATATYPES_CUSTOM_ASSERT( buffer != NULL ); /* Make sure malloc didn't fail */\
+	src = a;\
+	dst = buffer;\
+	for( w = VUL_SORT_TYPED_RUN; w < n; w *= 2 ) {\
+		for( lo = 0; lo < n; lo += 2 * w ) {\
+			mid = lo + w < n ? lo + w : n;\
+			hi = mid + w < n ? mid + w : n;\
+			if( mid == hi || !less( src[ mid ], src[ mid - 1 ] ) ) {\
+				memcpy( dst + lo, src + lo, sizeof( T ) * ( hi - lo ) ); /* Already in order */\
+			} else {\
+				name##_merge( dst, src, lo, mid, hi );\
+			}\
+		}\
+		swap = src; src = dst; dst = swap;\
+	}\
+	if( src != a ) {\
+		memcpy( a, src, sizeof( T ) * n );\
+	}\
+	if( !tmp ) {\
+		free( buffer );\
+	}\
+}
+
 /**
  * Entry in the merge stack. Contains a pair of first entry and run length.
  */
@@ -109,6 +367,164 @@ void vul_sort_vector_insertion( vul_vector *list, s32 (*comparator)( const void
  * version around that IS stable!
  */
 void vul_sort_vector_thynn( vul_vector *list, s32 (*comparator)( const void *a, const void *b ), s32 low, s32 high );
+/**
+ * Sorts the whole vector based on the result of the given comparator function.
+ * Uses a stable bottom-up merge sort over insertion sorted runs. Allocates a temporary
+ * buffer as large as the vector with the vector's allocator.
+ */
+void vul_sort_vector_merge( vul_vector *list, s32 (*comparator)( const void *a, const void *b ) );
+/**
+ * Reorders the vector so the element at index k is the one that would be there if the
+ * vector was sorted, with no larger elements before it and no smaller ones after it.
+ * Introselect: quickselect with median-of-3 pivots, falling back to a heap select if
+ * the pivots turn out bad, so it is O(n) on average and O(n log k) at worst. Unstable.
+ */
+void vul_sort_vector_nth_element( vul_vector *list, s32 (*comparator)( const void *a, const void *b ), u32 k );
+/**
+ * Sorts the k smallest elements of the vector into its k first slots; the rest are left
+ * in unspecified order. Selects with vul_sort_vector_nth_element, then merge sorts the
+ * prefix, so it is O(n + k log k) on average. Unstable.
+ */
+void vul_sort_vector_partial( vul_vector *list, s32 (*comparator)( const void *a, const void *b ), u32 k );
+#ifdef VUL_THREAD_H
+/**
+ * Sorts the whole vector based on the result of the given comparator function, on the
+ * pool's workers and the calling thread. Stable, like vul_sort_vector_merge.
+ * The vector is split in one chunk per thread that are sorted independently, and then
+ * merged pairwise. Each merge round splits the output evenly across all threads by
+ * binary searching the split points in both inputs, so the last merges are parallel too.
+ * Every phase is a vul_parallel_for on the pool, so no threads are created. Vectors too
+ * small to be worth it use fewer chunks, see VUL_SORT_PARALLEL_MIN_CHUNK; with a NULL
+ * pool it is vul_sort_vector_merge. The comparator must be thread safe.
+ */
+void vul_sort_vector_parallel( vul_vector *list, s32 (*comparator)( const void *a, const void *b ), vul_task_pool *pool );
+#endif
+#ifdef VUL_FILE_H
+/**
+ * Sorts a file of fixed size records that may be larger than memory, writing the result
+ * to output_path (which must differ from input_path). Stable.
+ * The input is read through vul_mmap one window at a time, cut into runs that fit in
+ * memory_budget bytes, sorted with the merge sort and written to temporary run files
+ * next to the output (output_path.run0, .run1, ...). The runs are then merged with a
+ * heap; each run is read through its own mmap window and the output through one
+ * buffer, all of them an equal share of the budget, so all I/O is sequential.
+ * All memory, including the run file names, comes from allocator and is returned to deallocator.
+ * Returns VUL_FALSE if a file could not be read or written, a run file name could
+ * not be formed, or the input length is not a multiple of element_size.
+ */
+b32 vul_sort_file( const char *input_path, const char *output_path, u32 element_size,
+				   s32 (*comparator)( const void *a, const void *b ), size_t memory_budget,
+				   void *( *allocator )( size_t size ), void ( *deallocator )( void *ptr ) );
+#endif
+/**
+ * Sorts an array of primitive keys in ascending order with the typed introsort.
+ * Floats are compared with <, so NaNs end up in unspecified places, and -0 and +0
+ * in either order.
+ */
+void vul_sort_u32( u32 *a, u32 n );
+void vul_sort_s32( s32 *a, u32 n );
+void vul_sort_u64( u64 *a, u32 n );
+void vul_sort_f32( f32 *a, u32 n );
+void vul_sort_f64( f64 *a, u32 n );
+/**
+ * Typed versions of vul_sort_vector_nth_element and vul_sort_vector_partial for arrays
+ * of primitive keys. nth does nothing if k >= n; partial sorts all of a if k >= n.
+ */
+void vul_sort_nth_u32( u32 *a, u32 n, u32 k );
+void vul_sort_nth_s32( s32 *a, u32 n, u32 k );
+void vul_sort_nth_u64( u64 *a, u32 n, u32 k );
+void vul_sort_nth_f32( f32 *a, u32 n, u32 k );
+void vul_sort_nth_f64( f64 *a, u32 n, u32 k );
+void vul_sort_partial_u32( u32 *a, u32 n, u32 k );
+void vul_sort_partial_s32( s32 *a, u32 n, u32 k );
+void vul_sort_partial_u64( u64 *a, u32 n, u32 k );
+void vul_sort_partial_f32( f32 *a, u32 n, u32 k );
+void vul_sort_partial_f64( f64 *a, u32 n, u32 k );
+
+/**
+ * Streaming top-k: keeps the k smallest elements (by comparator) of everything pushed
+ * into it, in a max-heap of k elements, so the largest kept element is the one to beat.
+ * Pushing is O(1) for elements that are rejected, and O(log k) otherwise. For the k
+ * largest, flip the comparator.
+ */
+typedef struct vul_sort_top_k {
+	u8 *data;			// capacity + 1 elements; the last is scratch space
+	u32 element_size;
+	u32 capacity;
+	u32 count;
+	s32 (*comparator)( const void *a, const void *b );
+
+	void *( *allocator )( size_t size );
+	void ( *deallocator )( void *ptr );
+} vul_sort_top_k;
+
+/**
+ * Creates a top-k tracker for k elements of element_size bytes. k must be at least 1.
+ */
+vul_sort_top_k *vul_sort_top_k_create( u32 element_size, u32 k, s32 (*comparator)( const void *a, const void *b ),
+									   void *( *allocator )( size_t size ), void ( *deallocator )( void *ptr ) );
+/**
+ * Destroys the tracker.
+ */
+void vul_sort_top_k_destroy( vul_sort_top_k *t );
+/**
+ * Offers an element. Returns VUL_TRUE if it was kept (possibly evicting the largest
+ * kept element), VUL_FALSE if it is not among the k smallest seen so far. Ties with the
+ * largest kept element are rejected, so the first elements pushed win ties.
+ */
+b32 vul_sort_top_k_push( vul_sort_top_k *t, const void *element );
+/**
+ * Returns the number of elements kept, min( k, number of elements pushed ).
+ */
+u32 vul_sort_top_k_count( vul_sort_top_k *t );
+/**
+ * Copies the kept elements into out, which must hold vul_sort_top_k_count elements,
+ * sorted in ascending order. The tracker is left unchanged, so pushing may continue.
+ */
+void vul_sort_top_k_extract( vul_sort_top_k *t, void *out );
+/**
+ * Forgets all kept elements.
+ */
+void vul_sort_top_k_reset( vul_sort_top_k *t );
+/**
+ * Maps a float to an unsigned integer with the same ordering (the sign bit is flipped
+ * for positives, all bits for negatives), so floats can be radix sorted. -0 sorts before
+ * +0, and NaNs sort outside the infinities depending on their sign.
+ */
+u32 vul_sort_f32_key( f32 f );
+f32 vul_sort_f32_from_key( u32 key );
+u64 vul_sort_f64_key( f64 f );
+f64 vul_sort_f64_from_key( u64 key );
+/**
+ * Sorts an array of keys in ascending order with a stable LSD radix sort, one byte per pass.
+ * Passes where all keys share the same byte are skipped, so small key ranges are cheap.
+ * tmp must hold n elements; if it is NULL, a temporary buffer is malloc'd.
+ */
+void vul_sort_radix_u32( u32 *a, u32 n, u32 *tmp );
+void vul_sort_radix_s32( s32 *a, u32 n, s32 *tmp );
+void vul_sort_radix_u64( u64 *a, u32 n, u64 *tmp );
+void vul_sort_radix_f32( f32 *a, u32 n, f32 *tmp );
+void vul_sort_radix_f64( f64 *a, u32 n, f64 *tmp );
+/**
+ * Sorts count records of element_size bytes with a stable LSD radix sort on the key
+ * returned by key( element ). The key is called once per element per pass, and should
+ * be cheap. For float keys, return vul_sort_f32_key/vul_sort_f64_key of it.
+ * tmp must hold count elements; if it is NULL, a temporary buffer is malloc'd.
+ */
+void vul_sort_radix_records( void *data, u32 count, u32 element_size, u64 (*key)( const void *element ), void *tmp );
+/**
+ * Sorts an array of keys in ascending order in place with an MSD radix sort
+ * (American flag sort). Unstable, but needs no buffer beyond a few kB of stack.
+ */
+void vul_sort_radix_inplace_u32( u32 *a, u32 n );
+void vul_sort_radix_inplace_u64( u64 *a, u32 n );
+void vul_sort_radix_inplace_f32( f32 *a, u32 n );
+/**
+ * Sorts count records of element_size bytes in place on the key returned by
+ * key( element ) with an MSD radix sort. Unstable. Only two elements worth
+ * of temporary memory are allocated.
+ */
+void vul_sort_radix_inplace_records( void *data, u32 count, u32 element_size, u64 (*key)( const void *element ) );
 
 //------------------
 // Helpers
@@ -190,14 +606,1290 @@ static void vul__sort_force_merge_collapse( vul_vector *list, s32 (*comparator)(
 #ifdef __cplusplus
 }
 #endif
+
+#ifndef VUL_TYPES_H
+#undef u8
+#undef s32
+#undef u32
+#undef u64
+#undef b32
+#undef f32
+#undef f64
+#endif
+
 #endif
 
 #ifdef VUL_DEFINE
 
+#ifndef VUL_TYPES_H
+#define u8 uint8_t
+#define s32 int32_t
+#define u32 uint32_t
+#define u64 uint64_t
+#define b32 uint32_t
+#define f32 float
+#define f64 double
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+//--------------------
+// Sorting networks
+//
+// Sorts up to 8 registers worth of 32-bit keys: each register is sorted with an in-register
+// bitonic network, and then sorted registers are merged pairwise with bitonic merges. Keys
+// are moved as floats (blends and shuffles are type agnostic), only min and max are typed.
+// Floats are sorted as their vul_sort_f32_key with unsigned min and max: float min/max
+// return the same operand for -0 and +0, which would lose one of them.
+// Lane i of a compare-exchange step takes the max if bit i of the blend mask is set.
+//
+
+#if !defined( VUL_SORT_NO_SIMD ) && defined( __AVX2__ )
+#include <immintrin.h>
+#define VUL__SORT_NETWORK_LANES 8
+#define vul__sort_vec __m256
+#define VUL__SORT_VLOAD( p ) _mm256_loadu_ps( p )
+#define VUL__SORT_VSTORE( p, v ) _mm256_storeu_ps( p, v )
+#define VUL__SORT_VBLEND( a, b, mask ) _mm256_blend_ps( a, b, mask )
+#define VUL__SORT_VSWAP1( v ) _mm256_shuffle_ps( v, v, _MM_SHUFFLE( 2, 3, 0, 1 ) )
+#define VUL__SORT_VSWAP2( v ) _mm256_shuffle_ps( v, v, _MM_SHUFFLE( 1, 0, 3, 2 ) )
+#define VUL__SORT_VSWAP4( v ) _mm256_permute2f128_ps( v, v, 1 )
+#define VUL__SORT_VREVERSE( v ) VUL__SORT_VSWAP4( _mm256_shuffle_ps( v, v, _MM_SHUFFLE( 0, 1, 2, 3 ) ) )
+#define VUL__SORT_VMIN_s32( a, b ) _mm256_castsi256_ps( _mm256_min_epi32( _mm256_castps_si256( a ), _mm256_castps_si256( b ) ) )
+#define VUL__SORT_VMAX_s32( a, b ) _mm256_castsi256_ps( _mm256_max_epi32( _mm256_castps_si256( a ), _mm256_castps_si256( b ) ) )
+#define VUL__SORT_VMIN_u32( a, b ) _mm256_castsi256_ps( _mm256_min_epu32( _mm256_castps_si256( a ), _mm256_castps_si256( b ) ) )
+#define VUL__SORT_VMAX_u32( a, b ) _mm256_castsi256_ps( _mm256_max_epu32( _mm256_castps_si256( a ), _mm256_castps_si256( b ) ) )
+#define VUL__SORT_VSORT( v, vmin, vmax )\
+	VUL__SORT_VSTEP( v, VUL__SORT_VSWAP1, 0x66, vmin, vmax );\
+	VUL__SORT_VSTEP( v, VUL__SORT_VSWAP2, 0x3c, vmin, vmax );\
+	VUL__SORT_VSTEP( v, VUL__SORT_VSWAP1, 0x5a, vmin, vmax );\
+	VUL__SORT_VCLEAN( v, vmin, vmax )
+#define VUL__SORT_VCLEAN( v, vmin, vmax )\
+	VUL__SORT_VSTEP( v, VUL__SORT_VSWAP4, 0xf0, vmin, vmax );\
+	VUL__SORT_VSTEP( v, VUL__SORT_VSWAP2, 0xcc, vmin, vmax );\
+	VUL__SORT_VSTEP( v, VUL__SORT_VSWAP1, 0xaa, vmin, vmax )
+#elif !defined( VUL_SORT_NO_SIMD ) && defined( __SSE4_1__ )
+#include <smmintrin.h>
+#define VUL__SORT_NETWORK_LANES 4
+#define vul__sort_vec __m128
+#define VUL__SORT_VLOAD( p ) _mm_loadu_ps( p )
+#define VUL__SORT_VSTORE( p, v ) _mm_storeu_ps( p, v )
+#define VUL__SORT_VBLEND( a, b, mask ) _mm_blend_ps( a, b, mask )
+#define VUL__SORT_VSWAP1( v ) _mm_shuffle_ps( v, v, _MM_SHUFFLE( 2, 3, 0, 1 ) )
+#define VUL__SORT_VSWAP2( v ) _mm_shuffle_ps( v, v, _MM_SHUFFLE( 1, 0, 3, 2 ) )
+#define VUL__SORT_VREVERSE( v ) _mm_shuffle_ps( v, v, _MM_SHUFFLE( 0, 1, 2, 3 ) )
+#define VUL__SORT_VMIN_s32( a, b ) _mm_castsi128_ps( _mm_min_epi32( _mm_castps_si128( a ), _mm_castps_si128( b ) ) )
+#define VUL__SORT_VMAX_s32( a, b ) _mm_castsi128_ps( _mm_max_epi32( _mm_castps_si128( a ), _mm_castps_si128( b ) ) )
+#define VUL__SORT_VMIN_u32( a, b ) _mm_castsi128_ps( _mm_min_epu32( _mm_castps_si128( a ), _mm_castps_si128( b ) ) )
+#define VUL__SORT_VMAX_u32( a, b ) _mm_castsi128_ps( _mm_max_epu32( _mm_castps_si128( a ), _mm_castps_si128( b ) ) )
+#define VUL__SORT_VSORT( v, vmin, vmax )\
+	VUL__SORT_VSTEP( v, VUL__SORT_VSWAP1, 0x6, vmin, vmax );\
+	VUL__SORT_VCLEAN( v, vmin, vmax )
+#define VUL__SORT_VCLEAN( v, vmin, vmax )\
+	VUL__SORT_VSTEP( v, VUL__SORT_VSWAP2, 0xc, vmin, vmax );\
+	VUL__SORT_VSTEP( v, VUL__SORT_VSWAP1, 0xa, vmin, vmax )
+#endif
+
+#ifdef VUL__SORT_NETWORK_LANES
+
+/**
+ * Partitions at or below this size are sorted with a network by vul_sort_u32/s32/f32.
+ */
+#define VUL__SORT_NETWORK_MAX ( 8 * VUL__SORT_NETWORK_LANES )
+
+#define VUL__SORT_VSTEP( v, swap, mask, vmin, vmax )\
+	p = swap( v );\
+	v = VUL__SORT_VBLEND( vmin( v, p ), vmax( v, p ), mask )
+
+/**
+ * Defines vul__sort_network_T( T *a, u32 n ) for n <= VUL__SORT_NETWORK_MAX. The bits of
+ * each element are mapped to a key of type K with to_key, sorted with K's min and max, and
+ * mapped back with from_key. The input is padded to a power of two registers with the key
+ * pad, which must not sort before any key.
+ */
+#define VUL__SORT_NETWORK_IDENTITY( x ) ( x )
+#define VUL__SORT_NETWORK_F32_TO_KEY( x ) ( ( x ) ^ ( ( u32 )-( s32 )( ( x ) >> 31 ) | 0x80000000u ) )
+#define VUL__SORT_NETWORK_F32_FROM_KEY( x ) ( ( x ) ^ ( ( ( ( x ) >> 31 ) - 1 ) | 0x80000000u ) )
+#define VUL__SORT_DEFINE_NETWORK( T, K, to_key, from_key, pad )\
+static void vul__sort_network_##T( T *a, u32 n )\
+{\
+	vul__sort_vec r[ 8 ], p, lo, hi;\
+	u32 buffer[ VUL__SORT_NETWORK_MAX ];\
+	u32 count, i, j, m, g, d;\
+	\
+	if( n < 2 ) {\
+		return;\
+	}\
+	for( count = 1; count * VUL__SORT_NETWORK_LANES < n; count *= 2 )\
+		;\
+	memcpy( buffer, a, sizeof( T ) * n );\
+	for( i = 0; i < n; ++i ) {\
+		buffer[ i ] = to_key( buffer[ i ] );\
+	}\
+	for( i = n; i < count * VUL__SORT_NETWORK_LANES; ++i ) {\
+		buffer[ i ] = pad;\
+	}\
+	for( i = 0; i < count; ++i ) {\
+		r[ i ] = VUL__SORT_VLOAD( ( const float* )buffer + i * VUL__SORT_NETWORK_LANES );\
+		VUL__SORT_VSORT( r[ i ], VUL__SORT_VMIN_##K, VUL__SORT_VMAX_##K );\
+	}\
+	for( m = 1; m < count; m *= 2 ) {\
+		for( g = 0; g < count; g += 2 * m ) {\
+			/* Reversing the second half makes the pair one bitonic sequence */\
+			for( i = 0; i < m / 2; ++i ) {\
+				p = r[ g + m + i ]; r[ g + m + i ] = r[ g + 2 * m - 1 - i ]; r[ g + 2 * m - 1 - i ] = p;\
+			}\
+			for( i = g + m; i < g + 2 * m; ++i ) {\
+				r[ i ] = VUL__SORT_VREVERSE( r[ i ] );\
+			}\
+			for( d = m; d > 0; d >>= 1 ) {\
+				for( i = g; i < g + 2 * m; ++i ) {\
+					if( ( i - g ) & d ) {\
+						continue;\
+					}\
+					j = i + d;\
+					lo = VUL__SORT_VMIN_##K( r[ i ], r[ j ] );\
+					hi = VUL__SORT_VMAX_##K( r[ i ], r[ j ] );\
+					r[ i ] = lo;\
+					r[ j ] = hi;\
+				}\
+			}\
+			for( i = g; i < g + 2 * m; ++i ) {\
+				VUL__SORT_VCLEAN( r[ i ], VUL__SORT_VMIN_##K, VUL__SORT_VMAX_##K );\
+			}\
+		}\
+	}\
+	for( i = 0; i < count; ++i ) {\
+		VUL__SORT_VSTORE( ( float* )buffer + i * VUL__SORT_NETWORK_LANES, r[ i ] );\
+	}\
+	for( i = 0; i < n; ++i ) {\
+		buffer[ i ] = from_key( buffer[ i ] );\
+	}\
+	memcpy( a, buffer, sizeof( T ) * n );\
+}
+
+VUL__SORT_DEFINE_NETWORK( u32, u32, VUL__SORT_NETWORK_IDENTITY, VUL__SORT_NETWORK_IDENTITY, 0xffffffffu )
+VUL__SORT_DEFINE_NETWORK( s32, s32, VUL__SORT_NETWORK_IDENTITY, VUL__SORT_NETWORK_IDENTITY, 0x7fffffffu )
+VUL__SORT_DEFINE_NETWORK( f32, u32, VUL__SORT_NETWORK_F32_TO_KEY, VUL__SORT_NETWORK_F32_FROM_KEY, 0xffffffffu )
+#undef VUL__SORT_DEFINE_NETWORK
+#undef VUL__SORT_NETWORK_IDENTITY
+#undef VUL__SORT_NETWORK_F32_TO_KEY
+#undef VUL__SORT_NETWORK_F32_FROM_KEY
+
+#define VUL__SORT_LESS( x, y ) ( ( x ) < ( y ) )
+VUL__SORT_DEFINE_TYPED_BASE( vul__sort_typed_u32, u32, VUL__SORT_LESS, vul__sort_network_u32, VUL__SORT_NETWORK_MAX )
+VUL__SORT_DEFINE_TYPED_BASE( vul__sort_typed_s32, s32, VUL__SORT_LESS, vul__sort_network_s32, VUL__SORT_NETWORK_MAX )
+VUL__SORT_DEFINE_TYPED_BASE( vul__sort_typed_f32, f32, VUL__SORT_LESS, vul__sort_network_f32, VUL__SORT_NETWORK_MAX )
+#else
+#define VUL__SORT_LESS( x, y ) ( ( x ) < ( y ) )
+VUL_SORT_DEFINE_TYPED( vul__sort_typed_u32, u32, VUL__SORT_LESS )
+VUL_SORT_DEFINE_TYPED( vul__sort_typed_s32, s32, VUL__SORT_LESS )
+VUL_SORT_DEFINE_TYPED( vul__sort_typed_f32, f32, VUL__SORT_LESS )
+#endif
+VUL_SORT_DEFINE_TYPED( vul__sort_typed_u64, u64, VUL__SORT_LESS )
+VUL_SORT_DEFINE_TYPED( vul__sort_typed_f64, f64, VUL__SORT_LESS )
+#undef VUL__SORT_LESS
+
+void vul_sort_u32( u32 *a, u32 n )
+{
+	vul__sort_typed_u32( a, n );
+}
+
+void vul_sort_s32( s32 *a, u32 n )
+{
+	vul__sort_typed_s32( a, n );
+}
+
+void vul_sort_u64( u64 *a, u32 n )
+{
+	vul__sort_typed_u64( a, n );
+}
+
+void vul_sort_f32( f32 *a, u32 n )
+{
+	vul__sort_typed_f32( a, n );
+}
+
+void vul_sort_f64( f64 *a, u32 n )
+{
+	vul__sort_typed_f64( a, n );
+}
+
+void vul_sort_nth_u32( u32 *a, u32 n, u32 k )
+{
+	vul__sort_typed_u32_nth( a, n, k );
+}
+
+void vul_sort_nth_s32( s32 *a, u32 n, u32 k )
+{
+	vul__sort_typed_s32_nth( a, n, k );
+}
+
+void vul_sort_nth_u64( u64 *a, u32 n, u32 k )
+{
+	vul__sort_typed_u64_nth( a, n, k );
+}
+
+void vul_sort_nth_f32( f32 *a, u32 n, u32 k )
+{
+	vul__sort_typed_f32_nth( a, n, k );
+}
+
+void vul_sort_nth_f64( f64 *a, u32 n, u32 k )
+{
+	vul__sort_typed_f64_nth( a, n, k );
+}
+
+void vul_sort_partial_u32( u32 *a, u32 n, u32 k )
+{
+	vul__sort_typed_u32_partial( a, n, k );
+}
+
+void vul_sort_partial_s32( s32 *a, u32 n, u32 k )
+{
+	vul__sort_typed_s32_partial( a, n, k );
+}
+
+void vul_sort_partial_u64( u64 *a, u32 n, u32 k )
+{
+	vul__sort_typed_u64_partial( a, n, k );
+}
+
+void vul_sort_partial_f32( f32 *a, u32 n, u32 k )
+{
+	vul__sort_typed_f32_partial( a, n, k );
+}
+
+void vul_sort_partial_f64( f64 *a, u32 n, u32 k )
+{
+	vul__sort_typed_f64_partial( a, n, k );
+}
+
+//--------------------
+// Radix sorts
+
+/**
+ * Below this size a bucket of the MSD radix sort is finished with insertion sort.
+ */
+#ifndef VUL_SORT_RADIX_INSERTION_CUTOFF
+#define VUL_SORT_RADIX_INSERTION_CUTOFF 64
+#endif
+
+u32 vul_sort_f32_key( f32 f )
+{
+	u32 u;
+
+	memcpy( &u, &f, sizeof( u32 ) );
+	return u ^ ( ( u32 )-( s32 )( u >> 31 ) | 0x80000000u );
+}
+
+f32 vul_sort_f32_from_key( u32 key )
+{
+	f32 f;
+
+	key ^= ( ( key >> 31 ) - 1 ) | 0x80000000u;
+	memcpy( &f, &key, sizeof( u32 ) );
+	return f;
+}
+
+u64 vul_sort_f64_key( f64 f )
+{
+	u64 u;
+
+	memcpy( &u, &f, sizeof( u64 ) );
+	return u ^ ( ( u64 )-( int64_t )( u >> 63 ) | 0x8000000000000000ull );
+}
+
+f64 vul_sort_f64_from_key( u64 key )
+{
+	f64 f;
+
+	key ^= ( ( key >> 63 ) - 1 ) | 0x8000000000000000ull;
+	memcpy( &f, &key, sizeof( u64 ) );
+	return f;
+}
+
+/**
+ * Defines the LSD and MSD radix sorts vul__sort_radix_lsd_##name and vul__sort_radix_msd_##name
+ * over elements of type T, ordered by the unsigned integer key KEY( x ) of type K.
+ * Elements are moved as T and keys are computed on the fly, so float arrays are never
+ * accessed through an integer pointer. All digit histograms are built in a single read pass.
+ */
+#define VUL__SORT_RADIX_IDENTITY( x ) ( x )
+#define VUL__SORT_DEFINE_RADIX( name, T, K, KEY )\
+VUL__SORT_UNUSED static void vul__sort_radix_lsd_##name( T *a, u32 n, T *tmp )\
+{\
+	u32 hist[ sizeof( K ) ][ 256 ];\
+	u32 i, d, sum, c;\
+	T *src, *dst, *swap, *buffer;\
+	\
+	if( n < 2 ) {\
+		return;\
+	}\
+	memset( hist, 0, sizeof( hist ) );\
+	for( i = 0; i < n; ++i ) {\
+		for( d = 0; d < sizeof( K ); ++d ) {\
+			++hist[ d ][ ( KEY( a[ i ] ) >> ( d * 8 ) ) & 0xff ];\
+		}\
+	}\
+	buffer = tmp ? tmp : ( T* )malloc( sizeof( T ) * n );\
+	VUL_DATATYPES_CUSTOM_ASSERT( buffer != NULL ); /* Make sure malloc didn't fail */\
+	src = a;\
+	dst = buffer;\
+	for( d = 0; d < sizeof( K ); ++d ) {\
+		if( hist[ d ][ ( KEY( a[ 0 ] ) >> ( d * 8 ) ) & 0xff ] == n ) {\
+			continue; /* Every key has the same digit here */\
+		}\
+		sum = 0;\
+		for( i = 0; i < 256; ++i ) {\
+			c = hist[ d ][ i ];\
+			hist[ d ][ i ] = sum;\
+			sum += c;\
+		}\
+		for( i = 0; i < n; ++i ) {\
+			dst[ hist[ d ][ ( KEY( src[ i ] ) >> ( d * 8 ) ) & 0xff ]++ ] = src[ i ];\
+		}\
+		swap = src; src = dst; dst = swap;\
+	}\
+	if( src != a ) {\
+		memcpy( a, src, sizeof( T ) * n );\
+	}\
+	if( !tmp ) {\
+		free( buffer );\
+	}\
+}\
+VUL__SORT_UNUSED static void vul__sort_radix_msd_##name( T *a, u32 n, u32 shift )\
+{\
+	u32 heads[ 256 ], tails[ 256 ];\
+	u32 i, b, d, sum;\
+	T v, w;\
+	\
+	if( n <= VUL_SORT_RADIX_INSERTION_CUTOFF ) {\
+		for( i = 1; i < n; ++i ) {\
+			v = a[ i ];\
+			for( b = i; b > 0 && KEY( v ) < KEY( a[ b - 1 ] ); --b ) {\
+				a[ b ] = a[ b - 1 ];\
+			}\
+			a[ b ] = v;\
+		}\
+		return;\
+	}\
+	memset( tails, 0, sizeof( tails ) );\
+	for( i = 0; i < n; ++i ) {\
+		++tails[ ( KEY( a[ i ] ) >> shift ) & 0xff ];\
+	}\
+	if( tails[ ( KEY( a[ 0 ] ) >> shift ) & 0xff ] == n ) {\
+		if( shift > 0 ) { /* One bucket only, go straight to the next digit */\
+			vul__sort_radix_msd_##name( a, n, shift - 8 );\
+		}\
+		return;\
+	}\
+	sum = 0;\
+	for( b = 0; b < 256; ++b ) {\
+		heads[ b ] = sum;\
+		sum += tails[ b ];\
+		tails[ b ] = sum;\
+	}\
+	/* Walk each bucket, swapping misplaced keys to their bucket's head until it fills up */\
+	for( b = 0; b < 256; ++b ) {\
+		while( heads[ b ] < tails[ b ] ) {\
+			v = a[ heads[ b ] ];\
+			d = ( KEY( v ) >> shift ) & 0xff;\
+			while( d != b ) {\
+				w = a[ heads[ d ] ];\
+				a[ heads[ d ]++ ] = v;\
+				v = w;\
+				d = ( KEY( v ) >> shift ) & 0xff;\
+			}\
+			a[ heads[ b ]++ ] = v;\
+		}\
+	}\
+	if( shift == 0 ) {\
+		return;\
+	}\
+	for( b = 0, i = 0; b < 256; i = tails[ b++ ] ) {\
+		if( tails[ b ] - i > 1 ) {\
+			vul__sort_radix_msd_##name( a + i, tails[ b ] - i, shift - 8 );\
+		}\
+	}\
+}
+VUL__SORT_DEFINE_RADIX( u32, u32, u32, VUL__SORT_RADIX_IDENTITY )
+VUL__SORT_DEFINE_RADIX( u64, u64, u64, VUL__SORT_RADIX_IDENTITY )
+VUL__SORT_DEFINE_RADIX( f32, f32, u32, vul_sort_f32_key )
+VUL__SORT_DEFINE_RADIX( f64, f64, u64, vul_sort_f64_key )
+#undef VUL__SORT_DEFINE_RADIX
+#undef VUL__SORT_RADIX_IDENTITY
+
+void vul_sort_radix_u32( u32 *a, u32 n, u32 *tmp )
+{
+	vul__sort_radix_lsd_u32( a, n, tmp );
+}
+
+void vul_sort_radix_s32( s32 *a, u32 n, s32 *tmp )
+{
+	u32 i;
+
+	// Flipping the sign bit orders two's complement values as unsigned ones
+	for( i = 0; i < n; ++i ) {
+		( ( u32* )a )[ i ] ^= 0x80000000u;
+	}
+	vul__sort_radix_lsd_u32( ( u32* )a, n, ( u32* )tmp );
+	for( i = 0; i < n; ++i ) {
+		( ( u32* )a )[ i ] ^= 0x80000000u;
+	}
+}
+
+void vul_sort_radix_u64( u64 *a, u32 n, u64 *tmp )
+{
+	vul__sort_radix_lsd_u64( a, n, tmp );
+}
+
+void vul_sort_radix_f32( f32 *a, u32 n, f32 *tmp )
+{
+	vul__sort_radix_lsd_f32( a, n, tmp );
+}
+
+void vul_sort_radix_f64( f64 *a, u32 n, f64 *tmp )
+{
+	vul__sort_radix_lsd_f64( a, n, tmp );
+}
+
+void vul_sort_radix_records( void *data, u32 count, u32 element_size, u64 (*key)( const void *element ), void *tmp )
+{
+	u32 hist[ 8 ][ 256 ];
+	u32 i, d, sum, c, first;
+	u64 k;
+	u8 *src, *dst, *swap, *buffer;
+
+	if( count < 2 ) {
+		return;
+	}
+	memset( hist, 0, sizeof( hist ) );
+	for( i = 0; i < count; ++i ) {
+		k = key( ( u8* )data + ( size_t )i * element_size );
+		for( d = 0; d < 8; ++d ) {
+			++hist[ d ][ ( k >> ( d * 8 ) ) & 0xff ];
+		}
+	}
+	buffer = tmp ? ( u8* )tmp : ( u8* )malloc( ( size_t )element_size * count );
+	VUL_DATATYPES_CUSTOM_ASSERT( buffer != NULL ); // Make sure malloc didn't fail
+	src = ( u8* )data;
+	dst = buffer;
+	k = key( data );
+	for( d = 0; d < 8; ++d ) {
+		first = ( k >> ( d * 8 ) ) & 0xff;
+		if( hist[ d ][ first ] == count ) {
+			continue; // Every key has the same digit here
+		}
+		sum = 0;
+		for( i = 0; i < 256; ++i ) {
+			c = hist[ d ][ i ];
+			hist[ d ][ i ] = sum;
+			sum += c;
+		}
+		for( i = 0; i < count; ++i ) {
+			c = ( key( src + ( size_t )i * element_size ) >> ( d * 8 ) ) & 0xff;
+			memcpy( dst + ( size_t )hist[ d ][ c ]++ * element_size, src + ( size_t )i * element_size, element_size );
+		}
+		swap = src; src = dst; dst = swap;
+	}
+	if( src != ( u8* )data ) {
+		memcpy( data, src, ( size_t )element_size * count );
+	}
+	if( !tmp ) {
+		free( buffer );
+	}
+}
+
+void vul_sort_radix_inplace_u32( u32 *a, u32 n )
+{
+	if( n > 1 ) {
+		vul__sort_radix_msd_u32( a, n, 24 );
+	}
+}
+
+void vul_sort_radix_inplace_u64( u64 *a, u32 n )
+{
+	if( n > 1 ) {
+		vul__sort_radix_msd_u64( a, n, 56 );
+	}
+}
+
+void vul_sort_radix_inplace_f32( f32 *a, u32 n )
+{
+	if( n > 1 ) {
+		vul__sort_radix_msd_f32( a, n, 24 );
+	}
+}
+
+static void vul__sort_radix_msd_records( u8 *a, u32 n, u32 element_size, u64 (*key)( const void *element ), u32 shift, u8 *v, u8 *w )
+{
+	u32 heads[ 256 ], tails[ 256 ];
+	u32 i, j, b, d, sum;
+	u64 k;
+
+	if( n <= VUL_SORT_RADIX_INSERTION_CUTOFF ) {
+		for( i = 1; i < n; ++i ) {
+			memcpy( v, a + ( size_t )i * element_size, element_size );
+			k = key( v );
+			for( j = i; j > 0 && k < key( a + ( size_t )( j - 1 ) * element_size ); --j ) {
+				memcpy( a + ( size_t )j * element_size, a + ( size_t )( j - 1 ) * element_size, element_size );
+			}
+			memcpy( a + ( size_t )j * element_size, v, element_size );
+		}
+		return;
+	}
+	memset( tails, 0, sizeof( tails ) );
+	for( i = 0; i < n; ++i ) {
+		++tails[ ( key( a + ( size_t )i * element_size ) >> shift ) & 0xff ];
+	}
+	if( tails[ ( key( a ) >> shift ) & 0xff ] == n ) {
+		if( shift > 0 ) { // One bucket only, go straight to the next digit
+			vul__sort_radix_msd_records( a, n, element_size, key, shift - 8, v, w );
+		}
+		return;
+	}
+	sum = 0;
+	for( b = 0; b < 256; ++b ) {
+		heads[ b ] = sum;
+		sum += tails[ b ];
+		tails[ b ] = sum;
+	}
+	// Same cycle walk as the integer version, with the element in hand kept in v
+	for( b = 0; b < 256; ++b ) {
+		while( heads[ b ] < tails[ b ] ) {
+			memcpy( v, a + ( size_t )heads[ b ] * element_size, element_size );
+			d = ( key( v ) >> shift ) & 0xff;
+			while( d != b ) {
+				memcpy( w, a + ( size_t )heads[ d ] * element_size, element_size );
+				memcpy( a + ( size_t )heads[ d ]++ * element_size, v, element_size );
+				memcpy( v, w, element_size );
+				d = ( key( v ) >> shift ) & 0xff;
+			}
+			memcpy( a + ( size_t )heads[ b ]++ * element_size, v, element_size );
+		}
+	}
+	if( shift == 0 ) {
+		return;
+	}
+	for( b = 0, i = 0; b < 256; i = tails[ b++ ] ) {
+		if( tails[ b ] - i > 1 ) {
+			vul__sort_radix_msd_records( a + ( size_t )i * element_size, tails[ b ] - i, element_size, key, shift - 8, v, w );
+		}
+	}
+}
+
+void vul_sort_radix_inplace_records( void *data, u32 count, u32 element_size, u64 (*key)( const void *element ) )
+{
+	u8 *held;
+
+	if( count < 2 ) {
+		return;
+	}
+	held = ( u8* )malloc( ( size_t )element_size * 2 );
+	VUL_DATATYPES_CUSTOM_ASSERT( held != NULL ); // Make sure malloc didn't fail
+	vul__sort_radix_msd_records( ( u8* )data, count, element_size, key, 56, held, held + element_size );
+	free( held );
+}
+
+//--------------------
+// Merge sorts
+
+/**
+ * The parallel sort uses no more threads than leave each at least this many elements.
+ */
+#ifndef VUL_SORT_PARALLEL_MIN_CHUNK
+#define VUL_SORT_PARALLEL_MIN_CHUNK 4096
+#endif
+
+/**
+ * Stable merge of a[ 0, na ) and b[ 0, nb ) into dst. Ties are taken from a.
+ */
+static void vul__sort_merge_runs( u8 *dst, const u8 *a, u32 na, const u8 *b, u32 nb, u32 size,
+								  s32 (*comparator)( const void *a, const void *b ) )
+{
+	u32 i, j;
+
+	i = 0;
+	j = 0;
+	while( i < na && j < nb ) {
+		if( comparator( b + ( size_t )j * size, a + ( size_t )i * size ) < 0 ) {
+			memcpy( dst, b + ( size_t )j++ * size, size );
+		} else {
+			memcpy( dst, a + ( size_t )i++ * size, size );
+		}
+		dst += size;
+	}
+	memcpy( dst, a + ( size_t )i * size, ( size_t )( na - i ) * size );
+	dst += ( size_t )( na - i ) * size;
+	memcpy( dst, b + ( size_t )j * size, ( size_t )( nb - j ) * size );
+}
+
+/**
+ * Stable sort of n elements in a. tmp must hold n elements. The result ends up in a.
+ */
+static void vul__sort_merge( u8 *a, u8 *tmp, u32 n, u32 size, s32 (*comparator)( const void *a, const void *b ) )
+{
+	u32 lo, hi, mid, i, j, w;
+	u8 *src, *dst, *swap;
+
+	// Insertion sort runs, holding the element being moved in tmp
+	for( lo = 0; lo < n; lo += VUL_SORT_TYPED_RUN ) {
+		hi = n - lo < VUL_SORT_TYPED_RUN ? n : lo + VUL_SORT_TYPED_RUN;
+		for( i = lo + 1; i < hi; ++i ) {
+			if( comparator( a + ( size_t )( i - 1 ) * size, a + ( size_t )i * size ) <= 0 ) {
+				continue;
+			}
+			memcpy( tmp, a + ( size_t )i * size, size );
+			for( j = i - 1; j > lo && comparator( a + ( size_t )( j - 1 ) * size, tmp ) > 0; --j )
+				;
+			memmove( a + ( size_t )( j + 1 ) * size, a + ( size_t )j * size, ( size_t )( i - j ) * size );
+			memcpy( a + ( size_t )j * size, tmp, size );
+		}
+	}
+
+	src = a;
+	dst = tmp;
+	for( w = VUL_SORT_TYPED_RUN; w < n; w *= 2 ) {
+		for( lo = 0; lo < n; lo += 2 * w ) {
+			mid = n - lo < w ? n : lo + w;
+			hi = n - mid < w ? n : mid + w;
+			vul__sort_merge_runs( dst + ( size_t )lo * size, src + ( size_t )lo * size, mid - lo,
+								  src + ( size_t )mid * size, hi - mid, size, comparator );
+		}
+		swap = src; src = dst; dst = swap;
+	}
+	if( src != a ) {
+		memcpy( a, src, ( size_t )n * size );
+	}
+}
+
+void vul_sort_vector_merge( vul_vector *list, s32 (*comparator)( const void *a, const void *b ) )
+{
+	u8 *tmp;
+	u32 n;
+
+	n = vul_vector_size( list );
+	if( n < 2 ) {
+		return;
+	}
+	tmp = ( u8* )vul_vector_scratch_alloc( list, ( size_t )n * list->element_size );
+	VUL_DATATYPES_CUSTOM_ASSERT( tmp != NULL ); // Make sure allocation didn't fail
+	vul__sort_merge( ( u8* )vul_vector_begin( list ), tmp, n, list->element_size, comparator );
+	vul_vector_scratch_free( list, tmp, ( size_t )n * list->element_size );
+}
+
+//--------------------
+// Selection
+
+/**
+ * Restores the max-heap property below i in the heap a[ 0, n ). v is scratch for one element.
+ */
+static void vul__sort_sift_down( u8 *a, u32 i, u32 n, u32 size, s32 (*comparator)( const void *a, const void *b ), u8 *v )
+{
+	u32 c;
+
+	memcpy( v, a + ( size_t )i * size, size );
+	while( ( c = 2 * i + 1 ) < n ) {
+		if( c + 1 < n && comparator( a + ( size_t )c * size, a + ( size_t )( c + 1 ) * size ) < 0 ) {
+			++c;
+		}
+		if( comparator( v, a + ( size_t )c * size ) >= 0 ) {
+			break;
+		}
+		memcpy( a + ( size_t )i * size, a + ( size_t )c * size, size );
+		i = c;
+	}
+	memcpy( a + ( size_t )i * size, v, size );
+}
+
+static void vul__sort_swap( u8 *a, u8 *b, u32 size, u8 *v )
+{
+	memcpy( v, a, size );
+	memcpy( a, b, size );
+	memcpy( b, v, size );
+}
+
+/**
+ * Introselect of element k of a[ 0, n ). p and v are scratch for one element each.
+ */
+static void vul__sort_select( u8 *a, u32 n, u32 k, u32 size, s32 (*comparator)( const void *a, const void *b ), u8 *p, u8 *v )
+{
+	u32 depth, i, j, m;
+
+	depth = 0;
+	for( i = n; i > 1; i >>= 1 ) {
+		depth += 2;
+	}
+	while( n > VUL_SORT_TYPED_INSERTION_CUTOFF ) {
+		if( depth-- == 0 ) {
+			// Too many bad pivots: heap select, max-heap of the k + 1 smallest at the front
+			for( i = ( k + 1 ) / 2; i > 0; --i ) {
+				vul__sort_sift_down( a, i - 1, k + 1, size, comparator, v );
+			}
+			for( i = k + 1; i < n; ++i ) {
+				if( comparator( a + ( size_t )i * size, a ) < 0 ) {
+					vul__sort_swap( a, a + ( size_t )i * size, size, v );
+					vul__sort_sift_down( a, 0, k + 1, size, comparator, v );
+				}
+			}
+			vul__sort_swap( a, a + ( size_t )k * size, size, v );
+			return;
+		}
+		// Median of three, which also puts sentinels at both ends
+		m = n >> 1;
+		if( comparator( a + ( size_t )m * size, a ) < 0 ) {
+			vul__sort_swap( a + ( size_t )m * size, a, size, v );
+		}
+		if( comparator( a + ( size_t )( n - 1 ) * size, a + ( size_t )m * size ) < 0 ) {
+			vul__sort_swap( a + ( size_t )m * size, a + ( size_t )( n - 1 ) * size, size, v );
+			if( comparator( a + ( size_t )m * size, a ) < 0 ) {
+				vul__sort_swap( a + ( size_t )m * size, a, size, v );
+			}
+		}
+		memcpy( p, a + ( size_t )m * size, size );
+		i = 1;
+		j = n - 2;
+		while( 1 ) {
+			while( comparator( a + ( size_t )i * size, p ) < 0 ) ++i;
+			while( comparator( p, a + ( size_t )j * size ) < 0 ) --j;
+			if( i >= j ) break;
+			vul__sort_swap( a + ( size_t )i * size, a + ( size_t )j * size, size, v );
+			++i;
+			--j;
+		}
+		// [ 0, i ) <= p <= [ j + 1, n )
+		if( k < i ) {
+			n = i;
+		} else if( k > j ) {
+			a += ( size_t )( j + 1 ) * size;
+			n -= j + 1;
+			k -= j + 1;
+		} else {
+			return; // Between the halves everything equals the pivot
+		}
+	}
+	// Insertion sort the rest
+	for( i = 1; i < n; ++i ) {
+		memcpy( v, a + ( size_t )i * size, size );
+		for( j = i; j > 0 && comparator( v, a + ( size_t )( j - 1 ) * size ) < 0; --j )
+			;
+		memmove( a + ( size_t )( j + 1 ) * size, a + ( size_t )j * size, ( size_t )( i - j ) * size );
+		memcpy( a + ( size_t )j * size, v, size );
+	}
+}
+
+void vul_sort_vector_nth_element( vul_vector *list, s32 (*comparator)( const void *a, const void *b ), u32 k )
+{
+	u8 *tmp;
+	u32 n;
+
+	n = vul_vector_size( list );
+	if( k >= n || n < 2 ) {
+		return;
+	}
+	tmp = ( u8* )vul_vector_scratch_alloc( list, 2 * ( size_t )list->element_size );
+	VUL_DATATYPES_CUSTOM_ASSERT( tmp != NULL ); // Make sure allocation didn't fail
+	vul__sort_select( ( u8* )vul_vector_begin( list ), n, k, list->element_size, comparator,
+					  tmp, tmp + list->element_size );
+	vul_vector_scratch_free( list, tmp, 2 * ( size_t )list->element_size );
+}
+
+void vul_sort_vector_partial( vul_vector *list, s32 (*comparator)( const void *a, const void *b ), u32 k )
+{
+	u8 *a, *tmp;
+	u32 n;
+
+	n = vul_vector_size( list );
+	if( k >= n ) {
+		vul_sort_vector_merge( list, comparator );
+		return;
+	}
+	if( k == 0 ) {
+		return;
+	}
+	a = ( u8* )vul_vector_begin( list );
+	// The merge sort needs k elements of scratch, the selection 2
+	tmp = ( u8* )vul_vector_scratch_alloc( list, ( size_t )( k < 2 ? 2 : k ) * list->element_size );
+	VUL_DATATYPES_CUSTOM_ASSERT( tmp != NULL ); // Make sure allocation didn't fail
+	vul__sort_select( a, n, k - 1, list->element_size, comparator, tmp, tmp + list->element_size );
+	vul__sort_merge( a, tmp, k, list->element_size, comparator );
+	vul_vector_scratch_free( list, tmp, ( size_t )( k < 2 ? 2 : k ) * list->element_size );
+}
+
+vul_sort_top_k *vul_sort_top_k_create( u32 element_size, u32 k, s32 (*comparator)( const void *a, const void *b ),
+									   void *( *allocator )( size_t size ), void ( *deallocator )( void *ptr ) )
+{
+	vul_sort_top_k *t;
+
+	VUL_DATATYPES_CUSTOM_ASSERT( k > 0 );
+	t = ( vul_sort_top_k* )allocator( sizeof( vul_sort_top_k ) );
+	VUL_DATATYPES_CUSTOM_ASSERT( t != NULL ); // Make sure allocation didn't fail
+	t->data = ( u8* )allocator( ( ( size_t )k + 1 ) * element_size );
+	VUL_DATATYPES_CUSTOM_ASSERT( t->data != NULL ); // Make sure allocation didn't fail
+	t->element_size = element_size;
+	t->capacity = k;
+	t->count = 0;
+	t->comparator = comparator;
+	t->allocator = allocator;
+	t->deallocator = deallocator;
+
+	return t;
+}
+
+void vul_sort_top_k_destroy( vul_sort_top_k *t )
+{
+	t->deallocator( t->data );
+	t->deallocator( t );
+}
+
+b32 vul_sort_top_k_push( vul_sort_top_k *t, const void *element )
+{
+	u8 *scratch;
+	u32 i, parent, size;
+
+	size = t->element_size;
+	scratch = t->data + ( size_t )t->capacity * size;
+	if( t->count < t->capacity ) {
+		// Sift up from the end
+		i = t->count++;
+		while( i > 0 ) {
+			parent = ( i - 1 ) / 2;
+			if( t->comparator( t->data + ( size_t )parent * size, element ) >= 0 ) {
+				break;
+			}
+			memcpy( t->data + ( size_t )i * size, t->data + ( size_t )parent * size, size );
+			i = parent;
+		}
+		memcpy( t->data + ( size_t )i * size, element, size );
+		return VUL_TRUE;
+	}
+	if( t->comparator( element, t->data ) >= 0 ) {
+		return VUL_FALSE;
+	}
+	// Replace the largest kept element
+	memcpy( t->data, element, size );
+	vul__sort_sift_down( t->data, 0, t->count, size, t->comparator, scratch );
+	return VUL_TRUE;
+}
+
+u32 vul_sort_top_k_count( vul_sort_top_k *t )
+{
+	return t->count;
+}
+
+void vul_sort_top_k_extract( vul_sort_top_k *t, void *out )
+{
+	u8 *o, *scratch;
+	u32 i, size;
+
+	o = ( u8* )out;
+	size = t->element_size;
+	scratch = t->data + ( size_t )t->capacity * size;
+	memcpy( o, t->data, ( size_t )t->count * size );
+	// Already a max-heap, so only the second half of a heap sort remains
+	for( i = t->count; i > 1; --i ) {
+		vul__sort_swap( o, o + ( size_t )( i - 1 ) * size, size, scratch );
+		vul__sort_sift_down( o, 0, i - 1, size, t->comparator, scratch );
+	}
+}
+
+void vul_sort_top_k_reset( vul_sort_top_k *t )
+{
+	t->count = 0;
+}
+
+#ifdef VUL_THREAD_H
+
+typedef enum vul__sort_parallel_phase {
+	VUL__SORT_PARALLEL_SORT,
+	VUL__SORT_PARALLEL_MERGE,
+	VUL__SORT_PARALLEL_COPY
+} vul__sort_parallel_phase;
+
+typedef struct vul__sort_parallel_job {
+	u8 *data, *tmp;
+	u8 *src, *dst;			// Merge input and output for this round
+	u32 count, size;
+	u32 part_count;			// Parts each phase is split in, also the number of initial runs
+	u32 width;				// Runs per merge input this round
+	vul__sort_parallel_phase phase;
+	s32 (*comparator)( const void *a, const void *b );
+} vul__sort_parallel_job;
+
+/**
+ * First element of run r, or count for r >= part_count.
+ */
+static u32 vul__sort_parallel_run_start( vul__sort_parallel_job *job, u32 r )
+{
+	if( r >= job->part_count ) {
+		return job->count;
+	}
+	return ( u32 )( ( ( u64 )job->count * r ) / job->part_count );
+}
+
+/**
+ * Finds how many of the first k elements of the stable merge of a and b come from a.
+ */
+static u32 vul__sort_co_rank( const u8 *a, u32 na, const u8 *b, u32 nb, u32 k, u32 size,
+							  s32 (*comparator)( const void *a, const void *b ) )
+{
+	u32 lo, hi, i;
+
+	lo = k > nb ? k - nb : 0;
+	hi = k < na ? k : na;
+	while( lo < hi ) {
+		i = ( lo + hi ) >> 1;
+		// a[ i ] precedes b[ k - i - 1 ] if it is not larger, so more than i come from a
+		if( comparator( a + ( size_t )i * size, b + ( size_t )( k - i - 1 ) * size ) <= 0 ) {
+			lo = i + 1;
+		} else {
+			hi = i;
+		}
+	}
+	return lo;
+}
+
+/**
+ * Does part t of the job's current phase.
+ */
+static void vul__sort_parallel_work( vul__sort_parallel_job *job, u32 t )
+{
+	u32 first, last, r, lo, mid, hi, ks, ke, i0, i1;
+	u8 *a, *b;
+
+	first = vul__sort_parallel_run_start( job, t );
+	last = vul__sort_parallel_run_start( job, t + 1 );
+
+	switch( job->phase ) {
+	case VUL__SORT_PARALLEL_SORT:
+		vul__sort_merge( job->data + ( size_t )first * job->size, job->tmp + ( size_t )first * job->size,
+						 last - first, job->size, job->comparator );
+		break;
+	case VUL__SORT_PARALLEL_MERGE:
+		// Produce output elements [ first, last ) of every merge that overlaps them
+		for( r = 0; r < job->part_count; r += 2 * job->width ) {
+			lo = vul__sort_parallel_run_start( job, r );
+			mid = vul__sort_parallel_run_start( job, r + job->width );
+			hi = vul__sort_parallel_run_start( job, r + 2 * job->width );
+			if( hi <= first || lo >= last ) {
+				continue;
+			}
+			ks = ( first > lo ? first : lo ) - lo;
+			ke = ( last < hi ? last : hi ) - lo;
+			a = job->src + ( size_t )lo * job->size;
+			b = job->src + ( size_t )mid * job->size;
+			i0 = vul__sort_co_rank( a, mid - lo, b, hi - mid, ks, job->size, job->comparator );
+			i1 = vul__sort_co_rank( a, mid - lo, b, hi - mid, ke, job->size, job->comparator );
+			vul__sort_merge_runs( job->dst + ( size_t )( lo + ks ) * job->size,
+								  a + ( size_t )i0 * job->size, i1 - i0,
+								  b + ( size_t )( ks - i0 ) * job->size, ( ke - i1 ) - ( ks - i0 ),
+								  job->size, job->comparator );
+		}
+		break;
+	case VUL__SORT_PARALLEL_COPY:
+		memcpy( job->data + ( size_t )first * job->size, job->src + ( size_t )first * job->size,
+				( size_t )( last - first ) * job->size );
+		break;
+	}
+}
+
+/**
+ * vul_parallel_for body: does parts [ begin, end ) of the job's current phase.
+ */
+static void vul__sort_parallel_parts( u32 begin, u32 end, void *ctx )
+{
+	u32 t;
+
+	for( t = begin; t < end; ++t ) {
+		vul__sort_parallel_work( ( vul__sort_parallel_job* )ctx, t );
+	}
+}
+
+void vul_sort_vector_parallel( vul_vector *list, s32 (*comparator)( const void *a, const void *b ), vul_task_pool *pool )
+{
+	vul__sort_parallel_job job;
+	u8 *swap;
+	u32 n, part_count;
+
+	n = vul_vector_size( list );
+	part_count = pool ? vul_task_pool_worker_count( pool ) + 1 : 1;
+	if( part_count > n / VUL_SORT_PARALLEL_MIN_CHUNK ) {
+		part_count = n / VUL_SORT_PARALLEL_MIN_CHUNK;
+	}
+	if( part_count <= 1 ) {
+		vul_sort_vector_merge( list, comparator );
+		return;
+	}
+
+	memset( &job, 0, sizeof( job ) );
+	job.data = ( u8* )vul_vector_begin( list );
+	job.tmp = ( u8* )vul_vector_scratch_alloc( list, ( size_t )n * list->element_size );
+	VUL_DATATYPES_CUSTOM_ASSERT( job.tmp != NULL ); // Make sure allocation didn't fail
+	job.count = n;
+	job.size = list->element_size;
+	job.part_count = part_count;
+	job.comparator = comparator;
+
+	// One part per index, so each phase is spread over every thread of the pool
+	job.phase = VUL__SORT_PARALLEL_SORT;
+	vul_parallel_for( pool, 0, part_count, 1, vul__sort_parallel_parts, &job );
+
+	job.phase = VUL__SORT_PARALLEL_MERGE;
+	job.src = job.data;
+	job.dst = job.tmp;
+	for( job.width = 1; job.width < part_count; job.width *= 2 ) {
+		vul_parallel_for( pool, 0, part_count, 1, vul__sort_parallel_parts, &job );
+		swap = job.src; job.src = job.dst; job.dst = swap;
+	}
+	if( job.src != job.data ) {
+		job.phase = VUL__SORT_PARALLEL_COPY;
+		vul_parallel_for( pool, 0, part_count, 1, vul__sort_parallel_parts, &job );
+	}
+
+	vul_vector_scratch_free( list, job.tmp, ( size_t )n * list->element_size );
+}
+
+#endif // VUL_THREAD_H
+
+#ifdef VUL_FILE_H
+
+/**
+ * mmap offsets must be a multiple of this (the allocation granularity on Windows,
+ * a multiple of the page size elsewhere).
+ */
+#define VUL__SORT_FILE_MAP_ALIGNMENT 65536
+
+typedef struct vul__sort_file_run {
+	const char *path;
+	u64 offset;				// Byte offset of the next unread element in the run file
+	u64 end;				// Length of the run file
+	vul_mmap_file window;	// The currently mapped part, or window.map == NULL
+	u8 *current, *last;		// Next element and end of the mapped elements
+} vul__sort_file_run;
+
+/**
+ * Maps the next window of a run, covering up to window_elements elements.
+ * Returns VUL_FALSE once the run is exhausted, or if the map fails.
+ */
+static b32 vul__sort_file_run_advance( vul__sort_file_run *run, u32 element_size, u64 window_elements )
+{
+	u64 start, length;
+
+	if( run->window.map ) {
+		vul_munmap( run->window );
+		run->window.map = NULL;
+	}
+	if( run->offset >= run->end ) {
+		return VUL_FALSE;
+	}
+	length = window_elements * element_size;
+	if( length > run->end - run->offset ) {
+		length = run->end - run->offset;
+	}
+	start = run->offset - run->offset % VUL__SORT_FILE_MAP_ALIGNMENT;
+	run->window = vul_mmap( run->path, NULL, VUL_MMAP_PROT_READ, VUL_MMAP_MAP_SHARED,
+							( size_t )start, ( size_t )( run->offset + length - start ) );
+	if( !run->window.map ) {
+		return VUL_FALSE;
+	}
+	run->current = ( u8* )run->window.map + ( run->offset - start );
+	run->last = run->current + length;
+	run->offset += length;
+	return VUL_TRUE;
+}
+
+/**
+ * Whether run a's current element must be output before run b's. Ties go to the
+ * earlier run, which keeps the merge stable.
+ */
+static b32 vul__sort_file_before( vul__sort_file_run *runs, u32 a, u32 b,
+								  s32 (*comparator)( const void *a, const void *b ) )
+{
+	s32 c;
+
+	c = comparator( runs[ a ].current, runs[ b ].current );
+	return c < 0 || ( c == 0 && a < b );
+}
+
+static void vul__sort_file_sift_down( vul__sort_file_run *runs, u32 *heap, u32 count, u32 i,
+									  s32 (*comparator)( const void *a, const void *b ) )
+{
+	u32 c, v;
+
+	v = heap[ i ];
+	while( ( c = 2 * i + 1 ) < count ) {
+		if( c + 1 < count && vul__sort_file_before( runs, heap[ c + 1 ], heap[ c ], comparator ) ) {
+			++c;
+		}
+		if( !vul__sort_file_before( runs, heap[ c ], v, comparator ) ) {
+			break;
+		}
+		heap[ i ] = heap[ c ];
+		i = c;
+	}
+	heap[ i ] = v;
+}
+
+b32 vul_sort_file( const char *input_path, const char *output_path, u32 element_size,
+				   s32 (*comparator)( const void *a, const void *b ), size_t memory_budget,
+				   void *( *allocator )( size_t size ), void ( *deallocator )( void *ptr ) )
+{
+	FILE *f, *out;
+	vul__sort_file_run input, *runs;
+	u8 *buffer, *tmp, *write, *write_end;
+	char *paths;
+	u32 *heap;
+	u32 run_count, created, i, heap_count, n;
+	u64 length, run_elements, window_elements, read;
+	size_t path_size;
+	s32 written;
+	b32 ok;
+
+	VUL_DATATYPES_CUSTOM_ASSERT( element_size > 0 );
+
+	f = fopen( input_path, "rb" );
+	if( !f ) {
+		return VUL_FALSE;
+	}
+	length = vul_file_length( f );
+	fclose( f );
+	if( length % element_size ) {
+		return VUL_FALSE;
+	}
+	out = fopen( output_path, "wb" );
+	if( !out ) {
+		return VUL_FALSE;
+	}
+	if( length == 0 ) {
+		fclose( out );
+		return VUL_TRUE;
+	}
+
+	// Phase 1: sorted runs. Half the budget holds the run, half is the merge sort's buffer.
+	run_elements = memory_budget / ( 2 * ( size_t )element_size );
+	if( run_elements == 0 ) {
+		run_elements = 1;
+	}
+	if( run_elements > 0xffffffffu ) {
+		run_elements = 0xffffffffu;
+	}
+	if( run_elements > length / element_size ) {
+		run_elements = length / element_size;
+	}
+	run_count = ( u32 )( ( length / element_size + run_elements - 1 ) / run_elements );
+	// Room for output_path, ".run" and the ten digits of a u32 run index
+	path_size = strlen( output_path ) + sizeof( ".run" ) + 10;
+	runs = ( vul__sort_file_run* )allocator( sizeof( vul__sort_file_run ) * run_count );
+	paths = ( char* )allocator( path_size * run_count );
+	buffer = ( u8* )allocator( ( size_t )run_elements * element_size * 2 );
+	VUL_DATATYPES_CUSTOM_ASSERT( runs != NULL && paths != NULL && buffer != NULL ); // Make sure allocation didn't fail
+	tmp = buffer + ( size_t )run_elements * element_size;
+
+	memset( &input, 0, sizeof( input ) );
+	input.path = input_path;
+	input.end = length;
+	ok = VUL_TRUE;
+	created = 0;
+	for( i = 0; i < run_count && ok; ++i ) {
+		ok = vul__sort_file_run_advance( &input, element_size, run_elements );
+		if( !ok ) {
+			break;
+		}
+		read = ( u64 )( input.last - input.current );
+		n = ( u32 )( read / element_size );
+		memcpy( buffer, input.current, ( size_t )read );
+		vul__sort_merge( buffer, tmp, n, element_size, comparator );
+		if( run_count == 1 ) {
+			// Everything fit in one run, so it is the output
+			ok = fwrite( buffer, element_size, n, out ) == n;
+			break;
+		}
+		memset( &runs[ i ], 0, sizeof( vul__sort_file_run ) );
+		runs[ i ].path = paths + path_size * i;
+		written = snprintf( paths + path_size * i, path_size, "%s.run%u", output_path, i );
+		if( written < 0 || ( size_t )written >= path_size ) {
+			ok = VUL_FALSE; // The run file name did not fit
+			break;
+		}
+		runs[ i ].end = read;
+		created = i + 1;
+		f = fopen( runs[ i ].path, "wb" );
+		ok = f && fwrite( buffer, element_size, n, f ) == n;
+		if( f ) {
+			ok = fclose( f ) == 0 && ok;
+		}
+	}
+	if( input.window.map ) {
+		vul_munmap( input.window );
+	}
+	deallocator( buffer );
+	if( run_count == 1 || !ok ) {
+		ok = fclose( out ) == 0 && ok;
+		goto cleanup;
+	}
+
+	// Phase 2: k-way merge. The runs' windows and the output buffer share the budget.
+	window_elements = memory_budget / ( ( u64 )( run_count + 1 ) * element_size );
+	if( window_elements == 0 ) {
+		window_elements = 1;
+	}
+	buffer = ( u8* )allocator( ( size_t )window_elements * element_size );
+	heap = ( u32* )allocator( sizeof( u32 ) * run_count );
+	VUL_DATATYPES_CUSTOM_ASSERT( buffer != NULL && heap != NULL ); // Make sure allocation didn't fail
+	heap_count = 0;
+	for( i = 0; i < run_count && ok; ++i ) {
+		ok = vul__sort_file_run_advance( &runs[ i ], element_size, window_elements );
+		heap[ heap_count++ ] = i;
+	}
+	for( i = heap_count / 2; i > 0 && ok; --i ) {
+		vul__sort_file_sift_down( runs, heap, heap_count, i - 1, comparator );
+	}
+	write = buffer;
+	write_end = buffer + ( size_t )window_elements * element_size;
+	while( heap_count > 0 && ok ) {
+		memcpy( write, runs[ heap[ 0 ] ].current, element_size );
+		write += element_size;
+		if( write == write_end ) {
+			ok = fwrite( buffer, 1, ( size_t )( write - buffer ), out ) == ( size_t )( write - buffer );
+			write = buffer;
+		}
+		runs[ heap[ 0 ] ].current += element_size;
+		if( runs[ heap[ 0 ] ].current == runs[ heap[ 0 ] ].last
+		 && !vul__sort_file_run_advance( &runs[ heap[ 0 ] ], element_size, window_elements ) ) {
+			if( runs[ heap[ 0 ] ].offset < runs[ heap[ 0 ] ].end ) {
+				ok = VUL_FALSE; // Map failed, not the end of the run
+			}
+			heap[ 0 ] = heap[ --heap_count ];
+		}
+		vul__sort_file_sift_down( runs, heap, heap_count, 0, comparator );
+	}
+	if( ok && write != buffer ) {
+		ok = fwrite( buffer, 1, ( size_t )( write - buffer ), out ) == ( size_t )( write - buffer );
+	}
+	ok = fclose( out ) == 0 && ok;
+	deallocator( buffer );
+	deallocator( heap );
+
+cleanup:
+	for( i = 0; i < created; ++i ) {
+		if( runs[ i ].window.map ) {
+			vul_munmap( runs[ i ].window );
+		}
+		remove( runs[ i ].path );
+	}
+	deallocator( paths );
+	deallocator( runs );
+	if( !ok ) {
+		remove( output_path );
+	}
+	return ok;
+}
+
+#endif // VUL_FILE_H
+
 static s32 vul__sort_vector_check_range( vul_vector *list, s32 low, s32 high )
 {
 	return low <= high && low >= 0 && high <= ( s32 )vul_vector_size( list );
@@ -522,10 +2214,7 @@ static s32 vul__sort_gallop_left( const void *key, vul_vector *list, s32 (*compa
 
 static void vul__sort_merge_low( vul_vector *list, s32 (*comparator)( const void *a, const void *b ), s32 base1, s32 length1, s32 base2, s32 length2 )
 {
-	vul_vector *temp_list = vul_vector_create( list->element_size, length1, 
-												 list->allocator,
-												 list->deallocator,
-												 list->reallocator );
+	vul_vector *temp_list = vul_vector_create_like( list, list->element_size, length1 );
 	s32 c1, c2, dest, minG, running, count1, count2;
 
 	// Range checks
@@ -657,10 +2346,7 @@ static void vul__sort_merge_low( vul_vector *list, s32 (*comparator)( const void
 
 static void vul__sort_merge_high( vul_vector *list, s32 (*comparator)( const void *a, const void *b ), s32 base1, s32 length1, s32 base2, s32 length2 )
 {
-	vul_vector *temp_list = vul_vector_create( list->element_size, length2 + 1,
-												 list->allocator,
-												 list->deallocator,
-												 list->reallocator );
+	vul_vector *temp_list = vul_vector_create_like( list, list->element_size, length2 + 1 );
 	s32 c1, c2, dest, minG, running, count1, count2;
 
 	// Range checks
@@ -899,10 +2585,7 @@ void vul_sort_vector_thynn( vul_vector *list, s32 (*comparator)( const void *a,
 	// Setup
 	s32 n, f, run_length, min_run_length;
 	struct vul__sort_merge_stack_pair *current;
-	vul_vector *merge_stack = vul_vector_create( sizeof( struct vul__sort_merge_stack_pair ), 0,
-												 list->allocator,
-												 list->deallocator,
-												 list->reallocator );
+	vul_vector *merge_stack = vul_vector_create_like( list, sizeof( struct vul__sort_merge_stack_pair ), 0 );
 
 	// Check range
 	VUL_DATATYPES_CUSTOM_ASSERT( vul__sort_vector_check_range( list, low, high ) && "vul_sort_vector_thynn: Range check failed" );
@@ -1004,4 +2687,14 @@ void vul_sort_vector( vul_vector *list, s32 (*comparator)( const void *a, const
 }
 #endif
 
+#ifndef VUL_TYPES_H
+#undef u8
+#undef s32
+#undef u32
+#undef u64
+#undef b32
+#undef f32
+#undef f64
+#endif
+
 #endif
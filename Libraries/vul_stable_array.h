@@ -5,6 +5,14 @@
 * resize. It is implemented as an series of exponentially growing buffers
 * into which pointers will remain constant. 
 *
+* The buffers are contiguous, so vul_svector_buffer exposes them for tight loops.
+* vul_svector_soa is a structure-of-arrays variant where every field is its own
+* stable column, so scanning one field only touches that field's memory.
+*
+* If vul_thread.h is included before this file, vul_svector_iterate_parallel and
+* vul_svector_find_parallel split the buffers into chunks that a vul_task_pool
+* processes with vul_parallel_for.
+*
 * Define VUL_DEFINE in exactly one compilation unit.
 *
 * ? If public domain is not legally valid in your legal jurisdiction
@@ -61,6 +69,19 @@ typedef struct vul_svector {
    void ( *deallocator )( void *ptr );
 } vul_svector;
 
+/**
+* Structure-of-arrays stable vector. Every field is stored in its own vul_svector,
+* and all columns always have the same size.
+*/
+typedef struct vul_svector_soa {
+   u32 field_count;
+   vul_svector **columns;
+
+   /* Memory management functions */
+   void *( *allocator )( size_t size );
+   void ( *deallocator )( void *ptr );
+} vul_svector_soa;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -140,6 +161,63 @@ u32 vul_svector_size( vul_svector *vec );
 * Returns true if the vector is empty
 */
 b32 vul_svector_is_empty( vul_svector *vec );
+/**
+* Returns the start of buffer 'buffer' and, in count, how many elements of it are in use.
+*/
+void *vul_svector_buffer( vul_svector *vec, u32 buffer, u32 *count );
+
+/**
+* Create a structure-of-arrays stable vector with field_count fields of the given sizes.
+*/
+vul_svector_soa *vul_svector_soa_create( u32 field_count,
+                                         const u32 *field_sizes,
+                                         u32 buffer_base_size,
+                                         void *( *allocator )( size_t size ),
+                                         void ( *deallocator )( void *ptr ) );
+/**
+* Destroy the vector and all its columns.
+*/
+void vul_svector_soa_destroy( vul_svector_soa *soa );
+/**
+* Append an empty row to every column and return its index.
+*/
+u32 vul_svector_soa_append_empty( vul_svector_soa *soa );
+/**
+* Get field 'field' of the row at the given index.
+*/
+void *vul_svector_soa_get( vul_svector_soa *soa, u32 field, u32 index );
+/**
+* Returns the column holding the given field, f.ex. to scan it with vul_svector_buffer.
+*/
+vul_svector *vul_svector_soa_column( vul_svector_soa *soa, u32 field );
+/**
+* Removes a row, swapping the last row into it's place in every column.
+*/
+void vul_svector_soa_remove_swap( vul_svector_soa *soa, u32 index );
+/**
+* Returns the number of rows.
+*/
+u32 vul_svector_soa_size( vul_svector_soa *soa );
+
+#ifdef VUL_THREAD_H
+/**
+* Like vul_svector_iterate, but the elements are split into chunks of at most chunk_size
+* elements (never spanning two buffers) that the pool's workers and the calling thread
+* process in parallel. A NULL pool runs every chunk on the calling thread. func must be
+* safe to call concurrently; the order in which elements are visited is undefined.
+*/
+void vul_svector_iterate_parallel( vul_svector *vec,
+                                   void( *func )( void *data, u32 index, void *func_data ),
+                                   void *func_data,
+                                   vul_task_pool *pool, u32 chunk_size );
+/**
+* Like vul_svector_find, but searches in parallel as vul_svector_iterate_parallel does.
+* Returns the match with the lowest index, same as vul_svector_find.
+*/
+void *vul_svector_find_parallel( vul_svector *vec,
+                                 void *element, s32( *comparator )( void *a, void *b ),
+                                 vul_task_pool *pool, u32 chunk_size );
+#endif
 #ifdef __cplusplus
 }
 #endif
@@ -217,6 +295,21 @@ void vul_svector_freemem( vul_svector *vec )
    vec->size = 0;
 }
 
+/**
+ * Returns the number of elements buffer bi holds, base_size^( bi + 1 ). Integer
+ * arithmetic, since a float power rounds once buffers get large.
+ */
+static u32 vul__svector_buffer_size( u32 base_size, u32 bi )
+{
+   u32 size;
+
+   size = base_size;
+   while( bi-- ) {
+      size *= base_size;
+   }
+   return size;
+}
+
 static u32 vul__stable_vector_calculate_buffer_index( u32 base_size, u32 i )
 {
    u32 bi, base;
@@ -224,7 +317,7 @@ static u32 vul__stable_vector_calculate_buffer_index( u32 base_size, u32 i )
    base = base_size;
    bi = 0;
    while( base <= i ) {
-      base += ( u32 )pow( ( f32 )base_size, ( s32 )++bi + 1 );
+      base += vul__svector_buffer_size( base_size, ++bi );
    }
 
    return bi;
@@ -237,7 +330,7 @@ static u32 vul__stable_vector_calculate_relative_index( u32 base_size, u32 bi, u
    accumulated_base = 0;
    base = 0;
    while( base < bi ) {
-      accumulated_base += ( u32 )pow( ( f32 )base_size, ( s32 )base + 1 );
+      accumulated_base += vul__svector_buffer_size( base_size, base );
       ++base;
    }
    return i - accumulated_base;
@@ -264,8 +357,7 @@ void *vul_svector_append_empty( vul_svector *vec )
    }
    // Make sure the buffer exists
    if( !vec->buffers[ bi ] ) {
-      vec->buffers[ bi ] = vec->allocator( ( u32 )pow( ( f32 )vec->buffer_base_size,
-         ( s32 )bi + 1 ) * vec->element_size );
+      vec->buffers[ bi ] = vec->allocator( vul__svector_buffer_size( vec->buffer_base_size, bi ) * vec->element_size );
    }
    VUL_DATATYPES_CUSTOM_ASSERT( vec->buffers[ bi ] ); // This should always be valid at this point!
 
@@ -368,7 +460,7 @@ void vul_svector_iterate( vul_svector *vec,
 
    ai = 0;
    for( bi = 0; bi < vec->buffer_count; ++bi ) {
-      bs = ( u32 )pow( ( f32 )vec->buffer_base_size, ( s32 )bi + 1 );
+      bs = vul__svector_buffer_size( vec->buffer_base_size, bi );
       for( i = 0; i < bs && ai < vec->size; ++i, ++ai ) {
 #ifdef VUL_DEBUG
          void *addr = vec->buffers[ bi ];
@@ -391,8 +483,8 @@ void *vul_svector_find( vul_svector *vec,
 
    ai = 0;
    for( bi = 0; bi < vec->buffer_count; ++bi ) {
-      bs = ( u32 )pow( ( f32 )vec->buffer_base_size, ( s32 )bi + 1 );
-      for( i = 0; i < bs; ++i, ++ai ) {
+      bs = vul__svector_buffer_size( vec->buffer_base_size, bi );
+      for( i = 0; i < bs && ai < vec->size; ++i, ++ai ) {
          current = ( void* )( ( u8* )vec->buffers[ bi ] + ( vec->element_size * i ) );
          if( comparator( element, current ) == 0 ) {
             return current;
@@ -414,6 +506,281 @@ b32 vul_svector_is_empty( vul_svector *vec )
    return vec->size == 0;
 }
 
+void *vul_svector_buffer( vul_svector *vec, u32 buffer, u32 *count )
+{
+   u32 first, bs, bi;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( vec );
+   VUL_DATATYPES_CUSTOM_ASSERT( buffer < vec->buffer_count );
+
+   first = 0;
+   for( bi = 0; bi < buffer; ++bi ) {
+      first += vul__svector_buffer_size( vec->buffer_base_size, bi );
+   }
+   bs = vul__svector_buffer_size( vec->buffer_base_size, buffer );
+   if( count ) {
+      *count = vec->size <= first ? 0 : vec->size - first < bs ? vec->size - first : bs;
+   }
+   return vec->buffers[ buffer ];
+}
+
+vul_svector_soa *vul_svector_soa_create( u32 field_count,
+                                         const u32 *field_sizes,
+                                         u32 buffer_base_size,
+                                         void *( *allocator )( size_t size ),
+                                         void ( *deallocator )( void *ptr ) )
+{
+   vul_svector_soa *ret;
+   u32 i;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( field_count > 0 );
+
+   ret = ( vul_svector_soa* )allocator( sizeof( vul_svector_soa ) );
+   VUL_DATATYPES_CUSTOM_ASSERT( ret );
+   ret->columns = ( vul_svector** )allocator( sizeof( vul_svector* ) * field_count );
+   VUL_DATATYPES_CUSTOM_ASSERT( ret->columns );
+   ret->field_count = field_count;
+   for( i = 0; i < field_count; ++i ) {
+      ret->columns[ i ] = vul_svector_create( field_sizes[ i ], buffer_base_size, allocator, deallocator );
+   }
+   ret->allocator = allocator;
+   ret->deallocator = deallocator;
+
+   return ret;
+}
+
+void vul_svector_soa_destroy( vul_svector_soa *soa )
+{
+   u32 i;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( soa );
+   for( i = 0; i < soa->field_count; ++i ) {
+      vul_svector_destroy( soa->columns[ i ] );
+   }
+   soa->deallocator( soa->columns );
+   soa->deallocator( soa );
+}
+
+u32 vul_svector_soa_append_empty( vul_svector_soa *soa )
+{
+   u32 i;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( soa );
+   for( i = 0; i < soa->field_count; ++i ) {
+      vul_svector_append_empty( soa->columns[ i ] );
+   }
+   return soa->columns[ 0 ]->size - 1;
+}
+
+void *vul_svector_soa_get( vul_svector_soa *soa, u32 field, u32 index )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( soa );
+   VUL_DATATYPES_CUSTOM_ASSERT( field < soa->field_count );
+   return vul_svector_get( soa->columns[ field ], index );
+}
+
+vul_svector *vul_svector_soa_column( vul_svector_soa *soa, u32 field )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( soa );
+   VUL_DATATYPES_CUSTOM_ASSERT( field < soa->field_count );
+   return soa->columns[ field ];
+}
+
+void vul_svector_soa_remove_swap( vul_svector_soa *soa, u32 index )
+{
+   u32 i;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( soa );
+   for( i = 0; i < soa->field_count; ++i ) {
+      vul_svector_remove_swap( soa->columns[ i ], index );
+   }
+}
+
+u32 vul_svector_soa_size( vul_svector_soa *soa )
+{
+   VUL_DATATYPES_CUSTOM_ASSERT( soa );
+   return soa->columns[ 0 ]->size;
+}
+
+#ifdef VUL_THREAD_H
+
+/**
+ * A buffer with elements in it, as the parallel functions split it.
+ */
+typedef struct vul__svector_parallel_buffer {
+   u8 *data;
+   u32 used;        // Elements in the buffer
+   u32 index;       // Index of its first element
+   u32 first_chunk; // Number of the chunk that starts the buffer
+} vul__svector_parallel_buffer;
+
+typedef struct vul__svector_parallel_job {
+   vul_svector *vec;
+   u32 chunk_size;
+   vul__svector_parallel_buffer *buffers; // Computed once per call
+   u32 buffer_count, chunk_count;
+
+   // Iterate
+   void( *func )( void *data, u32 index, void *func_data );
+   void *func_data;
+
+   // Find
+   void *element;
+   s32( *comparator )( void *a, void *b );
+   volatile u32 found; // Lowest matching index so far, or 0xffffffff
+} vul__svector_parallel_job;
+
+/**
+ * Fills in the job's table of buffers and their chunks.
+ */
+static void vul__svector_parallel_prepare( vul__svector_parallel_job *job )
+{
+   vul__svector_parallel_buffer *b;
+   u32 bi, base, size;
+
+   job->buffer_count = 0;
+   job->chunk_count = 0;
+   job->buffers = NULL;
+   if( job->vec->buffer_count == 0 ) {
+      return;
+   }
+   job->buffers = ( vul__svector_parallel_buffer* )job->vec->allocator( sizeof( vul__svector_parallel_buffer )
+                                                                         * job->vec->buffer_count );
+   VUL_DATATYPES_CUSTOM_ASSERT( job->buffers );
+   base = 0;
+   for( bi = 0; bi < job->vec->buffer_count && base < job->vec->size; ++bi ) {
+      size = vul__svector_buffer_size( job->vec->buffer_base_size, bi );
+      b = &job->buffers[ job->buffer_count++ ];
+      b->data = ( u8* )job->vec->buffers[ bi ];
+      b->used = job->vec->size - base < size ? job->vec->size - base : size;
+      b->index = base;
+      b->first_chunk = job->chunk_count;
+      job->chunk_count += ( b->used + job->chunk_size - 1 ) / job->chunk_size;
+      base += b->used;
+   }
+}
+
+/**
+ * Maps chunk number c to its first element, the index of that and the element count.
+ * Returns false if there is no such chunk.
+ */
+static b32 vul__svector_parallel_chunk( vul__svector_parallel_job *job, u32 c,
+                                        u8 **data, u32 *count, u32 *index )
+{
+   vul__svector_parallel_buffer *b;
+   u32 lo, hi, mid, first;
+
+   if( c >= job->chunk_count ) {
+      return VUL_FALSE;
+   }
+   // The last buffer starting at or before chunk c
+   lo = 0;
+   hi = job->buffer_count;
+   while( hi - lo > 1 ) {
+      mid = lo + ( hi - lo ) / 2;
+      if( job->buffers[ mid ].first_chunk <= c ) {
+         lo = mid;
+      } else {
+         hi = mid;
+      }
+   }
+   b = &job->buffers[ lo ];
+   first = ( c - b->first_chunk ) * job->chunk_size;
+   *data = b->data + ( size_t )first * job->vec->element_size;
+   *count = b->used - first < job->chunk_size ? b->used - first : job->chunk_size;
+   *index = b->index + first;
+   return VUL_TRUE;
+}
+
+/**
+ * vul_parallel_for body: processes chunks [ begin, end ).
+ */
+static void vul__svector_parallel_chunks( u32 begin, u32 end, void *ctx )
+{
+   vul__svector_parallel_job *job;
+   u32 c, count, index, i, found;
+   u8 *data;
+
+   job = ( vul__svector_parallel_job* )ctx;
+   for( c = begin; c < end; ++c ) {
+      if( !vul__svector_parallel_chunk( job, c, &data, &count, &index ) ) {
+         return;
+      }
+      if( job->func ) {
+         for( i = 0; i < count; ++i ) {
+            job->func( data + ( size_t )i * job->vec->element_size, index + i, job->func_data );
+         }
+      } else {
+         // Chunks after a match can't hold the lowest one
+         if( vul_atomic_load_u32( &job->found ) < index ) {
+            return;
+         }
+         for( i = 0; i < count; ++i ) {
+            if( job->comparator( job->element, data + ( size_t )i * job->vec->element_size ) == 0 ) {
+               found = vul_atomic_load_u32( &job->found );
+               while( index + i < found && !vul_atomic_cas_u32( &job->found, found, index + i ) ) {
+                  found = vul_atomic_load_u32( &job->found );
+               }
+               break;
+            }
+         }
+      }
+   }
+}
+
+static void vul__svector_parallel_run( vul__svector_parallel_job *job, vul_task_pool *pool )
+{
+   vul__svector_parallel_prepare( job );
+   if( pool == NULL || job->chunk_count <= 1 ) {
+      vul__svector_parallel_chunks( 0, job->chunk_count, job );
+   } else {
+      vul_parallel_for( pool, 0, job->chunk_count, 1, vul__svector_parallel_chunks, job );
+   }
+   if( job->buffers ) {
+      job->vec->deallocator( job->buffers );
+   }
+}
+
+void vul_svector_iterate_parallel( vul_svector *vec,
+                                   void( *func )( void *data, u32 index, void *func_data ),
+                                   void *func_data,
+                                   vul_task_pool *pool, u32 chunk_size )
+{
+   vul__svector_parallel_job job;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( vec );
+   VUL_DATATYPES_CUSTOM_ASSERT( chunk_size > 0 );
+
+   memset( &job, 0, sizeof( job ) );
+   job.vec = vec;
+   job.chunk_size = chunk_size;
+   job.func = func;
+   job.func_data = func_data;
+   vul__svector_parallel_run( &job, pool );
+}
+
+void *vul_svector_find_parallel( vul_svector *vec,
+                                 void *element, s32( *comparator )( void *a, void *b ),
+                                 vul_task_pool *pool, u32 chunk_size )
+{
+   vul__svector_parallel_job job;
+
+   VUL_DATATYPES_CUSTOM_ASSERT( vec );
+   VUL_DATATYPES_CUSTOM_ASSERT( chunk_size > 0 );
+
+   memset( &job, 0, sizeof( job ) );
+   job.vec = vec;
+   job.chunk_size = chunk_size;
+   job.element = element;
+   job.comparator = comparator;
+   job.found = 0xffffffff;
+   vul__svector_parallel_run( &job, pool );
+
+   return job.found == 0xffffffff ? NULL : vul_svector_get( vec, job.found );
+}
+
+#endif // VUL_THREAD_H
+
 #ifdef __cplusplus
 }
 #endif
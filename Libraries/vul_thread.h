@@ -2,7 +2,9 @@
  * Villains' Utility Library - Thomas Martin Schmid, 2017. Public domain¹
  *
  * This file contains an OS agnostic thread/mutex wrapper for when you want
- * to avoid the C++ stdlib
+ * to avoid the C++ stdlib (with thread naming, affinity and NUMA placement),
+ * blocking primitives (condition variables, semaphores, barriers, events) and
+ * a work-stealing task pool on top of it.
  *
  * To use, define VUL_DEFINE in exacly _one_ C/CPP compilation unit before including 
  * this file.
@@ -21,11 +23,24 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #if defined( VUL_WINDOWS )
 	#include <windows.h>
+	#ifdef _MSC_VER
+		#pragma comment( lib, "Synchronization.lib" ) // WaitOnAddress
+	#endif
 #elif defined( VUL_LINUX ) || defined( VUL_OSX )
    #include <pthread.h>
+   #include <sched.h>
+   #include <time.h>
+   #include <unistd.h>
+   #include <sys/mman.h>
+   #ifdef VUL_LINUX
+      #include <linux/futex.h>
+      #include <sys/prctl.h>
+      #include <sys/syscall.h>
+   #endif
 #else
    #error "vul_thread.h: Unknown OS"
 #endif
@@ -60,13 +75,118 @@ typedef void *( *vul_thread_func )( void * );
 #else
    #error "vul_thread.h: Unknown OS"
 #endif
-// @TODO(thynn): Condition variables, events
+
+/**
+ * Condition variable, usable with any vul_mutex. A sequence number that waiters
+ * sleep on and signals bump.
+ */
+typedef struct vul_condition {
+   volatile u32 sequence;
+} vul_condition;
+
+/**
+ * Counting semaphore.
+ */
+typedef struct vul_semaphore {
+   volatile u32 count;
+   volatile u32 waiters;
+} vul_semaphore;
+
+/**
+ * Reusable barrier for a fixed number of threads.
+ */
+typedef struct vul_barrier {
+   volatile u32 count;
+   volatile u32 generation;
+   u32 threshold;
+} vul_barrier;
+
+/**
+ * Manual reset event. Once set, all current and future waiters pass until it is reset.
+ */
+typedef struct vul_event {
+   volatile u32 state;
+} vul_event;
+
+/**
+ * Contention counters of a lock. Read them with the lock's stats function; they are
+ * only approximate while the lock is in use.
+ */
+typedef struct vul_lock_stats {
+   u64 acquisitions;
+   u64 contended;       // Acquisitions that did not succeed on the first try
+   u64 parks;           // Times a thread went to sleep waiting for the lock
+} vul_lock_stats;
+
+/**
+ * A mutex for short critical sections. Spins with bounded exponential backoff before
+ * sleeping on a futex, and adapts how long it spins to how long it recently took to
+ * get the lock. Not recursive.
+ */
+typedef struct vul_adaptive_mutex {
+   volatile u32 state;  // 0 unlocked, 1 locked, 2 locked and maybe sleepers
+   volatile u32 spin_estimate; // Written only with the lock held
+   vul_lock_stats stats; // Written only with the lock held
+} vul_adaptive_mutex;
+
+/**
+ * Number of reader slots of a vul_rwlock. Readers on different slots don't share
+ * cache lines, so read locking scales with the number of cores.
+ */
+#ifndef VUL_RWLOCK_SLOTS
+#define VUL_RWLOCK_SLOTS 8
+#endif
+
+// One cache line; vul_rwlock_initialize places the slots on a 64-byte boundary
+typedef struct vul__rwlock_slot {
+   volatile u32 readers;
+   volatile u64 acquisitions;
+   u8 pad[ 48 ];
+} vul__rwlock_slot;
+
+/**
+ * Reader-writer lock for read-mostly data. Readers only touch their own slot (picked
+ * per thread) unless a writer is active, so read locking does not bounce a shared cache
+ * line between cores. Writers are expensive: they take the writer flag and wait for
+ * every slot to drain. Writers have priority, so readers can't starve them.
+ */
+typedef struct vul_rwlock {
+   vul__rwlock_slot *slots;   // VUL_RWLOCK_SLOTS slots at the first cache line boundary in slot_memory
+   u8 slot_memory[ ( VUL_RWLOCK_SLOTS + 1 ) * sizeof( vul__rwlock_slot ) ];
+   volatile u32 writer;
+   volatile u32 wake;         // Bumped to wake parked threads
+   volatile u32 waiters;
+   volatile u64 read_contended;
+   volatile u64 read_parks;
+   u64 write_acquisitions;    // Written only with the writer flag held
+   u64 write_contended;       // Written only with the writer flag held
+   volatile u64 write_parks;
+} vul_rwlock;
+
+/**
+ * Largest number of logical processors a vul_cpu_set can describe.
+ */
+#ifndef VUL_THREAD_MAX_CPUS
+#define VUL_THREAD_MAX_CPUS 256
+#endif
+
+/**
+ * A set of logical processors, used for thread affinity. Build with vul_cpu_set_clear
+ * and vul_cpu_set_add; an empty set means "no affinity".
+ */
+typedef struct vul_cpu_set {
+   u64 bits[ ( VUL_THREAD_MAX_CPUS + 63 ) / 64 ];
+} vul_cpu_set;
 
 typedef struct vul_thread_attributes {
    size_t stack_size;
    b32 create_suspended,  // @TODO(thynn): Can we do this with pthreads?
        stack_size_reserve_not_commit;
    // @TODO(thynn): Security settings on windows?
+   const char *name;      // Shown in debuggers and profilers. May be NULL. Copied.
+   vul_cpu_set affinity;  // Processors the thread may run on. Empty for any.
+   b32 pin_to_numa_node;  // If set, run on and prefer memory from numa_node
+   u32 numa_node;
 } vul_thread_attributes;
 
 #ifdef __cplusplus
@@ -83,10 +203,410 @@ vul_thread vul_thread_create( vul_thread_attributes attr,
 
 void vul_thread_join( vul_thread t, void **ret );
 
-inline vul_mutex vul_mutex_create( b32 owned_initially, const char *name );
-inline void vul_mutex_destroy( vul_mutex *m );
-inline void vul_mutex_wait_and_lock( vul_mutex *m );
-inline void vul_mutex_release( vul_mutex *m );
+vul_mutex vul_mutex_create( b32 owned_initially, const char *name );
+void vul_mutex_destroy( vul_mutex *m );
+void vul_mutex_wait_and_lock( vul_mutex *m );
+void vul_mutex_release( vul_mutex *m );
+
+u64 vul_gettid( );
+u64 vul_getpid( );
+
+//-----------------
+// Placement
+//
+// Affinity and NUMA placement are honoured on Linux and Windows (only the first
+// 64 processors there, i.e. processor group 0). On OSX there is no affinity API,
+// so they are ignored. Names are truncated to 15 characters on Linux.
+//
+
+void vul_cpu_set_clear( vul_cpu_set *set );
+void vul_cpu_set_add( vul_cpu_set *set, u32 cpu );
+b32 vul_cpu_set_contains( const vul_cpu_set *set, u32 cpu );
+u32 vul_cpu_set_count( const vul_cpu_set *set );
+
+/**
+ * Names the calling thread.
+ */
+void vul_thread_set_name( const char *name );
+/**
+ * Restricts the calling thread to the given processors. Returns false if the OS
+ * refused (or can't do it).
+ */
+b32 vul_thread_set_affinity( const vul_cpu_set *set );
+
+/**
+ * Number of NUMA nodes, 1 if the machine (or OS) isn't NUMA.
+ */
+u32 vul_numa_node_count( );
+/**
+ * Fills out with the processors of the given node. Returns false if the node is
+ * unknown, in which case out is empty.
+ */
+b32 vul_numa_node_cpus( u32 node, vul_cpu_set *out );
+/**
+ * Allocates size bytes (rounded up to pages) backed by memory on the given node.
+ * Falls back to ordinary page allocation, first touched by whoever writes it,
+ * where the OS can't bind memory. Free with vul_numa_free.
+ */
+void *vul_numa_alloc( size_t size, u32 node );
+void vul_numa_free( void *ptr, size_t size );
+
+//-----------------
+// Blocking primitives
+//
+// All of these are built on vul_futex_wait/vul_futex_wake: a futex on Linux,
+// WaitOnAddress on Windows (8 and later), and a small table of hashed
+// mutex/condition variable pairs elsewhere. Blocked threads use no CPU, and
+// nothing here needs destroying beyond what the destroy functions document.
+//
+
+/**
+ * Blocks while *address == expected, until woken by vul_futex_wake. May return
+ * spuriously, so always recheck the condition in a loop.
+ */
+void vul_futex_wait( volatile u32 *address, u32 expected );
+/**
+ * Wakes up to count threads blocked on address; 0xffffffff wakes them all. Change the
+ * value at address before waking, or the waiters may go back to sleep.
+ */
+void vul_futex_wake( volatile u32 *address, u32 count );
+
+vul_condition vul_condition_create( );
+void vul_condition_destroy( vul_condition *c );
+/**
+ * Releases the mutex, blocks until signaled, and locks the mutex again. Wakeups may
+ * be spurious; wait in a loop that checks the predicate.
+ */
+void vul_condition_wait( vul_condition *c, vul_mutex *m );
+void vul_condition_signal( vul_condition *c );
+void vul_condition_broadcast( vul_condition *c );
+
+vul_semaphore vul_semaphore_create( u32 initial_count );
+void vul_semaphore_destroy( vul_semaphore *s );
+/**
+ * Decrements the count, blocking while it is zero.
+ */
+void vul_semaphore_wait( vul_semaphore *s );
+/**
+ * Decrements the count if it is not zero. Returns whether it did.
+ */
+b32 vul_semaphore_try_wait( vul_semaphore *s );
+/**
+ * Increments the count by count, waking as many waiters.
+ */
+void vul_semaphore_post( vul_semaphore *s, u32 count );
+
+/**
+ * Creates a barrier for thread_count threads.
+ */
+vul_barrier vul_barrier_create( u32 thread_count );
+void vul_barrier_destroy( vul_barrier *b );
+/**
+ * Blocks until thread_count threads have called it, then releases them all and resets
+ * for the next round. Returns true in exactly one of the threads (the last to arrive).
+ */
+b32 vul_barrier_wait( vul_barrier *b );
+
+vul_event vul_event_create( b32 set );
+void vul_event_destroy( vul_event *e );
+void vul_event_set( vul_event *e );
+void vul_event_reset( vul_event *e );
+b32 vul_event_is_set( vul_event *e );
+/**
+ * Blocks until the event is set.
+ */
+void vul_event_wait( vul_event *e );
+
+//-----------------
+// Adaptive locks
+//
+
+/**
+ * Spin attempts bounds of vul_adaptive_mutex, and the cap on the number of pauses
+ * between two attempts; the pauses double from 1 up to it.
+ */
+#ifndef VUL_MUTEX_SPIN_MAX
+#define VUL_MUTEX_SPIN_MAX 128
+#endif
+#ifndef VUL_MUTEX_BACKOFF_MAX
+#define VUL_MUTEX_BACKOFF_MAX 64
+#endif
+
+vul_adaptive_mutex vul_adaptive_mutex_create( );
+void vul_adaptive_mutex_destroy( vul_adaptive_mutex *m );
+void vul_adaptive_mutex_lock( vul_adaptive_mutex *m );
+b32 vul_adaptive_mutex_try_lock( vul_adaptive_mutex *m );
+void vul_adaptive_mutex_unlock( vul_adaptive_mutex *m );
+void vul_adaptive_mutex_stats( vul_adaptive_mutex *m, vul_lock_stats *stats );
+void vul_adaptive_mutex_reset_stats( vul_adaptive_mutex *m );
+
+/**
+ * Initializes a reader-writer lock in place. It is large (VUL_RWLOCK_SLOTS cache
+ * lines), so it is not returned by value like the other primitives. The lock points
+ * into itself, so it must not be moved or copied once initialized.
+ */
+void vul_rwlock_initialize( vul_rwlock *l );
+void vul_rwlock_destroy( vul_rwlock *l );
+void vul_rwlock_read_lock( vul_rwlock *l );
+void vul_rwlock_read_unlock( vul_rwlock *l );
+void vul_rwlock_write_lock( vul_rwlock *l );
+void vul_rwlock_write_unlock( vul_rwlock *l );
+void vul_rwlock_stats( vul_rwlock *l, vul_lock_stats *reads, vul_lock_stats *writes );
+void vul_rwlock_reset_stats( vul_rwlock *l );
+
+//-----------------
+// Atomics
+//
+// Thin wrappers around the compiler intrinsics, for lock-free data structures.
+// All operations are sequentially consistent. The add and exchange functions
+// return the previous value, the cas functions return true if the swap happened.
+//
+
+#if defined( _MSC_VER )
+   #define VUL_THREAD_LOCAL __declspec( thread )
+#else
+   #define VUL_THREAD_LOCAL __thread
+#endif
+
+#if defined( _MSC_VER )
+
+static inline u32 vul_atomic_load_u32( volatile u32 *p ) { return ( u32 )InterlockedOr( ( volatile LONG* )p, 0 ); }
+static inline void vul_atomic_store_u32( volatile u32 *p, u32 v ) { InterlockedExchange( ( volatile LONG* )p, ( LONG )v ); }
+static inline u32 vul_atomic_add_u32( volatile u32 *p, u32 v ) { return ( u32 )InterlockedExchangeAdd( ( volatile LONG* )p, ( LONG )v ); }
+static inline u32 vul_atomic_exchange_u32( volatile u32 *p, u32 v ) { return ( u32 )InterlockedExchange( ( volatile LONG* )p, ( LONG )v ); }
+static inline b32 vul_atomic_cas_u32( volatile u32 *p, u32 expected, u32 desired )
+{
+   return ( u32 )InterlockedCompareExchange( ( volatile LONG* )p, ( LONG )desired, ( LONG )expected ) == expected;
+}
+static inline u64 vul_atomic_load_u64( volatile u64 *p ) { return ( u64 )InterlockedOr64( ( volatile LONG64* )p, 0 ); }
+static inline void vul_atomic_store_u64( volatile u64 *p, u64 v ) { InterlockedExchange64( ( volatile LONG64* )p, ( LONG64 )v ); }
+static inline u64 vul_atomic_add_u64( volatile u64 *p, u64 v ) { return ( u64 )InterlockedExchangeAdd64( ( volatile LONG64* )p, ( LONG64 )v ); }
+static inline u64 vul_atomic_exchange_u64( volatile u64 *p, u64 v ) { return ( u64 )InterlockedExchange64( ( volatile LONG64* )p, ( LONG64 )v ); }
+static inline b32 vul_atomic_cas_u64( volatile u64 *p, u64 expected, u64 desired )
+{
+   return ( u64 )InterlockedCompareExchange64( ( volatile LONG64* )p, ( LONG64 )desired, ( LONG64 )expected ) == expected;
+}
+static inline void *vul_atomic_load_ptr( void *volatile *p ) { return InterlockedCompareExchangePointer( p, NULL, NULL ); }
+static inline void vul_atomic_store_ptr( void *volatile *p, void *v ) { InterlockedExchangePointer( p, v ); }
+static inline void *vul_atomic_exchange_ptr( void *volatile *p, void *v ) { return InterlockedExchangePointer( p, v ); }
+static inline b32 vul_atomic_cas_ptr( void *volatile *p, void *expected, void *desired )
+{
+   return InterlockedCompareExchangePointer( p, desired, expected ) == expected;
+}
+static inline void vul_atomic_fence( ) { MemoryBarrier( ); }
+static inline void vul_cpu_relax( ) { YieldProcessor( ); }
+
+#else
+
+static inline u32 vul_atomic_load_u32( volatile u32 *p ) { return __atomic_load_n( p, __ATOMIC_SEQ_CST ); }
+static inline void vul_atomic_store_u32( volatile u32 *p, u32 v ) { __atomic_store_n( p, v, __ATOMIC_SEQ_CST ); }
+static inline u32 vul_atomic_add_u32( volatile u32 *p, u32 v ) { return __atomic_fetch_add( p, v, __ATOMIC_SEQ_CST ); }
+static inline u32 vul_atomic_exchange_u32( volatile u32 *p, u32 v ) { return __atomic_exchange_n( p, v, __ATOMIC_SEQ_CST ); }
+static inline b32 vul_atomic_cas_u32( volatile u32 *p, u32 expected, u32 desired )
+{
+   return __atomic_compare_exchange_n( p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+static inline u64 vul_atomic_load_u64( volatile u64 *p ) { return __atomic_load_n( p, __ATOMIC_SEQ_CST ); }
+static inline void vul_atomic_store_u64( volatile u64 *p, u64 v ) { __atomic_store_n( p, v, __ATOMIC_SEQ_CST ); }
+static inline u64 vul_atomic_add_u64( volatile u64 *p, u64 v ) { return __atomic_fetch_add( p, v, __ATOMIC_SEQ_CST ); }
+static inline u64 vul_atomic_exchange_u64( volatile u64 *p, u64 v ) { return __atomic_exchange_n( p, v, __ATOMIC_SEQ_CST ); }
+static inline b32 vul_atomic_cas_u64( volatile u64 *p, u64 expected, u64 desired )
+{
+   return __atomic_compare_exchange_n( p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+static inline void *vul_atomic_load_ptr( void *volatile *p ) { return __atomic_load_n( p, __ATOMIC_SEQ_CST ); }
+static inline void vul_atomic_store_ptr( void *volatile *p, void *v ) { __atomic_store_n( p, v, __ATOMIC_SEQ_CST ); }
+static inline void *vul_atomic_exchange_ptr( void *volatile *p, void *v ) { return __atomic_exchange_n( p, v, __ATOMIC_SEQ_CST ); }
+static inline b32 vul_atomic_cas_ptr( void *volatile *p, void *expected, void *desired )
+{
+   return __atomic_compare_exchange_n( p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+static inline void vul_atomic_fence( ) { __atomic_thread_fence( __ATOMIC_SEQ_CST ); }
+static inline void vul_cpu_relax( )
+{
+#if defined( __i386__ ) || defined( __x86_64__ )
+   __builtin_ia32_pause( );
+#elif defined( __arm__ ) || defined( __aarch64__ )
+   __asm__ __volatile__( "yield" );
+#endif
+}
+
+#endif
+
+//-----------------
+// Task pool
+//
+// A persistent pool of worker threads, each with its own Chase-Lev deque. Tasks
+// submitted from a worker (including continuations released by a finishing task)
+// go on that worker's deque and run LIFO, for locality; idle workers steal FIFO from
+// the others. Tasks submitted from other threads go through a shared queue. Workers
+// that find no work sleep until more is submitted.
+//
+// Tasks are caller-owned: initialize a vul_task, optionally add dependencies on
+// other tasks, and submit it. It runs once all its dependencies have finished.
+// A task's memory must stay valid until it has finished; wait for its group.
+//
+
+/**
+ * The maximum number of tasks that can depend on a single task.
+ */
+#ifndef VUL_TASK_MAX_CONTINUATIONS
+#define VUL_TASK_MAX_CONTINUATIONS 8
+#endif
+/**
+ * Capacity of each worker's deque. Must be a power of two. If a worker's deque is
+ * full, tasks it submits go through the shared queue instead.
+ */
+#ifndef VUL_TASK_DEQUE_SIZE
+#define VUL_TASK_DEQUE_SIZE 4096
+#endif
+/**
+ * Idle workers and waiting threads look for work this many times before they
+ * sleep or yield.
+ */
+#ifndef VUL_TASK_SPIN_COUNT
+#define VUL_TASK_SPIN_COUNT 64
+#endif
+
+typedef void ( *vul_task_func )( void *arg );
+
+/**
+ * Counts unfinished tasks, so a thread can wait for a batch of them.
+ */
+typedef struct vul_task_group {
+   volatile u32 pending;
+} vul_task_group;
+
+typedef struct vul_task {
+   vul_task_func func;
+   void *arg;
+   vul_task_group *group;
+   struct vul_task *next;        // Link in the pool's shared queue
+   volatile u32 dependencies;    // Unfinished dependencies, plus one until submitted
+   volatile u32 lock;            // Guards finished and the continuations
+   u32 finished;
+   u32 continuation_count;
+   struct vul_task *continuations[ VUL_TASK_MAX_CONTINUATIONS ];
+} vul_task;
+
+typedef struct vul_task_pool vul_task_pool;
+
+/**
+ * Returns the number of logical processors available.
+ */
+u32 vul_thread_processor_count( );
+
+/**
+ * Creates a pool with worker_count worker threads. If worker_count is 0, it uses one
+ * per processor, less the calling thread (which helps while it waits), but at least one.
+ * Returns NULL, with nothing left allocated or running, if an allocation or a worker
+ * thread failed.
+ */
+vul_task_pool *vul_task_pool_create( u32 worker_count,
+                                     void *( *allocator )( size_t size ),
+                                     void ( *deallocator )( void *ptr ) );
+/**
+ * As vul_task_pool_create, but pins worker i to processor i + 1 (modulo the processor
+ * count), leaving processor 0 to the creating thread. Workers then keep their caches,
+ * and memory they first touch stays on their NUMA node.
+ */
+vul_task_pool *vul_task_pool_create_pinned( u32 worker_count,
+                                            void *( *allocator )( size_t size ),
+                                            void ( *deallocator )( void *ptr ) );
+/**
+ * Runs all submitted tasks whose dependencies are met, then stops and joins the workers.
+ */
+void vul_task_pool_destroy( vul_task_pool *pool );
+u32 vul_task_pool_worker_count( vul_task_pool *pool );
+/**
+ * Returns the index of the calling worker thread in [ 0, worker_count ), or
+ * worker_count if the calling thread is not one of the pool's workers.
+ */
+u32 vul_task_pool_worker_index( vul_task_pool *pool );
+
+void vul_task_group_initialize( vul_task_group *group );
+/**
+ * Prepares a task to call func( arg ). If group is not NULL, the task counts towards it
+ * from submission until it finishes.
+ */
+void vul_task_initialize( vul_task *task, vul_task_func func, void *arg, vul_task_group *group );
+/**
+ * Makes task wait for dependency to finish; a continuation. Must be called before task
+ * is submitted. dependency may already be submitted, running or finished.
+ * Returns 0, and adds nothing, if VUL_TASK_MAX_CONTINUATIONS tasks already depend on
+ * dependency and it hasn't finished; task must then not be submitted until it has
+ * (wait for its group, say), or it may run too early.
+ */
+b32 vul_task_depends_on( vul_task *task, vul_task *dependency );
+/**
+ * Submits the task. It is scheduled as soon as all its dependencies have finished.
+ */
+void vul_task_pool_submit( vul_task_pool *pool, vul_task *task );
+/**
+ * Runs tasks until every task in the group has finished. May be called from inside a
+ * task; the waiting thread keeps working, so nested waits don't deadlock the pool.
+ * Threads that are not workers of the pool only help while not already inside a task.
+ */
+void vul_task_pool_wait( vul_task_pool *pool, vul_task_group *group );
+
+//-----------------
+// Parallel loops
+//
+// Data-parallel loops over index ranges on a task pool. The range is split in halves
+// recursively down to grain indices, with the task descriptors on the splitting
+// threads' stacks, so nothing is allocated. The calling thread works too, and the
+// loops may be nested inside tasks.
+//
+
+/**
+ * Target duration of one chunk of a parallel_for with automatic grain size, in nanoseconds.
+ */
+#ifndef VUL_PARALLEL_TARGET_NS
+#define VUL_PARALLEL_TARGET_NS 50000
+#endif
+/**
+ * Chunk size of parallel_reduce with automatic grain size. Fixed, not measured, so
+ * results are reproducible.
+ */
+#ifndef VUL_PARALLEL_REDUCE_GRAIN
+#define VUL_PARALLEL_REDUCE_GRAIN 1024
+#endif
+
+/**
+ * Processes indices [ begin, end ).
+ */
+typedef void ( *vul_parallel_for_func )( u32 begin, u32 end, void *ctx );
+/**
+ * Accumulates indices [ begin, end ) into result.
+ */
+typedef void ( *vul_parallel_reduce_func )( u32 begin, u32 end, void *ctx, void *result );
+/**
+ * Sets result to result combined with other, where other comes from the indices right
+ * after result's. Must be associative, but need not be commutative.
+ */
+typedef void ( *vul_parallel_combine_func )( void *result, const void *other, void *ctx );
+
+/**
+ * Calls func on chunks of [ begin, end ) of at most grain indices, in parallel, and
+ * returns when all are done. If grain is 0 it is picked automatically: the first
+ * chunks run on the calling thread with doubling sizes while their cost is measured,
+ * and the rest is split so each chunk takes about VUL_PARALLEL_TARGET_NS, but into at
+ * least four chunks per thread.
+ */
+void vul_parallel_for( vul_task_pool *pool, u32 begin, u32 end, u32 grain,
+                       vul_parallel_for_func func, void *ctx );
+/**
+ * Reduces [ begin, end ) into result, which holds result_size bytes. Every chunk of
+ * grain indices is reduced by func into a copy of identity, and the partial results are
+ * combined in a fixed binary tree in index order, so the result only depends on the
+ * range and the grain, never on timing or the number of workers; floating point sums
+ * come out bit identical every run. If grain is 0, VUL_PARALLEL_REDUCE_GRAIN is used.
+ * Partial results up to 64 bytes live on the stack, larger ones use the pool's allocator.
+ */
+void vul_parallel_reduce( vul_task_pool *pool, u32 begin, u32 end, u32 grain,
+                          u32 result_size, const void *identity,
+                          vul_parallel_reduce_func func, vul_parallel_combine_func combine,
+                          void *ctx, void *result );
 
 #ifdef __cplusplus
 }
@@ -128,125 +648,472 @@ inline void vul_mutex_release( vul_mutex *m );
 extern "C" {
 #endif
 
-vul_thread vul_thread_create( vul_thread_attributes attr, 
-                              vul_thread_func func,
-                              void *arg )
+//-----------------
+// Placement
+//
+
+#define VUL__THREAD_MAX_NUMA_NODES 1024
+
+void vul_cpu_set_clear( vul_cpu_set *set )
 {
-   vul_thread t;
-#ifdef VUL_WINDOWS
-   DWORD ss, flags;
-   
-   ss = ( DWORD )attr.stack_size;
-   flags = 0;
-   flags |= attr.stack_size_reserve_not_commit ? STACK_SIZE_PARAM_IS_A_RESERVATION : 0;
-   flags |= attr.create_suspended ? CREATE_SUSPENDED : 0;
-   t = CreateThread( NULL, ss,
-                     func, arg,
-                     flags, NULL ); // @TODO(thynn): Should thread ID be an optional return value?
-   if( !t ) {
-      VUL_THREAD_ERROR( "Failed to create thread: Code %d", GetLastError( ) );
-   }
-#elif defined( VUL_OSX ) || defined( VUL_LINUX )
-   int r;
-   pthread_attr_t pattr;
+   memset( set, 0, sizeof( vul_cpu_set ) );
+}
 
-   pthread_attr_init( &pattr );
-   if( attr.stack_size ) {
-      pthread_attr_setstacksize( &pattr, attr.stack_size );
-   }
-   r = pthread_create( &t, &pattr, func, arg );
-   pthread_attr_destroy( &pattr );
-   if( r ) {
-      VUL_THREAD_ERROR( "Failed to create thread: Code %d", r );
+void vul_cpu_set_add( vul_cpu_set *set, u32 cpu )
+{
+   if( cpu < VUL_THREAD_MAX_CPUS ) {
+      set->bits[ cpu / 64 ] |= 1ull << ( cpu % 64 );
    }
-#else
-   #error "vul_thread.h: Unknown OS"
-#endif
-   return t;
 }
 
-void vul_thread_join( vul_thread t, void **ret )
+b32 vul_cpu_set_contains( const vul_cpu_set *set, u32 cpu )
+{
+   return cpu < VUL_THREAD_MAX_CPUS && ( set->bits[ cpu / 64 ] >> ( cpu % 64 ) ) & 1;
+}
+
+u32 vul_cpu_set_count( const vul_cpu_set *set )
 {
+   u32 i, n;
+   u64 b;
+
+   n = 0;
+   for( i = 0; i < sizeof( set->bits ) / sizeof( set->bits[ 0 ] ); ++i ) {
+      for( b = set->bits[ i ]; b; b &= b - 1 ) {
+         ++n;
+      }
+   }
+   return n;
+}
+
 #ifdef VUL_WINDOWS
-   DWORD r;
-   BOOL s;
-   
-   r = WaitForSingleObject( t, INFINITE );
-   if( r == WAIT_FAILED ) {
-      VUL_THREAD_ERROR( "Could not join thread. Code %d", GetLastError( ) );
+// SetThreadDescription is Windows 10 1607 and later, so look it up rather than link it
+static void vul__thread_set_name_windows( HANDLE t, const char *name )
+{
+   typedef HRESULT ( WINAPI *set_description )( HANDLE, PCWSTR );
+   set_description f;
+   WCHAR wide[ 64 ];
+
+   f = ( set_description )GetProcAddress( GetModuleHandleA( "kernel32.dll" ), "SetThreadDescription" );
+   if( f && MultiByteToWideChar( CP_UTF8, 0, name, -1, wide, 64 ) ) {
+      wide[ 63 ] = 0;
+      f( t, wide );
    }
-   if( ret ) {
-      s = GetExitCodeThread( t, &r );
-      if( !s ) {
-         VUL_THREAD_ERROR( "Could not retrieve thread exit code. Error code %d", 
-                           GetLastError( ) );
+}
+#elif defined( VUL_LINUX )
+/**
+ * Reads a sysfs list like "0-3,8,10-11" into set. Returns false if the file can't be read.
+ */
+static b32 vul__thread_read_list( const char *path, vul_cpu_set *set )
+{
+   FILE *f;
+   char buf[ 1024 ], *c, *end;
+   unsigned long first, last;
+
+   vul_cpu_set_clear( set );
+   f = fopen( path, "r" );
+   if( !f ) {
+      return 0;
+   }
+   c = fgets( buf, sizeof( buf ), f );
+   fclose( f );
+   if( !c ) {
+      return 0;
+   }
+   while( *c >= '0' && *c <= '9' ) {
+      first = strtoul( c, &end, 10 );
+      last = first;
+      c = end;
+      if( *c == '-' ) {
+         last = strtoul( c + 1, &end, 10 );
+         c = end;
+      }
+      for( ; first <= last && first < VUL_THREAD_MAX_CPUS; ++first ) {
+         vul_cpu_set_add( set, ( u32 )first );
+      }
+      if( *c == ',' ) {
+         ++c;
       }
-      **( ( DWORD** )ret ) = r;
    }
-#elif defined( VUL_OSX ) || defined( VUL_LINUX )
-   int r;
+   return 1;
+}
+#endif
 
-   r = pthread_join( t, ret );
-   if( r ) {
-      VUL_THREAD_ERROR( "Could not join thread. Code %d", r );
+/**
+ * Makes the calling thread's future page faults prefer memory on the given node.
+ */
+static void vul__thread_prefer_numa_node( u32 node )
+{
+#ifdef VUL_LINUX
+   unsigned long mask[ VUL__THREAD_MAX_NUMA_NODES / ( 8 * sizeof( unsigned long ) ) ];
+
+   if( node >= VUL__THREAD_MAX_NUMA_NODES ) {
+      return;
    }
+   memset( mask, 0, sizeof( mask ) );
+   mask[ node / ( 8 * sizeof( unsigned long ) ) ] = 1ul << ( node % ( 8 * sizeof( unsigned long ) ) );
+   syscall( SYS_set_mempolicy, 1 /* MPOL_PREFERRED */, mask, VUL__THREAD_MAX_NUMA_NODES );
 #else
-   #error "vul_thread.h: Unknown OS"
+   // Windows allocates from the node of the processor that faults, which affinity fixes
+   ( void )node;
 #endif
 }
 
-inline vul_mutex vul_mutex_create( b32 owned_initially, const char *name )
+void vul_thread_set_name( const char *name )
 {
-   vul_mutex m;
 #ifdef VUL_WINDOWS
-   // @TODO(thynn): Security attributes?
-   m = CreateMutex( NULL, owned_initially ? TRUE : FALSE, name );
-   if( !m ) {
-      if( name ) {
-         VUL_THREAD_ERROR( "Failed to create mutex %s, code %d\n", name, GetLastError( ) );
-      } else {
-         VUL_THREAD_ERROR( "Failed to create mutex, code %d\n", GetLastError( ) );
-      }
-   }
-#elif defined( VUL_OSX ) || defined( VUL_LINUX )
-   int r;
-   pthread_mutexattr_t attr;
+   vul__thread_set_name_windows( GetCurrentThread( ), name );
+#elif defined( VUL_LINUX )
+   char buf[ 16 ];
 
-   pthread_mutexattr_init( &attr );
-#ifdef VUL_DEBUG
-   pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_ERRORCHECK );
+   strncpy( buf, name, sizeof( buf ) - 1 );
+   buf[ sizeof( buf ) - 1 ] = 0;
+   prctl( PR_SET_NAME, buf, 0, 0, 0 );
+#elif defined( VUL_OSX )
+   pthread_setname_np( name );
 #else
-   pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_NORMAL );
+   #error "vul_thread.h: Unknown OS"
 #endif
-   r = pthread_mutex_init( &m, &attr );
-   if( r ) {
-      if( name ) {
-         VUL_THREAD_ERROR( "Failed to create mutex %s, code %d\n", name, GetLastError( ) );
-      } else {
-         VUL_THREAD_ERROR( "Failed to create mutex, code %d\n", GetLastError( ) );
-      }
-   }
+}
+
+b32 vul_thread_set_affinity( const vul_cpu_set *set )
+{
+#ifdef VUL_WINDOWS
+   return set->bits[ 0 ] && SetThreadAffinityMask( GetCurrentThread( ), ( DWORD_PTR )set->bits[ 0 ] ) != 0;
+#elif defined( VUL_LINUX )
+   return syscall( SYS_sched_setaffinity, 0, sizeof( set->bits ), set->bits ) == 0;
+#elif defined( VUL_OSX )
+   ( void )set;
+   return 0;
 #else
    #error "vul_thread.h: Unknown OS"
 #endif
-   return m;
 }
 
-inline void vul_mutex_destroy( vul_mutex *m )
+u32 vul_numa_node_count( )
 {
 #ifdef VUL_WINDOWS
-   CloseHandle( *m );
-#elif defined( VUL_OSX ) || defined( VUL_LINUX )
-   pthread_mutex_destroy( m );
+   ULONG highest;
+
+   return GetNumaHighestNodeNumber( &highest ) ? ( u32 )highest + 1 : 1;
+#elif defined( VUL_LINUX )
+   vul_cpu_set nodes;
+   u32 i, n;
+
+   n = 1;
+   if( vul__thread_read_list( "/sys/devices/system/node/online", &nodes ) ) {
+      for( i = 0; i < VUL_THREAD_MAX_CPUS; ++i ) {
+         if( vul_cpu_set_contains( &nodes, i ) ) {
+            n = i + 1;
+         }
+      }
+   }
+   return n;
+#elif defined( VUL_OSX )
+   return 1;
 #else
    #error "vul_thread.h: Unknown OS"
 #endif
 }
-inline void vul_mutex_wait_and_lock( vul_mutex *m )
+
+b32 vul_numa_node_cpus( u32 node, vul_cpu_set *out )
 {
 #ifdef VUL_WINDOWS
-   DWORD r;
-   
+   ULONGLONG mask;
+
+   vul_cpu_set_clear( out );
+   if( node > 0xff || !GetNumaNodeProcessorMask( ( UCHAR )node, &mask ) ) {
+      return 0;
+   }
+   out->bits[ 0 ] = ( u64 )mask;
+   return mask != 0;
+#elif defined( VUL_LINUX )
+   char path[ 64 ];
+   u32 i, n;
+
+   snprintf( path, sizeof( path ), "/sys/devices/system/node/node%u/cpulist", node );
+   if( vul__thread_read_list( path, out ) ) {
+      return vul_cpu_set_count( out ) != 0;
+   }
+   // No sysfs node information: the machine is a single node with every processor
+   if( node != 0 || vul_numa_node_count( ) != 1 ) {
+      return 0;
+   }
+   n = vul_thread_processor_count( );
+   for( i = 0; i < n; ++i ) {
+      vul_cpu_set_add( out, i );
+   }
+   return 1;
+#elif defined( VUL_OSX )
+   u32 i, n;
+
+   vul_cpu_set_clear( out );
+   if( node != 0 ) {
+      return 0;
+   }
+   n = vul_thread_processor_count( );
+   for( i = 0; i < n; ++i ) {
+      vul_cpu_set_add( out, i );
+   }
+   return 1;
+#else
+   #error "vul_thread.h: Unknown OS"
+#endif
+}
+
+void *vul_numa_alloc( size_t size, u32 node )
+{
+#ifdef VUL_WINDOWS
+   void *p;
+
+   p = VirtualAllocExNuma( GetCurrentProcess( ), NULL, size, MEM_RESERVE | MEM_COMMIT,
+                           PAGE_READWRITE, ( DWORD )node );
+   if( !p ) {
+      p = VirtualAlloc( NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+   }
+   return p;
+#elif defined( VUL_OSX ) || defined( VUL_LINUX )
+   void *p;
+
+   p = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+   if( p == MAP_FAILED ) {
+      return NULL;
+   }
+   #ifdef VUL_LINUX
+   {
+      // Nothing is faulted in yet, so binding now places every page. If the kernel
+      // has no NUMA support this fails and the pages go wherever they're first touched.
+      unsigned long mask[ VUL__THREAD_MAX_NUMA_NODES / ( 8 * sizeof( unsigned long ) ) ];
+      if( node < VUL__THREAD_MAX_NUMA_NODES ) {
+         memset( mask, 0, sizeof( mask ) );
+         mask[ node / ( 8 * sizeof( unsigned long ) ) ] = 1ul << ( node % ( 8 * sizeof( unsigned long ) ) );
+         syscall( SYS_mbind, p, size, 1 /* MPOL_PREFERRED */, mask, VUL__THREAD_MAX_NUMA_NODES, 0 );
+      }
+   }
+   #else
+   ( void )node;
+   #endif
+   return p;
+#else
+   #error "vul_thread.h: Unknown OS"
+#endif
+}
+
+void vul_numa_free( void *ptr, size_t size )
+{
+   if( !ptr ) {
+      return;
+   }
+#ifdef VUL_WINDOWS
+   ( void )size;
+   VirtualFree( ptr, 0, MEM_RELEASE );
+#elif defined( VUL_OSX ) || defined( VUL_LINUX )
+   munmap( ptr, size );
+#else
+   #error "vul_thread.h: Unknown OS"
+#endif
+}
+
+#if defined( VUL_OSX ) || defined( VUL_LINUX )
+// Name, affinity and memory policy can only be set from the thread itself on some
+// of the pthread platforms, so placed threads start here and apply them first.
+typedef struct vul__thread_start {
+   vul_thread_func func;
+   void *arg;
+   char name[ 64 ];
+   vul_cpu_set affinity;
+   b32 pin_to_numa_node;
+   u32 numa_node;
+} vul__thread_start;
+
+static void *vul__thread_start_placed( void *arg )
+{
+   vul__thread_start start;
+
+   start = *( vul__thread_start* )arg;
+   free( arg );
+   if( start.name[ 0 ] ) {
+      vul_thread_set_name( start.name );
+   }
+   if( vul_cpu_set_count( &start.affinity ) ) {
+      vul_thread_set_affinity( &start.affinity );
+   }
+   if( start.pin_to_numa_node ) {
+      vul__thread_prefer_numa_node( start.numa_node );
+   }
+   return start.func( start.arg );
+}
+#endif
+
+/**
+ * Creates a thread into *t, returning 0 (after reporting the error) if it failed.
+ */
+static b32 vul__thread_create( vul_thread_attributes attr, vul_thread_func func, void *arg, vul_thread *t )
+{
+#ifdef VUL_WINDOWS
+   DWORD ss, flags;
+   
+   if( attr.pin_to_numa_node && !vul_cpu_set_count( &attr.affinity ) ) {
+      vul_numa_node_cpus( attr.numa_node, &attr.affinity );
+   }
+   ss = ( DWORD )attr.stack_size;
+   flags = 0;
+   flags |= attr.stack_size_reserve_not_commit ? STACK_SIZE_PARAM_IS_A_RESERVATION : 0;
+   flags |= attr.create_suspended ? CREATE_SUSPENDED : 0;
+   *t = CreateThread( NULL, ss,
+                     func, arg,
+                     flags | CREATE_SUSPENDED, NULL ); // @TODO(thynn): Should thread ID be an optional return value?
+   if( !*t ) {
+      VUL_THREAD_ERROR( "Failed to create thread: Code %d", GetLastError( ) );
+      return 0;
+   }
+   if( attr.affinity.bits[ 0 ] ) {
+      SetThreadAffinityMask( *t, ( DWORD_PTR )attr.affinity.bits[ 0 ] );
+   }
+   if( attr.name ) {
+      vul__thread_set_name_windows( *t, attr.name );
+   }
+   if( !attr.create_suspended ) {
+      ResumeThread( *t );
+   }
+#elif defined( VUL_OSX ) || defined( VUL_LINUX )
+   int r;
+   pthread_attr_t pattr;
+   vul__thread_start *start;
+
+   pthread_attr_init( &pattr );
+   if( attr.stack_size ) {
+      pthread_attr_setstacksize( &pattr, attr.stack_size );
+   }
+   if( attr.name || attr.pin_to_numa_node || vul_cpu_set_count( &attr.affinity ) ) {
+      start = ( vul__thread_start* )malloc( sizeof( vul__thread_start ) );
+      if( !start ) {
+         pthread_attr_destroy( &pattr );
+         VUL_THREAD_ERROR( "Failed to allocate thread start parameters" );
+         return 0;
+      }
+      memset( start, 0, sizeof( vul__thread_start ) );
+      start->func = func;
+      start->arg = arg;
+      if( attr.name ) {
+         strncpy( start->name, attr.name, sizeof( start->name ) - 1 );
+      }
+      start->affinity = attr.affinity;
+      if( attr.pin_to_numa_node && !vul_cpu_set_count( &start->affinity ) ) {
+         vul_numa_node_cpus( attr.numa_node, &start->affinity );
+      }
+      start->pin_to_numa_node = attr.pin_to_numa_node;
+      start->numa_node = attr.numa_node;
+      r = pthread_create( t, &pattr, vul__thread_start_placed, start );
+      if( r ) {
+         free( start );
+      }
+   } else {
+      r = pthread_create( t, &pattr, func, arg );
+   }
+   pthread_attr_destroy( &pattr );
+   if( r ) {
+      VUL_THREAD_ERROR( "Failed to create thread: Code %d", r );
+      return 0;
+   }
+#else
+   #error "vul_thread.h: Unknown OS"
+#endif
+   return 1;
+}
+
+vul_thread vul_thread_create( vul_thread_attributes attr, 
+                              vul_thread_func func,
+                              void *arg )
+{
+   vul_thread t;
+
+   memset( &t, 0, sizeof( t ) );
+   vul__thread_create( attr, func, arg, &t );
+   return t;
+}
+
+void vul_thread_join( vul_thread t, void **ret )
+{
+#ifdef VUL_WINDOWS
+   DWORD r;
+   BOOL s;
+   
+   r = WaitForSingleObject( t, INFINITE );
+   if( r == WAIT_FAILED ) {
+      VUL_THREAD_ERROR( "Could not join thread. Code %d", GetLastError( ) );
+   }
+   if( ret ) {
+      s = GetExitCodeThread( t, &r );
+      if( !s ) {
+         VUL_THREAD_ERROR( "Could not retrieve thread exit code. Error code %d", 
+                           GetLastError( ) );
+      }
+      **( ( DWORD** )ret ) = r;
+   }
+#elif defined( VUL_OSX ) || defined( VUL_LINUX )
+   int r;
+
+   r = pthread_join( t, ret );
+   if( r ) {
+      VUL_THREAD_ERROR( "Could not join thread. Code %d", r );
+   }
+#else
+   #error "vul_thread.h: Unknown OS"
+#endif
+}
+
+vul_mutex vul_mutex_create( b32 owned_initially, const char *name )
+{
+   vul_mutex m;
+#ifdef VUL_WINDOWS
+   // @TODO(thynn): Security attributes?
+   m = CreateMutex( NULL, owned_initially ? TRUE : FALSE, name );
+   if( !m ) {
+      if( name ) {
+         VUL_THREAD_ERROR( "Failed to create mutex %s, code %d\n", name, GetLastError( ) );
+      } else {
+         VUL_THREAD_ERROR( "Failed to create mutex, code %d\n", GetLastError( ) );
+      }
+   }
+#elif defined( VUL_OSX ) || defined( VUL_LINUX )
+   int r;
+   pthread_mutexattr_t attr;
+
+   pthread_mutexattr_init( &attr );
+#ifdef VUL_DEBUG
+   pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_ERRORCHECK );
+#else
+   pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_NORMAL );
+#endif
+   r = pthread_mutex_init( &m, &attr );
+   if( r ) {
+      if( name ) {
+         VUL_THREAD_ERROR( "Failed to create mutex %s, code %d\n", name, GetLastError( ) );
+      } else {
+         VUL_THREAD_ERROR( "Failed to create mutex, code %d\n", GetLastError( ) );
+      }
+   }
+#else
+   #error "vul_thread.h: Unknown OS"
+#endif
+   return m;
+}
+
+void vul_mutex_destroy( vul_mutex *m )
+{
+#ifdef VUL_WINDOWS
+   CloseHandle( *m );
+#elif defined( VUL_OSX ) || defined( VUL_LINUX )
+   pthread_mutex_destroy( m );
+#else
+   #error "vul_thread.h: Unknown OS"
+#endif
+}
+void vul_mutex_wait_and_lock( vul_mutex *m )
+{
+#ifdef VUL_WINDOWS
+   DWORD r;
+   
    r = WaitForSingleObject( *m, INFINITE );
    if( r != WAIT_OBJECT_0 ) {
       VUL_THREAD_ERROR( "Failed to lock mutex. Code %d", GetLastError( ) );
@@ -263,7 +1130,7 @@ inline void vul_mutex_wait_and_lock( vul_mutex *m )
 #endif
 }
 
-inline void vul_mutex_release( vul_mutex *m )
+void vul_mutex_release( vul_mutex *m )
 {
 #ifdef VUL_WINDOWS
    if( !ReleaseMutex( *m ) ) {
@@ -282,7 +1149,7 @@ inline void vul_mutex_release( vul_mutex *m )
 }
 
 // @TODO(thynn): getpid + gettid for all platforms!
-inline u64 vul_gettid( )
+u64 vul_gettid( )
 {
 #ifdef VUL_WINDOWS
    // #error "vul_thread.h: Not implemented yet!"
@@ -295,7 +1162,7 @@ inline u64 vul_gettid( )
 #endif
 }
 
-inline u64 vul_getpid( )
+u64 vul_getpid( )
 {
 #ifdef VUL_WINDOWS
    // #error "vul_thread.h: Not implemented yet!"
@@ -308,6 +1175,1184 @@ inline u64 vul_getpid( )
 #endif
 }
 
+//-----------------
+// Blocking primitives
+//
+
+#if defined( VUL_OSX )
+// No public futex; park on one of a few mutex/condition pairs picked by address.
+// Waiters check the value under the pair's lock, and wakers take it to notify,
+// so a wake between the check and the wait can't be lost.
+#define VUL__FUTEX_BUCKETS 64
+
+typedef struct vul__futex_bucket {
+   pthread_mutex_t lock;
+   pthread_cond_t wake;
+} vul__futex_bucket;
+
+static vul__futex_bucket vul__futex_buckets[ VUL__FUTEX_BUCKETS ];
+static pthread_once_t vul__futex_once = PTHREAD_ONCE_INIT;
+
+static void vul__futex_initialize( )
+{
+   u32 i;
+
+   for( i = 0; i < VUL__FUTEX_BUCKETS; ++i ) {
+      pthread_mutex_init( &vul__futex_buckets[ i ].lock, NULL );
+      pthread_cond_init( &vul__futex_buckets[ i ].wake, NULL );
+   }
+}
+
+static vul__futex_bucket *vul__futex_bucket_of( volatile u32 *address )
+{
+   pthread_once( &vul__futex_once, vul__futex_initialize );
+   return &vul__futex_buckets[ ( ( uintptr_t )address >> 2 ) % VUL__FUTEX_BUCKETS ];
+}
+#endif
+
+void vul_futex_wait( volatile u32 *address, u32 expected )
+{
+#if defined( VUL_WINDOWS )
+   WaitOnAddress( address, &expected, sizeof( u32 ), INFINITE );
+#elif defined( VUL_LINUX )
+   syscall( SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0 );
+#elif defined( VUL_OSX )
+   vul__futex_bucket *b;
+
+   b = vul__futex_bucket_of( address );
+   pthread_mutex_lock( &b->lock );
+   if( vul_atomic_load_u32( address ) == expected ) {
+      pthread_cond_wait( &b->wake, &b->lock );
+   }
+   pthread_mutex_unlock( &b->lock );
+#else
+   #error "vul_thread.h: Unknown OS"
+#endif
+}
+
+void vul_futex_wake( volatile u32 *address, u32 count )
+{
+#if defined( VUL_WINDOWS )
+   if( count == 1 ) {
+      WakeByAddressSingle( ( PVOID )address );
+   } else {
+      WakeByAddressAll( ( PVOID )address );
+   }
+#elif defined( VUL_LINUX )
+   syscall( SYS_futex, address, FUTEX_WAKE_PRIVATE, count > 0x7fffffff ? 0x7fffffff : count, NULL, NULL, 0 );
+#elif defined( VUL_OSX )
+   vul__futex_bucket *b;
+
+   // Other addresses share the bucket, so waking one could wake the wrong thread
+   ( void )count;
+   b = vul__futex_bucket_of( address );
+   pthread_mutex_lock( &b->lock );
+   pthread_cond_broadcast( &b->wake );
+   pthread_mutex_unlock( &b->lock );
+#else
+   #error "vul_thread.h: Unknown OS"
+#endif
+}
+
+vul_condition vul_condition_create( )
+{
+   vul_condition c;
+
+   c.sequence = 0;
+   return c;
+}
+
+void vul_condition_destroy( vul_condition *c )
+{
+   ( void )c;
+}
+
+void vul_condition_wait( vul_condition *c, vul_mutex *m )
+{
+   u32 sequence;
+
+   // Read before unlocking: a signal after that changes it, so the wait returns at once
+   sequence = vul_atomic_load_u32( &c->sequence );
+   vul_mutex_release( m );
+   vul_futex_wait( &c->sequence, sequence );
+   vul_mutex_wait_and_lock( m );
+}
+
+void vul_condition_signal( vul_condition *c )
+{
+   vul_atomic_add_u32( &c->sequence, 1 );
+   vul_futex_wake( &c->sequence, 1 );
+}
+
+void vul_condition_broadcast( vul_condition *c )
+{
+   vul_atomic_add_u32( &c->sequence, 1 );
+   vul_futex_wake( &c->sequence, 0xffffffff );
+}
+
+vul_semaphore vul_semaphore_create( u32 initial_count )
+{
+   vul_semaphore s;
+
+   s.count = initial_count;
+   s.waiters = 0;
+   return s;
+}
+
+void vul_semaphore_destroy( vul_semaphore *s )
+{
+   ( void )s;
+}
+
+b32 vul_semaphore_try_wait( vul_semaphore *s )
+{
+   u32 c;
+
+   while( ( c = vul_atomic_load_u32( &s->count ) ) != 0 ) {
+      if( vul_atomic_cas_u32( &s->count, c, c - 1 ) ) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+void vul_semaphore_wait( vul_semaphore *s )
+{
+   while( !vul_semaphore_try_wait( s ) ) {
+      vul_atomic_add_u32( &s->waiters, 1 );
+      vul_futex_wait( &s->count, 0 );
+      vul_atomic_add_u32( &s->waiters, ( u32 )-1 );
+   }
+}
+
+void vul_semaphore_post( vul_semaphore *s, u32 count )
+{
+   vul_atomic_add_u32( &s->count, count );
+   if( vul_atomic_load_u32( &s->waiters ) != 0 ) {
+      vul_futex_wake( &s->count, count );
+   }
+}
+
+vul_barrier vul_barrier_create( u32 thread_count )
+{
+   vul_barrier b;
+
+   b.count = 0;
+   b.generation = 0;
+   b.threshold = thread_count;
+   return b;
+}
+
+void vul_barrier_destroy( vul_barrier *b )
+{
+   ( void )b;
+}
+
+b32 vul_barrier_wait( vul_barrier *b )
+{
+   u32 generation;
+
+   generation = vul_atomic_load_u32( &b->generation );
+   if( vul_atomic_add_u32( &b->count, 1 ) + 1 == b->threshold ) {
+      // Reset before releasing anyone, so early arrivals for the next round count from 0
+      vul_atomic_store_u32( &b->count, 0 );
+      vul_atomic_add_u32( &b->generation, 1 );
+      vul_futex_wake( &b->generation, 0xffffffff );
+      return 1;
+   }
+   while( vul_atomic_load_u32( &b->generation ) == generation ) {
+      vul_futex_wait( &b->generation, generation );
+   }
+   return 0;
+}
+
+vul_event vul_event_create( b32 set )
+{
+   vul_event e;
+
+   e.state = set ? 1 : 0;
+   return e;
+}
+
+void vul_event_destroy( vul_event *e )
+{
+   ( void )e;
+}
+
+void vul_event_set( vul_event *e )
+{
+   if( vul_atomic_exchange_u32( &e->state, 1 ) == 0 ) {
+      vul_futex_wake( &e->state, 0xffffffff );
+   }
+}
+
+void vul_event_reset( vul_event *e )
+{
+   vul_atomic_store_u32( &e->state, 0 );
+}
+
+b32 vul_event_is_set( vul_event *e )
+{
+   return vul_atomic_load_u32( &e->state );
+}
+
+void vul_event_wait( vul_event *e )
+{
+   while( vul_atomic_load_u32( &e->state ) == 0 ) {
+      vul_futex_wait( &e->state, 0 );
+   }
+}
+
+//-----------------
+// Adaptive locks
+//
+
+/**
+ * Pauses for *backoff spins and doubles it, up to VUL_MUTEX_BACKOFF_MAX.
+ */
+static void vul__lock_backoff( u32 *backoff )
+{
+   u32 i;
+
+   for( i = 0; i < *backoff; ++i ) {
+      vul_cpu_relax( );
+   }
+   if( *backoff < VUL_MUTEX_BACKOFF_MAX ) {
+      *backoff *= 2;
+   }
+}
+
+vul_adaptive_mutex vul_adaptive_mutex_create( )
+{
+   vul_adaptive_mutex m;
+
+   memset( &m, 0, sizeof( m ) );
+   m.spin_estimate = 8;
+   return m;
+}
+
+void vul_adaptive_mutex_destroy( vul_adaptive_mutex *m )
+{
+   ( void )m;
+}
+
+b32 vul_adaptive_mutex_try_lock( vul_adaptive_mutex *m )
+{
+   if( vul_atomic_cas_u32( &m->state, 0, 1 ) ) {
+      ++m->stats.acquisitions;
+      return 1;
+   }
+   return 0;
+}
+
+void vul_adaptive_mutex_lock( vul_adaptive_mutex *m )
+{
+   u32 attempts, limit, backoff, parks, estimate;
+
+   if( vul_atomic_cas_u32( &m->state, 0, 1 ) ) {
+      ++m->stats.acquisitions;
+      return;
+   }
+
+   // Spin for about twice as long as it recently took to get the lock. The estimate
+   // is read racily; it is only a hint.
+   limit = 2 * vul_atomic_load_u32( &m->spin_estimate ) + 8;
+   if( limit > VUL_MUTEX_SPIN_MAX ) {
+      limit = VUL_MUTEX_SPIN_MAX;
+   }
+   backoff = 1;
+   parks = 0;
+   for( attempts = 1; attempts < limit; ++attempts ) {
+      vul__lock_backoff( &backoff );
+      if( vul_atomic_load_u32( &m->state ) == 0 && vul_atomic_cas_u32( &m->state, 0, 1 ) ) {
+         break;
+      }
+   }
+   if( attempts == limit ) {
+      // Park. Mark the lock as having sleepers, so the unlock wakes one of us; we can't
+      // tell if we are the last, so keep the mark when we get it.
+      while( vul_atomic_exchange_u32( &m->state, 2 ) != 0 ) {
+         ++parks;
+         vul_futex_wait( &m->state, 2 );
+      }
+   }
+
+   m->stats.acquisitions += 1;
+   m->stats.contended += 1;
+   m->stats.parks += parks;
+   estimate = vul_atomic_load_u32( &m->spin_estimate );
+   if( attempts < limit ) {
+      estimate = ( u32 )( ( s32 )estimate + ( ( s32 )attempts - ( s32 )estimate ) / 8 );
+   } else if( estimate < VUL_MUTEX_SPIN_MAX ) {
+      ++estimate; // Spinning didn't pay off, but a little more might have
+   }
+   vul_atomic_store_u32( &m->spin_estimate, estimate );
+}
+
+void vul_adaptive_mutex_unlock( vul_adaptive_mutex *m )
+{
+   if( vul_atomic_exchange_u32( &m->state, 0 ) == 2 ) {
+      vul_futex_wake( &m->state, 1 );
+   }
+}
+
+void vul_adaptive_mutex_stats( vul_adaptive_mutex *m, vul_lock_stats *stats )
+{
+   *stats = m->stats;
+}
+
+void vul_adaptive_mutex_reset_stats( vul_adaptive_mutex *m )
+{
+   memset( &m->stats, 0, sizeof( m->stats ) );
+}
+
+static volatile u32 vul__rwlock_next_slot = 0;
+static VUL_THREAD_LOCAL u32 vul__rwlock_thread_slot = 0; // 1-based; 0 means not assigned yet
+
+static vul__rwlock_slot *vul__rwlock_slot_of( vul_rwlock *l )
+{
+   if( vul__rwlock_thread_slot == 0 ) {
+      vul__rwlock_thread_slot = vul_atomic_add_u32( &vul__rwlock_next_slot, 1 ) + 1;
+   }
+   return &l->slots[ ( vul__rwlock_thread_slot - 1 ) % VUL_RWLOCK_SLOTS ];
+}
+
+/**
+ * Spins, then parks, until value is no longer nonzero.
+ * Parked threads sleep on l->wake, which is bumped by whoever changes a value
+ * that someone may be waiting on while l->waiters is nonzero.
+ */
+static u32 vul__rwlock_wait_zero( vul_rwlock *l, volatile u32 *value )
+{
+   u32 attempts, backoff, sequence, parks;
+
+   backoff = 1;
+   parks = 0;
+   for( attempts = 0; vul_atomic_load_u32( value ) != 0; ++attempts ) {
+      if( attempts < VUL_MUTEX_SPIN_MAX ) {
+         vul__lock_backoff( &backoff );
+         continue;
+      }
+      sequence = vul_atomic_load_u32( &l->wake );
+      vul_atomic_add_u32( &l->waiters, 1 );
+      if( vul_atomic_load_u32( value ) != 0 ) {
+         vul_futex_wait( &l->wake, sequence );
+         ++parks;
+      }
+      vul_atomic_add_u32( &l->waiters, ( u32 )-1 );
+   }
+   return parks;
+}
+
+static void vul__rwlock_wake( vul_rwlock *l )
+{
+   if( vul_atomic_load_u32( &l->waiters ) != 0 ) {
+      vul_atomic_add_u32( &l->wake, 1 );
+      vul_futex_wake( &l->wake, 0xffffffff );
+   }
+}
+
+void vul_rwlock_initialize( vul_rwlock *l )
+{
+   memset( l, 0, sizeof( vul_rwlock ) );
+   // The lock itself may only be 8-byte aligned, so skip ahead to the first cache line
+   l->slots = ( vul__rwlock_slot* )( ( ( uintptr_t )l->slot_memory + 63 ) & ~( uintptr_t )63 );
+}
+
+void vul_rwlock_destroy( vul_rwlock *l )
+{
+   ( void )l;
+}
+
+void vul_rwlock_read_lock( vul_rwlock *l )
+{
+   vul__rwlock_slot *slot;
+   u32 parks;
+
+   slot = vul__rwlock_slot_of( l );
+   // Announce, then check for a writer; the writer sets its flag, then checks the slots.
+   // With sequentially consistent atomics at least one of us sees the other.
+   vul_atomic_add_u32( &slot->readers, 1 );
+   if( vul_atomic_load_u32( &l->writer ) == 0 ) {
+      vul_atomic_add_u64( &slot->acquisitions, 1 );
+      return;
+   }
+   vul_atomic_add_u64( &l->read_contended, 1 );
+   parks = 0;
+   while( 1 ) {
+      // Back out, so the writer can drain, and wait for it to finish
+      vul_atomic_add_u32( &slot->readers, ( u32 )-1 );
+      vul__rwlock_wake( l );
+      parks += vul__rwlock_wait_zero( l, &l->writer );
+      vul_atomic_add_u32( &slot->readers, 1 );
+      if( vul_atomic_load_u32( &l->writer ) == 0 ) {
+         break;
+      }
+   }
+   vul_atomic_add_u64( &slot->acquisitions, 1 );
+   if( parks ) {
+      vul_atomic_add_u64( &l->read_parks, parks );
+   }
+}
+
+void vul_rwlock_read_unlock( vul_rwlock *l )
+{
+   vul__rwlock_slot *slot;
+
+   slot = vul__rwlock_slot_of( l );
+   vul_atomic_add_u32( &slot->readers, ( u32 )-1 );
+   if( vul_atomic_load_u32( &l->writer ) != 0 ) {
+      vul__rwlock_wake( l ); // A writer may be waiting for us to drain
+   }
+}
+
+void vul_rwlock_write_lock( vul_rwlock *l )
+{
+   u32 i, parks;
+   b32 contended;
+
+   contended = 0;
+   parks = 0;
+   while( !vul_atomic_cas_u32( &l->writer, 0, 1 ) ) {
+      contended = 1;
+      parks += vul__rwlock_wait_zero( l, &l->writer );
+   }
+   for( i = 0; i < VUL_RWLOCK_SLOTS; ++i ) {
+      if( vul_atomic_load_u32( &l->slots[ i ].readers ) != 0 ) {
+         contended = 1;
+         parks += vul__rwlock_wait_zero( l, &l->slots[ i ].readers );
+      }
+   }
+   ++l->write_acquisitions;
+   l->write_contended += contended;
+   if( parks ) {
+      vul_atomic_add_u64( &l->write_parks, parks );
+   }
+}
+
+void vul_rwlock_write_unlock( vul_rwlock *l )
+{
+   vul_atomic_store_u32( &l->writer, 0 );
+   vul__rwlock_wake( l );
+}
+
+void vul_rwlock_stats( vul_rwlock *l, vul_lock_stats *reads, vul_lock_stats *writes )
+{
+   u32 i;
+
+   reads->acquisitions = 0;
+   for( i = 0; i < VUL_RWLOCK_SLOTS; ++i ) {
+      reads->acquisitions += vul_atomic_load_u64( &l->slots[ i ].acquisitions );
+   }
+   reads->contended = vul_atomic_load_u64( &l->read_contended );
+   reads->parks = vul_atomic_load_u64( &l->read_parks );
+   writes->acquisitions = l->write_acquisitions;
+   writes->contended = l->write_contended;
+   writes->parks = vul_atomic_load_u64( &l->write_parks );
+}
+
+void vul_rwlock_reset_stats( vul_rwlock *l )
+{
+   u32 i;
+
+   for( i = 0; i < VUL_RWLOCK_SLOTS; ++i ) {
+      vul_atomic_store_u64( &l->slots[ i ].acquisitions, 0 );
+   }
+   vul_atomic_store_u64( &l->read_contended, 0 );
+   vul_atomic_store_u64( &l->read_parks, 0 );
+   vul_atomic_store_u64( &l->write_parks, 0 );
+   l->write_acquisitions = 0;
+   l->write_contended = 0;
+}
+
+//-----------------
+// Task pool
+//
+
+typedef struct vul__task_worker {
+   vul_task_pool *pool;
+   vul_thread thread;
+   u32 index;
+   u32 rng;
+   volatile u64 top;             // Thieves take from here
+   u8 pad[ 64 ];                 // Keeps the owner's and the thieves' ends on separate cache lines
+   volatile u64 bottom;          // The owner pushes and pops here
+   vul_task *volatile *tasks;
+} vul__task_worker;
+
+struct vul_task_pool {
+   vul__task_worker *workers;
+   u32 worker_count;
+
+   // Shared queue for tasks submitted from outside the pool
+   vul_task *head, *tail;
+   vul_mutex queue_lock;
+   volatile u32 queued;
+
+   // Sleeping. epoch is bumped on every submission, so a worker that saw no work
+   // can tell if any arrived before it went to sleep.
+   volatile u32 epoch;
+   volatile u32 sleeping;
+   volatile u32 shutdown;
+
+   void *( *allocator )( size_t size );
+   void ( *deallocator )( void *ptr );
+};
+
+static VUL_THREAD_LOCAL vul__task_worker *vul__task_current_worker = NULL;
+// Tasks being run by this thread when it is not a worker. Such threads have no deque,
+// so everything they submit goes FIFO through the shared queue; if they kept helping
+// from inside tasks, each help could start another big task and nest without bound.
+static VUL_THREAD_LOCAL u32 vul__task_outside_depth = 0;
+
+static void vul__task_yield( )
+{
+#ifdef VUL_WINDOWS
+   SwitchToThread( );
+#elif defined( VUL_OSX ) || defined( VUL_LINUX )
+   sched_yield( );
+#endif
+}
+
+u32 vul_thread_processor_count( )
+{
+#ifdef VUL_WINDOWS
+   SYSTEM_INFO info;
+
+   GetSystemInfo( &info );
+   return ( u32 )info.dwNumberOfProcessors;
+#elif defined( VUL_OSX ) || defined( VUL_LINUX )
+   long n;
+
+   n = sysconf( _SC_NPROCESSORS_ONLN );
+   return n > 0 ? ( u32 )n : 1;
+#else
+   #error "vul_thread.h: Unknown OS"
+#endif
+}
+
+/**
+ * Pushes to the bottom of the worker's own deque. Returns false if it is full.
+ */
+static b32 vul__task_deque_push( vul__task_worker *w, vul_task *task )
+{
+   u64 b, t;
+
+   b = vul_atomic_load_u64( &w->bottom );
+   t = vul_atomic_load_u64( &w->top );
+   if( b - t >= VUL_TASK_DEQUE_SIZE ) {
+      return 0;
+   }
+   vul_atomic_store_ptr( ( void *volatile* )&w->tasks[ b & ( VUL_TASK_DEQUE_SIZE - 1 ) ], task );
+   vul_atomic_store_u64( &w->bottom, b + 1 );
+   return 1;
+}
+
+/**
+ * Pops from the bottom of the worker's own deque, racing thieves for the last task.
+ */
+static vul_task *vul__task_deque_pop( vul__task_worker *w )
+{
+   vul_task *task;
+   u64 b, t;
+
+   b = vul_atomic_load_u64( &w->bottom ) - 1;
+   vul_atomic_store_u64( &w->bottom, b );
+   t = vul_atomic_load_u64( &w->top );
+   if( ( s64 )( b - t ) < 0 ) {
+      vul_atomic_store_u64( &w->bottom, t );
+      return NULL;
+   }
+   task = ( vul_task* )vul_atomic_load_ptr( ( void *volatile* )&w->tasks[ b & ( VUL_TASK_DEQUE_SIZE - 1 ) ] );
+   if( b != t ) {
+      return task;
+   }
+   if( !vul_atomic_cas_u64( &w->top, t, t + 1 ) ) {
+      task = NULL; // A thief got it
+   }
+   vul_atomic_store_u64( &w->bottom, t + 1 );
+   return task;
+}
+
+/**
+ * Takes from the top of another worker's deque.
+ */
+static vul_task *vul__task_deque_steal( vul__task_worker *w )
+{
+   vul_task *task;
+   u64 b, t;
+
+   t = vul_atomic_load_u64( &w->top );
+   b = vul_atomic_load_u64( &w->bottom );
+   if( ( s64 )( b - t ) <= 0 ) {
+      return NULL;
+   }
+   task = ( vul_task* )vul_atomic_load_ptr( ( void *volatile* )&w->tasks[ t & ( VUL_TASK_DEQUE_SIZE - 1 ) ] );
+   if( !vul_atomic_cas_u64( &w->top, t, t + 1 ) ) {
+      return NULL;
+   }
+   return task;
+}
+
+static void vul__task_wake( vul_task_pool *pool, b32 all )
+{
+   vul_atomic_add_u32( &pool->epoch, 1 );
+   if( vul_atomic_load_u32( &pool->sleeping ) != 0 ) {
+      vul_futex_wake( &pool->epoch, all ? 0xffffffff : 1 );
+   }
+}
+
+/**
+ * Sleeps until something is submitted, unless something was since epoch was read.
+ */
+static void vul__task_sleep( vul_task_pool *pool, u32 epoch )
+{
+   vul_atomic_add_u32( &pool->sleeping, 1 );
+   while( vul_atomic_load_u32( &pool->epoch ) == epoch && !vul_atomic_load_u32( &pool->shutdown ) ) {
+      vul_futex_wait( &pool->epoch, epoch );
+   }
+   vul_atomic_add_u32( &pool->sleeping, ( u32 )-1 );
+}
+
+/**
+ * Makes a task whose dependencies have all finished runnable.
+ */
+static void vul__task_schedule( vul_task_pool *pool, vul_task *task )
+{
+   vul__task_worker *w;
+
+   w = vul__task_current_worker;
+   if( w == NULL || w->pool != pool || !vul__task_deque_push( w, task ) ) {
+      task->next = NULL;
+      vul_mutex_wait_and_lock( &pool->queue_lock );
+      if( pool->tail ) {
+         pool->tail->next = task;
+      } else {
+         pool->head = task;
+      }
+      pool->tail = task;
+      vul_atomic_add_u32( &pool->queued, 1 );
+      vul_mutex_release( &pool->queue_lock );
+   }
+   vul__task_wake( pool, 0 );
+}
+
+/**
+ * Drops one dependency of the task, scheduling it if that was the last.
+ */
+static void vul__task_release( vul_task_pool *pool, vul_task *task )
+{
+   if( vul_atomic_add_u32( &task->dependencies, ( u32 )-1 ) == 1 ) {
+      vul__task_schedule( pool, task );
+   }
+}
+
+static void vul__task_lock( vul_task *task )
+{
+   while( !vul_atomic_cas_u32( &task->lock, 0, 1 ) ) {
+      vul_cpu_relax( );
+   }
+}
+
+static void vul__task_run( vul_task_pool *pool, vul_task *task )
+{
+   vul_task *continuations[ VUL_TASK_MAX_CONTINUATIONS ];
+   vul_task_group *group;
+   u32 i, count;
+
+   task->func( task->arg );
+
+   // Once finished is set no more continuations are added, but take a copy anyway:
+   // the task may be reused as soon as its group says it is done.
+   group = task->group;
+   vul__task_lock( task );
+   task->finished = 1;
+   count = task->continuation_count;
+   for( i = 0; i < count; ++i ) {
+      continuations[ i ] = task->continuations[ i ];
+   }
+   vul_atomic_store_u32( &task->lock, 0 );
+
+   for( i = 0; i < count; ++i ) {
+      vul__task_release( pool, continuations[ i ] );
+   }
+   if( group && vul_atomic_add_u32( &group->pending, ( u32 )-1 ) == 1 ) {
+      vul_futex_wake( &group->pending, 0xffffffff );
+   }
+}
+
+/**
+ * Finds a task to run: from the worker's own deque, the shared queue, or another worker.
+ */
+static vul_task *vul__task_find( vul_task_pool *pool, vul__task_worker *w )
+{
+   vul_task *task;
+   u32 i, victim;
+
+   if( w != NULL && ( task = vul__task_deque_pop( w ) ) != NULL ) {
+      return task;
+   }
+   if( vul_atomic_load_u32( &pool->queued ) ) {
+      vul_mutex_wait_and_lock( &pool->queue_lock );
+      task = pool->head;
+      if( task ) {
+         pool->head = task->next;
+         if( !pool->head ) {
+            pool->tail = NULL;
+         }
+         vul_atomic_add_u32( &pool->queued, ( u32 )-1 );
+      }
+      vul_mutex_release( &pool->queue_lock );
+      if( task ) {
+         return task;
+      }
+   }
+   // Start at a random victim, so thieves spread out
+   if( w != NULL ) {
+      w->rng ^= w->rng << 13;
+      w->rng ^= w->rng >> 17;
+      w->rng ^= w->rng << 5;
+      victim = w->rng;
+   } else {
+      victim = vul_atomic_load_u32( &pool->epoch );
+   }
+   for( i = 0; i < pool->worker_count; ++i ) {
+      victim = ( victim + 1 ) % pool->worker_count;
+      if( &pool->workers[ victim ] != w && ( task = vul__task_deque_steal( &pool->workers[ victim ] ) ) != NULL ) {
+         return task;
+      }
+   }
+   return NULL;
+}
+
+static void vul__task_worker_loop( vul__task_worker *w )
+{
+   vul_task_pool *pool;
+   vul_task *task;
+   u32 epoch, spins;
+
+   pool = w->pool;
+   vul__task_current_worker = w;
+   spins = 0;
+   while( 1 ) {
+      epoch = vul_atomic_load_u32( &pool->epoch );
+      task = vul__task_find( pool, w );
+      if( task ) {
+         vul__task_run( pool, task );
+         spins = 0;
+         continue;
+      }
+      if( vul_atomic_load_u32( &pool->shutdown ) ) {
+         break;
+      }
+      if( ++spins < VUL_TASK_SPIN_COUNT ) {
+         vul_cpu_relax( );
+         continue;
+      }
+      vul__task_sleep( pool, epoch );
+      spins = 0;
+   }
+   vul__task_current_worker = NULL;
+}
+
+#ifdef VUL_WINDOWS
+static DWORD WINAPI vul__task_worker_entry( LPVOID arg )
+{
+   vul__task_worker_loop( ( vul__task_worker* )arg );
+   return 0;
+}
+#else
+static void *vul__task_worker_entry( void *arg )
+{
+   vul__task_worker_loop( ( vul__task_worker* )arg );
+   return NULL;
+}
+#endif
+
+/**
+ * Stops and joins the first started workers, then frees everything the pool owns.
+ * Also unwinds a partially created pool, where later deques may be missing.
+ */
+static void vul__task_pool_free( vul_task_pool *pool, u32 started )
+{
+   u32 i;
+
+   vul_atomic_store_u32( &pool->shutdown, 1 );
+   vul__task_wake( pool, 1 );
+   for( i = 0; i < started; ++i ) {
+      vul_thread_join( pool->workers[ i ].thread, NULL );
+   }
+   if( pool->workers ) {
+      for( i = 0; i < pool->worker_count; ++i ) {
+         if( pool->workers[ i ].tasks ) {
+            pool->deallocator( ( void* )pool->workers[ i ].tasks );
+         }
+      }
+      pool->deallocator( pool->workers );
+   }
+   vul_mutex_destroy( &pool->queue_lock );
+   pool->deallocator( pool );
+}
+
+static vul_task_pool *vul__task_pool_create( u32 worker_count, b32 pinned,
+                                             void *( *allocator )( size_t size ),
+                                             void ( *deallocator )( void *ptr ) )
+{
+   vul_task_pool *pool;
+   vul_thread_attributes attr;
+   char name[ 32 ];
+   u32 i, processors;
+
+   if( worker_count == 0 ) {
+      worker_count = vul_thread_processor_count( ) - 1;
+      if( worker_count == 0 ) {
+         worker_count = 1;
+      }
+   }
+
+   pool = ( vul_task_pool* )allocator( sizeof( vul_task_pool ) );
+   if( !pool ) {
+      VUL_THREAD_ERROR( "Failed to allocate task pool" );
+      return NULL;
+   }
+   memset( pool, 0, sizeof( vul_task_pool ) );
+   pool->allocator = allocator;
+   pool->deallocator = deallocator;
+   pool->worker_count = worker_count;
+   pool->queue_lock = vul_mutex_create( 0, NULL );
+
+   pool->workers = ( vul__task_worker* )allocator( sizeof( vul__task_worker ) * worker_count );
+   if( !pool->workers ) {
+      VUL_THREAD_ERROR( "Failed to allocate task pool workers" );
+      vul__task_pool_free( pool, 0 );
+      return NULL;
+   }
+   memset( pool->workers, 0, sizeof( vul__task_worker ) * worker_count );
+   for( i = 0; i < worker_count; ++i ) {
+      pool->workers[ i ].pool = pool;
+      pool->workers[ i ].index = i;
+      pool->workers[ i ].rng = 0x9e3779b9u * ( i + 1 );
+      pool->workers[ i ].tasks = ( vul_task *volatile* )allocator( sizeof( vul_task* ) * VUL_TASK_DEQUE_SIZE );
+      if( !pool->workers[ i ].tasks ) {
+         VUL_THREAD_ERROR( "Failed to allocate task pool deque" );
+         vul__task_pool_free( pool, 0 );
+         return NULL;
+      }
+   }
+
+   // Only start the workers once they can all be stolen from
+   memset( &attr, 0, sizeof( attr ) );
+   attr.name = name;
+   processors = vul_thread_processor_count( );
+   for( i = 0; i < worker_count; ++i ) {
+      snprintf( name, sizeof( name ), "vul_worker %u", i );
+      if( pinned ) {
+         vul_cpu_set_clear( &attr.affinity );
+         vul_cpu_set_add( &attr.affinity, ( i + 1 ) % processors );
+      }
+      if( !vul__thread_create( attr, vul__task_worker_entry, &pool->workers[ i ], &pool->workers[ i ].thread ) ) {
+         vul__task_pool_free( pool, i ); // The error is already reported
+         return NULL;
+      }
+   }
+
+   return pool;
+}
+
+vul_task_pool *vul_task_pool_create( u32 worker_count,
+                                     void *( *allocator )( size_t size ),
+                                     void ( *deallocator )( void *ptr ) )
+{
+   return vul__task_pool_create( worker_count, 0, allocator, deallocator );
+}
+
+vul_task_pool *vul_task_pool_create_pinned( u32 worker_count,
+                                            void *( *allocator )( size_t size ),
+                                            void ( *deallocator )( void *ptr ) )
+{
+   return vul__task_pool_create( worker_count, 1, allocator, deallocator );
+}
+
+void vul_task_pool_destroy( vul_task_pool *pool )
+{
+   vul__task_pool_free( pool, pool->worker_count );
+}
+
+u32 vul_task_pool_worker_count( vul_task_pool *pool )
+{
+   return pool->worker_count;
+}
+
+u32 vul_task_pool_worker_index( vul_task_pool *pool )
+{
+   vul__task_worker *w;
+
+   w = vul__task_current_worker;
+   return ( w != NULL && w->pool == pool ) ? w->index : pool->worker_count;
+}
+
+void vul_task_group_initialize( vul_task_group *group )
+{
+   group->pending = 0;
+}
+
+void vul_task_initialize( vul_task *task, vul_task_func func, void *arg, vul_task_group *group )
+{
+   task->func = func;
+   task->arg = arg;
+   task->group = group;
+   task->next = NULL;
+   task->dependencies = 1;
+   task->lock = 0;
+   task->finished = 0;
+   task->continuation_count = 0;
+}
+
+b32 vul_task_depends_on( vul_task *task, vul_task *dependency )
+{
+   vul__task_lock( dependency );
+   if( dependency->finished ) {
+      vul_atomic_store_u32( &dependency->lock, 0 );
+      return 1;
+   }
+   if( dependency->continuation_count == VUL_TASK_MAX_CONTINUATIONS ) {
+      // Nowhere to record it; the caller has to order the tasks some other way
+      vul_atomic_store_u32( &dependency->lock, 0 );
+      return 0;
+   }
+   vul_atomic_add_u32( &task->dependencies, 1 );
+   dependency->continuations[ dependency->continuation_count++ ] = task;
+   vul_atomic_store_u32( &dependency->lock, 0 );
+   return 1;
+}
+
+void vul_task_pool_submit( vul_task_pool *pool, vul_task *task )
+{
+   if( task->group ) {
+      vul_atomic_add_u32( &task->group->pending, 1 );
+   }
+   vul__task_release( pool, task );
+}
+
+void vul_task_pool_wait( vul_task_pool *pool, vul_task_group *group )
+{
+   vul__task_worker *w;
+   vul_task *task;
+   u32 spins, pending;
+
+   w = vul__task_current_worker;
+   if( w != NULL && w->pool != pool ) {
+      w = NULL;
+   }
+   spins = 0;
+   while( ( pending = vul_atomic_load_u32( &group->pending ) ) != 0 ) {
+      task = ( w != NULL || vul__task_outside_depth == 0 ) ? vul__task_find( pool, w ) : NULL;
+      if( task ) {
+         ++vul__task_outside_depth;
+         vul__task_run( pool, task );
+         --vul__task_outside_depth;
+         spins = 0;
+      } else if( ++spins < VUL_TASK_SPIN_COUNT ) {
+         vul_cpu_relax( );
+      } else if( w == NULL ) {
+         // Leave the rest to the workers and sleep until the group is done
+         vul_futex_wait( &group->pending, pending );
+      } else {
+         vul__task_yield( ); // A worker keeps looking, more work may show up
+      }
+   }
+}
+
+//-----------------
+// Parallel loops
+//
+
+typedef struct vul__parallel_range {
+   vul_task_pool *pool;
+   u32 begin, end, grain;
+   vul_parallel_for_func func;
+   vul_parallel_reduce_func reduce;
+   vul_parallel_combine_func combine;
+   u32 result_size;
+   const void *identity;
+   void *ctx;
+   void *result;
+} vul__parallel_range;
+
+static u64 vul__thread_nanos( )
+{
+#ifdef VUL_WINDOWS
+   LARGE_INTEGER count, freq;
+
+   QueryPerformanceCounter( &count );
+   QueryPerformanceFrequency( &freq );
+   return ( u64 )( ( f64 )count.QuadPart * 1e9 / ( f64 )freq.QuadPart );
+#elif defined( VUL_OSX ) || defined( VUL_LINUX )
+   struct timespec ts;
+
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ( u64 )ts.tv_sec * 1000000000ull + ( u64 )ts.tv_nsec;
+#endif
+}
+
+/**
+ * Runs the root of a parallel loop. Off the pool it goes through a task, so the
+ * splitting happens on a worker, which has a deque to push the halves to.
+ */
+static void vul__parallel_run( vul__parallel_range *r, vul_task_func func )
+{
+   vul_task task;
+   vul_task_group group;
+
+   if( vul_task_pool_worker_index( r->pool ) < vul_task_pool_worker_count( r->pool ) ) {
+      func( r );
+      return;
+   }
+   vul_task_group_initialize( &group );
+   vul_task_initialize( &task, func, r, &group );
+   vul_task_pool_submit( r->pool, &task );
+   vul_task_pool_wait( r->pool, &group );
+}
+
+static void vul__parallel_for_task( void *arg )
+{
+   vul__parallel_range *r, ranges[ 32 ];
+   vul_task tasks[ 32 ];
+   vul_task_group group;
+   u32 begin, end, mid, count;
+
+   r = ( vul__parallel_range* )arg;
+   begin = r->begin;
+   end = r->end;
+   vul_task_group_initialize( &group );
+   // Hand off the right half until what is left is one chunk. At most 32 halvings of a u32.
+   count = 0;
+   while( end - begin > r->grain ) {
+      mid = begin + ( end - begin ) / 2;
+      ranges[ count ] = *r;
+      ranges[ count ].begin = mid;
+      ranges[ count ].end = end;
+      vul_task_initialize( &tasks[ count ], vul__parallel_for_task, &ranges[ count ], &group );
+      vul_task_pool_submit( r->pool, &tasks[ count ] );
+      ++count;
+      end = mid;
+   }
+   r->func( begin, end, r->ctx );
+   vul_task_pool_wait( r->pool, &group );
+}
+
+void vul_parallel_for( vul_task_pool *pool, u32 begin, u32 end, u32 grain,
+                       vul_parallel_for_func func, void *ctx )
+{
+   vul__parallel_range r;
+   u64 start, elapsed, target;
+   u32 chunk, measured, threads, slack;
+
+   if( begin >= end ) {
+      return;
+   }
+   threads = vul_task_pool_worker_count( pool ) + 1;
+   if( grain == 0 ) {
+      // Measure on doubling chunks until one takes long enough to time reliably,
+      // but don't spend more than a share of the range on it.
+      slack = ( end - begin ) / ( 4 * threads );
+      chunk = 1;
+      measured = 0;
+      elapsed = 0;
+      while( chunk <= slack ) {
+         start = vul__thread_nanos( );
+         func( begin, begin + chunk, ctx );
+         elapsed = vul__thread_nanos( ) - start;
+         begin += chunk;
+         measured = chunk;
+         if( elapsed >= VUL_PARALLEL_TARGET_NS / 8 ) {
+            break;
+         }
+         chunk *= 2;
+      }
+      // Chunks of about the target duration, but enough of them to keep every thread busy
+      target = elapsed ? ( u64 )measured * VUL_PARALLEL_TARGET_NS / elapsed : chunk;
+      slack = ( end - begin ) / ( 4 * threads );
+      grain = target < slack ? ( u32 )target : slack;
+      if( grain == 0 ) {
+         grain = 1;
+      }
+   }
+
+   memset( &r, 0, sizeof( r ) );
+   r.pool = pool;
+   r.begin = begin;
+   r.end = end;
+   r.grain = grain;
+   r.func = func;
+   r.ctx = ctx;
+   vul__parallel_run( &r, vul__parallel_for_task );
+}
+
+static void vul__parallel_reduce_task( void *arg )
+{
+   vul__parallel_range *r, left, right;
+   vul_task task;
+   vul_task_group group;
+   u64 local[ 8 ]; // Small partial results live here; u64 for alignment
+   u32 chunks, mid;
+
+   r = ( vul__parallel_range* )arg;
+   chunks = ( r->end - r->begin + r->grain - 1 ) / r->grain;
+   if( chunks <= 1 ) {
+      r->reduce( r->begin, r->end, r->ctx, r->result );
+      return;
+   }
+   // Split on a chunk boundary, so the leaves are the same however the tree is run
+   mid = r->begin + ( chunks / 2 ) * r->grain;
+   right = *r;
+   right.begin = mid;
+   right.result = r->result_size <= sizeof( local ) ? ( void* )local : r->pool->allocator( r->result_size );
+   if( !right.result ) {
+      VUL_THREAD_ERROR( "Failed to allocate partial reduction result" );
+      return;
+   }
+   memcpy( right.result, r->identity, r->result_size );
+   vul_task_group_initialize( &group );
+   vul_task_initialize( &task, vul__parallel_reduce_task, &right, &group );
+   vul_task_pool_submit( r->pool, &task );
+
+   left = *r;
+   left.end = mid;
+   vul__parallel_reduce_task( &left );
+   vul_task_pool_wait( r->pool, &group );
+
+   r->combine( r->result, right.result, r->ctx );
+   if( right.result != ( void* )local ) {
+      r->pool->deallocator( right.result );
+   }
+}
+
+void vul_parallel_reduce( vul_task_pool *pool, u32 begin, u32 end, u32 grain,
+                          u32 result_size, const void *identity,
+                          vul_parallel_reduce_func func, vul_parallel_combine_func combine,
+                          void *ctx, void *result )
+{
+   vul__parallel_range r;
+
+   memcpy( result, identity, result_size );
+   if( begin >= end ) {
+      return;
+   }
+   memset( &r, 0, sizeof( r ) );
+   r.pool = pool;
+   r.begin = begin;
+   r.end = end;
+   r.grain = grain ? grain : VUL_PARALLEL_REDUCE_GRAIN;
+   r.reduce = func;
+   r.combine = combine;
+   r.result_size = result_size;
+   r.identity = identity;
+   r.ctx = ctx;
+   r.result = result;
+   vul__parallel_run( &r, vul__parallel_reduce_task );
+}
+
 #ifdef __cplusplus
 }
 #endif
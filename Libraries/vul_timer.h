@@ -4,6 +4,12 @@
  * This file contains a high performace timer that works on windows, linux
  * and OS X. Possibly works on other *nix systems as well.
  * It also contains an OS agnostic sleep function.
+ *
+ * For timing very short stretches of code there is a cycle counter reader
+ * (vul_tsc_*) using rdtsc on x86 and the virtual counter on ARM64, calibrated to
+ * nanoseconds once at startup. Where the counter doesn't tick at a constant rate,
+ * or on other CPUs, it falls back to the monotonic OS clock. Define VUL_TIMER_NO_TSC
+ * to always use the OS clock.
  * 
  * Define VUL_DEFINE in exactly one compilation unit.
  * Define VUL_WINDOWS, VUL_LINUX or VUL_OSX depending out your system.
@@ -47,6 +53,19 @@
 	vul needs an operating system defined.
 #endif
 
+#ifndef VUL_TIMER_NO_TSC
+	#if defined( _M_X64 ) || defined( _M_IX86 )
+		#include <intrin.h>
+		#define VUL__TSC_X86
+	#elif defined( __x86_64__ ) || defined( __i386__ )
+		#include <x86intrin.h>
+		#include <cpuid.h>
+		#define VUL__TSC_X86
+	#elif defined( __aarch64__ ) && ( defined( __GNUC__ ) || defined( __clang__ ) )
+		#define VUL__TSC_ARM64
+	#endif
+#endif
+
 #ifndef VUL_TIMER_CUSTOM_ASSERT
 #include <assert.h>
 #define VUL_TIMER_CUSTOM_ASSERT assert
@@ -57,6 +76,8 @@
 #define s32 int32_t
 #define u32 uint32_t
 #define u64 uint64_t
+#define f64 double
+#define b32 uint32_t
 #endif
 		
 typedef struct vul_timer {
@@ -118,6 +139,116 @@ u64 vul_timer_get_micros( vul_timer *c );
  */
 u32 vul_sleep( u32 milliseconds );
 
+//-----------------
+// Cycle counter
+//
+
+/**
+ * How long vul_tsc_calibrate measures the counter against the OS clock.
+ */
+#ifndef VUL_TSC_CALIBRATION_NANOS
+#define VUL_TSC_CALIBRATION_NANOS 10000000
+#endif
+
+typedef struct vul_tsc_info {
+	b32 calibrated;
+	b32 hardware;           // Ticks come from the CPU counter, not the OS clock
+	b32 invariant;          // The CPU counter ticks at a constant rate in all power states
+	u64 ticks_per_second;
+	f64 nanos_per_tick;
+	u64 overhead;           // Ticks measured by an empty vul_tsc_begin/vul_tsc_end pair
+} vul_tsc_info;
+
+extern b32 vul__tsc_hardware;
+u64 vul__tsc_clock( );
+
+/**
+ * Detects whether the CPU counter is usable and measures its rate. Call once at
+ * startup, before any other vul_tsc function and before other threads use them.
+ * Takes about VUL_TSC_CALIBRATION_NANOS.
+ */
+void vul_tsc_calibrate( );
+/**
+ * Returns what vul_tsc_calibrate found.
+ */
+const vul_tsc_info *vul_tsc_get_info( );
+/**
+ * Converts a tick count (the difference of two reads) to nanoseconds.
+ */
+u64 vul_tsc_to_nanos( u64 ticks );
+/**
+ * Converts a tick count to seconds.
+ */
+f64 vul_tsc_to_seconds( u64 ticks );
+
+/**
+ * Reads the counter. Not serializing: the CPU may move it past surrounding
+ * instructions, which is fine for timing anything longer than a few hundred cycles.
+ */
+static inline u64 vul_tsc_now( )
+{
+#if defined( VUL__TSC_X86 )
+	if( vul__tsc_hardware ) {
+		return __rdtsc( );
+	}
+#elif defined( VUL__TSC_ARM64 )
+	u64 v;
+	if( vul__tsc_hardware ) {
+		__asm__ volatile( "mrs %0, cntvct_el0" : "=r"( v ) );
+		return v;
+	}
+#endif
+	return vul__tsc_clock( );
+}
+
+/**
+ * Reads the counter at the start of a measured region. Earlier instructions finish
+ * before the read, and later ones don't start before it.
+ */
+static inline u64 vul_tsc_begin( )
+{
+#if defined( VUL__TSC_X86 )
+	u64 v;
+	if( vul__tsc_hardware ) {
+		_mm_lfence( );
+		v = __rdtsc( );
+		_mm_lfence( );
+		return v;
+	}
+#elif defined( VUL__TSC_ARM64 )
+	u64 v;
+	if( vul__tsc_hardware ) {
+		__asm__ volatile( "isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"( v ) :: "memory" );
+		return v;
+	}
+#endif
+	return vul__tsc_clock( );
+}
+
+/**
+ * Reads the counter at the end of a measured region. Instructions of the region
+ * finish before the read, and later ones don't start before it.
+ */
+static inline u64 vul_tsc_end( )
+{
+#if defined( VUL__TSC_X86 )
+	u64 v;
+	unsigned int aux;
+	if( vul__tsc_hardware ) {
+		v = __rdtscp( &aux );
+		_mm_lfence( );
+		return v;
+	}
+#elif defined( VUL__TSC_ARM64 )
+	u64 v;
+	if( vul__tsc_hardware ) {
+		__asm__ volatile( "isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"( v ) :: "memory" );
+		return v;
+	}
+#endif
+	return vul__tsc_clock( );
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -126,6 +257,8 @@ u32 vul_sleep( u32 milliseconds );
 #undef s32
 #undef u32
 #undef u64
+#undef f64
+#undef b32
 #endif
 
 #endif // VUL_TIMER_H
@@ -136,6 +269,8 @@ u32 vul_sleep( u32 milliseconds );
 #define s32 int32_t
 #define u32 uint32_t
 #define u64 uint64_t
+#define f64 double
+#define b32 uint32_t
 #endif
 
 #ifdef __cplusplus
@@ -359,6 +494,142 @@ unsigned int vul_sleep( unsigned int milliseconds )
 #endif
 }
 
+b32 vul__tsc_hardware = 0;
+static vul_tsc_info vul__tsc_info;
+
+/**
+ * The fallback: a monotonic OS clock, in its native unit.
+ */
+u64 vul__tsc_clock( )
+{
+#if defined( VUL_WINDOWS )
+	LARGE_INTEGER t;
+
+	QueryPerformanceCounter( &t );
+	return ( u64 )t.QuadPart;
+#elif defined( VUL_LINUX )
+	struct timespec t;
+
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return ( u64 )t.tv_sec * 1000000000ull + ( u64 )t.tv_nsec;
+#elif defined( VUL_OSX )
+	return mach_absolute_time( );
+#endif
+}
+
+/**
+ * Rate of vul__tsc_clock in ticks per second.
+ */
+static f64 vul__tsc_clock_rate( )
+{
+#if defined( VUL_WINDOWS )
+	LARGE_INTEGER f;
+
+	QueryPerformanceFrequency( &f );
+	return ( f64 )f.QuadPart;
+#elif defined( VUL_LINUX )
+	return 1e9;
+#elif defined( VUL_OSX )
+	mach_timebase_info_data_t tb;
+
+	mach_timebase_info( &tb );
+	return 1e9 * ( f64 )tb.denom / ( f64 )tb.numer;
+#endif
+}
+
+/**
+ * Whether the CPU counter ticks at a constant rate, independent of frequency
+ * scaling and sleep states, and is synchronized between cores.
+ */
+static b32 vul__tsc_detect_invariant( )
+{
+#if defined( VUL__TSC_X86 ) && defined( _MSC_VER )
+	int r[ 4 ];
+
+	__cpuid( r, 0x80000000 );
+	if( ( unsigned int )r[ 0 ] < 0x80000007 ) {
+		return 0;
+	}
+	__cpuid( r, 0x80000007 );
+	return ( r[ 3 ] >> 8 ) & 1;
+#elif defined( VUL__TSC_X86 )
+	unsigned int a, b, c, d;
+
+	a = b = c = d = 0;
+	if( __get_cpuid_max( 0x80000000, NULL ) < 0x80000007 ) {
+		return 0;
+	}
+	if( !__get_cpuid( 0x80000007, &a, &b, &c, &d ) ) {
+		return 0; // Leaf not supported after all
+	}
+	return ( d >> 8 ) & 1;
+#elif defined( VUL__TSC_ARM64 )
+	return 1; // The generic timer's virtual counter has a fixed frequency by spec
+#else
+	return 0;
+#endif
+}
+
+void vul_tsc_calibrate( )
+{
+	f64 clock_rate;
+	u64 c0, c1, t0, t1, t, i, best;
+
+	clock_rate = vul__tsc_clock_rate( );
+	vul__tsc_info.invariant = vul__tsc_detect_invariant( );
+	vul__tsc_hardware = vul__tsc_info.invariant;
+	vul__tsc_info.hardware = vul__tsc_hardware;
+
+	if( vul__tsc_hardware ) {
+		// Count counter ticks over a stretch of the OS clock. Bracketing each clock read
+		// with counter reads keeps the error to a few tens of nanoseconds either end.
+		c0 = vul_tsc_begin( );
+		t0 = vul__tsc_clock( );
+		do {
+			t1 = vul__tsc_clock( );
+		} while( ( f64 )( t1 - t0 ) * 1e9 / clock_rate < ( f64 )VUL_TSC_CALIBRATION_NANOS );
+		c1 = vul_tsc_end( );
+		vul__tsc_info.ticks_per_second = ( u64 )( ( f64 )( c1 - c0 ) * clock_rate / ( f64 )( t1 - t0 ) + 0.5 );
+		if( vul__tsc_info.ticks_per_second == 0 ) {
+			// The counter didn't move (an emulator, say); don't trust it
+			vul__tsc_hardware = 0;
+			vul__tsc_info.hardware = 0;
+		}
+	}
+	if( !vul__tsc_hardware ) {
+		vul__tsc_info.ticks_per_second = ( u64 )( clock_rate + 0.5 );
+	}
+	vul__tsc_info.nanos_per_tick = 1e9 / ( f64 )vul__tsc_info.ticks_per_second;
+
+	// The cost of the measurement itself, to subtract from very short regions
+	best = ~( u64 )0;
+	for( i = 0; i < 64; ++i ) {
+		t = vul_tsc_begin( );
+		t = vul_tsc_end( ) - t;
+		best = t < best ? t : best;
+	}
+	vul__tsc_info.overhead = best;
+	vul__tsc_info.calibrated = 1;
+}
+
+const vul_tsc_info *vul_tsc_get_info( )
+{
+	VUL_TIMER_CUSTOM_ASSERT( vul__tsc_info.calibrated && "Call vul_tsc_calibrate first" );
+	return &vul__tsc_info;
+}
+
+u64 vul_tsc_to_nanos( u64 ticks )
+{
+	VUL_TIMER_CUSTOM_ASSERT( vul__tsc_info.calibrated && "Call vul_tsc_calibrate first" );
+	return ( u64 )( ( f64 )ticks * vul__tsc_info.nanos_per_tick + 0.5 );
+}
+
+f64 vul_tsc_to_seconds( u64 ticks )
+{
+	VUL_TIMER_CUSTOM_ASSERT( vul__tsc_info.calibrated && "Call vul_tsc_calibrate first" );
+	return ( f64 )ticks / ( f64 )vul__tsc_info.ticks_per_second;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -367,6 +638,8 @@ unsigned int vul_sleep( unsigned int milliseconds )
 #undef s32
 #undef u32
 #undef u64
+#undef f64
+#undef b32
 #endif
 
 #endif // VUL_DEFINE